@@ -25,7 +25,8 @@ COMMON_SHARED_LIBRARIES := \
     libhardware \
     libbinder \
     libaudioclient \
-    libmedia_helper
+    libmedia_helper \
+    libaaudio
 
 # Header libraries required by the application
 COMMON_HEADER_LIBRARIES := \
@@ -2,30 +2,56 @@
 #include <atomic>
 #include <cinttypes>
 #include <cmath>
+#include <complex>
 #include <cstring>
+#include <deque>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <fstream>
 #include <getopt.h>
+#include <glob.h>
 #include <iostream>
+#include <sstream>
+#include <memory>
+#include <mutex>
+#include <poll.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <thread>
 #include <time.h>
 #include <type_traits>
 #include <unistd.h>
+#include <linux/futex.h>
 #include <unordered_map>
+#include <vector>
 
+#ifndef AUDIO_TEST_CLIENT_HOST
+#include <aaudio/AAudio.h>
+#include <aaudio/AAudioTesting.h>
 #include <binder/Binder.h>
 #include <media/AudioParameter.h>
 #include <media/AudioRecord.h>
 #include <media/AudioSystem.h>
 #include <media/AudioTrack.h>
+#else
+#include <system/audio.h>
+#include <utils/Errors.h>
+#endif
 #include <utils/Log.h>
 #include <utils/String8.h>
 
@@ -34,8 +60,395 @@
 #define AUDIO_TEST_CLIENT_VERSION "2.2.0"
 #define ENABLE_SET_PARAMS 0
 
+// AUDIO_TEST_CLIENT_HOST builds for a Linux host (the audio_test_client_selftest host variant): everything that
+// needs the audio server (legacy and aaudio backends, -m100) is left out, the stand-in backends, the file tools
+// and the -m207 self test remain.
+
 using namespace android;
+#ifndef AUDIO_TEST_CLIENT_HOST
 using android::content::AttributionSourceState;
+#endif
+
+/************************** Sample Traits ******************************/
+// Per-format sample access resolved at compile time. Kernels (metering, conversion, signal generation, pattern
+// verification) are written once against SampleTraits<F> and instantiated for every PCM format; dispatchFormat()
+// is the only runtime switch on audio_format_t, so a caller picks the instantiation once per buffer or once per
+// stream and the inner loops carry no format branches.
+//   Value      signed sample value returned by load(): centered for 8-bit, sign-extended for 24-bit
+//   Magnitude  |Value| without overflow, compared to find peaks
+//   SquareSum  accumulator of square(): exact integers where they cannot overflow, double otherwise
+//   kFullScale |Value| of a full-scale sample, toFloat() divides by it
+//   storeCode/loadCode move the top bits of a 32-bit code in and out of a sample (test signals, bit-exact pattern)
+template <audio_format_t Format> struct SampleTraits;
+
+// Unaligned, aliasing-safe access to sample i of a byte buffer; a fixed-size memcpy compiles to a plain load/store
+template <typename T> static inline T loadUnaligned(const char* buffer, const size_t i) {
+    T value;
+    memcpy(&value, buffer + i * sizeof(T), sizeof(T));
+    return value;
+}
+
+template <typename T> static inline void storeUnaligned(char* buffer, const size_t i, const T value) {
+    memcpy(buffer + i * sizeof(T), &value, sizeof(T));
+}
+
+template <> struct SampleTraits<AUDIO_FORMAT_PCM_8_BIT> {
+    using Value = int32_t;
+    using Magnitude = int32_t;
+    using SquareSum = int64_t;
+    static constexpr audio_format_t kFormat = AUDIO_FORMAT_PCM_8_BIT;
+    static constexpr size_t kBytes = 1;
+    static constexpr int kOption = 2;      // -f value
+    static constexpr uint32_t kWavBits = 8; // bits per sample of a WAV file read as this format
+    static constexpr bool kIsFloat = false;
+    static constexpr float kFullScale = 128.0f;
+    static constexpr const char* kName = "pcm8";
+
+    static Value load(const char* buffer, const size_t i) {
+        return static_cast<int32_t>(reinterpret_cast<const uint8_t*>(buffer)[i]) - 128;
+    }
+    static Magnitude magnitude(const Value v) { return std::abs(v); }
+    static int32_t square(const Value v) { return v * v; }
+    static float toFloat(const Value v) { return v / kFullScale; }
+    static void storeFloat(char* buffer, const size_t i, const float v) {
+        reinterpret_cast<uint8_t*>(buffer)[i] =
+            static_cast<uint8_t>(static_cast<int32_t>(std::lrint(std::clamp(v, -1.0f, 1.0f) * 127.0f)) + 128);
+    }
+    static void storeCode(char* buffer, const size_t i, const uint32_t code) {
+        reinterpret_cast<uint8_t*>(buffer)[i] = static_cast<uint8_t>((code >> 24) ^ 0x80u);
+    }
+    static uint32_t loadCode(const char* buffer, const size_t i) {
+        return (static_cast<uint32_t>(reinterpret_cast<const uint8_t*>(buffer)[i]) ^ 0x80u) << 24;
+    }
+};
+
+template <> struct SampleTraits<AUDIO_FORMAT_PCM_16_BIT> {
+    using Value = int32_t;
+    using Magnitude = int32_t;
+    using SquareSum = int64_t;
+    static constexpr audio_format_t kFormat = AUDIO_FORMAT_PCM_16_BIT;
+    static constexpr size_t kBytes = 2;
+    static constexpr int kOption = 1;
+    static constexpr uint32_t kWavBits = 16;
+    static constexpr bool kIsFloat = false;
+    static constexpr float kFullScale = 32768.0f;
+    static constexpr const char* kName = "pcm16";
+
+    static Value load(const char* buffer, const size_t i) { return loadUnaligned<int16_t>(buffer, i); }
+    static Magnitude magnitude(const Value v) { return std::abs(v); }
+    static int32_t square(const Value v) { return v * v; }
+    static float toFloat(const Value v) { return v / kFullScale; }
+    static void storeFloat(char* buffer, const size_t i, const float v) {
+        storeUnaligned(buffer, i, static_cast<int16_t>(std::lrint(std::clamp(v, -1.0f, 1.0f) * 32767.0f)));
+    }
+    static void storeCode(char* buffer, const size_t i, const uint32_t code) {
+        storeUnaligned(buffer, i, static_cast<int16_t>(code >> 16));
+    }
+    static uint32_t loadCode(const char* buffer, const size_t i) {
+        return static_cast<uint32_t>(loadUnaligned<uint16_t>(buffer, i)) << 16;
+    }
+};
+
+template <> struct SampleTraits<AUDIO_FORMAT_PCM_24_BIT_PACKED> {
+    using Value = int32_t;
+    using Magnitude = int32_t;
+    using SquareSum = double; // 2^46 per sample, an int64 sum could overflow on large buffers
+    static constexpr audio_format_t kFormat = AUDIO_FORMAT_PCM_24_BIT_PACKED;
+    static constexpr size_t kBytes = 3;
+    static constexpr int kOption = 6;
+    static constexpr uint32_t kWavBits = 24;
+    static constexpr bool kIsFloat = false;
+    static constexpr float kFullScale = 8388608.0f;
+    static constexpr const char* kName = "pcm24";
+
+    static Value load(const char* buffer, const size_t i) {
+        // Assemble the little-endian sample in the top bits, then sign-extend by shifting down
+        return static_cast<int32_t>(loadCode(buffer, i)) >> 8;
+    }
+    static Magnitude magnitude(const Value v) { return std::abs(v); }
+    static double square(const Value v) { return static_cast<double>(v) * v; }
+    static float toFloat(const Value v) { return v / kFullScale; }
+    static void storeFloat(char* buffer, const size_t i, const float v) {
+        storeCode(buffer, i, static_cast<uint32_t>(std::lrint(std::clamp(v, -1.0f, 1.0f) * 8388607.0f)) << 8);
+    }
+    static void storeCode(char* buffer, const size_t i, const uint32_t code) {
+        uint8_t* s = reinterpret_cast<uint8_t*>(buffer) + i * 3;
+        s[0] = static_cast<uint8_t>(code >> 8);
+        s[1] = static_cast<uint8_t>(code >> 16);
+        s[2] = static_cast<uint8_t>(code >> 24);
+    }
+    static uint32_t loadCode(const char* buffer, const size_t i) {
+        const uint8_t* s = reinterpret_cast<const uint8_t*>(buffer) + i * 3;
+        return static_cast<uint32_t>(s[0]) << 8 | static_cast<uint32_t>(s[1]) << 16 | static_cast<uint32_t>(s[2]) << 24;
+    }
+};
+
+template <> struct SampleTraits<AUDIO_FORMAT_PCM_8_24_BIT> {
+    using Value = int32_t;
+    using Magnitude = int32_t;
+    using SquareSum = double;
+    static constexpr audio_format_t kFormat = AUDIO_FORMAT_PCM_8_24_BIT;
+    static constexpr size_t kBytes = 4;
+    static constexpr int kOption = 4;
+    static constexpr uint32_t kWavBits = 0; // none: saved as 32-bit WAV, read back as PCM_32_BIT
+    static constexpr bool kIsFloat = false;
+    static constexpr float kFullScale = 8388608.0f; // Q8.23: 24-bit value sign-extended into 32 bits
+    static constexpr const char* kName = "pcm8_24";
+
+    static Value load(const char* buffer, const size_t i) { return loadUnaligned<int32_t>(buffer, i); }
+    static Magnitude magnitude(const Value v) { return std::abs(v); }
+    static double square(const Value v) { return static_cast<double>(v) * v; }
+    static float toFloat(const Value v) { return v / kFullScale; }
+    static void storeFloat(char* buffer, const size_t i, const float v) {
+        storeUnaligned(buffer, i, static_cast<int32_t>(std::lrint(std::clamp(v, -1.0f, 1.0f) * 8388607.0f)));
+    }
+    static void storeCode(char* buffer, const size_t i, const uint32_t code) {
+        storeUnaligned(buffer, i, static_cast<int32_t>(code) >> 8);
+    }
+    static uint32_t loadCode(const char* buffer, const size_t i) {
+        return loadUnaligned<uint32_t>(buffer, i) << 8;
+    }
+};
+
+template <> struct SampleTraits<AUDIO_FORMAT_PCM_32_BIT> {
+    using Value = int32_t;
+    using Magnitude = uint32_t; // |INT32_MIN| does not fit an int32_t
+    using SquareSum = double;
+    static constexpr audio_format_t kFormat = AUDIO_FORMAT_PCM_32_BIT;
+    static constexpr size_t kBytes = 4;
+    static constexpr int kOption = 3;
+    static constexpr uint32_t kWavBits = 32;
+    static constexpr bool kIsFloat = false;
+    static constexpr float kFullScale = 2147483648.0f;
+    static constexpr const char* kName = "pcm32";
+
+    static Value load(const char* buffer, const size_t i) { return loadUnaligned<int32_t>(buffer, i); }
+    static Magnitude magnitude(const Value v) {
+        return v < 0 ? 0u - static_cast<uint32_t>(v) : static_cast<uint32_t>(v);
+    }
+    static double square(const Value v) { return static_cast<double>(v) * v; }
+    static float toFloat(const Value v) { return v / kFullScale; }
+    static void storeFloat(char* buffer, const size_t i, const float v) {
+        // Scale in double: 2147483647 is not representable in float
+        storeUnaligned(buffer, i, static_cast<int32_t>(std::lrint(std::clamp(v, -1.0f, 1.0f) * 2147483647.0)));
+    }
+    static void storeCode(char* buffer, const size_t i, const uint32_t code) {
+        storeUnaligned(buffer, i, code);
+    }
+    static uint32_t loadCode(const char* buffer, const size_t i) {
+        return loadUnaligned<uint32_t>(buffer, i);
+    }
+};
+
+template <> struct SampleTraits<AUDIO_FORMAT_PCM_FLOAT> {
+    using Value = float;
+    using Magnitude = float;
+    using SquareSum = double;
+    static constexpr audio_format_t kFormat = AUDIO_FORMAT_PCM_FLOAT;
+    static constexpr size_t kBytes = 4;
+    static constexpr int kOption = -1; // no -f value, float comes from WAV files only
+    static constexpr uint32_t kWavBits = 32;
+    static constexpr bool kIsFloat = true;
+    static constexpr float kFullScale = 1.0f;
+    static constexpr const char* kName = "float";
+
+    static Value load(const char* buffer, const size_t i) { return loadUnaligned<float>(buffer, i); }
+    static Magnitude magnitude(const Value v) { return std::fabs(v); }
+    static double square(const Value v) { return static_cast<double>(v) * v; }
+    static float toFloat(const Value v) { return v; }
+    static void storeFloat(char* buffer, const size_t i, const float v) { storeUnaligned(buffer, i, v); }
+    static void storeCode(char* buffer, const size_t i, const uint32_t code) {
+        // 24-bit integer scaled by 2^-23 is exact in a float
+        storeUnaligned(buffer, i, static_cast<float>(static_cast<int32_t>(code) >> 8) / 8388608.0f);
+    }
+    static uint32_t loadCode(const char* buffer, const size_t i) {
+        return static_cast<uint32_t>(static_cast<int32_t>(lrintf(load(buffer, i) * 8388608.0f))) << 8;
+    }
+};
+
+// The one runtime switch on the sample format: calls fn(SampleTraits<format>()), false if format is not PCM
+template <typename Fn> static bool dispatchFormat(const audio_format_t format, Fn&& fn) {
+    switch (format) {
+    case AUDIO_FORMAT_PCM_8_BIT:
+        fn(SampleTraits<AUDIO_FORMAT_PCM_8_BIT>());
+        return true;
+    case AUDIO_FORMAT_PCM_16_BIT:
+        fn(SampleTraits<AUDIO_FORMAT_PCM_16_BIT>());
+        return true;
+    case AUDIO_FORMAT_PCM_24_BIT_PACKED:
+        fn(SampleTraits<AUDIO_FORMAT_PCM_24_BIT_PACKED>());
+        return true;
+    case AUDIO_FORMAT_PCM_8_24_BIT:
+        fn(SampleTraits<AUDIO_FORMAT_PCM_8_24_BIT>());
+        return true;
+    case AUDIO_FORMAT_PCM_32_BIT:
+        fn(SampleTraits<AUDIO_FORMAT_PCM_32_BIT>());
+        return true;
+    case AUDIO_FORMAT_PCM_FLOAT:
+        fn(SampleTraits<AUDIO_FORMAT_PCM_FLOAT>());
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Calls fn(SampleTraits<F>()) for every supported format, for lookups by a traits property
+template <typename Fn> static void forEachFormat(Fn&& fn) {
+    fn(SampleTraits<AUDIO_FORMAT_PCM_8_BIT>());
+    fn(SampleTraits<AUDIO_FORMAT_PCM_16_BIT>());
+    fn(SampleTraits<AUDIO_FORMAT_PCM_24_BIT_PACKED>());
+    fn(SampleTraits<AUDIO_FORMAT_PCM_8_24_BIT>());
+    fn(SampleTraits<AUDIO_FORMAT_PCM_32_BIT>());
+    fn(SampleTraits<AUDIO_FORMAT_PCM_FLOAT>());
+}
+
+// Calls fn with the channel count as a compile-time constant for mono and stereo, so per-channel loops of those
+// layouts unroll; other counts are passed at run time
+template <typename Fn> static void dispatchChannels(const int32_t channelCount, Fn&& fn) {
+    switch (channelCount) {
+    case 1:
+        fn(std::integral_constant<int32_t, 1>());
+        break;
+    case 2:
+        fn(std::integral_constant<int32_t, 2>());
+        break;
+    default:
+        fn(channelCount);
+        break;
+    }
+}
+
+/************************** Stdio Streaming ******************************/
+// Streams audio through stdout, e.g. "adb exec-out audio_test_client -m0 - > cap.wav", without touching flash.
+// Data is gathered into blocks of half the pipe size. On a pipe each full block is handed over with vmsplice(),
+// which references the pages instead of copying them; kBlocks blocks rotate, so a block is only refilled after
+// more than a pipe size of data followed it, when the reader has certainly consumed it. Other outputs get plain
+// write() calls of whole blocks.
+class StdoutStreamWriter {
+public:
+    // Moves console output off stdout so it carries nothing but audio: to stderr, or to /dev/null when stderr is
+    // the same stream (adb exec-out), logcat still gets the messages. Returns the data descriptor, -1 on error.
+    // Must run before the first console flush; until then earlier messages wait in the stdio buffer.
+    static int claimStdout() {
+        static int dataFd = -1;
+        if (dataFd >= 0) {
+            return dataFd;
+        }
+        if (isatty(STDOUT_FILENO)) {
+            fprintf(stderr, "Error: stdout is a terminal, redirect it to stream audio\n");
+            return -1;
+        }
+        struct stat out {};
+        struct stat err {};
+        const bool shared = fstat(STDOUT_FILENO, &out) == 0 && fstat(STDERR_FILENO, &err) == 0 &&
+                            out.st_dev == err.st_dev && out.st_ino == err.st_ino;
+        const int console = shared ? ::open("/dev/null", O_WRONLY | O_CLOEXEC) : STDERR_FILENO;
+        dataFd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+        if (dataFd < 0 || console < 0 || dup2(console, STDOUT_FILENO) < 0) {
+            fprintf(stderr, "Error: Can't redirect stdout: %s\n", strerror(errno));
+            return -1;
+        }
+        if (shared) {
+            ::close(console);
+        }
+        // A reader that goes away ends the recording through EPIPE instead of killing the process
+        signal(SIGPIPE, SIG_IGN);
+        ALOGI("Streaming audio to stdout, console output %s", shared ? "discarded" : "on stderr");
+        return dataFd;
+    }
+
+    explicit StdoutStreamWriter(const int fd) : mFd(fd) {
+        struct stat st {};
+        mIsPipe = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+        size_t pipeBytes = kDefaultBlockBytes * 2;
+        if (mIsPipe) {
+            // A larger pipe takes bigger blocks per call; keep the size the kernel grants
+            fcntl(fd, F_SETPIPE_SZ, static_cast<int>(kMaxPipeBytes));
+            const int granted = fcntl(fd, F_GETPIPE_SZ);
+            pipeBytes = granted > 0 ? static_cast<size_t>(granted) : pipeBytes;
+        }
+        mBlockBytes = std::max(pipeBytes / 2, static_cast<size_t>(getpagesize()));
+        void* blocks = mmap(nullptr, mBlockBytes * kBlocks, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        mBlocks = blocks == MAP_FAILED ? nullptr : static_cast<char*>(blocks);
+    }
+
+    // The pipe keeps its own references to spliced pages, unmapping does not touch data still queued
+    ~StdoutStreamWriter() {
+        flush();
+        if (mBlocks != nullptr) {
+            munmap(mBlocks, mBlockBytes * kBlocks);
+        }
+    }
+
+    StdoutStreamWriter(const StdoutStreamWriter&) = delete;
+    StdoutStreamWriter& operator=(const StdoutStreamWriter&) = delete;
+
+    bool isValid() const { return mBlocks != nullptr; }
+
+    bool write(const char* data, size_t size) {
+        while (size > 0) {
+            char* block = mBlocks + mCurrent * mBlockBytes;
+            const size_t copy = std::min(size, mBlockBytes - mFill);
+            memcpy(block + mFill, data, copy);
+            mFill += copy;
+            data += copy;
+            size -= copy;
+            if (mFill == mBlockBytes && !flush()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Hand over the current block, also when it is partly filled
+    bool flush() {
+        if (mFill == 0) {
+            return true;
+        }
+        const char* block = mBlocks + mCurrent * mBlockBytes;
+        const bool ok = writeBlock(block, mFill);
+        mCurrent = (mCurrent + 1) % kBlocks;
+        mFill = 0;
+        return ok;
+    }
+
+private:
+    static constexpr size_t kBlocks = 4;
+    static constexpr size_t kDefaultBlockBytes = 64 * 1024;
+    static constexpr size_t kMaxPipeBytes = 1024 * 1024; // default limit of /proc/sys/fs/pipe-max-size
+
+    bool writeBlock(const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t written = -1;
+            if (mIsPipe) {
+                struct iovec iov = {const_cast<char*>(data), size};
+                written = vmsplice(mFd, &iov, 1, 0);
+                if (written < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                    mIsPipe = false; // no splice support here, copy from now on
+                    continue;
+                }
+            } else {
+                written = ::write(mFd, data, size);
+            }
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    int mFd;
+    bool mIsPipe = false;
+    size_t mBlockBytes = 0;
+    char* mBlocks = nullptr;
+    size_t mCurrent = 0; // block being filled
+    size_t mFill = 0;    // bytes in the current block
+};
 
 /************************** WAV File Management ******************************/
 class WAVFile {
@@ -119,15 +532,34 @@ public:
         }
     };
 
-    // Create WAV file for writing with specified audio parameters
+    // Path that streams to stdout or from stdin instead of a file
+    static bool isStdio(const std::string& filePath) { return filePath == "-"; }
+
+    // Create WAV file for writing with specified audio parameters. "-" streams to stdout with a header whose
+    // sizes are 0xFFFFFFFF, the usual marker of an unknown length, so it never needs a seek back. A raw file
+    // holds the PCM data only.
     bool createForWriting(const std::string& filePath,
                           const uint32_t sampleRate,
                           const uint32_t numChannels,
-                          const uint32_t bitsPerSample) {
+                          const uint32_t bitsPerSample,
+                          const bool raw = false) {
         filePath_ = filePath;
-        fileStream_.open(filePath_, std::ios::binary | std::ios::out | std::ios::trunc);
-        if (!fileStream_.is_open()) {
-            return false;
+        raw_ = raw;
+        if (isStdio(filePath)) {
+            const int fd = StdoutStreamWriter::claimStdout();
+            if (fd < 0) {
+                return false;
+            }
+            streamWriter_ = std::make_unique<StdoutStreamWriter>(fd);
+            if (!streamWriter_->isValid()) {
+                streamWriter_.reset();
+                return false;
+            }
+        } else {
+            fileStream_.open(filePath_, std::ios::binary | std::ios::out | std::ios::trunc);
+            if (!fileStream_.is_open()) {
+                return false;
+            }
         }
 
         // Initialize header
@@ -148,8 +580,23 @@ public:
         header_.dataSize = 0;  // Will be updated as data is written
         header_.riffSize = 36; // Header size (36) + dataSize (0 initially)
 
+        if (streamWriter_) {
+            isHeaderValid_ = true;
+            if (raw_) {
+                return true;
+            }
+            Header streamHeader = header_;
+            streamHeader.riffSize = kUnknownSize;
+            streamHeader.dataSize = kUnknownSize;
+            std::ostringstream headerBytes;
+            streamHeader.write(headerBytes);
+            return streamWriter_->write(headerBytes.str().data(), headerBytes.str().size());
+        }
+
         // Write initial header with placeholder values
-        header_.write(fileStream_);
+        if (!raw_) {
+            header_.write(fileStream_);
+        }
         if (!fileStream_.good()) {
             fileStream_.close(); // Close file if header write failed
             return false;
@@ -161,34 +608,73 @@ public:
         return fileStream_.good();
     }
 
-    // Open WAV file for reading
+    // Open WAV file for reading, "-" reads the WAV stream from stdin
     bool openForReading(const std::string& filePath) {
         filePath_ = filePath;
-        fileStream_.open(filePath_, std::ios::binary | std::ios::in);
-        if (!fileStream_.is_open()) {
-            return false;
+        if (isStdio(filePath)) {
+            char headerBytes[kHeaderSize];
+            if (readStdin(headerBytes, sizeof(headerBytes)) != sizeof(headerBytes)) {
+                return false;
+            }
+            std::istringstream headerStream(std::string(headerBytes, sizeof(headerBytes)));
+            header_.read(headerStream);
+            stdinOpen_ = true;
+        } else {
+            fileStream_.open(filePath_, std::ios::binary | std::ios::in);
+            if (!fileStream_.is_open()) {
+                return false;
+            }
+            header_.read(fileStream_);
         }
-
-        header_.read(fileStream_);
         // Basic WAV header validation
         if (strncmp(header_.riffID, "RIFF", 4) != 0 || strncmp(header_.waveID, "WAVE", 4) != 0 ||
             strncmp(header_.fmtID, "fmt ", 4) != 0 || strncmp(header_.dataID, "data", 4) != 0) {
-            fileStream_.close(); // Close file before returning
+            close(); // Close file before returning
             return false;
         }
         if (header_.fmtSize < 16 || (header_.audioFormat != 1 && header_.audioFormat != 3) ||
             header_.numChannels == 0 || header_.sampleRate == 0) {
-            fileStream_.close(); // Close file before returning
+            close(); // Close file before returning
             return false;
         }
 
         isHeaderValid_ = true;
-        return fileStream_.good();
+        return stdinOpen_ || fileStream_.good();
+    }
+
+    // Open headerless PCM in the given layout for reading, "-" reads it from stdin
+    bool openRawForReading(const std::string& filePath,
+                           const uint32_t sampleRate,
+                           const uint32_t numChannels,
+                           const uint32_t bitsPerSample) {
+        filePath_ = filePath;
+        raw_ = true;
+        if (isStdio(filePath)) {
+            stdinOpen_ = true;
+        } else {
+            fileStream_.open(filePath_, std::ios::binary | std::ios::in);
+            if (!fileStream_.is_open()) {
+                return false;
+            }
+        }
+        memcpy(header_.riffID, "RIFF", 4);
+        memcpy(header_.waveID, "WAVE", 4);
+        memcpy(header_.fmtID, "fmt ", 4);
+        memcpy(header_.dataID, "data", 4);
+        header_.fmtSize = 16;
+        header_.audioFormat = 1; // PCM
+        header_.numChannels = numChannels;
+        header_.sampleRate = sampleRate;
+        header_.bitsPerSample = bitsPerSample;
+        header_.blockAlign = numChannels * (bitsPerSample / 8);
+        header_.byteRate = sampleRate * header_.blockAlign;
+        isHeaderValid_ = true;
+        return true;
     }
 
     // Write audio data to WAV file
     size_t writeData(const char* data, const size_t size) {
-        if (!fileStream_.is_open() || !isHeaderValid_ || !data || size == 0) {
+        if ((!fileStream_.is_open() && !streamWriter_) || !isHeaderValid_ || !data || size == 0) {
             return 0;
         }
 
@@ -197,6 +683,14 @@ public:
             return 0;
         }
 
+        if (streamWriter_) {
+            if (!streamWriter_->write(data, size)) {
+                return 0;
+            }
+            header_.dataSize += static_cast<uint32_t>(size);
+            header_.riffSize = 36 + header_.dataSize;
+            return size;
+        }
         fileStream_.write(data, size);
         if (fileStream_.good()) {
             // Update header sizes
@@ -209,7 +703,7 @@ public:
 
     // Update WAV header with final file sizes
     void updateHeader() {
-        if (fileStream_.is_open() && isHeaderValid_) {
+        if (fileStream_.is_open() && isHeaderValid_ && !raw_) {
             const auto currentPos = fileStream_.tellp();
 
             // Update RIFF chunk size
@@ -226,6 +720,9 @@ public:
     }
 
     size_t readData(char* data, const size_t size) {
+        if (stdinOpen_ && isHeaderValid_) {
+            return readStdin(data, size);
+        }
         if (!fileStream_.is_open() || !isHeaderValid_) {
             return 0;
         }
@@ -234,8 +731,12 @@ public:
         return static_cast<size_t>(fileStream_.gcount());
     }
 
-    // Finalize WAV file by updating header and closing file
+    // Finalize WAV file by updating header and closing file; a stream is flushed, its header stays as sent
     void finalize() {
+        if (streamWriter_) {
+            streamWriter_->flush();
+            streamWriter_.reset();
+        }
         if (fileStream_.is_open() && isHeaderValid_) {
             updateHeader();
             fileStream_.close();
@@ -243,6 +744,8 @@ public:
     }
 
     void close() {
+        streamWriter_.reset();
+        stdinOpen_ = false;
         if (fileStream_.is_open()) {
             fileStream_.close();
         }
@@ -255,33 +758,43 @@ public:
     uint32_t getBitsPerSample() const { return header_.bitsPerSample; }
     audio_format_t getAudioFormat() const {
         // WAV fmt audioFormat: 1 = PCM (integer), 3 = IEEE float
-        if (header_.audioFormat == 1) {
-            switch (header_.bitsPerSample) {
-            case 8:
-                return AUDIO_FORMAT_PCM_8_BIT;
-            case 16:
-                return AUDIO_FORMAT_PCM_16_BIT;
-            case 24:
-                return AUDIO_FORMAT_PCM_24_BIT_PACKED;
-            case 32:
-                return AUDIO_FORMAT_PCM_32_BIT;
-            default:
-                return AUDIO_FORMAT_INVALID;
+        audio_format_t format = AUDIO_FORMAT_INVALID;
+        forEachFormat([&](auto traits) {
+            using T = decltype(traits);
+            if (T::kWavBits != 0 && T::kWavBits == header_.bitsPerSample &&
+                header_.audioFormat == (T::kIsFloat ? 3 : 1)) {
+                format = T::kFormat;
+            }
+        });
+        return format;
+    }
+
+private:
+    static constexpr size_t kHeaderSize = 44;
+    static constexpr uint32_t kUnknownSize = 0xFFFFFFFF;
+
+    // Pipes return what is available, fill the whole request unless the stream ended
+    static size_t readStdin(char* data, const size_t size) {
+        size_t total = 0;
+        while (total < size) {
+            const ssize_t bytes = ::read(STDIN_FILENO, data + total, size - total);
+            if (bytes < 0 && errno == EINTR) {
+                continue;
             }
-        } else if (header_.audioFormat == 3) {
-            // IEEE float WAV -- typically 32-bit float samples
-            if (header_.bitsPerSample == 32) {
-                return AUDIO_FORMAT_PCM_FLOAT;
+            if (bytes <= 0) {
+                break;
             }
-            return AUDIO_FORMAT_INVALID;
+            total += static_cast<size_t>(bytes);
         }
-        return AUDIO_FORMAT_INVALID;
+        return total;
     }
 
-private:
     Header header_{};
     std::string filePath_;
     mutable std::fstream fileStream_;
+    std::unique_ptr<StdoutStreamWriter> streamWriter_;
+    bool stdinOpen_{false};
+    bool raw_{false}; // no header in the file
     bool isHeaderValid_{false};
     std::streampos dataSizePos_{};
 };
@@ -326,6 +839,83 @@ private:
     size_t size{0};
 };
 
+/************************** BufferPool class ******************************/
+// Keeps released buffers for reuse, so repeated runs in one process skip allocation and first-touch page faults
+class BufferPool {
+public:
+    BufferPool() = default;
+    ~BufferPool() = default;
+
+    // Disable copy operations to prevent issues with pooled buffers
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Buffer borrowed from a pool, returned automatically when the lease goes out of scope
+    class Lease {
+    public:
+        Lease(BufferPool* pool, std::unique_ptr<BufferManager> buffer) : mPool(pool), mBuffer(std::move(buffer)) {}
+        ~Lease() {
+            if (mPool != nullptr && mBuffer != nullptr && mBuffer->isValid()) {
+                mPool->release(std::move(mBuffer));
+            }
+        }
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        Lease(Lease&& other) noexcept : mPool(other.mPool), mBuffer(std::move(other.mBuffer)) {}
+        Lease& operator=(Lease&&) = delete;
+
+        BufferManager& get() { return *mBuffer; }
+
+    private:
+        BufferPool* mPool;
+        std::unique_ptr<BufferManager> mBuffer;
+    };
+
+    // Borrow a buffer of at least size bytes from pool, or allocate a private one if pool is nullptr
+    static Lease acquire(BufferPool* pool, const size_t size) {
+        if (pool != nullptr) {
+            std::lock_guard<std::mutex> lock(pool->mMutex);
+            // Best fit: smallest free buffer that is large enough
+            auto best = pool->mFreeBuffers.end();
+            for (auto it = pool->mFreeBuffers.begin(); it != pool->mFreeBuffers.end(); ++it) {
+                if ((*it)->getSize() >= size &&
+                    (best == pool->mFreeBuffers.end() || (*it)->getSize() < (*best)->getSize())) {
+                    best = it;
+                }
+            }
+            if (best != pool->mFreeBuffers.end()) {
+                std::unique_ptr<BufferManager> buffer = std::move(*best);
+                pool->mFreeBuffers.erase(best);
+                return Lease(pool, std::move(buffer));
+            }
+        }
+        return Lease(pool, std::make_unique<BufferManager>(size));
+    }
+
+private:
+    void release(std::unique_ptr<BufferManager> buffer) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFreeBuffers.push_back(std::move(buffer));
+    }
+
+    std::mutex mMutex;
+    std::vector<std::unique_ptr<BufferManager>> mFreeBuffers;
+};
+
+/************************** Audio Backend Definitions ******************************/
+// Stream backend used by record/play/loopback: legacy AudioRecord/AudioTrack, an AAudio exclusive (MMAP) stream
+// with data callbacks or its host fake, a stand-in for running without an audio server (paced to real time,
+// or as fast as possible), or the replay of a --trace file
+enum AudioBackend {
+    BACKEND_LEGACY = 0,
+    BACKEND_SIM = 1,
+    BACKEND_SIM_FAST = 2,
+    BACKEND_AAUDIO = 3,
+    BACKEND_AAUDIO_FAKE = 4,
+    BACKEND_REPLAY = 5,
+};
+
 /************************** Audio Utility Functions ******************************/
 class AudioUtils {
 private:
@@ -449,21 +1039,113 @@ public:
 
     // Parse format option value to audio_format_t enum
     static audio_format_t parseFormatOption(const int v) {
-        switch (v) {
-        case 1:
-            return AUDIO_FORMAT_PCM_16_BIT;
-        case 2:
-            return AUDIO_FORMAT_PCM_8_BIT;
-        case 3:
-            return AUDIO_FORMAT_PCM_32_BIT;
-        case 4:
-            return AUDIO_FORMAT_PCM_8_24_BIT;
-        case 6:
-            return AUDIO_FORMAT_PCM_24_BIT_PACKED;
-        default:
+        audio_format_t format = AUDIO_FORMAT_INVALID;
+        forEachFormat([&](auto traits) {
+            if (decltype(traits)::kOption == v) {
+                format = decltype(traits)::kFormat;
+            }
+        });
+        if (format == AUDIO_FORMAT_INVALID) {
             printf("Error: format %d not found, using default format 16bit\n", v);
             return AUDIO_FORMAT_PCM_16_BIT;
         }
+        return format;
+    }
+
+    // Parse backend option value to AudioBackend enum
+    static AudioBackend parseBackendOption(const char* name) {
+        if (strcmp(name, "legacy") == 0) {
+            return BACKEND_LEGACY;
+        } else if (strcmp(name, "sim") == 0) {
+            return BACKEND_SIM;
+        } else if (strcmp(name, "sim-fast") == 0) {
+            return BACKEND_SIM_FAST;
+        } else if (strcmp(name, "aaudio") == 0) {
+            return BACKEND_AAUDIO;
+        } else if (strcmp(name, "aaudio-fake") == 0) {
+            return BACKEND_AAUDIO_FAKE;
+        } else if (strcmp(name, "replay") == 0) {
+            return BACKEND_REPLAY;
+        }
+        printf("Error: backend %s not found, using default backend legacy\n", name);
+        return BACKEND_LEGACY;
+    }
+
+    // Expand directories (sorted .wav files), glob patterns, list files (one path per line, relative to the
+    // list, # comments) and WAV files into files, in argument order
+    static bool collectWavFiles(const std::vector<std::string>& args, std::vector<std::string>& files) {
+        for (const std::string& arg : args) {
+            struct stat st {};
+            const bool exists = stat(arg.c_str(), &st) == 0;
+            if (!exists && arg.find_first_of("*?[") != std::string::npos) {
+                glob_t matches{};
+                const int rc = glob(arg.c_str(), 0, nullptr, &matches);
+                if (rc == 0) {
+                    files.insert(files.end(), matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+                }
+                globfree(&matches);
+                if (rc != 0) {
+                    printf("Error: No file matches %s\n", arg.c_str());
+                    return false;
+                }
+            } else if (!exists) {
+                printf("Error: File does not exist: %s\n", arg.c_str());
+                return false;
+            } else if (S_ISDIR(st.st_mode)) {
+                if (!listDirectory(arg, files)) {
+                    return false;
+                }
+            } else if (hasWavExtension(arg)) {
+                files.push_back(arg);
+            } else if (!readListFile(arg, files)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool hasWavExtension(const std::string& path) {
+        return path.size() > 4 && strcasecmp(path.c_str() + path.size() - 4, ".wav") == 0;
+    }
+
+    static bool listDirectory(const std::string& dirPath, std::vector<std::string>& files) {
+        DIR* dir = opendir(dirPath.c_str());
+        if (dir == nullptr) {
+            printf("Error: Can't open directory %s: %s\n", dirPath.c_str(), strerror(errno));
+            return false;
+        }
+        std::vector<std::string> names;
+        while (const struct dirent* entry = readdir(dir)) {
+            const std::string path = dirPath + "/" + entry->d_name;
+            struct stat st {};
+            if (hasWavExtension(entry->d_name) && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+                names.push_back(path);
+            }
+        }
+        closedir(dir);
+        std::sort(names.begin(), names.end());
+        files.insert(files.end(), names.begin(), names.end());
+        return true;
+    }
+
+    static bool readListFile(const std::string& listPath, std::vector<std::string>& files) {
+        std::ifstream list(listPath);
+        if (!list.is_open()) {
+            printf("Error: Can't open file list %s\n", listPath.c_str());
+            return false;
+        }
+        const size_t slash = listPath.rfind('/');
+        const std::string baseDir = slash == std::string::npos ? std::string() : listPath.substr(0, slash + 1);
+        std::string line;
+        while (std::getline(list, line)) {
+            const size_t first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#') {
+                continue;
+            }
+            const std::string path = line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+            files.push_back(path[0] == '/' ? path : baseDir + path);
+        }
+        return true;
     }
 
     // Get current time formatted as YYYYMMDD_HH.MM.SS
@@ -494,6 +1176,130 @@ public:
         }
     }
 
+    // Format a CLOCK_REALTIME time as local "YYYY-MM-DD HH:MM:SS.mmm"
+    static std::string formatWallTime(const int64_t realtimeNs) {
+        const time_t seconds = static_cast<time_t>(realtimeNs / 1000000000LL);
+        struct tm now;
+        char buffer[32] = "0000-00-00 00:00:00";
+        if (localtime_r(&seconds, &now) != nullptr) {
+            strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &now);
+        }
+        return String8::format("%s.%03d", buffer, static_cast<int>(realtimeNs / 1000000 % 1000)).c_str();
+    }
+
+    // Get CLOCK_MONOTONIC time in nanoseconds for interval measurements
+    static int64_t getMonotonicNs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+    }
+
+    // Compute normalized peak amplitude (0.0 - 1.0) of interleaved PCM data, -1.0 if format is unsupported
+    static float computePeakAmplitude(const char* buffer, const size_t size, const audio_format_t format) {
+        float result = -1.0f;
+        if (buffer != nullptr) {
+            dispatchFormat(format, [&](auto traits) { result = peakKernel<decltype(traits)>(buffer, size); });
+        }
+        return result;
+    }
+
+    // Compute normalized mean square (0.0 - 1.0, full-scale square wave = 1.0) of PCM data, -1.0 if format is
+    // unsupported
+    static double computeMeanSquare(const char* buffer, const size_t size, const audio_format_t format) {
+        double result = -1.0;
+        if (buffer != nullptr) {
+            dispatchFormat(format, [&](auto traits) { result = meanSquareKernel<decltype(traits)>(buffer, size); });
+        }
+        return result;
+    }
+
+    // Merge the per-channel peaks (0.0 - 1.0) of interleaved PCM data into peaks[0..channelCount)
+    static bool accumulateChannelPeaks(const char* buffer,
+                                       const size_t size,
+                                       const audio_format_t format,
+                                       const int32_t channelCount,
+                                       float* peaks) {
+        if (buffer == nullptr || peaks == nullptr || channelCount <= 0) {
+            return false;
+        }
+        return dispatchFormat(format, [&](auto traits) {
+            dispatchChannels(channelCount, [&](auto channels) {
+                channelPeaksKernel<decltype(traits)>(buffer, size, channels, peaks);
+            });
+        });
+    }
+
+    // Convert interleaved PCM data to float samples (-1.0 - 1.0)
+    static bool pcmToFloat(const char* src, float* dst, const size_t numSamples, const audio_format_t format) {
+        if (src == nullptr || dst == nullptr) {
+            return false;
+        }
+        if (format == AUDIO_FORMAT_PCM_FLOAT) {
+            memcpy(dst, src, numSamples * sizeof(float));
+            return true;
+        }
+        return dispatchFormat(format, [&](auto traits) {
+            for (size_t i = 0; i < numSamples; ++i) {
+                dst[i] = decltype(traits)::toFloat(decltype(traits)::load(src, i));
+            }
+        });
+    }
+
+    // Convert float samples (-1.0 - 1.0) to interleaved PCM data, out-of-range values are clipped
+    static bool floatToPcm(const float* src, char* dst, const size_t numSamples, const audio_format_t format) {
+        if (src == nullptr || dst == nullptr) {
+            return false;
+        }
+        if (format == AUDIO_FORMAT_PCM_FLOAT) {
+            memcpy(dst, src, numSamples * sizeof(float));
+            return true;
+        }
+        return dispatchFormat(format, [&](auto traits) {
+            for (size_t i = 0; i < numSamples; ++i) {
+                decltype(traits)::storeFloat(dst, i, src[i]);
+            }
+        });
+    }
+
+    // Sample kernels, instantiated per format by the dispatching functions above
+
+    // Track the peak magnitude and normalize once, so the loop stays branch-free and vectorizable
+    template <typename T> static float peakKernel(const char* buffer, const size_t size) {
+        const size_t numSamples = size / T::kBytes;
+        typename T::Magnitude peak = 0;
+        for (size_t i = 0; i < numSamples; ++i) {
+            peak = std::max(peak, T::magnitude(T::load(buffer, i)));
+        }
+        return std::min(static_cast<float>(peak) / T::kFullScale, 1.0f);
+    }
+
+    // 8/16-bit data sums exact integer squares, so those loops vectorize without float conversion
+    template <typename T> static double meanSquareKernel(const char* buffer, const size_t size) {
+        const size_t numSamples = size / T::kBytes;
+        if (numSamples == 0) {
+            return -1.0;
+        }
+        typename T::SquareSum sum = 0;
+        for (size_t i = 0; i < numSamples; ++i) {
+            sum += T::square(T::load(buffer, i));
+        }
+        return static_cast<double>(sum) / (numSamples * (static_cast<double>(T::kFullScale) * T::kFullScale));
+    }
+
+    // channels is an int32_t or a std::integral_constant from dispatchChannels()
+    template <typename T, typename Channels>
+    static void channelPeaksKernel(const char* buffer, const size_t size, const Channels channels, float* peaks) {
+        const int32_t channelCount = channels;
+        const size_t numFrames = size / (T::kBytes * channelCount);
+        for (size_t frame = 0; frame < numFrames; ++frame) {
+            for (int32_t ch = 0; ch < channelCount; ++ch) {
+                const float v = static_cast<float>(T::magnitude(T::load(buffer, frame * channelCount + ch))) /
+                                T::kFullScale;
+                peaks[ch] = std::max(peaks[ch], std::min(v, 1.0f));
+            }
+        }
+    }
+
     // Generate WAV file path with timestamp or use provided override path
     static std::string makeRecordFilePath(const int32_t sampleRate,
                                           const int32_t channelCount,
@@ -519,840 +1325,11244 @@ public:
     }
 };
 
-/************************** Global Variables ******************************/
-// Global exit flag for signal handling
-static std::atomic<bool> sExitRequested(false);
+/************************** Async Logger ******************************/
+// Keeps stdout and logcat writes off the audio threads. Callers push fixed-size binary records (format literal,
+// numeric arguments, string arguments copied into the record) into a bounded lock-free queue; a background thread
+// formats them with the printf conversions of the format and writes them out. When the queue is full the message
+// is dropped and counted, the caller never blocks. Before start() and after stop() records are written directly.
+// Format strings must be string literals. Length modifiers are ignored, the argument type decides.
+class AsyncLogger {
+public:
+    enum Level : uint8_t {
+        LEVEL_PRINT, // stdout
+        LEVEL_TIMED, // stdout with a [HH:MM:SS.mmm] prefix taken when the message was pushed
+        LEVEL_INFO,  // stdout and ALOGI
+        LEVEL_ERROR, // stdout with "Error: " prefix and ALOGE
+    };
 
-/************************** Audio Configuration ******************************/
-struct AudioConfig {
-    // Common parameters
-    int32_t sampleRate = 48000;
-    int32_t channelCount = 2;
-    audio_format_t format = AUDIO_FORMAT_PCM_16_BIT;
-    size_t minFrameCount = 0; // will be calculated
+    AsyncLogger() = default;
+    ~AsyncLogger() { stop(); }
 
-    // Recording parameters
-    audio_source_t inputSource = AUDIO_SOURCE_MIC;
-    audio_input_flags_t inputFlag = AUDIO_INPUT_FLAG_NONE;
-    int32_t durationSeconds = 0;     // 0 = unlimited
-    std::string recordFilePath = ""; // will be generated if empty
+    // Disable copy operations, the writer thread refers to this instance
+    AsyncLogger(const AsyncLogger&) = delete;
+    AsyncLogger& operator=(const AsyncLogger&) = delete;
 
-    // Playback parameters
-    audio_usage_t usage = AUDIO_USAGE_MEDIA;
-    audio_output_flags_t outputFlag = AUDIO_OUTPUT_FLAG_NONE;
-    std::string playFilePath = "/data/audio_test.wav";
+    template <typename... Args> void print(const char* format, Args... args) { log(LEVEL_PRINT, format, args...); }
+    template <typename... Args> void printTimed(const char* format, Args... args) {
+        log(LEVEL_TIMED, format, args...);
+    }
+    template <typename... Args> void info(const char* format, Args... args) { log(LEVEL_INFO, format, args...); }
+    template <typename... Args> void error(const char* format, Args... args) { log(LEVEL_ERROR, format, args...); }
 
-    // Set params parameters
-    std::vector<int32_t> setParams{};
-};
+    // Start the writer thread; messages pushed from now on are queued
+    void start() {
+        if (mRunning.load(std::memory_order_acquire)) {
+            return;
+        }
+        if (!mSlots) {
+            mSlots.reset(new Slot[kCapacity]);
+            for (size_t i = 0; i < kCapacity; ++i) {
+                mSlots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+        mStopRequested.store(false, std::memory_order_relaxed);
+        mRunning.store(true, std::memory_order_release);
+        mThread = std::thread(&AsyncLogger::run, this);
+    }
 
-/************************** AudioMode Definitions ******************************/
-enum AudioMode { MODE_INVALID = -1, MODE_RECORD = 0, MODE_PLAY = 1, MODE_LOOPBACK = 2, MODE_SET_PARAMS = 100 };
+    // Write everything still queued and stop the writer thread
+    void stop() {
+        if (!mRunning.exchange(false, std::memory_order_acq_rel)) {
+            return;
+        }
+        mStopRequested.store(true, std::memory_order_release);
+        mThread.join();
+        drain();
+    }
 
-/************************** Audio Parameter Manager ******************************/
-static const String8 PARAM_OPEN_SOURCE = String8("open_source");   // Open source parameter name
-static const String8 PARAM_CLOSE_SOURCE = String8("close_source"); // Close source parameter name
-static const String8 PARAM_CHANNEL_MASK = String8("channel_mask"); // Channel mask parameter name
+    // Wait until every message queued so far is written, keeps order with direct printf output after a hot loop
+    void flush() {
+        const size_t target = mEnqueuePos.load(std::memory_order_acquire);
+        while (mRunning.load(std::memory_order_acquire) && mDequeuePos.load(std::memory_order_acquire) < target) {
+            usleep(kFlushPollUs);
+        }
+    }
 
-class AudioParameterManager {
-public:
-    explicit AudioParameterManager(const AudioConfig& config) : mConfig(config) {}
-    ~AudioParameterManager() = default;
+    uint64_t getDroppedCount() const { return mDropped.load(std::memory_order_relaxed); }
+    uint64_t getTruncatedCount() const { return mTruncated.load(std::memory_order_relaxed); }
 
-    // Disable copy operations to prevent issues with configuration references
-    AudioParameterManager(const AudioParameterManager&) = delete;
-    AudioParameterManager& operator=(const AudioParameterManager&) = delete;
+private:
+    static constexpr size_t kCapacity = 512; // records, power of two
+    static constexpr size_t kMaxArgs = 16;
+    static constexpr size_t kLineSize = 512;       // formatted line, longer lines are truncated
+    static constexpr size_t kTextSize = kLineSize; // string arguments, copied back to back; cut ones end in "..."
+    static constexpr useconds_t kIdleSleepUs = 5000;
+    static constexpr useconds_t kFlushPollUs = 1000;
+
+    enum ArgType : uint8_t { ARG_INT, ARG_UINT, ARG_DOUBLE, ARG_TEXT };
+
+    union ArgValue {
+        int64_t i;
+        uint64_t u;
+        double d;
+        size_t textOffset;
+    };
 
-    // Set open source parameter with specific audio usage
-    void setOpenSourceWithUsage(audio_usage_t usage) {
-        setSystemParameter(PARAM_OPEN_SOURCE, audioUsageToString(usage));
-    }
+    struct Record {
+        const char* format;
+        int64_t realtimeNs; // LEVEL_TIMED only
+        Level level;
+        uint8_t argCount;
+        uint16_t textUsed;
+        bool truncated; // a string argument did not fit into text
+        ArgType argTypes[kMaxArgs];
+        ArgValue args[kMaxArgs];
+        char text[kTextSize];
+    };
 
-    // Set close source parameter with specific audio usage
-    void setCloseSourceWithUsage(audio_usage_t usage) {
-        setSystemParameter(PARAM_CLOSE_SOURCE, audioUsageToString(usage));
-    }
+    // Bounded MPMC queue cell: sequence == position when free, position + 1 when it holds a record
+    struct Slot {
+        std::atomic<size_t> sequence{0};
+        Record record;
+    };
 
-    // Set channel mask parameter for AudioTrack
-    void setChannelMask(const sp<AudioTrack>& audioTrack, audio_channel_mask_t channelMask) {
-        setAudioTrackParameter(audioTrack, PARAM_CHANNEL_MASK, String8::format("%d", channelMask));
+    std::unique_ptr<Slot[]> mSlots;
+    std::atomic<size_t> mEnqueuePos{0};
+    std::atomic<size_t> mDequeuePos{0}; // advanced by the writer thread only
+    std::atomic<uint64_t> mDropped{0};
+    uint64_t mReportedDropped = 0;
+    std::atomic<uint64_t> mTruncated{0};
+    uint64_t mReportedTruncated = 0;
+    std::atomic<bool> mRunning{false};
+    std::atomic<bool> mStopRequested{false};
+    std::thread mThread;
+
+    template <typename... Args> void log(const Level level, const char* format, Args... args) {
+        static_assert(sizeof...(Args) <= kMaxArgs, "too many log arguments");
+        if (!mRunning.load(std::memory_order_acquire)) {
+            Record record;
+            fill(record, level, format, args...);
+            if (record.truncated) {
+                mTruncated.fetch_add(1, std::memory_order_relaxed);
+            }
+            write(record);
+            fflush(stdout);
+            return;
+        }
+
+        size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+        Slot* slot = nullptr;
+        for (;;) {
+            slot = &mSlots[pos & (kCapacity - 1)];
+            const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                mDropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        fill(slot->record, level, format, args...);
+        if (slot->record.truncated) {
+            mTruncated.fetch_add(1, std::memory_order_relaxed);
+        }
+        slot->sequence.store(pos + 1, std::memory_order_release);
     }
 
-private:
-    AudioConfig mConfig;
+    template <typename... Args>
+    static void fill(Record& record, const Level level, const char* format, Args... args) {
+        record.format = format;
+        record.level = level;
+        record.argCount = 0;
+        record.textUsed = 0;
+        record.truncated = false;
+        if (level == LEVEL_TIMED) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            record.realtimeNs = static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+        } else {
+            record.realtimeNs = 0;
+        }
+        (addArg(record, args), ...);
+    }
 
-    // Unified interface for AudioSystem::setParameters
-    void setSystemParameter(const String8& key, const String8& value) {
-#if ENABLE_SET_PARAMS
-        AudioParameter audioParam;
-        audioParam.add(key, value);
-        String8 paramString = audioParam.toString();
-        AudioSystem::setParameters(paramString);
-        printf("Set parameter: %s\n", paramString.c_str());
-#endif
+    template <typename T> static void addArg(Record& record, const T value) {
+        ArgValue& arg = record.args[record.argCount];
+        ArgType& type = record.argTypes[record.argCount];
+        if constexpr (std::is_same_v<T, const char*> || std::is_same_v<T, char*>) {
+            // The terminator of the previous copy stays within kTextSize, so an exhausted area reads as ""
+            const size_t room = kTextSize - record.textUsed;
+            const char* text = value != nullptr ? value : "(null)";
+            type = ARG_TEXT;
+            if (room == 0) {
+                arg.textOffset = kTextSize - 1;
+                record.truncated = record.truncated || text[0] != '\0';
+            } else {
+                const size_t length = strnlen(text, room - 1);
+                memcpy(record.text + record.textUsed, text, length);
+                record.text[record.textUsed + length] = '\0';
+                if (text[length] != '\0') {
+                    const size_t mark = std::min<size_t>(length, 3);
+                    memset(record.text + record.textUsed + length - mark, '.', mark);
+                    record.truncated = true;
+                }
+                arg.textOffset = record.textUsed;
+                record.textUsed = static_cast<uint16_t>(record.textUsed + length + 1);
+            }
+        } else if constexpr (std::is_floating_point_v<T>) {
+            type = ARG_DOUBLE;
+            arg.d = static_cast<double>(value);
+        } else if constexpr (std::is_enum_v<T> || std::is_signed_v<T>) {
+            type = ARG_INT;
+            arg.i = static_cast<int64_t>(value);
+        } else {
+            static_assert(std::is_integral_v<T>, "unsupported log argument type");
+            type = ARG_UINT;
+            arg.u = static_cast<uint64_t>(value);
+        }
+        ++record.argCount;
     }
 
-    // Unified interface for audioTrack->setParameters
-    void setAudioTrackParameter(const sp<AudioTrack>& audioTrack, const String8& key, const String8& value) {
-#if ENABLE_SET_PARAMS
-        AudioParameter audioParam;
-        audioParam.add(key, value);
-        String8 paramString = audioParam.toString();
-        audioTrack->setParameters(paramString);
-        printf("Set parameter: %s\n", paramString.c_str());
-#endif
+    // Expand the format of a record into out, one conversion at a time
+    static void format(const Record& record, char* out, const size_t size) {
+        size_t used = 0;
+        size_t argIndex = 0;
+        auto append = [&](const int n) {
+            if (n > 0) {
+                used = std::min(used + static_cast<size_t>(n), size - 1);
+            }
+        };
+        for (const char* p = record.format; *p != '\0' && used < size - 1; ++p) {
+            if (*p != '%') {
+                out[used++] = *p;
+                continue;
+            }
+            if (p[1] == '%') {
+                out[used++] = '%';
+                ++p;
+                continue;
+            }
+            // Keep flags, width and precision, replace the length modifier by the one of the stored type
+            char spec[32] = "%";
+            size_t specLength = 1;
+            const char* q = p + 1;
+            while (*q != '\0' && strchr("-+ #0123456789.", *q) != nullptr && specLength < sizeof(spec) - 4) {
+                spec[specLength++] = *q++;
+            }
+            while (*q != '\0' && strchr("hlLqjzt", *q) != nullptr) {
+                ++q;
+            }
+            const char conversion = *q;
+            if (conversion == '\0') {
+                break;
+            }
+            p = q;
+            if (argIndex >= record.argCount) {
+                append(snprintf(out + used, size - used, "<?>"));
+                continue;
+            }
+            const ArgType type = record.argTypes[argIndex];
+            const ArgValue& arg = record.args[argIndex++];
+            switch (conversion) {
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+            case 'c': {
+                if (type == ARG_TEXT) {
+                    append(snprintf(out + used, size - used, "<?>"));
+                    break;
+                }
+                const int64_t value = type == ARG_DOUBLE ? static_cast<int64_t>(arg.d) : arg.i;
+                if (conversion == 'c') {
+                    spec[specLength++] = 'c';
+                    spec[specLength] = '\0';
+                    append(snprintf(out + used, size - used, spec, static_cast<int>(value)));
+                } else {
+                    spec[specLength++] = 'l';
+                    spec[specLength++] = 'l';
+                    spec[specLength++] = conversion;
+                    spec[specLength] = '\0';
+                    append(snprintf(out + used, size - used, spec, static_cast<long long>(value)));
+                }
+                break;
+            }
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G': {
+                if (type == ARG_TEXT) {
+                    append(snprintf(out + used, size - used, "<?>"));
+                    break;
+                }
+                const double value = type == ARG_DOUBLE ? arg.d
+                                     : type == ARG_INT  ? static_cast<double>(arg.i)
+                                                        : static_cast<double>(arg.u);
+                spec[specLength++] = conversion;
+                spec[specLength] = '\0';
+                append(snprintf(out + used, size - used, spec, value));
+                break;
+            }
+            case 's':
+                spec[specLength++] = 's';
+                spec[specLength] = '\0';
+                append(snprintf(out + used, size - used, spec,
+                                type == ARG_TEXT ? record.text + arg.textOffset : "<?>"));
+                break;
+            default:
+                append(snprintf(out + used, size - used, "<?>"));
+                break;
+            }
+        }
+        out[used] = '\0';
     }
 
-    // Convert audio_usage_t enum to string representation
-    String8 audioUsageToString(audio_usage_t usage) {
-        static const std::unordered_map<audio_usage_t, const char*> usageMap = {
-            // Basic usage types (Android 16 AUDIO_USAGE_LIST_NO_SYS_DEF)
-            {AUDIO_USAGE_UNKNOWN, "AUDIO_USAGE_UNKNOWN"},
-            {AUDIO_USAGE_MEDIA, "AUDIO_USAGE_MEDIA"},
-            {AUDIO_USAGE_VOICE_COMMUNICATION, "AUDIO_USAGE_VOICE_COMMUNICATION"},
-            {AUDIO_USAGE_VOICE_COMMUNICATION_SIGNALLING, "AUDIO_USAGE_VOICE_COMMUNICATION_SIGNALLING"},
-            {AUDIO_USAGE_ALARM, "AUDIO_USAGE_ALARM"},
-            {AUDIO_USAGE_NOTIFICATION, "AUDIO_USAGE_NOTIFICATION"},
-            {AUDIO_USAGE_NOTIFICATION_TELEPHONY_RINGTONE, "AUDIO_USAGE_NOTIFICATION_TELEPHONY_RINGTONE"},
-            {AUDIO_USAGE_NOTIFICATION_EVENT, "AUDIO_USAGE_NOTIFICATION_EVENT"},
-            {AUDIO_USAGE_ASSISTANCE_ACCESSIBILITY, "AUDIO_USAGE_ASSISTANCE_ACCESSIBILITY"},
-            {AUDIO_USAGE_ASSISTANCE_NAVIGATION_GUIDANCE, "AUDIO_USAGE_ASSISTANCE_NAVIGATION_GUIDANCE"},
-            {AUDIO_USAGE_ASSISTANCE_SONIFICATION, "AUDIO_USAGE_ASSISTANCE_SONIFICATION"},
-            {AUDIO_USAGE_GAME, "AUDIO_USAGE_GAME"},
-            {AUDIO_USAGE_VIRTUAL_SOURCE, "AUDIO_USAGE_VIRTUAL_SOURCE"},
-            {AUDIO_USAGE_ASSISTANT, "AUDIO_USAGE_ASSISTANT"},
-            {AUDIO_USAGE_CALL_ASSISTANT, "AUDIO_USAGE_CALL_ASSISTANT"},
+    static void write(const Record& record) {
+        char line[kLineSize];
+        size_t prefixLength = 0;
+        if (record.level == LEVEL_TIMED) {
+            const time_t seconds = static_cast<time_t>(record.realtimeNs / 1000000000LL);
+            struct tm now;
+            if (localtime_r(&seconds, &now) != nullptr) {
+                prefixLength = static_cast<size_t>(
+                    snprintf(line, sizeof(line), "[%02d:%02d:%02d.%03d] ", now.tm_hour, now.tm_min, now.tm_sec,
+                             static_cast<int>(record.realtimeNs / 1000000 % 1000)));
+            } else {
+                prefixLength = static_cast<size_t>(snprintf(line, sizeof(line), "[00:00:00.000] "));
+            }
+        } else if (record.level == LEVEL_ERROR) {
+            prefixLength = static_cast<size_t>(snprintf(line, sizeof(line), "Error: "));
+        }
+        char* const message = line + prefixLength;
+        format(record, message, sizeof(line) - prefixLength);
+        // A line cut at kLineSize keeps its end mark and newline
+        const size_t used = prefixLength + strlen(message);
+        const size_t formatLength = strlen(record.format);
+        if (used == sizeof(line) - 1 && formatLength > 0 && record.format[formatLength - 1] == '\n' &&
+            line[used - 1] != '\n') {
+            memcpy(line + used - 4, "...\n", 4);
+        }
+        fputs(line, stdout);
 
-            // System usage types (available when not AUDIO_NO_SYSTEM_DECLARATIONS)
-            {AUDIO_USAGE_NOTIFICATION_COMMUNICATION_REQUEST, "AUDIO_USAGE_NOTIFICATION_COMMUNICATION_REQUEST"},
-            {AUDIO_USAGE_NOTIFICATION_COMMUNICATION_INSTANT, "AUDIO_USAGE_NOTIFICATION_COMMUNICATION_INSTANT"},
-            {AUDIO_USAGE_NOTIFICATION_COMMUNICATION_DELAYED, "AUDIO_USAGE_NOTIFICATION_COMMUNICATION_DELAYED"},
+        if (record.level == LEVEL_INFO || record.level == LEVEL_ERROR) {
+            const size_t length = strlen(message);
+            if (length > 0 && message[length - 1] == '\n') {
+                message[length - 1] = '\0';
+            }
+            if (record.level == LEVEL_INFO) {
+                ALOGI("%s", message);
+            } else {
+                ALOGE("%s", message);
+            }
+        }
+    }
 
-            // High-value usage types (Android Automotive and special scenarios)
-            {AUDIO_USAGE_EMERGENCY, "AUDIO_USAGE_EMERGENCY"},
-            {AUDIO_USAGE_SAFETY, "AUDIO_USAGE_SAFETY"},
-            {AUDIO_USAGE_VEHICLE_STATUS, "AUDIO_USAGE_VEHICLE_STATUS"},
-            {AUDIO_USAGE_ANNOUNCEMENT, "AUDIO_USAGE_ANNOUNCEMENT"},
-            // {AUDIO_USAGE_SPEAKER_CLEANUP, "AUDIO_USAGE_SPEAKER_CLEANUP"},
-        };
-        const char* usageName = "AUDIO_USAGE_UNKNOWN";
-        const auto it = usageMap.find(usage);
-        if (it != usageMap.end()) {
-            usageName = it->second;
+    // Write every published record in queue order, returns false when there was nothing to do
+    bool drain() {
+        bool wrote = false;
+        size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = mSlots[pos & (kCapacity - 1)];
+            if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+                break;
+            }
+            write(slot.record);
+            slot.sequence.store(pos + kCapacity, std::memory_order_release);
+            mDequeuePos.store(++pos, std::memory_order_release);
+            wrote = true;
+        }
+        const uint64_t dropped = mDropped.load(std::memory_order_relaxed);
+        if (dropped != mReportedDropped) {
+            printf("Warning: %" PRIu64 " log messages dropped, queue full\n", dropped - mReportedDropped);
+            mReportedDropped = dropped;
+            wrote = true;
+        }
+        const uint64_t truncated = mTruncated.load(std::memory_order_relaxed);
+        if (truncated != mReportedTruncated) {
+            printf("Warning: %" PRIu64 " log messages truncated, string arguments over %zu bytes\n",
+                   truncated - mReportedTruncated, kTextSize);
+            mReportedTruncated = truncated;
+            wrote = true;
+        }
+        if (wrote) {
+            fflush(stdout);
+        }
+        return wrote;
+    }
+
+    void run() {
+        while (!mStopRequested.load(std::memory_order_acquire)) {
+            if (!drain()) {
+                usleep(kIdleSleepUs);
+            }
         }
-        return String8::format("0:%s", usageName);
     }
 };
 
-/************************** Audio Operation Base Class ******************************/
-class AudioOperation {
+/************************** Global Variables ******************************/
+// Global exit flag for signal handling
+static std::atomic<bool> sExitRequested(false);
+// External trigger of the pre-trigger capture, set by SIGUSR1
+static std::atomic<bool> sTriggerRequested(false);
+// Process entry time, taken during static initialization before main() runs
+static const int64_t sProcessEntryNs = AudioUtils::getMonotonicNs();
+// Process-wide logger for the streaming loops, started by main()
+static AsyncLogger sLogger;
+
+/************************** Startup Timeline ******************************/
+// Monotonic timestamps of startup phases, from process entry to the first frame read or written.
+// Phase names must be string literals; marks beyond kMaxMarks are dropped.
+class StartupTimeline {
 public:
-    explicit AudioOperation(const AudioConfig& config) : mConfig(config), mAudioParamManager(config) {
-        setupSignalHandler();
+    struct Mark {
+        const char* phase;
+        int64_t timeNs;
+    };
+
+    StartupTimeline() { mMarks.reserve(kMaxMarks); }
+
+    // Record a phase as finished now
+    void mark(const char* phase) { markAt(phase, AudioUtils::getMonotonicNs()); }
+
+    // Record a phase as finished at a given monotonic time
+    void markAt(const char* phase, const int64_t timeNs) {
+        if (mMarks.size() < kMaxMarks) {
+            mMarks.push_back({phase, timeNs});
+        }
     }
-    virtual ~AudioOperation() = default;
-    // Disable copy operations to prevent issues with configuration and audio parameters
-    AudioOperation(const AudioOperation&) = delete;
-    AudioOperation& operator=(const AudioOperation&) = delete;
 
-    virtual int32_t execute() = 0;
+    void append(const StartupTimeline& other) {
+        for (const Mark& m : other.mMarks) {
+            markAt(m.phase, m.timeNs);
+        }
+    }
 
-protected:
-    static constexpr uint32_t kMaxAudioDataSize = 2u * 1024u * 1024u * 1024u; // 2 GiB
-    static constexpr uint32_t kProgressReportInterval = 10;                   // report progress every 10 seconds
-    static constexpr uint32_t kLevelMeterInterval = 25;                       // Update level meter every 30 frames
+    void clear() { mMarks.clear(); }
+    bool empty() const { return mMarks.empty(); }
+    const std::vector<Mark>& getMarks() const { return mMarks; }
 
-    AudioConfig mConfig;
-    AudioParameterManager mAudioParamManager;
-    uint32_t mLevelMeterCounter = 0;  // For level meter updates
-    uint64_t mNextProgressReport = 0; // For progress reporting
+    // Time from the origin phase (nullptr = first mark) to the first frame read or written, -1 if not reached
+    int64_t getTimeToFirstFrameNs(const char* originPhase = nullptr) const {
+        const Mark* origin = originPhase == nullptr ? (mMarks.empty() ? nullptr : &mMarks.front()) : find(originPhase);
+        if (origin == nullptr) {
+            return -1;
+        }
+        for (const Mark& m : mMarks) {
+            if (strcmp(m.phase, "first_read") == 0 || strcmp(m.phase, "first_write") == 0) {
+                return m.timeNs - origin->timeNs;
+            }
+        }
+        return -1;
+    }
 
-    // Calculate required buffer size based on audio configuration
-    size_t calculateBufferSize() const {
-        const size_t bytesPerSample = audio_bytes_per_sample(mConfig.format);
-        return (mConfig.minFrameCount * 2) * mConfig.channelCount * bytesPerSample;
+    // Time spent in a phase, i.e. since the previous mark, -1 if the phase was not recorded
+    int64_t getPhaseDurationNs(const char* phase) const {
+        for (size_t i = 0; i < mMarks.size(); ++i) {
+            if (strcmp(mMarks[i].phase, phase) == 0) {
+                return i > 0 ? mMarks[i].timeNs - mMarks[i - 1].timeNs : 0;
+            }
+        }
+        return -1;
     }
 
-    // Calculate frame count with minimum buffer considerations
-    size_t calculateFrameCount() const {
-        const size_t minFrames = static_cast<size_t>((mConfig.sampleRate * 10) / 1000);
-        const size_t adjustedMinFrameCount = std::max(mConfig.minFrameCount, minFrames);
-        return adjustedMinFrameCount * 2;
+    // Print one row per phase: time since the first mark and time since the previous mark
+    void print(const char* title) const {
+        if (mMarks.empty()) {
+            return;
+        }
+        printf("%s:\n", title);
+        printf("  %-24s %10s %10s\n", "phase", "t(ms)", "delta(ms)");
+        const int64_t originNs = mMarks.front().timeNs;
+        int64_t previousNs = originNs;
+        for (const Mark& m : mMarks) {
+            printf("  %-24s %10.3f %10.3f\n", m.phase, (m.timeNs - originNs) / 1e6, (m.timeNs - previousNs) / 1e6);
+            previousNs = m.timeNs;
+        }
+        const int64_t firstFrameNs = getTimeToFirstFrameNs();
+        if (firstFrameNs >= 0) {
+            printf("  Time to first frame: %.3f ms\n", firstFrameNs / 1e6);
+        }
     }
 
-    // Calculate bytes per second based on audio configuration
-    uint64_t calculateBytesPerSecond() const {
-        const size_t bytesPerSample = audio_bytes_per_sample(mConfig.format);
-        return static_cast<uint64_t>(mConfig.sampleRate) * mConfig.channelCount * bytesPerSample;
+    // Format as a single-line JSON object (JSON Lines report)
+    std::string toJsonLine(const int32_t cycle) const {
+        std::string line = String8::format("{\"version\":\"%s\",\"type\":\"startup\",\"cycle\":%d,"
+                                           "\"time_to_first_frame_ms\":%.3f,\"phases\":[",
+                                           AUDIO_TEST_CLIENT_VERSION, cycle, getTimeToFirstFrameNs() / 1e6)
+                               .c_str();
+        const int64_t originNs = mMarks.empty() ? 0 : mMarks.front().timeNs;
+        int64_t previousNs = originNs;
+        for (size_t i = 0; i < mMarks.size(); ++i) {
+            line += String8::format("%s{\"phase\":\"%s\",\"t_ms\":%.3f,\"delta_ms\":%.3f}", i > 0 ? "," : "",
+                                    mMarks[i].phase, (mMarks[i].timeNs - originNs) / 1e6,
+                                    (mMarks[i].timeNs - previousNs) / 1e6)
+                        .c_str();
+            previousNs = mMarks[i].timeNs;
+        }
+        line += "]}";
+        return line;
     }
 
-    // Validate audio parameters for correctness
-    bool validateAudioParameters() const {
-        if (mConfig.sampleRate <= 0 || mConfig.channelCount <= 0) {
-            printf("Error: Invalid sample rate or channel count\n");
+private:
+    static constexpr size_t kMaxMarks = 32;
+
+    const Mark* find(const char* phase) const {
+        for (const Mark& m : mMarks) {
+            if (strcmp(m.phase, phase) == 0) {
+                return &m;
+            }
+        }
+        return nullptr;
+    }
+
+    std::vector<Mark> mMarks;
+};
+
+/************************** Live Metrics ******************************/
+// Duration statistics of read() or write() calls
+struct LiveTransferStats {
+    uint32_t count;   // calls in the current window
+    uint32_t reserved;
+    int64_t meanNs;   // mean call duration in the current window
+    int64_t maxNs;    // longest call in the current window
+    int64_t peakNs;   // longest call since the run started
+};
+
+// One published state of a run. Plain data only, so it is copied as a whole
+struct LiveMetricsSnapshot {
+    static constexpr int32_t kMaxChannels = 16;
+
+    int32_t pid;
+    int32_t mode;
+    int32_t finished; // 1 once the run has ended
+    int32_t sampleRate;
+    int32_t channelCount;
+    int32_t format;
+    int64_t updateTimeNs; // CLOCK_MONOTONIC time of this snapshot
+    uint64_t publishCount;
+    uint64_t bytesCaptured;
+    uint64_t bytesRendered;
+    uint32_t overrunFrames;
+    uint32_t underrunCount;
+    float peakDb[kMaxChannels]; // per-channel peak of the current window, -60dB floor
+    LiveTransferStats read;
+    LiveTransferStats write;
+};
+
+// Shared page layout. The writer makes sequence odd, copies the snapshot and makes it even again; readers
+// retry until they see the same even sequence before and after their copy, so the writer never waits.
+struct LiveMetricsPage {
+    static constexpr uint32_t kMagic = 0x4d435441; // "ATCM"
+    static constexpr uint32_t kVersion = 1;
+    static constexpr size_t kSize = 4096;
+    static constexpr int32_t kMaxReadAttempts = 64;
+
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint32_t> sequence;
+    uint32_t reserved;
+    LiveMetricsSnapshot snapshot;
+
+    // Single writer only
+    void store(const LiveMetricsSnapshot& value) {
+        const uint32_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(&snapshot, &value, sizeof(value));
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    // Returns false when every attempt overlapped a write
+    bool load(LiveMetricsSnapshot& value) const {
+        for (int32_t attempt = 0; attempt < kMaxReadAttempts; ++attempt) {
+            const uint32_t before = sequence.load(std::memory_order_acquire);
+            if ((before & 1u) != 0) {
+                continue;
+            }
+            memcpy(&value, &snapshot, sizeof(value));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == before) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+static_assert(sizeof(LiveMetricsPage) <= LiveMetricsPage::kSize, "metrics page must fit one page");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "sequence is shared between processes");
+
+// Publishes run metrics to a memory-mapped file at a fixed rate for -m202 readers and dashboards.
+// Called from the audio loop: accounting and publishing are plain memory writes without locks or syscalls.
+class LiveMetricsPublisher {
+public:
+    LiveMetricsPublisher() = default;
+    ~LiveMetricsPublisher() { close(); }
+
+    LiveMetricsPublisher(const LiveMetricsPublisher&) = delete;
+    LiveMetricsPublisher& operator=(const LiveMetricsPublisher&) = delete;
+
+    bool open(const std::string& path,
+              const int32_t mode,
+              const int32_t sampleRate,
+              const int32_t channelCount,
+              const audio_format_t format,
+              const int32_t intervalMs) {
+        close();
+        // No O_TRUNC: a reader may still map the file, and shrinking it would fault the reader
+        const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            printf("Error: Can't create metrics file %s: %s\n", path.c_str(), strerror(errno));
             return false;
         }
-        if (mConfig.format == AUDIO_FORMAT_INVALID) {
-            printf("Error: Invalid audio format\n");
+        void* addr = MAP_FAILED;
+        if (ftruncate(fd, LiveMetricsPage::kSize) == 0) {
+            addr = mmap(nullptr, LiveMetricsPage::kSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            printf("Error: Can't map metrics file %s: %s\n", path.c_str(), strerror(errno));
             return false;
         }
+
+        mPage = static_cast<LiveMetricsPage*>(addr);
+        mFormat = format;
+        mIntervalNs = static_cast<int64_t>(std::max(intervalMs, 1)) * 1000000LL;
+        mSnapshot = LiveMetricsSnapshot{};
+        mSnapshot.pid = getpid();
+        mSnapshot.mode = mode;
+        mSnapshot.sampleRate = sampleRate;
+        mSnapshot.channelCount = std::clamp(channelCount, 0, LiveMetricsSnapshot::kMaxChannels);
+        mSnapshot.format = format;
+        resetWindow();
+        mPage->magic = LiveMetricsPage::kMagic;
+        mPage->version = LiveMetricsPage::kVersion;
+        publish(AudioUtils::getMonotonicNs(), 0, 0);
+        printf("Publishing live metrics to %s every %d ms\n", path.c_str(), std::max(intervalMs, 1));
         return true;
     }
 
-    // Create attribution source for audio operations
-    AttributionSourceState createAttributionSource() {
-        AttributionSourceState attributionSource;
-        attributionSource.packageName = std::string("Audio Test Client");
-        attributionSource.token = sp<BBinder>::make();
-        attributionSource.uid = getuid();
-        attributionSource.pid = getpid();
-        return attributionSource;
+    bool isOpen() const { return mPage != nullptr; }
+    bool isDue(const int64_t nowNs) const { return nowNs >= mNextPublishNs; }
+
+    // Account one read (capture) or write call that took durationNs and moved bytes of audio
+    void addTransfer(const bool capture, const int64_t durationNs, const char* buffer, const size_t bytes) {
+        LiveTransferStats& stats = capture ? mSnapshot.read : mSnapshot.write;
+        ++stats.count;
+        mWindowTotalNs[capture ? 0 : 1] += durationNs;
+        stats.maxNs = std::max(stats.maxNs, durationNs);
+        stats.peakNs = std::max(stats.peakNs, durationNs);
+        (capture ? mSnapshot.bytesCaptured : mSnapshot.bytesRendered) += bytes;
+        AudioUtils::accumulateChannelPeaks(buffer, bytes, mFormat, mSnapshot.channelCount, mWindowPeaks);
     }
 
-    // Initialize AudioRecord with audio configuration
-    bool initializeAudioRecord(sp<AudioRecord>& audioRecord) {
-        audio_channel_mask_t channelMask = audio_channel_in_mask_from_count(mConfig.channelCount);
-        if (AudioRecord::getMinFrameCount(&mConfig.minFrameCount, mConfig.sampleRate, mConfig.format, channelMask) !=
-            NO_ERROR) {
-            printf("Warning: Cannot get min frame count, using default value\n");
+    // Store a snapshot of the current window and start the next one
+    void publish(const int64_t nowNs,
+                 const uint32_t overrunFrames,
+                 const uint32_t underrunCount,
+                 const bool finished = false) {
+        constexpr float DB_FLOOR = -60.0f;
+        for (int32_t ch = 0; ch < mSnapshot.channelCount; ++ch) {
+            mSnapshot.peakDb[ch] =
+                mWindowPeaks[ch] > 0.0f ? std::max(20.0f * std::log10(mWindowPeaks[ch]), DB_FLOOR) : DB_FLOOR;
         }
-        const size_t frameCount = calculateFrameCount();
+        mSnapshot.read.meanNs = mSnapshot.read.count > 0 ? mWindowTotalNs[0] / mSnapshot.read.count : 0;
+        mSnapshot.write.meanNs = mSnapshot.write.count > 0 ? mWindowTotalNs[1] / mSnapshot.write.count : 0;
+        mSnapshot.overrunFrames = overrunFrames;
+        mSnapshot.underrunCount = underrunCount;
+        mSnapshot.finished = finished ? 1 : 0;
+        mSnapshot.updateTimeNs = nowNs;
+        ++mSnapshot.publishCount;
+        mPage->store(mSnapshot);
+        resetWindow();
+        mNextPublishNs = nowNs + mIntervalNs;
+    }
 
-        printf("Initialize AudioRecord: source=%d, sampleRate=%d, channelCount=%d, format=%d, channelMask=0x%x, "
-               "frameCount=%zu\n",
-               mConfig.inputSource, mConfig.sampleRate, mConfig.channelCount, mConfig.format, channelMask, frameCount);
-        ALOGI("Initialize AudioRecord: source=%d, sampleRate=%d, channelCount=%d, format=%d, channelMask=0x%x, "
-              "frameCount=%zu",
-              mConfig.inputSource, mConfig.sampleRate, mConfig.channelCount, mConfig.format, channelMask, frameCount);
+    void close() {
+        if (mPage != nullptr) {
+            munmap(mPage, LiveMetricsPage::kSize);
+            mPage = nullptr;
+        }
+    }
 
-        AttributionSourceState attributionSource = createAttributionSource();
-        audio_attributes_t attributes{};
-        attributes.source = mConfig.inputSource;
-        audioRecord = sp<AudioRecord>::make(attributionSource);
-        if (audioRecord->set(mConfig.inputSource, // input source
-                             mConfig.sampleRate,  // sample rate
-                             mConfig.format,      // audio format
-                             channelMask,         // channel mask
-                             frameCount,          // frame count
-                             nullptr,             // callback/IAudioRecordCallback. use TRANSFER_CALLBACK
-#ifndef ANDROID_API_14_PLUS
-                             nullptr, // user mCallbackData
-#endif
-                             0,                          // notificationFrames
-                             false,                      // threadCanCallJava
-                             AUDIO_SESSION_ALLOCATE,     // sessionId
-                             AudioRecord::TRANSFER_SYNC, // transferType
-                             mConfig.inputFlag,          // inputFlag
-                             getuid(),                   // uid
-                             getpid(),                   // pid
-                             &attributes,                // audioAttributes
-                             AUDIO_PORT_HANDLE_NONE      // selectedDeviceId
-                             ) != NO_ERROR) {
-            printf("Error: Failed to initialize AudioRecord parameters\n");
-            ALOGE("Failed to initialize AudioRecord parameters");
+private:
+    void resetWindow() {
+        mSnapshot.read.count = 0;
+        mSnapshot.read.maxNs = 0;
+        mSnapshot.write.count = 0;
+        mSnapshot.write.maxNs = 0;
+        mWindowTotalNs[0] = 0;
+        mWindowTotalNs[1] = 0;
+        std::fill(std::begin(mWindowPeaks), std::end(mWindowPeaks), 0.0f);
+    }
+
+    LiveMetricsPage* mPage = nullptr;
+    LiveMetricsSnapshot mSnapshot{};
+    audio_format_t mFormat = AUDIO_FORMAT_PCM_16_BIT;
+    int64_t mIntervalNs = 0;
+    int64_t mNextPublishNs = 0;
+    int64_t mWindowTotalNs[2] = {0, 0}; // read, write
+    float mWindowPeaks[LiveMetricsSnapshot::kMaxChannels] = {};
+};
+
+/************************** Resource Usage ******************************/
+// CPU time, context switches and page faults of a thread or process
+struct ResourceUsage {
+    int64_t userUs = 0;
+    int64_t systemUs = 0;
+    int64_t voluntarySwitches = 0;   // the thread blocked; each one is a wakeup when it runs again
+    int64_t involuntarySwitches = 0; // the thread was preempted
+    int64_t minorFaults = 0;
+    int64_t majorFaults = 0;
+
+    int64_t cpuUs() const { return userUs + systemUs; }
+
+    ResourceUsage operator-(const ResourceUsage& other) const {
+        ResourceUsage delta;
+        delta.userUs = userUs - other.userUs;
+        delta.systemUs = systemUs - other.systemUs;
+        delta.voluntarySwitches = voluntarySwitches - other.voluntarySwitches;
+        delta.involuntarySwitches = involuntarySwitches - other.involuntarySwitches;
+        delta.minorFaults = minorFaults - other.minorFaults;
+        delta.majorFaults = majorFaults - other.majorFaults;
+        return delta;
+    }
+
+    // Usage of the calling thread (RUSAGE_THREAD) or the whole process (RUSAGE_SELF)
+    static bool sample(const int who, ResourceUsage& usage) {
+        struct rusage ru {};
+        if (getrusage(who, &ru) != 0) {
             return false;
         }
+        usage.userUs = static_cast<int64_t>(ru.ru_utime.tv_sec) * 1000000 + ru.ru_utime.tv_usec;
+        usage.systemUs = static_cast<int64_t>(ru.ru_stime.tv_sec) * 1000000 + ru.ru_stime.tv_usec;
+        usage.voluntarySwitches = ru.ru_nvcsw;
+        usage.involuntarySwitches = ru.ru_nivcsw;
+        usage.minorFaults = ru.ru_minflt;
+        usage.majorFaults = ru.ru_majflt;
+        return true;
+    }
 
-        if (audioRecord->initCheck() != NO_ERROR) {
-            printf("Error: AudioRecord initialization check failed\n");
-            ALOGE("AudioRecord initialization check failed");
+    // Usage of another process from /proc/<pid>/stat and /proc/<pid>/status, e.g. the audio server
+    static bool samplePid(const pid_t pid, ResourceUsage& usage) {
+        std::ifstream stat(String8::format("/proc/%d/stat", pid).c_str());
+        std::string line;
+        if (!std::getline(stat, line)) {
+            return false;
+        }
+        // Fields after the parenthesized command name, which may contain spaces: state is field 3
+        const size_t commEnd = line.rfind(')');
+        if (commEnd == std::string::npos) {
             return false;
         }
+        std::vector<std::string> fields;
+        std::istringstream tokens(line.substr(commEnd + 1));
+        for (std::string field; tokens >> field;) {
+            fields.push_back(field);
+        }
+        if (fields.size() < 13) {
+            return false;
+        }
+        const int64_t usPerTick = 1000000 / std::max<long>(sysconf(_SC_CLK_TCK), 1);
+        usage.minorFaults = atoll(fields[10 - 3].c_str());
+        usage.majorFaults = atoll(fields[12 - 3].c_str());
+        usage.userUs = atoll(fields[14 - 3].c_str()) * usPerTick;
+        usage.systemUs = atoll(fields[15 - 3].c_str()) * usPerTick;
+
+        // Context switches are summed over the process threads in the status file
+        std::ifstream status(String8::format("/proc/%d/status", pid).c_str());
+        while (std::getline(status, line)) {
+            if (line.compare(0, 24, "voluntary_ctxt_switches:") == 0) {
+                usage.voluntarySwitches = atoll(line.c_str() + 24);
+            } else if (line.compare(0, 27, "nonvoluntary_ctxt_switches:") == 0) {
+                usage.involuntarySwitches = atoll(line.c_str() + 27);
+            }
+        }
+        return true;
+    }
 
-        printf("AudioRecord initialized successfully\n");
+    // First process whose command name is name, -1 if none is running
+    static pid_t findProcess(const std::string& name) {
+        DIR* proc = opendir("/proc");
+        if (proc == nullptr) {
+            return -1;
+        }
+        pid_t found = -1;
+        while (const struct dirent* entry = readdir(proc)) {
+            if (!isdigit(static_cast<unsigned char>(entry->d_name[0]))) {
+                continue;
+            }
+            std::ifstream comm(String8::format("/proc/%s/comm", entry->d_name).c_str());
+            std::string command;
+            if (std::getline(comm, command) && command == name) {
+                found = static_cast<pid_t>(atoi(entry->d_name));
+                break;
+            }
+        }
+        closedir(proc);
+        return found;
+    }
+};
+
+// Accounts the CPU cost of one run as the difference between its start and its end: every loop thread from its
+// own rusage, the whole client process (including the logger and binder threads), and optionally a server
+// process. Threads register themselves, so begin/endThread must be called on the accounted thread.
+class ResourceMeter {
+public:
+    ResourceMeter() = default;
+
+    // Disable copy operations, threads refer to their scope by index
+    ResourceMeter(const ResourceMeter&) = delete;
+    ResourceMeter& operator=(const ResourceMeter&) = delete;
+
+    bool isStarted() const { return mStarted; }
+
+    // Take the process baselines, serverPid < 0 = no server
+    void start(const pid_t serverPid, const std::string& serverName) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mThreads.clear();
+        mServerPid = serverPid;
+        mServerName = serverName;
+        mStartNs = AudioUtils::getMonotonicNs();
+        ResourceUsage::sample(RUSAGE_SELF, mProcess.start);
+        mHasServer = mServerPid >= 0 && ResourceUsage::samplePid(mServerPid, mServer.start);
+        mStarted = true;
+    }
+
+    // Start accounting the calling thread, returns its index for endThread()
+    size_t beginThread(const std::string& name) {
+        Scope scope;
+        scope.name = name;
+        ResourceUsage::sample(RUSAGE_THREAD, scope.start);
+        std::lock_guard<std::mutex> lock(mMutex);
+        mThreads.push_back(scope);
+        return mThreads.size() - 1;
+    }
+
+    // Stop accounting the calling thread; transferCalls are its stream read/write calls
+    void endThread(const size_t index, const uint64_t transferCalls) {
+        ResourceUsage end;
+        ResourceUsage::sample(RUSAGE_THREAD, end);
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (index < mThreads.size()) {
+            mThreads[index].usage = end - mThreads[index].start;
+            mThreads[index].calls = transferCalls;
+        }
+    }
+
+    // Take the process end samples, after every thread ended
+    void stop() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mStarted) {
+            return;
+        }
+        mWallNs = AudioUtils::getMonotonicNs() - mStartNs;
+        ResourceUsage end;
+        ResourceUsage::sample(RUSAGE_SELF, end);
+        mProcess.usage = end - mProcess.start;
+        if (mHasServer) {
+            mHasServer = ResourceUsage::samplePid(mServerPid, end);
+            mServer.usage = end - mServer.start;
+        }
+    }
+
+    // CPU% and wakeups are normalized to the seconds of audio streamed, so runs of different length compare
+    void print(const double audioSeconds) const {
+        const double seconds = std::max(audioSeconds, 1e-9);
+        printf("\nCPU usage: %.2f s of audio in %.2f s\n", audioSeconds, mWallNs / 1e9);
+        printf("  %-16s %9s %9s %7s %10s %10s %8s %7s %8s\n", "Scope", "User(ms)", "Sys(ms)", "CPU%", "Wakeups/s",
+               "Preempt/s", "MinFlt", "MajFlt", "Calls/s");
+        for (const Scope& scope : mThreads) {
+            printScope(scope, seconds, true);
+        }
+        printScope(Scope{"process", {}, mProcess.usage, 0}, seconds, false);
+        if (mHasServer) {
+            printScope(Scope{mServerName + String8::format(" (%d)", mServerPid).c_str(), {}, mServer.usage, 0},
+                       seconds, false);
+        }
+        printf("CPU%% is CPU time per second of audio; Wakeups/s counts voluntary context switches\n");
+    }
+
+    // One JSON line with every scope
+    std::string toJsonLine(const int32_t mode, const double audioSeconds) const {
+        std::string line = String8::format("{\"type\":\"cpu_usage\",\"mode\":%d,\"audio_seconds\":%.3f,"
+                                           "\"wall_seconds\":%.3f,\"scopes\":[",
+                                           mode, audioSeconds, mWallNs / 1e9)
+                               .c_str();
+        std::vector<Scope> scopes = mThreads;
+        scopes.push_back(Scope{"process", {}, mProcess.usage, 0});
+        if (mHasServer) {
+            scopes.push_back(Scope{mServerName, {}, mServer.usage, 0});
+        }
+        const double seconds = std::max(audioSeconds, 1e-9);
+        for (size_t i = 0; i < scopes.size(); ++i) {
+            const ResourceUsage& u = scopes[i].usage;
+            line += String8::format("%s{\"scope\":\"%s\",\"user_ms\":%.3f,\"system_ms\":%.3f,\"cpu_percent\":%.3f,"
+                                    "\"voluntary_switches\":%" PRId64 ",\"involuntary_switches\":%" PRId64
+                                    ",\"minor_faults\":%" PRId64 ",\"major_faults\":%" PRId64 ",\"calls\":%" PRIu64
+                                    ",\"wakeups_per_second\":%.3f}",
+                                    i > 0 ? "," : "", scopes[i].name.c_str(), u.userUs / 1e3, u.systemUs / 1e3,
+                                    u.cpuUs() / 1e4 / seconds, u.voluntarySwitches, u.involuntarySwitches,
+                                    u.minorFaults, u.majorFaults, scopes[i].calls, u.voluntarySwitches / seconds)
+                        .c_str();
+        }
+        return line + "]}";
+    }
+
+private:
+    struct Scope {
+        std::string name;
+        ResourceUsage start;
+        ResourceUsage usage;
+        uint64_t calls = 0;
+    };
+
+    static void printScope(const Scope& scope, const double seconds, const bool withCalls) {
+        const ResourceUsage& u = scope.usage;
+        const String8 calls = withCalls ? String8::format("%.1f", scope.calls / seconds) : String8("-");
+        printf("  %-16s %9.1f %9.1f %7.2f %10.1f %10.1f %8" PRId64 " %7" PRId64 " %8s\n", scope.name.c_str(),
+               u.userUs / 1e3, u.systemUs / 1e3, u.cpuUs() / 1e4 / seconds, u.voluntarySwitches / seconds,
+               u.involuntarySwitches / seconds, u.minorFaults, u.majorFaults, calls.c_str());
+    }
+
+    std::mutex mMutex;
+    std::vector<Scope> mThreads;
+    Scope mProcess;
+    Scope mServer;
+    pid_t mServerPid = -1;
+    std::string mServerName;
+    bool mHasServer = false;
+    bool mStarted = false;
+    int64_t mStartNs = 0;
+    int64_t mWallNs = 0;
+};
+
+/************************** Timestamp Sidecar ******************************/
+// Per-read timing index written next to a recording as "<wav>.ts": one header, then one fixed-size record per
+// read. Records are collected in a small batch and appended with a single write(), so the capture loop does no
+// formatting and no per-read syscall. The -m204 dumper reconstructs gaps, jitter and capture latency from it.
+struct TimestampSidecarHeader {
+    static constexpr uint32_t kMagic = 0x54435441; // "ATCT"
+    static constexpr uint16_t kVersion = 1;
+
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    int32_t sampleRate;
+    uint16_t channelCount;
+    uint16_t frameSize;
+    int64_t startRealtimeNs;  // CLOCK_REALTIME taken together with startMonotonicNs, maps records to wall time
+    int64_t startMonotonicNs; // CLOCK_MONOTONIC
+};
+
+struct TimestampSidecarRecord {
+    static constexpr uint32_t kFlagTimestampValid = 1u; // streamPosition/streamTimeNs are set
+
+    uint64_t framePosition; // WAV frame offset of the first frame of this read
+    uint32_t bytes;
+    uint32_t flags;
+    int64_t returnNs;       // CLOCK_MONOTONIC when read() returned
+    int64_t streamPosition; // stream timestamp: frames captured by the device at streamTimeNs
+    int64_t streamTimeNs;   // CLOCK_MONOTONIC
+};
+
+static_assert(sizeof(TimestampSidecarHeader) == 32, "sidecar header layout changed");
+static_assert(sizeof(TimestampSidecarRecord) == 40, "sidecar record layout changed");
+
+class TimestampSidecarWriter {
+public:
+    TimestampSidecarWriter() = default;
+    ~TimestampSidecarWriter() { close(); }
+
+    TimestampSidecarWriter(const TimestampSidecarWriter&) = delete;
+    TimestampSidecarWriter& operator=(const TimestampSidecarWriter&) = delete;
+
+    bool open(const std::string& path, const int32_t sampleRate, const int32_t channelCount, const size_t frameSize) {
+        close();
+        mFd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (mFd < 0) {
+            printf("Error: Can't create timestamp file %s: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+        TimestampSidecarHeader header{};
+        header.magic = TimestampSidecarHeader::kMagic;
+        header.version = TimestampSidecarHeader::kVersion;
+        header.recordSize = sizeof(TimestampSidecarRecord);
+        header.sampleRate = sampleRate;
+        header.channelCount = static_cast<uint16_t>(channelCount);
+        header.frameSize = static_cast<uint16_t>(frameSize);
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        header.startMonotonicNs = AudioUtils::getMonotonicNs();
+        header.startRealtimeNs = static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+        if (::write(mFd, &header, sizeof(header)) != static_cast<ssize_t>(sizeof(header))) {
+            printf("Error: Can't write timestamp file %s: %s\n", path.c_str(), strerror(errno));
+            close();
+            return false;
+        }
+        mPath = path;
+        mCount = 0;
+        mWritten = 0;
+        printf("Writing read timestamps to %s\n", path.c_str());
         return true;
     }
 
-    // Initialize AudioTrack with audio configuration
-    bool initializeAudioTrack(sp<AudioTrack>& audioTrack) {
-        audio_channel_mask_t channelMask = audio_channel_out_mask_from_count(mConfig.channelCount);
+    bool isOpen() const { return mFd >= 0; }
 
-        // Get minimum frame count using AudioTrack static method with streamType
-        // Since we use audio_attributes_t, we need to convert usage to streamType
-        audio_stream_type_t streamType = AudioUtils::usageToStreamType(mConfig.usage);
-        if (AudioTrack::getMinFrameCount(&mConfig.minFrameCount, streamType, mConfig.sampleRate) != NO_ERROR) {
-            printf("Warning: Cannot get min frame count using streamType, using default value\n");
+    void add(const TimestampSidecarRecord& record) {
+        mBatch[mCount++] = record;
+        if (mCount == kBatchRecords) {
+            flush();
         }
-        const size_t frameCount = calculateFrameCount();
+    }
 
-        printf("Initialize AudioTrack: usage=%d, sampleRate=%d, channelCount=%d, format=%d, channelMask=0x%x, "
-               "frameCount=%zu\n",
-               mConfig.usage, mConfig.sampleRate, mConfig.channelCount, mConfig.format, channelMask, frameCount);
-        ALOGI("Initialize AudioTrack: usage=%d, sampleRate=%d, channelCount=%d, format=%d, channelMask=0x%x, "
-              "frameCount=%zu",
-              mConfig.usage, mConfig.sampleRate, mConfig.channelCount, mConfig.format, channelMask, frameCount);
+    void close() {
+        if (mFd < 0) {
+            return;
+        }
+        flush();
+        ::close(mFd);
+        mFd = -1;
+        printf("Timestamps saved: %s (%" PRIu64 " reads)\n", mPath.c_str(), mWritten);
+    }
 
-        AttributionSourceState attributionSource = createAttributionSource();
-        audio_attributes_t attributes{};
-        attributes.usage = mConfig.usage;
-        attributes.content_type = AudioUtils::usageToContentType(mConfig.usage);
-        audioTrack = sp<AudioTrack>::make(attributionSource);
-        if (audioTrack->set(AUDIO_STREAM_DEFAULT, // streamType
-                            mConfig.sampleRate,   // sampleRate
-                            mConfig.format,       // audioFormat
-                            channelMask,          // channelMask
-                            frameCount,           // frameCount
-                            mConfig.outputFlag,   // outputFlag
-                            nullptr,              // callback/IAudioTrackCallback. use TRANSFER_CALLBACK
-#ifndef ANDROID_API_14_PLUS
-                            nullptr, // userCallbackData
-#endif
-                            0,                         // notificationFrames
-                            nullptr,                   // sharedBuffer, use TRANSFER_SHARED
-                            false,                     // threadCanCallJava
-                            AUDIO_SESSION_ALLOCATE,    // sessionId
-                            AudioTrack::TRANSFER_SYNC, // transferType
-                            nullptr,                   // offloadInfo
-                            attributionSource,         // attributionSource
-                            &attributes,               // pAttributes
-                            false,                     // doNotReconnect
-                            1.0f,                      // maxRequiredSpeed
-                            AUDIO_PORT_HANDLE_NONE     // selectedDeviceId
-                            ) != NO_ERROR) {
-            printf("Error: Failed to initialize AudioTrack parameters\n");
-            ALOGE("Failed to initialize AudioTrack parameters");
+private:
+    static constexpr size_t kBatchRecords = 128; // 5 KiB, a few seconds of reads
+
+    // A failed write closes the file; the recording itself goes on
+    void flush() {
+        if (mCount == 0) {
+            return;
+        }
+        const ssize_t bytes = static_cast<ssize_t>(mCount * sizeof(TimestampSidecarRecord));
+        if (::write(mFd, mBatch, static_cast<size_t>(bytes)) != bytes) {
+            sLogger.error("Can't write timestamp file %s, index stops here\n", mPath.c_str());
+            ::close(mFd);
+            mFd = -1;
+        } else {
+            mWritten += mCount;
+        }
+        mCount = 0;
+    }
+
+    int mFd = -1;
+    std::string mPath;
+    TimestampSidecarRecord mBatch[kBatchRecords];
+    size_t mCount = 0;
+    uint64_t mWritten = 0;
+};
+
+/************************** Spectrum Monitor ******************************/
+// Single-producer single-consumer handoff of the newest value through three slots. The writer fills its back
+// slot and swaps it with the middle one; the reader swaps its front slot with the middle one when that holds a
+// newer value. Neither side ever waits, values the reader was too slow to take are replaced.
+template <typename Slot> class TripleBuffer {
+public:
+    TripleBuffer() = default;
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    Slot& slot(const uint32_t index) { return mSlots[index]; }
+
+    // Writer side
+    Slot& back() { return mSlots[mBack]; }
+
+    // Publish the back slot, returns true when it replaced a value the reader never took
+    bool publish() {
+        const uint32_t old = mMiddle.exchange(mBack | kFresh, std::memory_order_acq_rel);
+        mBack = old & kIndexMask;
+        return (old & kFresh) != 0;
+    }
+
+    // Reader side
+    const Slot& front() const { return mSlots[mFront]; }
+
+    // Take the newest published slot as front, false when nothing was published since the last take
+    bool take() {
+        if ((mMiddle.load(std::memory_order_relaxed) & kFresh) == 0) {
             return false;
         }
+        mFront = mMiddle.exchange(mFront, std::memory_order_acq_rel) & kIndexMask;
+        return true;
+    }
 
-        if (audioTrack->initCheck() != NO_ERROR) {
-            printf("Error: AudioTrack initialization check failed\n");
-            ALOGE("AudioTrack initialization check failed");
+private:
+    static constexpr uint32_t kIndexMask = 3u;
+    static constexpr uint32_t kFresh = 4u;
+
+    Slot mSlots[3];
+    std::atomic<uint32_t> mMiddle{1};
+    uint32_t mBack = 0;  // writer only
+    uint32_t mFront = 2; // reader only
+};
+
+// Binary spectrum file: this header, the band center frequencies (float[bandCount]), then one record per
+// analysis: SpectrumFileRecord followed by float[channels * (2 * peakCount + bandCount)], per channel the
+// peaks as (Hz, dBFS) pairs, strongest first (0 Hz, -200 dBFS when fewer were found), then the band levels.
+struct SpectrumFileHeader {
+    static constexpr uint32_t kMagic = 0x53435441; // "ATCS"
+    static constexpr uint16_t kVersion = 1;
+
+    uint32_t magic;
+    uint16_t version;
+    uint16_t channels;     // analyzed channels, in --spectrum-channels order
+    int32_t sampleRate;
+    uint32_t fftSize;
+    uint16_t peakCount;
+    uint16_t bandCount;
+    uint32_t ratePerMille; // analyses per second x 1000
+};
+
+struct SpectrumFileRecord {
+    int64_t timeNs;         // CLOCK_MONOTONIC when the capture loop completed the analyzed window
+    uint64_t framePosition; // capture frame offset of the first analyzed frame
+};
+
+static_assert(sizeof(SpectrumFileHeader) == 24, "spectrum header layout changed");
+static_assert(sizeof(SpectrumFileRecord) == 16, "spectrum record layout changed");
+
+// Spectrum of selected capture channels computed on a side thread. The capture loop only copies each buffer
+// into a window-sized slot of a triple buffer, so it never waits for the analyzer and does no math. The analyzer
+// wakes at a fixed rate, takes the newest complete window, applies a Hann window and an FFT per channel, and
+// emits the strongest peaks and octave band levels to the console or a binary file. Its cost depends on the
+// rate, FFT size and channel count only, not on the sample rate; windows captured between two wakeups are
+// skipped rather than queued.
+class SpectrumMonitor {
+public:
+    static constexpr int32_t kPeakCount = 3;
+    static constexpr uint32_t kMinFftSize = 256;
+    static constexpr uint32_t kMaxFftSize = 65536;
+
+    SpectrumMonitor() = default;
+    ~SpectrumMonitor() { stop(); }
+
+    SpectrumMonitor(const SpectrumMonitor&) = delete;
+    SpectrumMonitor& operator=(const SpectrumMonitor&) = delete;
+
+    bool start(const int32_t sampleRate,
+               const int32_t channelCount,
+               const audio_format_t format,
+               const std::vector<int32_t>& channels,
+               const uint32_t fftSize,
+               const float rate,
+               const std::string& outPath) {
+        stop();
+        if (fftSize < kMinFftSize || fftSize > kMaxFftSize || (fftSize & (fftSize - 1)) != 0) {
+            printf("Error: Spectrum FFT size must be a power of two in %u..%u\n", kMinFftSize, kMaxFftSize);
+            return false;
+        }
+        if (!dispatchFormat(format, [](auto) {})) {
+            printf("Error: Unsupported spectrum format: %d\n", static_cast<int>(format));
+            return false;
+        }
+        mChannels = channels;
+        if (mChannels.empty()) {
+            for (int32_t ch = 0; ch < channelCount; ++ch) {
+                mChannels.push_back(ch);
+            }
+        }
+        for (const int32_t ch : mChannels) {
+            if (ch < 0 || ch >= channelCount) {
+                printf("Error: Spectrum channel %d out of range (0..%d)\n", ch, channelCount - 1);
+                return false;
+            }
+        }
+        mSampleRate = sampleRate;
+        mChannelCount = channelCount;
+        mFormat = format;
+        mFftSize = fftSize;
+        mRate = std::clamp(rate, 0.1f, 100.0f);
+        mFrameSize = audio_bytes_per_sample(format) * channelCount;
+        for (uint32_t i = 0; i < 3; ++i) {
+            mSnapshots.slot(i).data.assign(static_cast<size_t>(fftSize) * mFrameSize, 0);
+        }
+        setupTables();
+        if (!outPath.empty() && !openFile(outPath)) {
+            return false;
+        }
+
+        mFill = 0;
+        mFramePosition = 0;
+        mDropped = 0;
+        mAnalyses = 0;
+        mIdleTicks = 0;
+        mStopRequested.store(false);
+        mThread = std::thread(&SpectrumMonitor::analyzerLoop, this);
+        printf("Spectrum monitor: %zu channel(s), %u point FFT (%.1f Hz bins), %.1f per second%s%s\n",
+               mChannels.size(), mFftSize, static_cast<float>(mSampleRate) / mFftSize, mRate,
+               mFd >= 0 ? ", saving to " : "", mFd >= 0 ? outPath.c_str() : "");
+        if (mFd < 0) {
+            std::string centers;
+            for (const Band& band : mBands) {
+                centers += String8::format(" %g", band.centerHz).c_str();
+            }
+            printf("Spectrum band centers (Hz):%s\n", centers.c_str());
+        }
+        return true;
+    }
+
+    bool isRunning() const { return mThread.joinable(); }
+
+    // Capture loop: copy a buffer into the current window, publishing each full window. No locks, no syscalls.
+    void feed(const char* buffer, size_t bytes) {
+        while (bytes > 0) {
+            Snapshot& snapshot = mSnapshots.back();
+            const size_t copy = std::min(bytes, snapshot.data.size() - mFill);
+            memcpy(snapshot.data.data() + mFill, buffer, copy);
+            mFill += copy;
+            buffer += copy;
+            bytes -= copy;
+            if (mFill == snapshot.data.size()) {
+                snapshot.framePosition = mFramePosition;
+                snapshot.timeNs = AudioUtils::getMonotonicNs();
+                mFramePosition += mFftSize;
+                mDropped += mSnapshots.publish() ? 1 : 0;
+                mFill = 0;
+            }
+        }
+    }
+
+    // Join the analyzer and print what it did
+    void stop() {
+        if (!mThread.joinable()) {
+            return;
+        }
+        mStopRequested.store(true);
+        mThread.join();
+        if (mFd >= 0) {
+            ::close(mFd);
+            mFd = -1;
+        }
+        sLogger.flush();
+        printf("Spectrum monitor: %" PRIu64 " analyses, %" PRIu64 " windows skipped, %" PRIu64
+               " idle wakeups, analyzer CPU %.1f ms (%.2f%% of one core)\n",
+               mAnalyses, mDropped, mIdleTicks, mAnalyzerCpuUs / 1000.0,
+               mAnalyzerWallUs > 0 ? 100.0 * mAnalyzerCpuUs / mAnalyzerWallUs : 0.0);
+    }
+
+private:
+    static constexpr float kDbFloor = -200.0f;
+
+    struct Snapshot {
+        std::vector<char> data; // fftSize interleaved frames in the capture format
+        uint64_t framePosition = 0;
+        int64_t timeNs = 0;
+    };
+
+    struct Band {
+        float centerHz;
+        uint32_t firstBin;
+        uint32_t lastBin; // inclusive
+    };
+
+    bool openFile(const std::string& path) {
+        mFd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (mFd < 0) {
+            printf("Error: Can't create spectrum file %s: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+        SpectrumFileHeader header{};
+        header.magic = SpectrumFileHeader::kMagic;
+        header.version = SpectrumFileHeader::kVersion;
+        header.channels = static_cast<uint16_t>(mChannels.size());
+        header.sampleRate = mSampleRate;
+        header.fftSize = mFftSize;
+        header.peakCount = kPeakCount;
+        header.bandCount = static_cast<uint16_t>(mBands.size());
+        header.ratePerMille = static_cast<uint32_t>(mRate * 1000.0f);
+        std::vector<float> centers;
+        for (const Band& band : mBands) {
+            centers.push_back(band.centerHz);
+        }
+        const ssize_t centerBytes = static_cast<ssize_t>(centers.size() * sizeof(float));
+        if (::write(mFd, &header, sizeof(header)) != static_cast<ssize_t>(sizeof(header)) ||
+            ::write(mFd, centers.data(), static_cast<size_t>(centerBytes)) != centerBytes) {
+            printf("Error: Can't write spectrum file %s: %s\n", path.c_str(), strerror(errno));
+            ::close(mFd);
+            mFd = -1;
             return false;
         }
+        return true;
+    }
+
+    // Hann window, twiddle factors, bit reversal permutation and the octave bands below Nyquist
+    void setupTables() {
+        const double twoPi = 2.0 * M_PI;
+        mWindow.resize(mFftSize);
+        double windowSum = 0.0;
+        double windowSquareSum = 0.0;
+        for (uint32_t i = 0; i < mFftSize; ++i) {
+            mWindow[i] = static_cast<float>(0.5 - 0.5 * std::cos(twoPi * i / mFftSize));
+            windowSum += mWindow[i];
+            windowSquareSum += static_cast<double>(mWindow[i]) * mWindow[i];
+        }
+        // A full-scale sine reads 0 dBFS as a peak and as the level of the band containing it
+        mPeakScale = 4.0 / (windowSum * windowSum);
+        mBandScale = 4.0 / (static_cast<double>(mFftSize) * windowSquareSum);
+
+        mTwiddles.resize(mFftSize / 2);
+        for (uint32_t i = 0; i < mFftSize / 2; ++i) {
+            mTwiddles[i] = std::polar(1.0f, static_cast<float>(-twoPi * i / mFftSize));
+        }
+        mBitReverse.resize(mFftSize);
+        uint32_t bits = 0;
+        while ((1u << bits) < mFftSize) {
+            ++bits;
+        }
+        for (uint32_t i = 0; i < mFftSize; ++i) {
+            uint32_t reversed = 0;
+            for (uint32_t b = 0; b < bits; ++b) {
+                reversed |= ((i >> b) & 1u) << (bits - 1 - b);
+            }
+            mBitReverse[i] = reversed;
+        }
+
+        // Octave bands centered on 1 kHz multiples of two; bands without an FFT bin are left out
+        mBands.clear();
+        const double binHz = static_cast<double>(mSampleRate) / mFftSize;
+        const double nyquist = mSampleRate / 2.0;
+        for (double center = 1000.0 / 32.0; center * M_SQRT2 <= nyquist; center *= 2.0) {
+            const uint32_t first = static_cast<uint32_t>(std::max(std::ceil(center / M_SQRT2 / binHz), 1.0));
+            const uint32_t last = std::min(static_cast<uint32_t>(std::ceil(center * M_SQRT2 / binHz)) - 1,
+                                           mFftSize / 2 - 1);
+            if (first <= last) {
+                mBands.push_back(Band{static_cast<float>(center), first, last});
+            }
+        }
+        mSpectrum.resize(mFftSize);
+        mPower.resize(mFftSize / 2);
+    }
+
+    // Wake at the analysis rate; a wakeup without a new complete window does nothing
+    void analyzerLoop() {
+        ResourceUsage startUsage;
+        ResourceUsage::sample(RUSAGE_THREAD, startUsage);
+        const int64_t startNs = AudioUtils::getMonotonicNs();
+        const int64_t periodNs = static_cast<int64_t>(1e9 / mRate);
+        struct timespec next;
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        while (!mStopRequested.load(std::memory_order_relaxed)) {
+            next.tv_nsec += periodNs % 1000000000LL;
+            next.tv_sec += static_cast<time_t>(periodNs / 1000000000LL + next.tv_nsec / 1000000000LL);
+            next.tv_nsec %= 1000000000LL;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+            if (!mSnapshots.take()) {
+                ++mIdleTicks;
+                continue;
+            }
+            analyze(mSnapshots.front());
+            ++mAnalyses;
+        }
+        ResourceUsage endUsage;
+        ResourceUsage::sample(RUSAGE_THREAD, endUsage);
+        mAnalyzerCpuUs = (endUsage - startUsage).cpuUs();
+        mAnalyzerWallUs = (AudioUtils::getMonotonicNs() - startNs) / 1000;
+    }
+
+    void analyze(const Snapshot& snapshot) {
+        const size_t valuesPerChannel = 2 * kPeakCount + mBands.size();
+        mRecordValues.assign(mChannels.size() * valuesPerChannel, 0.0f);
+        for (size_t c = 0; c < mChannels.size(); ++c) {
+            dispatchFormat(mFormat, [&](auto traits) {
+                using T = decltype(traits);
+                for (uint32_t i = 0; i < mFftSize; ++i) {
+                    const float sample = T::toFloat(T::load(snapshot.data.data(),
+                                                            static_cast<size_t>(i) * mChannelCount + mChannels[c]));
+                    mSpectrum[mBitReverse[i]] = std::complex<float>(sample * mWindow[i], 0.0f);
+                }
+            });
+            transform();
+            for (uint32_t k = 0; k < mFftSize / 2; ++k) {
+                mPower[k] = std::norm(mSpectrum[k]);
+            }
+            float* values = mRecordValues.data() + c * valuesPerChannel;
+            findPeaks(values);
+            for (size_t b = 0; b < mBands.size(); ++b) {
+                double sum = 0.0;
+                for (uint32_t k = mBands[b].firstBin; k <= mBands[b].lastBin; ++k) {
+                    sum += mPower[k];
+                }
+                values[2 * kPeakCount + b] = toDb(sum * mBandScale);
+            }
+        }
+        emit(snapshot, valuesPerChannel);
+    }
+
+    // In-place radix-2 FFT of mSpectrum, whose input is already in bit reversed order
+    void transform() {
+        for (uint32_t size = 2; size <= mFftSize; size *= 2) {
+            const uint32_t half = size / 2;
+            const uint32_t stride = mFftSize / size;
+            for (uint32_t start = 0; start < mFftSize; start += size) {
+                for (uint32_t j = 0; j < half; ++j) {
+                    const std::complex<float> odd = mSpectrum[start + j + half] * mTwiddles[j * stride];
+                    mSpectrum[start + j + half] = mSpectrum[start + j] - odd;
+                    mSpectrum[start + j] += odd;
+                }
+            }
+        }
+    }
+
+    // Strongest local maxima of mPower as (Hz, dBFS), refined by parabolic interpolation of the dB levels
+    void findPeaks(float* values) const {
+        for (int32_t p = 0; p < kPeakCount; ++p) {
+            values[2 * p] = 0.0f;
+            values[2 * p + 1] = kDbFloor;
+        }
+        for (uint32_t k = 1; k + 1 < mFftSize / 2; ++k) {
+            if (mPower[k] <= mPower[k - 1] || mPower[k] < mPower[k + 1]) {
+                continue;
+            }
+            const float left = toDb(mPower[k - 1] * mPeakScale);
+            const float center = toDb(mPower[k] * mPeakScale);
+            const float right = toDb(mPower[k + 1] * mPeakScale);
+            const float curvature = left - 2.0f * center + right;
+            const float offset = curvature < 0.0f ? 0.5f * (left - right) / curvature : 0.0f;
+            const float level = center - 0.25f * (left - right) * offset;
+            if (level <= values[2 * kPeakCount - 1]) {
+                continue;
+            }
+            // Insert into the sorted list, dropping the weakest
+            int32_t p = kPeakCount - 1;
+            for (; p > 0 && values[2 * (p - 1) + 1] < level; --p) {
+                values[2 * p] = values[2 * (p - 1)];
+                values[2 * p + 1] = values[2 * (p - 1) + 1];
+            }
+            values[2 * p] = (k + offset) * static_cast<float>(mSampleRate) / mFftSize;
+            values[2 * p + 1] = level;
+        }
+    }
+
+    static float toDb(const double power) {
+        return power > 0.0 ? std::max(static_cast<float>(10.0 * std::log10(power)), kDbFloor) : kDbFloor;
+    }
+
+    // One record to the file, or one line per channel through the async logger
+    void emit(const Snapshot& snapshot, const size_t valuesPerChannel) {
+        if (mFd >= 0) {
+            SpectrumFileRecord record{};
+            record.timeNs = snapshot.timeNs;
+            record.framePosition = snapshot.framePosition;
+            const ssize_t valueBytes = static_cast<ssize_t>(mRecordValues.size() * sizeof(float));
+            if (::write(mFd, &record, sizeof(record)) != static_cast<ssize_t>(sizeof(record)) ||
+                ::write(mFd, mRecordValues.data(), static_cast<size_t>(valueBytes)) != valueBytes) {
+                sLogger.error("Can't write spectrum file, spectrum stops here\n");
+                ::close(mFd);
+                mFd = -1;
+                mStopRequested.store(true);
+            }
+            return;
+        }
+        for (size_t c = 0; c < mChannels.size(); ++c) {
+            const float* values = mRecordValues.data() + c * valuesPerChannel;
+            std::string peaks;
+            for (int32_t p = 0; p < kPeakCount && values[2 * p + 1] > kDbFloor; ++p) {
+                peaks += String8::format(" %.0fHz/%.1f", values[2 * p], values[2 * p + 1]).c_str();
+            }
+            std::string bands;
+            for (size_t b = 0; b < mBands.size(); ++b) {
+                bands += String8::format(" %.0f", values[2 * kPeakCount + b]).c_str();
+            }
+            sLogger.printTimed("Spectrum ch%d peaks:%s | bands:%s\n", mChannels[c], peaks.c_str(), bands.c_str());
+        }
+    }
+
+    // Capture side
+    TripleBuffer<Snapshot> mSnapshots;
+    size_t mFill = 0; // bytes in the back slot
+    uint64_t mFramePosition = 0;
+    uint64_t mDropped = 0; // complete windows replaced before the analyzer took them
+
+    // Analyzer side
+    std::thread mThread;
+    std::atomic<bool> mStopRequested{false};
+    std::vector<int32_t> mChannels;
+    int32_t mSampleRate = 0;
+    int32_t mChannelCount = 0;
+    audio_format_t mFormat = AUDIO_FORMAT_PCM_16_BIT;
+    size_t mFrameSize = 0;
+    uint32_t mFftSize = 0;
+    float mRate = 0.0f;
+    int mFd = -1;
+    std::vector<float> mWindow;
+    std::vector<std::complex<float>> mTwiddles;
+    std::vector<uint32_t> mBitReverse;
+    std::vector<Band> mBands;
+    std::vector<std::complex<float>> mSpectrum;
+    std::vector<float> mPower;
+    std::vector<float> mRecordValues;
+    double mPeakScale = 1.0;
+    double mBandScale = 1.0;
+    uint64_t mAnalyses = 0;
+    uint64_t mIdleTicks = 0;
+    int64_t mAnalyzerCpuUs = 0;
+    int64_t mAnalyzerWallUs = 0;
+};
+
+/************************** Goertzel Bank ******************************/
+// Goertzel detectors for every (channel, frequency) pair, run over fixed blocks. The frequencies are padded to
+// groups of kLanes in fixed-size arrays, so the per-sample update is a branch-free loop with a constant trip count
+// over one group that the compiler vectorizes (NEON/SSE/AVX) without intrinsics. Blocks should hold whole cycles of
+// every frequency: then the frequencies are orthogonal over a block and don't leak into each other's detectors.
+class GoertzelBank {
+public:
+    static constexpr int32_t kMaxChannels = 16;
+    static constexpr size_t kMaxTones = 16;
+
+    bool configure(const int32_t channelCount, const std::vector<double>& frequencies, const int32_t sampleRate,
+                   const size_t blockFrames) {
+        if (channelCount <= 0 || channelCount > kMaxChannels || frequencies.empty() ||
+            frequencies.size() > kMaxTones || blockFrames == 0) {
+            return false;
+        }
+        mChannelCount = channelCount;
+        mToneCount = frequencies.size();
+        mGroupCount = (mToneCount + kLanes - 1) / kLanes;
+        mBlockFrames = blockFrames;
+        for (size_t t = 0; t < kMaxTones; ++t) { // padding lanes stay silent
+            mCoefficients[t / kLanes].v[t % kLanes] =
+                t < mToneCount ? static_cast<float>(2.0 * std::cos(2.0 * M_PI * frequencies[t] / sampleRate)) : 0.0f;
+        }
+        mAmplitudes.assign(mChannelCount * mToneCount, 0.0f);
+        resetStates();
+        return true;
+    }
+
+    size_t getBlockFrames() const { return mBlockFrames; }
+    size_t getToneCount() const { return mToneCount; }
+
+    // Run interleaved float frames through every detector, at most up to the end of the current block.
+    // Returns the frames consumed.
+    size_t process(const float* frames, const size_t count) {
+        const size_t n = std::min(count, mBlockFrames - mFill);
+        for (size_t f = 0; f < n; ++f) {
+            const float* frame = frames + f * mChannelCount;
+            for (int32_t ch = 0; ch < mChannelCount; ++ch) {
+                const float x = frame[ch];
+                for (size_t g = 0; g < mGroupCount; ++g) {
+                    const Lanes& coefficients = mCoefficients[g];
+                    Lanes& s1 = mS1[ch][g];
+                    Lanes& s2 = mS2[ch][g];
+                    for (size_t t = 0; t < kLanes; ++t) {
+                        const float s0 = x + coefficients.v[t] * s1.v[t] - s2.v[t];
+                        s2.v[t] = s1.v[t];
+                        s1.v[t] = s0;
+                    }
+                }
+            }
+        }
+        mFill += n;
+        return n;
+    }
+
+    bool isBlockComplete() const { return mFill == mBlockFrames; }
+
+    // Amplitude of every detector over the completed block (1.0 = full-scale sine), indexed
+    // channel * tones + tone. The states restart for the next block.
+    const std::vector<float>& finishBlock() {
+        const double scale = 2.0 / static_cast<double>(mBlockFrames);
+        for (int32_t ch = 0; ch < mChannelCount; ++ch) {
+            for (size_t t = 0; t < mToneCount; ++t) {
+                const double s1 = mS1[ch][t / kLanes].v[t % kLanes];
+                const double s2 = mS2[ch][t / kLanes].v[t % kLanes];
+                const double power = s1 * s1 + s2 * s2 - mCoefficients[t / kLanes].v[t % kLanes] * s1 * s2;
+                mAmplitudes[ch * mToneCount + t] = static_cast<float>(std::sqrt(std::max(power, 0.0)) * scale);
+            }
+        }
+        resetStates();
+        return mAmplitudes;
+    }
+
+private:
+    static constexpr size_t kLanes = 8; // one AVX or two NEON/SSE registers of floats
+    static constexpr size_t kMaxGroups = kMaxTones / kLanes;
+
+    struct Lanes {
+        alignas(32) float v[kLanes];
+    };
+
+    void resetStates() {
+        std::fill(&mS1[0][0], &mS1[0][0] + kMaxChannels * kMaxGroups, Lanes{});
+        std::fill(&mS2[0][0], &mS2[0][0] + kMaxChannels * kMaxGroups, Lanes{});
+        mFill = 0;
+    }
+
+    int32_t mChannelCount = 0;
+    size_t mToneCount = 0;
+    size_t mGroupCount = 0;
+    size_t mBlockFrames = 0;
+    size_t mFill = 0;
+    Lanes mCoefficients[kMaxGroups] = {};
+    Lanes mS1[kMaxChannels][kMaxGroups] = {};
+    Lanes mS2[kMaxChannels][kMaxGroups] = {};
+    std::vector<float> mAmplitudes;
+};
+
+/************************** DSP Stage Graph ******************************/
+// Float processing between a PCM source and a PCM sink (--dsp). The graph converts each transfer buffer in blocks
+// of at most a fixed frame count into a preallocated float buffer, runs the stages over it and converts the
+// result to the sink format. Stages work in place unless they change the channel count, which ping-pongs between
+// the two scratch buffers, so nothing is allocated while streaming. Every step is timed with the thread CPU clock
+// and the cost per stage is printed at the end of the run.
+class DspStage {
+public:
+    virtual ~DspStage() = default;
+
+    // Short description for the report, e.g. "gain -6.0dB"
+    virtual std::string getName() const = 0;
+    virtual int32_t getOutputChannels(const int32_t inputChannels) const { return inputChannels; }
+    virtual bool isInPlace() const { return true; }
+    virtual void prepare(const int32_t sampleRate, const int32_t channels, const uint64_t totalFrames) {}
+    // in == out for in-place stages; frames never exceed the graph block size
+    virtual void process(const float* in, float* out, const size_t frames) = 0;
+};
+
+// Gain with optional linear fade-in from the start and fade-out towards a known total length
+class GainStage : public DspStage {
+public:
+    GainStage(const float gainDb, const int32_t fadeInMs, const int32_t fadeOutMs)
+        : mGainDb(gainDb), mFadeInMs(fadeInMs), mFadeOutMs(fadeOutMs) {}
+
+    std::string getName() const override {
+        if (mFadeInMs == 0 && mFadeOutMs == 0) {
+            return String8::format("gain %.1fdB", mGainDb).c_str();
+        }
+        return String8::format("fade %d/%dms", mFadeInMs, mFadeOutMs).c_str();
+    }
+
+    void prepare(const int32_t sampleRate, const int32_t channels, const uint64_t totalFrames) override {
+        mChannels = channels;
+        mGain = static_cast<float>(std::pow(10.0, mGainDb / 20.0));
+        mFadeInFrames = static_cast<uint64_t>(sampleRate) * mFadeInMs / 1000;
+        mFadeOutFrames = totalFrames > 0 ? static_cast<uint64_t>(sampleRate) * mFadeOutMs / 1000 : 0;
+        mTotalFrames = totalFrames;
+        mPosition = 0;
+    }
+
+    void process(const float* in, float* out, const size_t frames) override {
+        const uint64_t fadeOutStart = mTotalFrames - std::min(mFadeOutFrames, mTotalFrames);
+        if (mPosition >= mFadeInFrames && (mFadeOutFrames == 0 || mPosition + frames <= fadeOutStart)) {
+            for (size_t i = 0; i < frames * mChannels; ++i) {
+                out[i] = in[i] * mGain;
+            }
+        } else {
+            for (size_t f = 0; f < frames; ++f) {
+                const uint64_t position = mPosition + f;
+                float gain = mGain;
+                if (position < mFadeInFrames) {
+                    gain *= static_cast<float>(position) / mFadeInFrames;
+                }
+                if (mFadeOutFrames > 0 && position >= fadeOutStart) {
+                    gain *= static_cast<float>(mTotalFrames - std::min(position, mTotalFrames)) / mFadeOutFrames;
+                }
+                for (int32_t ch = 0; ch < mChannels; ++ch) {
+                    out[f * mChannels + ch] = in[f * mChannels + ch] * gain;
+                }
+            }
+        }
+        mPosition += frames;
+    }
+
+private:
+    float mGainDb;
+    int32_t mFadeInMs;
+    int32_t mFadeOutMs;
+    int32_t mChannels = 0;
+    float mGain = 1.0f;
+    uint64_t mFadeInFrames = 0;
+    uint64_t mFadeOutFrames = 0;
+    uint64_t mTotalFrames = 0; // 0 = unknown, no fade-out
+    uint64_t mPosition = 0;
+};
+
+// Cascade of RBJ cookbook biquads, transposed direct form II per channel. Consecutive filter specs share one
+// stage, so the cascade runs section after section over a channel while its samples are in cache.
+class BiquadCascadeStage : public DspStage {
+public:
+    enum Type { LOWPASS, HIGHPASS, PEAK, LOWSHELF, HIGHSHELF };
+
+    struct Section {
+        Type type;
+        double frequency;
+        double q;
+        double gainDb;
+    };
+
+    void addSection(const Section& section) { mSections.push_back(section); }
+
+    std::string getName() const override {
+        static const char* const kTypeNames[] = {"lp", "hp", "peak", "lowshelf", "highshelf"};
+        std::string name = "biquad";
+        for (const Section& s : mSections) {
+            name += String8::format(" %s%.0f", kTypeNames[s.type], s.frequency).c_str();
+        }
+        return name;
+    }
+
+    void prepare(const int32_t sampleRate, const int32_t channels, const uint64_t totalFrames) override {
+        mChannels = channels;
+        mCoefficients.clear();
+        for (const Section& s : mSections) {
+            mCoefficients.push_back(design(s, sampleRate));
+        }
+        mStates.assign(mSections.size() * channels * 2, 0.0f);
+    }
+
+    void process(const float* in, float* out, const size_t frames) override {
+        for (int32_t ch = 0; ch < mChannels; ++ch) {
+            const float* src = in;
+            for (size_t s = 0; s < mCoefficients.size(); ++s) {
+                const Coefficients& c = mCoefficients[s];
+                float* state = &mStates[(s * mChannels + ch) * 2];
+                float z1 = state[0];
+                float z2 = state[1];
+                for (size_t f = 0; f < frames; ++f) {
+                    const float x = src[f * mChannels + ch];
+                    const float y = c.b0 * x + z1;
+                    z1 = c.b1 * x - c.a1 * y + z2;
+                    z2 = c.b2 * x - c.a2 * y;
+                    out[f * mChannels + ch] = y;
+                }
+                state[0] = z1;
+                state[1] = z2;
+                src = out; // later sections filter the output of the previous one
+            }
+        }
+    }
+
+private:
+    struct Coefficients {
+        float b0, b1, b2, a1, a2; // normalized by a0
+    };
+
+    static Coefficients design(const Section& s, const int32_t sampleRate) {
+        const double w0 = 2.0 * M_PI * s.frequency / sampleRate;
+        const double cosW0 = std::cos(w0);
+        const double alpha = std::sin(w0) / (2.0 * s.q);
+        const double a = std::pow(10.0, s.gainDb / 40.0);
+        const double shelf = 2.0 * std::sqrt(a) * alpha;
+        double b0 = 0.0, b1 = 0.0, b2 = 0.0, a0 = 1.0, a1 = 0.0, a2 = 0.0;
+        switch (s.type) {
+        case LOWPASS:
+            b0 = b2 = (1.0 - cosW0) / 2.0;
+            b1 = 1.0 - cosW0;
+            a0 = 1.0 + alpha;
+            a1 = -2.0 * cosW0;
+            a2 = 1.0 - alpha;
+            break;
+        case HIGHPASS:
+            b0 = b2 = (1.0 + cosW0) / 2.0;
+            b1 = -(1.0 + cosW0);
+            a0 = 1.0 + alpha;
+            a1 = -2.0 * cosW0;
+            a2 = 1.0 - alpha;
+            break;
+        case PEAK:
+            b0 = 1.0 + alpha * a;
+            b1 = a1 = -2.0 * cosW0;
+            b2 = 1.0 - alpha * a;
+            a0 = 1.0 + alpha / a;
+            a2 = 1.0 - alpha / a;
+            break;
+        case LOWSHELF:
+            b0 = a * ((a + 1.0) - (a - 1.0) * cosW0 + shelf);
+            b1 = 2.0 * a * ((a - 1.0) - (a + 1.0) * cosW0);
+            b2 = a * ((a + 1.0) - (a - 1.0) * cosW0 - shelf);
+            a0 = (a + 1.0) + (a - 1.0) * cosW0 + shelf;
+            a1 = -2.0 * ((a - 1.0) + (a + 1.0) * cosW0);
+            a2 = (a + 1.0) + (a - 1.0) * cosW0 - shelf;
+            break;
+        case HIGHSHELF:
+            b0 = a * ((a + 1.0) + (a - 1.0) * cosW0 + shelf);
+            b1 = -2.0 * a * ((a - 1.0) + (a + 1.0) * cosW0);
+            b2 = a * ((a + 1.0) + (a - 1.0) * cosW0 - shelf);
+            a0 = (a + 1.0) - (a - 1.0) * cosW0 + shelf;
+            a1 = 2.0 * ((a - 1.0) - (a + 1.0) * cosW0);
+            a2 = (a + 1.0) - (a - 1.0) * cosW0 - shelf;
+            break;
+        }
+        return {static_cast<float>(b0 / a0), static_cast<float>(b1 / a0), static_cast<float>(b2 / a0),
+                static_cast<float>(a1 / a0), static_cast<float>(a2 / a0)};
+    }
+
+    std::vector<Section> mSections;
+    std::vector<Coefficients> mCoefficients;
+    std::vector<float> mStates; // (section * channels + channel) * 2: z1, z2
+    int32_t mChannels = 0;
+};
+
+// Channel count change with a fixed matrix. Downmix: output o averages the inputs i with i % outputs == o.
+// Upmix: output o copies input o % inputs, so every output carries signal (mono to all, stereo as L R L R).
+class MixerStage : public DspStage {
+public:
+    explicit MixerStage(const int32_t outputChannels) : mOutputChannels(outputChannels) {}
+
+    std::string getName() const override {
+        return String8::format("mix %d->%d", mInputChannels, mOutputChannels).c_str();
+    }
+    int32_t getOutputChannels(const int32_t inputChannels) const override { return mOutputChannels; }
+    bool isInPlace() const override { return false; }
+
+    void prepare(const int32_t sampleRate, const int32_t channels, const uint64_t totalFrames) override {
+        mInputChannels = channels;
+        mMatrix.assign(static_cast<size_t>(mOutputChannels) * channels, 0.0f);
+        for (int32_t o = 0; o < mOutputChannels; ++o) {
+            if (mOutputChannels >= channels) {
+                mMatrix[o * channels + o % channels] = 1.0f;
+                continue;
+            }
+            int32_t sources = 0;
+            for (int32_t i = o; i < channels; i += mOutputChannels) {
+                ++sources;
+            }
+            for (int32_t i = o; i < channels; i += mOutputChannels) {
+                mMatrix[o * channels + i] = 1.0f / sources;
+            }
+        }
+    }
+
+    void process(const float* in, float* out, const size_t frames) override {
+        for (size_t f = 0; f < frames; ++f) {
+            const float* frame = in + f * mInputChannels;
+            for (int32_t o = 0; o < mOutputChannels; ++o) {
+                const float* gains = &mMatrix[o * mInputChannels];
+                float sum = 0.0f;
+                for (int32_t i = 0; i < mInputChannels; ++i) {
+                    sum += frame[i] * gains[i];
+                }
+                out[f * mOutputChannels + o] = sum;
+            }
+        }
+    }
+
+private:
+    int32_t mOutputChannels;
+    int32_t mInputChannels = 0;
+    std::vector<float> mMatrix; // output * inputs + input
+};
+
+class DspGraph {
+public:
+    static constexpr size_t kDefaultBlockFrames = 256;
+    static constexpr int32_t kMaxChannels = 32;
+
+    // Build the stages from a spec like "hp:80,peak:1000:3:1.4,gain:-6,mix:1" and prepare them for the stream.
+    // totalFrames (0 = unknown) places the fade-out.
+    bool configure(const std::string& spec,
+                   const int32_t sampleRate,
+                   const int32_t inputChannels,
+                   const audio_format_t format,
+                   const size_t blockFrames,
+                   const uint64_t totalFrames) {
+        mStages.clear();
+        mFormat = format;
+        mInputChannels = inputChannels;
+        mBlockFrames = blockFrames > 0 ? blockFrames : kDefaultBlockFrames;
+        mSampleRate = sampleRate;
+        if (!parse(spec)) {
+            return false;
+        }
+
+        int32_t channels = inputChannels;
+        int32_t maxChannels = channels;
+        for (const std::unique_ptr<DspStage>& stage : mStages) {
+            stage->prepare(sampleRate, channels, totalFrames);
+            channels = stage->getOutputChannels(channels);
+            maxChannels = std::max(maxChannels, channels);
+        }
+        mOutputChannels = channels;
+        mScratch[0].assign(mBlockFrames * maxChannels, 0.0f);
+        mScratch[1].assign(mBlockFrames * maxChannels, 0.0f);
+        mStats.assign(mStages.size() + 2, StageStats());
+        mStats.front().name = String8::format("pcm in (%d ch)", inputChannels).c_str();
+        for (size_t s = 0; s < mStages.size(); ++s) {
+            mStats[s + 1].name = mStages[s]->getName();
+        }
+        mStats.back().name = String8::format("pcm out (%d ch)", mOutputChannels).c_str();
+        mFramesProcessed = 0;
+        mConfigured = true;
+
+        printf("DSP graph: %zu stages, %d -> %d channels, block %zu frames\n", mStages.size(), inputChannels,
+               mOutputChannels, mBlockFrames);
+        for (const std::unique_ptr<DspStage>& stage : mStages) {
+            printf("  %s\n", stage->getName().c_str());
+        }
+        return true;
+    }
+
+    bool isConfigured() const { return mConfigured; }
+    int32_t getOutputChannels() const { return mOutputChannels; }
+    size_t getInputFrameSize() const { return audio_bytes_per_sample(mFormat) * mInputChannels; }
+    size_t getOutputFrameSize() const { return audio_bytes_per_sample(mFormat) * mOutputChannels; }
+
+    // Process whole frames of PCM input into PCM output and return the output size. Output may alias the input
+    // when its frame size is not larger: every block is converted to float before its output is written.
+    size_t process(const char* in, const size_t inBytes, char* out) {
+        const size_t inFrameSize = getInputFrameSize();
+        const size_t outFrameSize = getOutputFrameSize();
+        const size_t frames = inBytes / inFrameSize;
+        for (size_t done = 0; done < frames;) {
+            const size_t n = std::min(mBlockFrames, frames - done);
+            int64_t startNs = threadCpuNs();
+            AudioUtils::pcmToFloat(in + done * inFrameSize, mScratch[0].data(), n * mInputChannels, mFormat);
+            startNs = account(mStats.front(), startNs);
+
+            int32_t current = 0;
+            for (size_t s = 0; s < mStages.size(); ++s) {
+                DspStage& stage = *mStages[s];
+                const int32_t target = stage.isInPlace() ? current : 1 - current;
+                stage.process(mScratch[current].data(), mScratch[target].data(), n);
+                current = target;
+                startNs = account(mStats[s + 1], startNs);
+            }
+
+            AudioUtils::floatToPcm(mScratch[current].data(), out + done * outFrameSize, n * mOutputChannels,
+                                   mFormat);
+            account(mStats.back(), startNs);
+            done += n;
+        }
+        mFramesProcessed += frames;
+        return frames * outFrameSize;
+    }
+
+    // Per-stage CPU time over the run, relative to the audio time processed
+    void printReport() const {
+        if (!mConfigured || mFramesProcessed == 0) {
+            return;
+        }
+        const double audioNs = mFramesProcessed * 1e9 / mSampleRate;
+        const double blockUs = mBlockFrames * 1e6 / mSampleRate;
+        printf("DSP graph CPU time: %" PRIu64 " frames (%.1fs), block %zu frames (%.2fms)\n", mFramesProcessed,
+               audioNs / 1e9, mBlockFrames, blockUs / 1000.0);
+        printf("  %-32s %10s %10s %13s %8s\n", "stage", "cpu(ms)", "ns/frame", "max block(us)", "load(%)");
+        int64_t totalNs = 0;
+        for (const StageStats& stats : mStats) {
+            printf("  %-32s %10.2f %10.2f %13.1f %8.3f\n", stats.name.c_str(), stats.cpuNs / 1e6,
+                   static_cast<double>(stats.cpuNs) / mFramesProcessed, stats.maxBlockNs / 1000.0,
+                   stats.cpuNs * 100.0 / audioNs);
+            totalNs += stats.cpuNs;
+        }
+        printf("  %-32s %10.2f %10.2f %13s %8.3f\n", "total", totalNs / 1e6,
+               static_cast<double>(totalNs) / mFramesProcessed, "", totalNs * 100.0 / audioNs);
+    }
+
+private:
+    struct StageStats {
+        std::string name;
+        int64_t cpuNs = 0;
+        int64_t maxBlockNs = 0;
+    };
+
+    static int64_t threadCpuNs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+    }
+
+    // Charge the time since startNs to a stage, returns the new start
+    static int64_t account(StageStats& stats, const int64_t startNs) {
+        const int64_t nowNs = threadCpuNs();
+        stats.cpuNs += nowNs - startNs;
+        stats.maxBlockNs = std::max(stats.maxBlockNs, nowNs - startNs);
+        return nowNs;
+    }
+
+    // Stage specs are separated by ',' and their parameters by ':'
+    bool parse(const std::string& spec) {
+        BiquadCascadeStage* cascade = nullptr;
+        std::istringstream stageList(spec);
+        std::string item;
+        while (std::getline(stageList, item, ',')) {
+            std::vector<std::string> fields;
+            std::istringstream fieldList(item);
+            std::string field;
+            while (std::getline(fieldList, field, ':')) {
+                fields.push_back(field);
+            }
+            if (fields.empty() || fields[0].empty()) {
+                continue;
+            }
+            std::vector<double> values;
+            for (size_t i = 1; i < fields.size(); ++i) {
+                char* end = nullptr;
+                values.push_back(strtod(fields[i].c_str(), &end));
+                if (fields[i].empty() || *end != '\0') {
+                    printf("Error: Invalid DSP stage parameter: %s\n", item.c_str());
+                    return false;
+                }
+            }
+            const auto arg = [&values](const size_t i, const double fallback) {
+                return i < values.size() ? values[i] : fallback;
+            };
+
+            const std::string& name = fields[0];
+            BiquadCascadeStage::Type type = BiquadCascadeStage::PEAK;
+            const bool isFilter = parseFilterType(name, type);
+            if (isFilter) {
+                const bool hasGain = type == BiquadCascadeStage::PEAK || type == BiquadCascadeStage::LOWSHELF ||
+                                     type == BiquadCascadeStage::HIGHSHELF;
+                const BiquadCascadeStage::Section section = {type, arg(0, 0.0), arg(hasGain ? 2 : 1, M_SQRT1_2),
+                                                             hasGain ? arg(1, 0.0) : 0.0};
+                if (values.empty() || (hasGain && values.size() < 2) || section.frequency <= 0.0 ||
+                    section.frequency >= mSampleRate / 2.0 || section.q <= 0.0) {
+                    printf("Error: Invalid DSP filter: %s (frequency below %d Hz, Q > 0, dB for peak/shelf)\n",
+                           item.c_str(), mSampleRate / 2);
+                    return false;
+                }
+                if (cascade == nullptr) {
+                    auto stage = std::make_unique<BiquadCascadeStage>();
+                    cascade = stage.get();
+                    mStages.push_back(std::move(stage));
+                }
+                cascade->addSection(section);
+                continue;
+            }
+            cascade = nullptr;
+            if (name == "gain" && values.size() == 1) {
+                mStages.push_back(std::make_unique<GainStage>(static_cast<float>(values[0]), 0, 0));
+            } else if (name == "fade" && !values.empty() && values.size() <= 2 && arg(0, 0) >= 0 && arg(1, 0) >= 0) {
+                mStages.push_back(std::make_unique<GainStage>(0.0f, static_cast<int32_t>(values[0]),
+                                                              static_cast<int32_t>(arg(1, 0))));
+            } else if (name == "mix" && values.size() == 1 && values[0] >= 1 && values[0] <= kMaxChannels) {
+                mStages.push_back(std::make_unique<MixerStage>(static_cast<int32_t>(values[0])));
+            } else {
+                printf("Error: Invalid DSP stage: %s\n", item.c_str());
+                printf("       Stages: gain:<dB>, fade:<in ms>[:<out ms>], lp|hp:<Hz>[:<Q>], "
+                       "peak|lowshelf|highshelf:<Hz>:<dB>[:<Q>], mix:<channels>\n");
+                return false;
+            }
+        }
+        if (mStages.empty()) {
+            printf("Error: Empty DSP graph: %s\n", spec.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    static bool parseFilterType(const std::string& name, BiquadCascadeStage::Type& type) {
+        static const std::pair<const char*, BiquadCascadeStage::Type> kTypes[] = {
+            {"lp", BiquadCascadeStage::LOWPASS},         {"hp", BiquadCascadeStage::HIGHPASS},
+            {"peak", BiquadCascadeStage::PEAK},          {"lowshelf", BiquadCascadeStage::LOWSHELF},
+            {"highshelf", BiquadCascadeStage::HIGHSHELF}};
+        for (const auto& entry : kTypes) {
+            if (name == entry.first) {
+                type = entry.second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<std::unique_ptr<DspStage>> mStages;
+    std::vector<float> mScratch[2]; // block frames * widest channel count
+    std::vector<StageStats> mStats; // pcm in, stages, pcm out
+    audio_format_t mFormat = AUDIO_FORMAT_PCM_16_BIT;
+    int32_t mInputChannels = 0;
+    int32_t mOutputChannels = 0;
+    int32_t mSampleRate = 0;
+    size_t mBlockFrames = kDefaultBlockFrames;
+    uint64_t mFramesProcessed = 0;
+    bool mConfigured = false;
+};
+
+/************************** Bit-Exact Pattern ******************************/
+// Deterministic, self-synchronizing test signal for bit-exact path checks. The signal is a sequence of
+// kBlockFrames frame blocks: frames 0 and 1 of channel 0 carry the block number (the embedded frame counter),
+// every other sample is a splitmix64 PRBS value of its position. Samples are generated as 32-bit codes and
+// stored in the top bits of the format, so the verifier can rebuild any block from its number alone.
+class BitExactPattern {
+public:
+    static constexpr size_t kBlockFrames = 256;
+    static constexpr uint32_t kHeaderKey = 0x5aa5; // xor-ed into the high half so silence is no valid header
+
+    static bool isSupportedFormat(const audio_format_t format) {
+        return format == AUDIO_FORMAT_PCM_16_BIT || format == AUDIO_FORMAT_PCM_24_BIT_PACKED ||
+               format == AUDIO_FORMAT_PCM_8_24_BIT || format == AUDIO_FORMAT_PCM_32_BIT ||
+               format == AUDIO_FORMAT_PCM_FLOAT;
+    }
+
+    // Code of one sample: header halves in the top 16 bits, PRBS elsewhere
+    static uint32_t code(const uint32_t block, const size_t frame, const int32_t channel, const int32_t channelCount) {
+        if (channel == 0 && frame < 2) {
+            const uint32_t half = frame == 0 ? (block & 0xffffu) : ((block >> 16) ^ kHeaderKey);
+            return half << 16;
+        }
+        uint64_t x = (static_cast<uint64_t>(block) * kBlockFrames + frame) * channelCount + channel;
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return static_cast<uint32_t>((x ^ (x >> 31)) >> 32);
+    }
+
+    // Store the top bits of a code in one sample of the format
+    static void storeSample(const uint32_t code, char* out, const audio_format_t format) {
+        dispatchFormat(format, [&](auto traits) { decltype(traits)::storeCode(out, 0, code); });
+    }
+
+    // Read one sample back as a code, the bits the format does not hold are zero
+    static uint32_t loadSample(const char* in, const audio_format_t format) {
+        uint32_t code = 0;
+        dispatchFormat(format, [&](auto traits) { code = decltype(traits)::loadCode(in, 0); });
+        return code;
+    }
+
+    // Block number of the header at the start of a frame block
+    static uint32_t loadHeader(const char* frames, const audio_format_t format, const size_t frameSize) {
+        const uint32_t low = loadSample(frames, format) >> 16;
+        const uint32_t high = (loadSample(frames + frameSize, format) >> 16) ^ kHeaderKey;
+        return low | high << 16;
+    }
+
+    // Write frames [firstFrame, firstFrame + frames) of the pattern
+    static void fill(const uint64_t firstFrame,
+                     const size_t frames,
+                     char* out,
+                     const audio_format_t format,
+                     const int32_t channelCount) {
+        dispatchFormat(format, [&](auto traits) {
+            size_t sample = 0;
+            for (size_t f = 0; f < frames; ++f) {
+                const uint64_t position = firstFrame + f;
+                const uint32_t block = static_cast<uint32_t>(position / kBlockFrames);
+                const size_t frame = static_cast<size_t>(position % kBlockFrames);
+                for (int32_t ch = 0; ch < channelCount; ++ch) {
+                    decltype(traits)::storeCode(out, sample++, code(block, frame, ch, channelCount));
+                }
+            }
+        });
+    }
+};
+
+// Aligns a capture of the pattern block by block. Before the first lock every frame position is tried as a
+// block start; a block is accepted when its header decodes to a number whose regenerated block matches byte for
+// byte. While locked each block is compared with memcmp against the expected one; a failing block whose header
+// is still the expected number counts as altered, anything else loses lock and the search resumes. The capture
+// to pattern offset after a relock tells how many frames were dropped (offset shrank) or duplicated (grew).
+class BitExactVerifier {
+public:
+    BitExactVerifier(const audio_format_t format, const int32_t channelCount)
+        : mFormat(format), mChannelCount(channelCount),
+          mSampleSize(audio_bytes_per_sample(format)), mFrameSize(mSampleSize * channelCount),
+          mBlockBytes(mFrameSize * BitExactPattern::kBlockFrames), mReference(mBlockBytes) {}
+
+    // Disable copy operations, the verifier owns its pending capture data
+    BitExactVerifier(const BitExactVerifier&) = delete;
+    BitExactVerifier& operator=(const BitExactVerifier&) = delete;
+
+    // Append captured frames and verify every complete block
+    void feed(const char* data, const size_t size) {
+        if (mFrameSize == 0 || size == 0) {
+            return;
+        }
+        mPending.insert(mPending.end(), data, data + size);
+        mCapturedFrames += size / mFrameSize;
+        size_t offset = 0;
+        while (mPending.size() - offset >= mBlockBytes) {
+            const char* block = mPending.data() + offset;
+            if (mLocked) {
+                const BlockCheck check = verifyExpected(block, mPending.size() - offset);
+                if (check == BLOCK_CONSUMED) {
+                    offset += mBlockBytes;
+                    continue;
+                }
+                if (check == BLOCK_NEED_MORE) {
+                    break;
+                }
+                mLocked = false;
+            }
+            uint32_t number = 0;
+            if (matchesBlock(block, number)) {
+                lock(number);
+                continue;
+            }
+            // No block starts here: skip one frame, it is either before the pattern or lost between blocks
+            offset += mFrameSize;
+            ++mFramePosition;
+            if (mFirstLockFrame >= 0) {
+                ++mUnsyncedFrames;
+            }
+        }
+        mPending.erase(mPending.begin(), mPending.begin() + offset);
+    }
+
+    // Every block between the first and the last one seen arrived unaltered, nothing dropped or duplicated
+    bool isBitExact() const {
+        return mFirstLockFrame >= 0 && mExactBlocks == getSpannedBlocks() && mDroppedFrames == 0 &&
+               mDuplicatedFrames == 0 && mUnsyncedFrames == 0;
+    }
+
+    void print(const char* title, const int32_t sampleRate) const {
+        printf("\n%s (format=%d, channelCount=%d):\n", title, mFormat, mChannelCount);
+        printf("  Captured frames:     %" PRIu64 "\n", mCapturedFrames);
+        if (mFirstLockFrame < 0) {
+            printf("  Pattern not found\n");
+            printf("Result: NOT BIT-EXACT\n");
+            return;
+        }
+        printf("  Pattern found at:    frame %" PRId64 " (%.2f ms), blocks %u-%u\n", mFirstLockFrame,
+               mFirstLockFrame * 1000.0 / sampleRate, mFirstBlock, mLastBlock);
+        printf("  Bit-exact blocks:    %" PRIu64 " of %" PRIu64 " (%.3f%%)\n", mExactBlocks, getSpannedBlocks(),
+               getBitExactPercent());
+        printf("  Altered blocks:      %" PRIu64 " (%" PRIu64 " samples differ)\n", mAlteredBlocks,
+               mMismatchedSamples);
+        if (mAlteredBlocks > 0) {
+            printf("  First altered sample: pattern frame %" PRIu64 ", capture frame %" PRIu64
+                   ", channel %d, expected 0x%08x, got 0x%08x\n",
+                   mFirstMismatch.patternFrame, mFirstMismatch.captureFrame, mFirstMismatch.channel,
+                   mFirstMismatch.expected, mFirstMismatch.actual);
+        }
+        printf("  Dropped frames:      %" PRIu64 "\n", mDroppedFrames);
+        printf("  Duplicated frames:   %" PRIu64 "\n", mDuplicatedFrames);
+        printf("  Unsynced frames:     %" PRIu64 "\n", mUnsyncedFrames);
+        for (const Discontinuity& d : mDiscontinuities) {
+            printf("    %s %" PRId64 " frames before pattern frame %" PRIu64 " (capture frame %" PRIu64 ")\n",
+                   d.frames < 0 ? "dropped" : "duplicated", d.frames < 0 ? -d.frames : d.frames, d.patternFrame,
+                   d.captureFrame);
+        }
+        if (mDiscontinuityCount > mDiscontinuities.size()) {
+            printf("    ... %" PRIu64 " more\n", mDiscontinuityCount - mDiscontinuities.size());
+        }
+        printf("Result: %s\n", isBitExact() ? "BIT-EXACT" : "NOT BIT-EXACT");
+    }
+
+    std::string toJsonLine(const char* source) const {
+        return String8::format("{\"source\":\"%s\",\"format\":%d,\"channels\":%d,\"captured_frames\":%" PRIu64
+                               ",\"first_lock_frame\":%" PRId64 ",\"spanned_blocks\":%" PRIu64
+                               ",\"exact_blocks\":%" PRIu64 ",\"altered_blocks\":%" PRIu64
+                               ",\"mismatched_samples\":%" PRIu64 ",\"dropped_frames\":%" PRIu64
+                               ",\"duplicated_frames\":%" PRIu64 ",\"unsynced_frames\":%" PRIu64
+                               ",\"discontinuities\":%" PRIu64 ",\"bit_exact_percent\":%.3f,\"bit_exact\":%s}",
+                               source, mFormat, mChannelCount, mCapturedFrames, mFirstLockFrame, getSpannedBlocks(),
+                               mExactBlocks, mAlteredBlocks, mMismatchedSamples, mDroppedFrames, mDuplicatedFrames,
+                               mUnsyncedFrames, mDiscontinuityCount, getBitExactPercent(),
+                               isBitExact() ? "true" : "false")
+            .c_str();
+    }
+
+private:
+    static constexpr size_t kMaxDiscontinuities = 16; // listed individually, the rest is only counted
+
+    enum BlockCheck { BLOCK_CONSUMED, BLOCK_NEED_MORE, BLOCK_LOST };
+    enum BlockState : uint8_t { BLOCK_UNSEEN, BLOCK_EXACT, BLOCK_ALTERED }; // ordered from best to worst
+
+    struct Mismatch {
+        uint64_t patternFrame = 0;
+        uint64_t captureFrame = 0;
+        int32_t channel = 0;
+        uint32_t expected = 0;
+        uint32_t actual = 0;
+    };
+
+    struct Discontinuity {
+        uint64_t patternFrame; // first pattern frame after the discontinuity
+        uint64_t captureFrame;
+        int64_t frames; // > 0 duplicated, < 0 dropped
+    };
+
+    audio_format_t mFormat;
+    int32_t mChannelCount;
+    size_t mSampleSize;
+    size_t mFrameSize;
+    size_t mBlockBytes;
+    std::vector<char> mReference; // regenerated pattern block mReferenceBlock
+    uint32_t mReferenceBlock = 0;
+    bool mReferenceValid = false;
+    std::vector<char> mPending; // captured bytes not verified yet, less than a block between feeds
+
+    uint64_t mCapturedFrames = 0;
+    uint64_t mFramePosition = 0; // capture frame of the first pending byte
+    bool mLocked = false;
+    uint32_t mExpectedBlock = 0;
+    int64_t mOffset = 0; // capture frame minus pattern frame while locked
+    int64_t mFirstLockFrame = -1;
+    uint32_t mFirstBlock = 0; // lowest and highest block number seen
+    uint32_t mLastBlock = 0;
+    std::vector<uint8_t> mBlockStates; // BlockState of every block from mFirstBlock, each block is scored once
+    uint64_t mExactBlocks = 0;
+    uint64_t mAlteredBlocks = 0;
+    uint64_t mMismatchedSamples = 0;
+    uint64_t mUnsyncedFrames = 0;
+    uint64_t mDroppedFrames = 0;
+    uint64_t mDuplicatedFrames = 0;
+    uint64_t mDiscontinuityCount = 0;
+    Mismatch mFirstMismatch;
+    std::vector<Discontinuity> mDiscontinuities;
+
+    uint64_t getSpannedBlocks() const {
+        return mFirstLockFrame < 0 ? 0 : static_cast<uint64_t>(mLastBlock) - mFirstBlock + 1;
+    }
+
+    double getBitExactPercent() const {
+        const uint64_t spanned = getSpannedBlocks();
+        return spanned > 0 ? mExactBlocks * 100.0 / spanned : 0.0;
+    }
+
+    const char* referenceBlock(const uint32_t number) {
+        if (!mReferenceValid || mReferenceBlock != number) {
+            BitExactPattern::fill(static_cast<uint64_t>(number) * BitExactPattern::kBlockFrames,
+                                  BitExactPattern::kBlockFrames, mReference.data(), mFormat, mChannelCount);
+            mReferenceBlock = number;
+            mReferenceValid = true;
+        }
+        return mReference.data();
+    }
+
+    // Header candidate check: one PRBS sample first, so noise and silence rarely cost a block regeneration
+    bool matchesBlock(const char* block, uint32_t& number) {
+        number = BitExactPattern::loadHeader(block, mFormat, mFrameSize);
+        char sample[sizeof(uint32_t)];
+        BitExactPattern::storeSample(BitExactPattern::code(number, 2, 0, mChannelCount), sample, mFormat);
+        if (memcmp(block + 2 * mFrameSize, sample, mSampleSize) != 0) {
+            return false;
+        }
+        return memcmp(block, referenceBlock(number), mBlockBytes) == 0;
+    }
+
+    // Compare the block at the expected position and consume it when it is the expected one. A differing block
+    // only counts as altered when the next header follows in place; otherwise frames were dropped or inserted
+    // inside it and lock is lost, so the search can find the shifted blocks.
+    BlockCheck verifyExpected(const char* block, const size_t available) {
+        const char* reference = referenceBlock(mExpectedBlock);
+        if (memcmp(block, reference, mBlockBytes) == 0) {
+            scoreBlock(mExpectedBlock, BLOCK_EXACT);
+        } else if (BitExactPattern::loadHeader(block, mFormat, mFrameSize) == mExpectedBlock) {
+            if (available < mBlockBytes + 2 * mFrameSize) {
+                return BLOCK_NEED_MORE;
+            }
+            if (BitExactPattern::loadHeader(block + mBlockBytes, mFormat, mFrameSize) != mExpectedBlock + 1) {
+                return BLOCK_LOST;
+            }
+            if (scoreBlock(mExpectedBlock, BLOCK_ALTERED)) {
+                countMismatches(block, reference);
+            }
+        } else {
+            return BLOCK_LOST;
+        }
+        ++mExpectedBlock;
+        mFramePosition += BitExactPattern::kBlockFrames;
+        return BLOCK_CONSUMED;
+    }
+
+    // Keep the worst result of a block seen more than once, e.g. again after a relock on duplicated frames, so
+    // exact and altered blocks never add up to more than the spanned blocks. Returns true if the state changed.
+    bool scoreBlock(const uint32_t number, const BlockState state) {
+        if (number < mFirstBlock) {
+            mBlockStates.insert(mBlockStates.begin(), mFirstBlock - number, BLOCK_UNSEEN);
+            mFirstBlock = number;
+        }
+        const size_t index = number - mFirstBlock;
+        if (index >= mBlockStates.size()) {
+            mBlockStates.resize(index + 1, BLOCK_UNSEEN);
+        }
+        mLastBlock = std::max(mLastBlock, number);
+        const uint8_t previous = mBlockStates[index];
+        if (state <= previous) {
+            return false;
+        }
+        mBlockStates[index] = state;
+        if (previous == BLOCK_EXACT) {
+            --mExactBlocks;
+        }
+        ++(state == BLOCK_EXACT ? mExactBlocks : mAlteredBlocks);
+        return true;
+    }
+
+    void countMismatches(const char* block, const char* reference) {
+        const uint64_t samples = static_cast<uint64_t>(BitExactPattern::kBlockFrames) * mChannelCount;
+        for (uint64_t i = 0; i < samples; ++i) {
+            const size_t at = static_cast<size_t>(i) * mSampleSize;
+            if (memcmp(block + at, reference + at, mSampleSize) == 0) {
+                continue;
+            }
+            if (mMismatchedSamples++ == 0) {
+                const uint64_t frame = i / static_cast<uint64_t>(mChannelCount);
+                mFirstMismatch.patternFrame = static_cast<uint64_t>(mExpectedBlock) * BitExactPattern::kBlockFrames +
+                                              frame;
+                mFirstMismatch.captureFrame = mFramePosition + frame;
+                mFirstMismatch.channel = static_cast<int32_t>(i % static_cast<uint64_t>(mChannelCount));
+                mFirstMismatch.expected = BitExactPattern::loadSample(reference + at, mFormat);
+                mFirstMismatch.actual = BitExactPattern::loadSample(block + at, mFormat);
+            }
+        }
+    }
+
+    // Lock onto a block found at the current position and account for the offset change since the last lock
+    void lock(const uint32_t number) {
+        const uint64_t patternFrame = static_cast<uint64_t>(number) * BitExactPattern::kBlockFrames;
+        const int64_t offset = static_cast<int64_t>(mFramePosition) - static_cast<int64_t>(patternFrame);
+        if (mFirstLockFrame < 0) {
+            mFirstLockFrame = static_cast<int64_t>(mFramePosition);
+            mFirstBlock = number;
+            mLastBlock = number;
+        } else if (offset != mOffset) {
+            const int64_t frames = offset - mOffset;
+            if (frames < 0) {
+                mDroppedFrames += static_cast<uint64_t>(-frames);
+            } else {
+                mDuplicatedFrames += static_cast<uint64_t>(frames);
+            }
+            if (mDiscontinuities.size() < kMaxDiscontinuities) {
+                mDiscontinuities.push_back({patternFrame, mFramePosition, frames});
+            }
+            ++mDiscontinuityCount;
+        }
+        mOffset = offset;
+        mExpectedBlock = number;
+        mLocked = true;
+    }
+};
+
+/************************** Multi-Source Alignment ******************************/
+// Merges capture streams of the same rate and format into one multichannel stream: the channels of stream i
+// become output channels [i * channelCount, (i + 1) * channelCount). Each stream is fed by its own reader thread
+// through a single-producer ring, merge() runs on the one writer thread. A stream is anchored by one timestamp
+// (device position at a CLOCK_MONOTONIC time), which gives the capture time of its first frame; leading frames
+// are skipped up to the first frame of the stream that started last, so output frame n of every stream was
+// captured at the same instant to within half a frame. The residual offsets are measured against stream 0.
+class MultiSourceAligner {
+public:
+    struct StreamResult {
+        double startOffsetMs;   // capture time of the first frame, relative to stream 0
+        uint64_t skippedFrames; // leading frames dropped for alignment
+        double residualStart;   // offset to stream 0 in frames at output frame 0
+        double residualEnd;     // offset to stream 0 in frames at the last output frame, NAN without end timestamp
+        uint64_t droppedFrames; // frames lost because the ring was full
+        bool fromTimestamp;     // anchored by a stream timestamp, not by the read return time
+    };
+
+    MultiSourceAligner(const size_t streamCount, const size_t frameSize, const int32_t sampleRate,
+                       const size_t ringFrames)
+        : mFrameSize(frameSize), mSampleRate(sampleRate), mRingFrames(ringFrames) {
+        for (size_t i = 0; i < streamCount; ++i) {
+            mStreams.push_back(std::make_unique<Stream>());
+            mStreams.back()->ring.resize(ringFrames * frameSize);
+        }
+    }
+    ~MultiSourceAligner() = default;
+
+    MultiSourceAligner(const MultiSourceAligner&) = delete;
+    MultiSourceAligner& operator=(const MultiSourceAligner&) = delete;
+
+    size_t getStreamCount() const { return mStreams.size(); }
+    size_t getOutputFrameSize() const { return mFrameSize * mStreams.size(); }
+    bool isAligned() const { return mAligned; }
+    uint64_t getMergedFrames() const { return mMergedFrames; }
+
+    // Reader side: append captured frames. Frames that do not fit are dropped and counted; the stream is then
+    // early by that many frames, which shows in the end residual.
+    void push(const size_t index, const char* data, const size_t frames) {
+        Stream& stream = *mStreams[index];
+        const uint64_t writePos = stream.writePos.load(std::memory_order_relaxed);
+        const uint64_t readPos = stream.readPos.load(std::memory_order_acquire);
+        const size_t count = std::min(frames, mRingFrames - static_cast<size_t>(writePos - readPos));
+        for (size_t done = 0; done < count;) {
+            const size_t offset = static_cast<size_t>((writePos + done) % mRingFrames);
+            const size_t chunk = std::min(count - done, mRingFrames - offset);
+            memcpy(&stream.ring[offset * mFrameSize], data + done * mFrameSize, chunk * mFrameSize);
+            done += chunk;
+        }
+        stream.writePos.store(writePos + count, std::memory_order_release);
+        stream.droppedFrames.fetch_add(frames - count, std::memory_order_relaxed);
+    }
+
+    // Reader side: tie the stream to the monotonic clock, position counts the frames pushed so far
+    void anchor(const size_t index, const int64_t position, const int64_t timeNs, const bool fromTimestamp) {
+        Stream& stream = *mStreams[index];
+        stream.firstFrameNs = timeNs - position * 1000000000LL / mSampleRate;
+        stream.fromTimestamp = fromTimestamp;
+        stream.anchored.store(true, std::memory_order_release);
+    }
+    bool isAnchored(const size_t index) const { return mStreams[index]->anchored.load(std::memory_order_acquire); }
+
+    // Reader side, after its last read: timestamp the end residual is measured with
+    void setEndTimestamp(const size_t index, const int64_t position, const int64_t timeNs) {
+        Stream& stream = *mStreams[index];
+        stream.endPosition = position;
+        stream.endTimeNs = timeNs;
+        stream.hasEndTimestamp = true;
+    }
+
+    // Writer side: interleave up to maxFrames aligned frames into out. Returns the frames merged, 0 until every
+    // stream is anchored and has data past its skipped frames.
+    size_t merge(char* out, const size_t maxFrames) {
+        if (!mAligned && !align()) {
+            return 0;
+        }
+        size_t frames = maxFrames;
+        for (const std::unique_ptr<Stream>& stream : mStreams) {
+            uint64_t readPos = stream->readPos.load(std::memory_order_relaxed);
+            const uint64_t writePos = stream->writePos.load(std::memory_order_acquire);
+            if (readPos < stream->skippedFrames) {
+                readPos = std::min(stream->skippedFrames, writePos);
+                stream->readPos.store(readPos, std::memory_order_release);
+            }
+            frames = (readPos < stream->skippedFrames) ? 0 : std::min(frames, static_cast<size_t>(writePos - readPos));
+        }
+        if (frames == 0) {
+            return 0;
+        }
+
+        const size_t outFrameSize = getOutputFrameSize();
+        for (size_t i = 0; i < mStreams.size(); ++i) {
+            Stream& stream = *mStreams[i];
+            const uint64_t readPos = stream.readPos.load(std::memory_order_relaxed);
+            for (size_t f = 0; f < frames; ++f) {
+                memcpy(out + f * outFrameSize + i * mFrameSize,
+                       &stream.ring[static_cast<size_t>((readPos + f) % mRingFrames) * mFrameSize], mFrameSize);
+            }
+            stream.readPos.store(readPos + frames, std::memory_order_release);
+        }
+        mMergedFrames += frames;
+        return frames;
+    }
+
+    // Writer side, after the readers joined
+    StreamResult getResult(const size_t index) const {
+        const Stream& stream = *mStreams[index];
+        const Stream& reference = *mStreams[0];
+        StreamResult result{};
+        result.startOffsetMs = (stream.firstFrameNs - reference.firstFrameNs) / 1e6;
+        result.skippedFrames = stream.skippedFrames;
+        result.residualStart = (frameTimeNs(stream, 0) - frameTimeNs(reference, 0)) * mSampleRate / 1e9;
+        result.residualEnd = NAN;
+        if (stream.hasEndTimestamp && reference.hasEndTimestamp) {
+            result.residualEnd = (endFrameTimeNs(stream) - endFrameTimeNs(reference)) * mSampleRate / 1e9;
+        }
+        result.droppedFrames = stream.droppedFrames.load(std::memory_order_relaxed);
+        result.fromTimestamp = stream.fromTimestamp;
+        return result;
+    }
+
+private:
+    struct Stream {
+        std::vector<char> ring;
+        std::atomic<uint64_t> writePos{0}; // frames pushed, written by the reader
+        std::atomic<uint64_t> readPos{0};  // frames consumed or skipped, written by the writer
+        std::atomic<uint64_t> droppedFrames{0};
+        std::atomic<bool> anchored{false};
+        int64_t firstFrameNs = 0; // published by anchored
+        bool fromTimestamp = false;
+        uint64_t skippedFrames = 0;
+        bool hasEndTimestamp = false;
+        int64_t endPosition = 0;
+        int64_t endTimeNs = 0;
+    };
+
+    // Start stream 0 at its first frame not earlier than the first frame of the latest stream, then skip every
+    // other stream to the frame nearest to that instant
+    bool align() {
+        int64_t latestNs = INT64_MIN;
+        for (const std::unique_ptr<Stream>& stream : mStreams) {
+            if (!stream->anchored.load(std::memory_order_acquire)) {
+                return false;
+            }
+            latestNs = std::max(latestNs, stream->firstFrameNs);
+        }
+        Stream& reference = *mStreams[0];
+        reference.skippedFrames =
+            static_cast<uint64_t>(std::ceil((latestNs - reference.firstFrameNs) * 1e-9 * mSampleRate));
+        const double startNs = frameTimeNs(reference, 0);
+        for (size_t i = 1; i < mStreams.size(); ++i) {
+            const double skipped = (startNs - mStreams[i]->firstFrameNs) * 1e-9 * mSampleRate;
+            mStreams[i]->skippedFrames = static_cast<uint64_t>(std::max<long long>(llround(skipped), 0));
+        }
+        mAligned = true;
+        return true;
+    }
+
+    // Capture time of output frame n according to the anchor
+    double frameTimeNs(const Stream& stream, const uint64_t n) const {
+        return stream.firstFrameNs + (stream.skippedFrames + n) * 1e9 / mSampleRate;
+    }
+
+    // Capture time of the last output frame according to the end timestamp, so drift and lost frames count
+    double endFrameTimeNs(const Stream& stream) const {
+        const uint64_t frame =
+            stream.skippedFrames + mMergedFrames + stream.droppedFrames.load(std::memory_order_relaxed);
+        return stream.endTimeNs + (static_cast<double>(frame) - stream.endPosition) * 1e9 / mSampleRate;
+    }
+
+    size_t mFrameSize;
+    int32_t mSampleRate;
+    size_t mRingFrames;
+    std::vector<std::unique_ptr<Stream>> mStreams;
+    bool mAligned = false;
+    uint64_t mMergedFrames = 0;
+};
+
+/************************** Capture Trigger ******************************/
+enum TriggerReason {
+    TRIGGER_NONE = 0,
+    TRIGGER_LEVEL,   // peak above the level threshold
+    TRIGGER_STEP,    // sample-to-sample step above the step threshold (pop, splice, lost samples)
+    TRIGGER_CLIP,    // run of full-scale samples
+    TRIGGER_OVERRUN, // the stream reported lost frames
+    TRIGGER_SIGNAL,  // SIGUSR1
+    TRIGGER_COMMAND, // line written to the trigger FIFO
+};
+
+static const char* triggerReasonName(const TriggerReason reason) {
+    static const char* const kNames[] = {"none", "level", "step", "clip", "overrun", "signal", "command"};
+    return kNames[reason];
+}
+
+// Signal detectors of the pre-trigger capture, run on every captured buffer in a single pass: per sample a
+// decode, two compares and a clip run counter. A step is the difference between consecutive samples of one
+// channel; a pop or a dropout jumps by far more than any sine of the same level can move in one sample.
+class TriggerDetector {
+public:
+    // Thresholds in dBFS, 0 disables the detector
+    TriggerDetector(const audio_format_t format,
+                    const int32_t channelCount,
+                    const float levelDb,
+                    const float stepDb,
+                    const bool clip)
+        : mChannelCount(channelCount), mLevel(levelDb < 0.0f ? std::pow(10.0f, levelDb / 20.0f) : INFINITY),
+          mStep(stepDb < 0.0f ? std::pow(10.0f, stepDb / 20.0f) : INFINITY), mClipRun(clip ? kClipRun : UINT32_MAX),
+          mLastSamples(channelCount, 0.0f), mClipRuns(channelCount, 0) {
+        // Select the kernel for the stream format once
+        dispatchFormat(format, [this](auto traits) {
+            mScan = &TriggerDetector::scanFrames<decltype(traits)>;
+            mSampleSize = decltype(traits)::kBytes;
+        });
+    }
+
+    bool isEnabled() const { return mLevel < INFINITY || mStep < INFINITY || mClipRun < UINT32_MAX; }
+
+    // Forget the previous samples, so the first step after a pause is not measured
+    void reset() {
+        mPrimed = false;
+        std::fill(mClipRuns.begin(), mClipRuns.end(), 0u);
+    }
+
+    // Scan one buffer; on a hit, getValue() is the peak or step (linear) or the clip run length and
+    // getFrame() the frame within the buffer. Returns TRIGGER_NONE for unsupported formats.
+    TriggerReason scan(const char* buffer, const size_t size) {
+        if (buffer == nullptr || mScan == nullptr || !isEnabled()) {
+            return TRIGGER_NONE;
+        }
+        return (this->*mScan)(buffer, size / (mSampleSize * mChannelCount));
+    }
+
+    float getValue() const { return mValue; }
+    size_t getFrame() const { return mFrame; }
+
+private:
+    static constexpr float kClipLevel = 0.99f; // within 0.1dB of full scale
+    static constexpr uint32_t kClipRun = 3;    // consecutive samples of one channel
+
+    template <typename T> TriggerReason scanFrames(const char* buffer, const size_t numFrames) {
+        const auto decode = [buffer](const size_t i) { return T::toFloat(T::load(buffer, i)); };
+        size_t frame = 0;
+        if (!mPrimed && numFrames > 0) {
+            for (int32_t ch = 0; ch < mChannelCount; ++ch) {
+                mLastSamples[ch] = decode(ch);
+            }
+            mPrimed = true;
+        }
+        for (; frame < numFrames; ++frame) {
+            for (int32_t ch = 0; ch < mChannelCount; ++ch) {
+                const float v = decode(frame * mChannelCount + ch);
+                const float magnitude = std::fabs(v);
+                const float step = std::fabs(v - mLastSamples[ch]);
+                mLastSamples[ch] = v;
+                mClipRuns[ch] = magnitude >= kClipLevel ? mClipRuns[ch] + 1 : 0;
+                if (magnitude >= mLevel) {
+                    return hit(TRIGGER_LEVEL, magnitude, frame);
+                }
+                if (step >= mStep) {
+                    return hit(TRIGGER_STEP, step, frame);
+                }
+                if (mClipRuns[ch] >= mClipRun) {
+                    return hit(TRIGGER_CLIP, static_cast<float>(mClipRuns[ch]), frame);
+                }
+            }
+        }
+        return TRIGGER_NONE;
+    }
+
+    TriggerReason hit(const TriggerReason reason, const float value, const size_t frame) {
+        mValue = value;
+        mFrame = frame;
+        return reason;
+    }
+
+    int32_t mChannelCount;
+    TriggerReason (TriggerDetector::*mScan)(const char*, size_t) = nullptr;
+    size_t mSampleSize = 0;
+    float mLevel;
+    float mStep;
+    uint32_t mClipRun;
+    std::vector<float> mLastSamples;
+    std::vector<uint32_t> mClipRuns;
+    bool mPrimed = false;
+    float mValue = 0.0f;
+    size_t mFrame = 0;
+};
+
+/************************** Audio Configuration ******************************/
+struct AudioConfig {
+    // Common parameters
+    AudioBackend backend = BACKEND_LEGACY;
+    int32_t sampleRate = 48000;
+    int32_t channelCount = 2;
+    audio_format_t format = AUDIO_FORMAT_PCM_16_BIT;
+    size_t minFrameCount = 0; // will be calculated
+    size_t frameCount = 0;    // stream buffer frames, 0 = derived from minFrameCount
+
+    // Recording parameters
+    audio_source_t inputSource = AUDIO_SOURCE_MIC;
+    audio_input_flags_t inputFlag = AUDIO_INPUT_FLAG_NONE;
+    int32_t durationSeconds = 0;     // 0 = unlimited
+    std::string recordFilePath = ""; // will be generated if empty
+
+    // Playback parameters
+    audio_usage_t usage = AUDIO_USAGE_MEDIA;
+    audio_output_flags_t outputFlag = AUDIO_OUTPUT_FLAG_NONE;
+    std::string playFilePath = "/data/audio_test.wav";
+    std::vector<std::string> playlistPaths{}; // -m7: directories, glob patterns, list files or WAV files
+
+    // Set params parameters
+    std::vector<int32_t> setParams{};
+    std::string paramList = "";     // batched "key=value;key=value" operations (-m100)
+    std::string paramFilePath = ""; // batched operations, one or more pairs per line (-m100)
+    int32_t paramCycles = 1;        // times the whole batch is sent
+    int32_t paramBatchSize = 0;     // keys per setParameters call, 0 = as many as can be coalesced
+
+    // Report parameters
+    std::string reportPath = ""; // machine-readable report output (empty = none)
+
+    // Benchmark parameters
+    int32_t benchRepetitions = 5;        // timed repetitions per case, median is reported
+    std::string benchBaselinePath = "";  // previous report to compare against (empty = no comparison)
+    float benchThresholdPercent = 10.0f; // allowed throughput drop before a case counts as regression
+
+    // Batch parameters
+    std::string batchScenarioPath = ""; // scenario file, one run configuration per line
+    int32_t batchJobs = 0;              // concurrent runs (-m201) or workers (-m205), 0 = 1 run / all cores
+
+    // File batch parameters
+    std::vector<std::string> fileBatchPaths{}; // -m205: directories, glob patterns, list files or WAV files
+    std::string fileBatchOp = "stats";         // -m205: stats, convert, hash or repair
+    std::string fileBatchOutDir = "";          // -m205: output directory of convert
+
+    // Startup profiling parameters
+    bool startupReport = false; // print the per-phase startup breakdown after the run
+    int32_t startupCycles = 0;  // open/start/stop cycles measured instead of streaming (0 = normal run)
+
+    // Buffer tuner parameters
+    int32_t tuneTarget = 1;                                           // tuned mode: 0=record, 1=play, 2=loopback
+    std::vector<int32_t> tuneFlags{};                                 // flags to sweep (empty = configured flag)
+    int32_t tuneIntervalMs = 1000;                                    // measured time per trial
+    int32_t tuneTrials = 2;                                           // consecutive clean trials to accept a size
+    std::string tuneFilePath = "/data/local/tmp/audio_test_tuning.txt"; // tuning results, one line per setup
+    bool useTuning = false;                                           // apply the saved buffer size and flags
+
+    // Live metrics parameters
+    std::string metricsPath = "";               // metrics page published by record/play/loopback (empty = none)
+    int32_t metricsIntervalMs = 0;              // publish/poll period, 0 = 100ms for writers, 1000ms for -m202
+    std::vector<std::string> metricsReadPaths{}; // metrics pages watched by -m202
+
+    // Bit-exact verification parameters
+    std::string patternOutPath = "";         // -m203: export the test pattern instead of verifying
+    std::vector<std::string> verifyPaths{}; // -m203: captured WAV files to verify
+
+    // Timestamp sidecar parameters
+    bool timestampSidecar = false;                // record/loopback: write "<wav>.ts" with one record per read
+    std::vector<std::string> timestampReadPaths{}; // -m204: sidecar files to dump
+
+    // Multi-source capture parameters
+    std::vector<int32_t> captureSources{}; // -m5: sources captured together, interleaved in this order
+    int32_t sourceStaggerMs = 0;           // -m5: delay between starting consecutive sources
+
+    // Pre-trigger capture parameters
+    int32_t preTriggerSeconds = 10;   // -m6: audio kept in memory and saved before a trigger
+    int32_t postTriggerSeconds = 5;   // -m6: audio saved after a trigger
+    float triggerLevelDb = 0.0f;      // -m6: peak threshold in dBFS (0 = off)
+    float triggerStepDb = 0.0f;       // -m6: sample-to-sample step threshold in dBFS (0 = off)
+    bool triggerClip = false;         // -m6: trigger on runs of full-scale samples
+    bool triggerOverrun = false;      // -m6: trigger when the stream reports lost frames
+    std::string triggerFifoPath = ""; // -m6: FIFO whose lines are trigger commands (empty = none)
+
+    // CPU accounting parameters (record/play/loopback/playlist/multi-source)
+    bool cpuUsage = false;       // report CPU time, context switches and faults per loop thread at exit
+    std::string cpuServer = "";  // also account this process by name, e.g. audioserver (empty = none)
+
+    // Level gate parameters (record mode)
+    float gateAttackDb = 0.0f;  // RMS level opening the gate in dBFS (0 = record everything)
+    float gateReleaseDb = 0.0f; // RMS level keeping the gate open in dBFS (0 = 6dB below attack)
+    int32_t gateAttackMs = 0;   // time at or above the attack level before the gate opens
+    int32_t gateHoldMs = 500;   // time below the release level before the gate closes
+    bool gateSplit = false;     // one numbered file per segment instead of a single file
+
+    // Duplex event loop parameters (loopback mode)
+    bool eventLoop = false;    // timer driven single-thread loop with non-blocking reads and writes
+    int32_t eventPeriodMs = 0; // timer period, 0 = half the transfer buffer duration
+
+    // Stdio streaming parameters
+    bool rawPcm = false; // record/play files are headerless PCM in the -r/-c/-f layout, also for "-"
+
+    // Spectrum monitor parameters (record/loopback)
+    bool spectrum = false;                   // analyze the capture on a side thread
+    std::vector<int32_t> spectrumChannels{}; // analyzed channels (empty = all)
+    int32_t spectrumFftSize = 4096;          // FFT points, power of two
+    float spectrumRate = 4.0f;               // analyses per second
+    std::string spectrumPath = "";           // binary spectrum file instead of console lines (empty = console)
+
+    // Clock drift parameters (-m9) and simulated device clocks
+    int32_t driftIntervalSeconds = 10; // time series period
+    double simInputPpm = 0.0;          // simulated capture clock offset
+    double simOutputPpm = 0.0;         // simulated render clock offset, also the pitch of the simulated capture tone
+
+    // DSP stage graph parameters (record/play/loopback)
+    std::string dspSpec = "";     // stages between source and sink, e.g. "hp:80,gain:-6" (empty = off)
+    int32_t dspBlockFrames = 256; // frames per processing block
+
+    // Routing test parameters (-m10)
+    bool routeStepped = false;     // one output channel at a time instead of all at once
+    int32_t routeStepMs = 1000;    // tone time per step, the first half allows for the round-trip latency
+    double routeIsolationDb = 0.0; // minimum isolation of every route (0 = no check)
+
+    // Stream trace parameters (record/play/loopback)
+    std::string tracePath = "";  // log every stream call into this file (empty = off)
+    std::string replayPath = ""; // trace replayed by the replay backend
+    bool replayRealtime = false; // replay with the recorded call timing instead of as fast as possible
+
+    // Capture fan-out parameters (-m8 server, -m206 client)
+    std::string fanoutSocketPath = "/data/local/tmp/audio_test_fanout.sock"; // '@name' = abstract socket
+    int32_t fanoutRingMs = 2000;                                             // shared ring length
+};
+
+/************************** AudioMode Definitions ******************************/
+enum AudioMode {
+    MODE_INVALID = -1,
+    MODE_RECORD = 0,
+    MODE_PLAY = 1,
+    MODE_LOOPBACK = 2,
+    MODE_TUNE = 3,
+    MODE_VERIFY = 4,
+    MODE_MULTI_CAPTURE = 5,
+    MODE_PRE_TRIGGER = 6,
+    MODE_PLAYLIST = 7,
+    MODE_FANOUT_SERVER = 8,
+    MODE_CLOCK_DRIFT = 9,
+    MODE_ROUTING = 10,
+    MODE_SET_PARAMS = 100,
+    MODE_BENCHMARK = 200,
+    MODE_BATCH = 201,
+    MODE_METRICS_READER = 202,
+    MODE_VERIFY_FILE = 203,
+    MODE_TIMESTAMP_DUMP = 204,
+    MODE_FILE_BATCH = 205,
+    MODE_FANOUT_CLIENT = 206,
+    MODE_SELF_TEST = 207
+};
+
+/************************** Level Gate ******************************/
+// Writes only the active regions of a recording. The RMS level of every captured buffer drives an attack/hold/
+// release gate: it opens once the level stayed at or above the attack threshold for the attack time, stays open
+// while the level is at or above the release threshold, and closes when it was below for the hold time. The
+// attack time plus kPreRollMs before the opening are kept in a small ring, so onsets are not cut. Segments go to
+// one WAV file or to numbered files; either way a "<file>.segments" list maps them to capture positions and time.
+class LevelGateWriter {
+public:
+    struct Segment {
+        uint64_t captureFrame; // position in the captured stream
+        int64_t realtimeNs;    // CLOCK_REALTIME of captureFrame
+        uint64_t fileFrame;    // position in the output file
+        uint64_t frames;
+        std::string path;
+    };
+
+    // Thresholds from config.gateAttackDb/gateReleaseDb, the release threshold defaults to 6dB below attack
+    explicit LevelGateWriter(const AudioConfig& config)
+        : mSampleRate(config.sampleRate), mChannelCount(config.channelCount), mFormat(config.format),
+          mFrameSize(audio_bytes_per_sample(config.format) * config.channelCount), mAttackDb(config.gateAttackDb),
+          mReleaseDb(config.gateReleaseDb < 0.0f ? config.gateReleaseDb : config.gateAttackDb - 6.0f),
+          mAttackFrames(static_cast<uint64_t>(config.gateAttackMs) * config.sampleRate / 1000),
+          mHoldFrames(static_cast<uint64_t>(config.gateHoldMs) * config.sampleRate / 1000), mSplit(config.gateSplit),
+          mPreRoll((mAttackFrames + static_cast<uint64_t>(kPreRollMs) * config.sampleRate / 1000) * mFrameSize) {}
+    ~LevelGateWriter() = default;
+
+    LevelGateWriter(const LevelGateWriter&) = delete;
+    LevelGateWriter& operator=(const LevelGateWriter&) = delete;
+
+    // Output is wavFile, or numbered files next to path when splitting
+    void open(WAVFile* wavFile, const std::string& path) {
+        mWavFile = wavFile;
+        mPath = path;
+        printf("Level gate: attack %.1f dBFS / %d ms, release %.1f dBFS, hold %d ms, %s\n", mAttackDb,
+               static_cast<int>(mAttackFrames * 1000 / mSampleRate), mReleaseDb,
+               static_cast<int>(mHoldFrames * 1000 / mSampleRate), mSplit ? "one file per segment" : "single file");
+    }
+
+    // Feed one captured buffer, false when writing failed
+    bool write(const char* buffer, const size_t size) {
+        const uint64_t frames = size / mFrameSize;
+        const uint64_t position = mCapturedBytes / mFrameSize;
+        mCapturedBytes += size;
+        const double meanSquare = AudioUtils::computeMeanSquare(buffer, size, mFormat);
+        const float levelDb = meanSquare > 0.0 ? static_cast<float>(10.0 * std::log10(meanSquare)) : -200.0f;
+
+        if (!mOpen) {
+            if (levelDb < mAttackDb) {
+                mAttackStart = UINT64_MAX;
+            } else if (mAttackStart == UINT64_MAX) {
+                mAttackStart = position;
+            }
+            if (mAttackStart == UINT64_MAX || position + frames - mAttackStart < mAttackFrames) {
+                storePreRoll(buffer, size);
+                return true;
+            }
+            mOpen = true;
+            mLastActive = position + frames;
+            if (!openSegment(position) || !writeOutput(buffer, size)) {
+                return false;
+            }
+            return true;
+        }
+
+        if (levelDb >= mReleaseDb) {
+            mLastActive = position + frames;
+        } else if (position + frames - mLastActive >= mHoldFrames) {
+            mOpen = false;
+            mAttackStart = UINT64_MAX;
+            closeSegment();
+            storePreRoll(buffer, size);
+            return true;
+        }
+        return writeOutput(buffer, size);
+    }
+
+    // Close the open segment, save the segment list and print the I/O savings
+    bool finish() {
+        if (mOpen) {
+            mOpen = false;
+            closeSegment();
+        }
+        const bool saved = saveSegmentList();
+        printf("Level gate: %zu segment(s), written %.2f MB of %.2f MB captured (%.1f%%)\n", mSegments.size(),
+               mWrittenBytes / (1024.0 * 1024.0), mCapturedBytes / (1024.0 * 1024.0),
+               mCapturedBytes > 0 ? 100.0 * mWrittenBytes / mCapturedBytes : 0.0);
+        return saved;
+    }
+
+    uint64_t getCapturedBytes() const { return mCapturedBytes; }
+    uint64_t getWrittenBytes() const { return mWrittenBytes; }
+    const std::vector<Segment>& getSegments() const { return mSegments; }
+
+private:
+    static constexpr int32_t kPreRollMs = 100; // kept before the attack started
+
+    // Closed time goes to the pre-roll ring, oldest bytes are overwritten
+    void storePreRoll(const char* buffer, const size_t size) {
+        const size_t capacity = mPreRoll.size();
+        if (capacity == 0) {
+            return;
+        }
+        const size_t skip = size > capacity ? size - capacity : 0;
+        for (size_t done = skip; done < size;) {
+            const size_t chunk = std::min(size - done, capacity - mPreRollPos);
+            memcpy(&mPreRoll[mPreRollPos], buffer + done, chunk);
+            mPreRollPos = (mPreRollPos + chunk) % capacity;
+            done += chunk;
+        }
+        mPreRollFill = std::min(mPreRollFill + size - skip, capacity);
+    }
+
+    // Start a segment at the pre-roll, which covers the attack time and kPreRollMs before it
+    bool openSegment(const uint64_t position) {
+        const uint64_t preRollFrames = mPreRollFill / mFrameSize;
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        Segment segment{};
+        segment.captureFrame = position - preRollFrames;
+        // Now is the end of the current buffer
+        segment.realtimeNs = static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec -
+                             static_cast<int64_t>((mCapturedBytes / mFrameSize - segment.captureFrame) * 1000000000ULL /
+                                                  mSampleRate);
+        segment.fileFrame = mSplit ? 0 : mWrittenBytes / mFrameSize;
+        segment.path = mPath;
+        if (mSplit) {
+            segment.path = makeSegmentPath(mSegments.size() + 1);
+            if (!mSegmentFile.createForWriting(segment.path, mSampleRate, mChannelCount,
+                                               audio_bytes_per_sample(mFormat) * 8)) {
+                sLogger.error("Can't create segment file: %s\n", segment.path.c_str());
+                return false;
+            }
+        }
+        mSegments.push_back(segment);
+        sLogger.printTimed("Gate open at %.3f s\n", static_cast<double>(segment.captureFrame) / mSampleRate);
+
+        // Oldest pre-roll bytes first
+        const size_t start = (mPreRollPos + mPreRoll.size() - mPreRollFill) % std::max<size_t>(mPreRoll.size(), 1);
+        const size_t first = std::min(mPreRollFill, mPreRoll.size() - start);
+        const bool written =
+            writeOutput(mPreRoll.data() + start, first) && writeOutput(mPreRoll.data(), mPreRollFill - first);
+        mPreRollFill = 0;
+        return written;
+    }
+
+    void closeSegment() {
+        Segment& segment = mSegments.back();
+        sLogger.printTimed("Gate closed, segment of %.3f s\n", static_cast<double>(segment.frames) / mSampleRate);
+        if (mSplit) {
+            mSegmentFile.finalize();
+        }
+    }
+
+    bool writeOutput(const char* data, const size_t size) {
+        if (size == 0) {
+            return true;
+        }
+        WAVFile& file = mSplit ? mSegmentFile : *mWavFile;
+        if (file.writeData(data, size) != size) {
+            sLogger.error("Failed to save audio data to file\n");
+            return false;
+        }
+        mWrittenBytes += size;
+        mSegments.back().frames += size / mFrameSize;
+        return true;
+    }
+
+    std::string makeSegmentPath(const size_t index) const {
+        std::string base = mPath;
+        const size_t extension = base.rfind(".wav");
+        if (extension != std::string::npos && extension + 4 == base.size()) {
+            base.resize(extension);
+        }
+        return String8::format("%s_%03zu.wav", base.c_str(), index).c_str();
+    }
+
+    bool saveSegmentList() const {
+        const std::string listPath = mPath + ".segments";
+        std::ofstream list(listPath, std::ios::out | std::ios::trunc);
+        if (!list.is_open()) {
+            printf("Error: Can't create segment list: %s\n", listPath.c_str());
+            return false;
+        }
+        list << "# segment\tcapture_frame\tcapture_time\tfile\tfile_frame\tframes\tseconds\n";
+        for (size_t i = 0; i < mSegments.size(); ++i) {
+            const Segment& segment = mSegments[i];
+            list << String8::format("%zu\t%" PRIu64 "\t%s\t%s\t%" PRIu64 "\t%" PRIu64 "\t%.3f\n", i + 1,
+                                    segment.captureFrame, AudioUtils::formatWallTime(segment.realtimeNs).c_str(),
+                                    segment.path.c_str(), segment.fileFrame, segment.frames,
+                                    static_cast<double>(segment.frames) / mSampleRate)
+                        .c_str();
+        }
+        printf("Segment list saved: %s\n", listPath.c_str());
+        return list.good();
+    }
+
+    int32_t mSampleRate;
+    int32_t mChannelCount;
+    audio_format_t mFormat;
+    size_t mFrameSize;
+    float mAttackDb;
+    float mReleaseDb;
+    uint64_t mAttackFrames;
+    uint64_t mHoldFrames;
+    bool mSplit;
+
+    WAVFile* mWavFile = nullptr;
+    WAVFile mSegmentFile;
+    std::string mPath;
+    std::vector<char> mPreRoll;
+    size_t mPreRollPos = 0;
+    size_t mPreRollFill = 0;
+
+    bool mOpen = false;
+    uint64_t mAttackStart = UINT64_MAX; // capture frame the level first reached the attack threshold
+    uint64_t mLastActive = 0;           // end of the last buffer at or above the release threshold
+    uint64_t mCapturedBytes = 0;
+    uint64_t mWrittenBytes = 0;
+    std::vector<Segment> mSegments;
+};
+
+/************************** Audio Parameter Manager ******************************/
+static const String8 PARAM_OPEN_SOURCE = String8("open_source");   // Open source parameter name
+static const String8 PARAM_CLOSE_SOURCE = String8("close_source"); // Close source parameter name
+static const String8 PARAM_CHANNEL_MASK = String8("channel_mask"); // Channel mask parameter name
+
+class AudioParameterManager {
+public:
+    explicit AudioParameterManager(const AudioConfig& config) : mConfig(config) {}
+    ~AudioParameterManager() = default;
+
+    // Disable copy operations to prevent issues with configuration references
+    AudioParameterManager(const AudioParameterManager&) = delete;
+    AudioParameterManager& operator=(const AudioParameterManager&) = delete;
+
+    // Set open source parameter with specific audio usage
+    void setOpenSourceWithUsage(audio_usage_t usage) {
+        setSystemParameter(PARAM_OPEN_SOURCE, audioUsageToString(usage));
+    }
+
+    // Set close source parameter with specific audio usage
+    void setCloseSourceWithUsage(audio_usage_t usage) {
+        setSystemParameter(PARAM_CLOSE_SOURCE, audioUsageToString(usage));
+    }
+
+    // One AudioSystem::setParameters round trip with "key1=value1;key2=value2", returns its status
+    status_t setSystemParameters(const String8& keyValuePairs) {
+#if ENABLE_SET_PARAMS
+        return AudioSystem::setParameters(keyValuePairs);
+#else
+        return NO_ERROR;
+#endif
+    }
+
+    // Whether this build sends parameters at all
+    static bool isEnabled() { return ENABLE_SET_PARAMS != 0; }
+
+    // Value of open_source/close_source for an audio usage
+    String8 getUsageValue(audio_usage_t usage) { return audioUsageToString(usage); }
+
+#ifndef AUDIO_TEST_CLIENT_HOST
+    // Set channel mask parameter for AudioTrack
+    void setChannelMask(const sp<AudioTrack>& audioTrack, audio_channel_mask_t channelMask) {
+        setAudioTrackParameter(audioTrack, PARAM_CHANNEL_MASK, String8::format("%d", channelMask));
+    }
+#endif
+
+private:
+    AudioConfig mConfig;
+
+    // Unified interface for AudioSystem::setParameters
+    void setSystemParameter(const String8& key, const String8& value) {
+#if ENABLE_SET_PARAMS
+        AudioParameter audioParam;
+        audioParam.add(key, value);
+        String8 paramString = audioParam.toString();
+        AudioSystem::setParameters(paramString);
+        printf("Set parameter: %s\n", paramString.c_str());
+#endif
+    }
+
+#ifndef AUDIO_TEST_CLIENT_HOST
+    // Unified interface for audioTrack->setParameters
+    void setAudioTrackParameter(const sp<AudioTrack>& audioTrack, const String8& key, const String8& value) {
+#if ENABLE_SET_PARAMS
+        AudioParameter audioParam;
+        audioParam.add(key, value);
+        String8 paramString = audioParam.toString();
+        audioTrack->setParameters(paramString);
+        printf("Set parameter: %s\n", paramString.c_str());
+#endif
+    }
+#endif
+
+    // Convert audio_usage_t enum to string representation
+    String8 audioUsageToString(audio_usage_t usage) {
+        static const std::unordered_map<audio_usage_t, const char*> usageMap = {
+            // Basic usage types (Android 16 AUDIO_USAGE_LIST_NO_SYS_DEF)
+            {AUDIO_USAGE_UNKNOWN, "AUDIO_USAGE_UNKNOWN"},
+            {AUDIO_USAGE_MEDIA, "AUDIO_USAGE_MEDIA"},
+            {AUDIO_USAGE_VOICE_COMMUNICATION, "AUDIO_USAGE_VOICE_COMMUNICATION"},
+            {AUDIO_USAGE_VOICE_COMMUNICATION_SIGNALLING, "AUDIO_USAGE_VOICE_COMMUNICATION_SIGNALLING"},
+            {AUDIO_USAGE_ALARM, "AUDIO_USAGE_ALARM"},
+            {AUDIO_USAGE_NOTIFICATION, "AUDIO_USAGE_NOTIFICATION"},
+            {AUDIO_USAGE_NOTIFICATION_TELEPHONY_RINGTONE, "AUDIO_USAGE_NOTIFICATION_TELEPHONY_RINGTONE"},
+            {AUDIO_USAGE_NOTIFICATION_EVENT, "AUDIO_USAGE_NOTIFICATION_EVENT"},
+            {AUDIO_USAGE_ASSISTANCE_ACCESSIBILITY, "AUDIO_USAGE_ASSISTANCE_ACCESSIBILITY"},
+            {AUDIO_USAGE_ASSISTANCE_NAVIGATION_GUIDANCE, "AUDIO_USAGE_ASSISTANCE_NAVIGATION_GUIDANCE"},
+            {AUDIO_USAGE_ASSISTANCE_SONIFICATION, "AUDIO_USAGE_ASSISTANCE_SONIFICATION"},
+            {AUDIO_USAGE_GAME, "AUDIO_USAGE_GAME"},
+            {AUDIO_USAGE_VIRTUAL_SOURCE, "AUDIO_USAGE_VIRTUAL_SOURCE"},
+            {AUDIO_USAGE_ASSISTANT, "AUDIO_USAGE_ASSISTANT"},
+            {AUDIO_USAGE_CALL_ASSISTANT, "AUDIO_USAGE_CALL_ASSISTANT"},
+
+            // System usage types (available when not AUDIO_NO_SYSTEM_DECLARATIONS)
+            {AUDIO_USAGE_NOTIFICATION_COMMUNICATION_REQUEST, "AUDIO_USAGE_NOTIFICATION_COMMUNICATION_REQUEST"},
+            {AUDIO_USAGE_NOTIFICATION_COMMUNICATION_INSTANT, "AUDIO_USAGE_NOTIFICATION_COMMUNICATION_INSTANT"},
+            {AUDIO_USAGE_NOTIFICATION_COMMUNICATION_DELAYED, "AUDIO_USAGE_NOTIFICATION_COMMUNICATION_DELAYED"},
+
+            // High-value usage types (Android Automotive and special scenarios)
+            {AUDIO_USAGE_EMERGENCY, "AUDIO_USAGE_EMERGENCY"},
+            {AUDIO_USAGE_SAFETY, "AUDIO_USAGE_SAFETY"},
+            {AUDIO_USAGE_VEHICLE_STATUS, "AUDIO_USAGE_VEHICLE_STATUS"},
+            {AUDIO_USAGE_ANNOUNCEMENT, "AUDIO_USAGE_ANNOUNCEMENT"},
+            // {AUDIO_USAGE_SPEAKER_CLEANUP, "AUDIO_USAGE_SPEAKER_CLEANUP"},
+        };
+        const char* usageName = "AUDIO_USAGE_UNKNOWN";
+        const auto it = usageMap.find(usage);
+        if (it != usageMap.end()) {
+            usageName = it->second;
+        }
+        return String8::format("0:%s", usageName);
+    }
+};
+
+/************************** Audio Stream Backends ******************************/
+// Capture stream interface used by the operation loops, implemented by AudioRecord and stand-in backends
+class AudioInputStream {
+public:
+    virtual ~AudioInputStream() = default;
+
+    virtual const char* getName() const = 0;
+    virtual status_t start() = 0;
+    virtual void stop() = 0;
+    // Same contract as AudioRecord::read: bytes read, 0 if nothing available (non-blocking), < 0 on error
+    virtual ssize_t read(void* buffer, size_t size, bool blocking = true) = 0;
+    // Frames lost to overrun since start()
+    virtual uint32_t getOverrunFrames() = 0;
+    virtual size_t getFrameCount() const = 0;
+    // Frames captured by the device and the CLOCK_MONOTONIC time of that position, false if not available
+    virtual bool getTimestamp(int64_t& position, int64_t& timeNs) = 0;
+};
+
+// Render stream interface used by the operation loops, implemented by AudioTrack and stand-in backends
+class AudioOutputStream {
+public:
+    virtual ~AudioOutputStream() = default;
+
+    virtual const char* getName() const = 0;
+    virtual status_t start() = 0;
+    virtual void stop() = 0;
+    // Same contract as AudioTrack::write: bytes written, 0 if no space (non-blocking), < 0 on error
+    virtual ssize_t write(const void* buffer, size_t size, bool blocking = true) = 0;
+    // Underrun events since start()
+    virtual uint32_t getUnderrunCount() = 0;
+    virtual size_t getFrameCount() const = 0;
+    // Frames presented by the device and the CLOCK_MONOTONIC time of that position, false if not available
+    virtual bool getTimestamp(int64_t& position, int64_t& timeNs) = 0;
+};
+
+#ifndef AUDIO_TEST_CLIENT_HOST
+// AudioRecord backed capture stream
+class AudioRecordStream : public AudioInputStream {
+public:
+    explicit AudioRecordStream(const sp<AudioRecord>& audioRecord) : mAudioRecord(audioRecord) {}
+    ~AudioRecordStream() override = default;
+
+    AudioRecordStream(const AudioRecordStream&) = delete;
+    AudioRecordStream& operator=(const AudioRecordStream&) = delete;
+
+    const char* getName() const override { return "AudioRecord"; }
+    status_t start() override {
+        mAudioRecord->getInputFramesLost(); // counter resets on read, discard frames lost before this run
+        mOverrunFrames = 0;
+        return mAudioRecord->start();
+    }
+    void stop() override { mAudioRecord->stop(); }
+    ssize_t read(void* buffer, size_t size, bool blocking) override {
+        // A non-blocking read with no data returns WOULD_BLOCK on some releases, which is not an error here
+        const ssize_t bytes = mAudioRecord->read(buffer, size, blocking);
+        return bytes == WOULD_BLOCK ? 0 : bytes;
+    }
+    uint32_t getOverrunFrames() override {
+        mOverrunFrames += mAudioRecord->getInputFramesLost();
+        return mOverrunFrames;
+    }
+    size_t getFrameCount() const override { return mAudioRecord->frameCount(); }
+    bool getTimestamp(int64_t& position, int64_t& timeNs) override {
+        ExtendedTimestamp timestamp;
+        return mAudioRecord->getTimestamp(&timestamp) == NO_ERROR &&
+               timestamp.getBestTimestamp(&position, &timeNs, ExtendedTimestamp::TIMEBASE_MONOTONIC) == NO_ERROR;
+    }
+
+    const sp<AudioRecord>& getAudioRecord() const { return mAudioRecord; }
+
+private:
+    sp<AudioRecord> mAudioRecord;
+    uint32_t mOverrunFrames = 0;
+};
+
+// AudioTrack backed render stream
+class AudioTrackStream : public AudioOutputStream {
+public:
+    explicit AudioTrackStream(const sp<AudioTrack>& audioTrack) : mAudioTrack(audioTrack) {}
+    ~AudioTrackStream() override = default;
+
+    AudioTrackStream(const AudioTrackStream&) = delete;
+    AudioTrackStream& operator=(const AudioTrackStream&) = delete;
+
+    const char* getName() const override { return "AudioTrack"; }
+    status_t start() override {
+        mUnderrunBase = mAudioTrack->getUnderrunCount(); // counter is cumulative over the track lifetime
+        return mAudioTrack->start();
+    }
+    void stop() override { mAudioTrack->stop(); }
+    ssize_t write(const void* buffer, size_t size, bool blocking) override {
+        // Same for a non-blocking write into a full buffer
+        const ssize_t bytes = mAudioTrack->write(buffer, size, blocking);
+        return bytes == WOULD_BLOCK ? 0 : bytes;
+    }
+    uint32_t getUnderrunCount() override { return mAudioTrack->getUnderrunCount() - mUnderrunBase; }
+    size_t getFrameCount() const override { return mAudioTrack->frameCount(); }
+    bool getTimestamp(int64_t& position, int64_t& timeNs) override {
+        AudioTimestamp timestamp;
+        if (mAudioTrack->getTimestamp(timestamp) != NO_ERROR) {
+            return false;
+        }
+        position = timestamp.mPosition;
+        timeNs = timestamp.mTime.tv_sec * 1000000000LL + timestamp.mTime.tv_nsec;
+        return true;
+    }
+
+    const sp<AudioTrack>& getAudioTrack() const { return mAudioTrack; }
+
+private:
+    sp<AudioTrack> mAudioTrack;
+    uint32_t mUnderrunBase = 0;
+};
+#endif // AUDIO_TEST_CLIENT_HOST
+
+// Stream clock shared by the simulated backends: maps CLOCK_MONOTONIC to a frame position. A device clock
+// offset in ppm makes the simulated device run that much faster than the nominal sample rate.
+class SimulatedStreamClock {
+public:
+    SimulatedStreamClock(const int32_t sampleRate, const bool realtime, const double ppm)
+        : mSampleRate(sampleRate), mRealtime(realtime), mOffset(ppm * 1e-6) {}
+
+    void start() { mStartNs = AudioUtils::getMonotonicNs(); }
+    bool isRealtime() const { return mRealtime; }
+
+    // Frames the simulated device has consumed or produced since start()
+    int64_t framesElapsed() const { return framesAt(AudioUtils::getMonotonicNs()); }
+    int64_t framesAt(const int64_t timeNs) const {
+        const int64_t nominal = (timeNs - mStartNs) * static_cast<int64_t>(mSampleRate) / 1000000000LL;
+        return nominal + std::llround(nominal * mOffset);
+    }
+
+    // CLOCK_MONOTONIC time at which the device position reaches frame
+    int64_t timeOfFrame(const int64_t frame) const {
+        const int64_t nominalNs = frame * 1000000000LL / mSampleRate;
+        return mStartNs + nominalNs - std::llround(nominalNs * (mOffset / (1.0 + mOffset)));
+    }
+
+    // Sleep until the device position reaches frame
+    void waitForFrame(const int64_t frame) const {
+        const int64_t deadlineNs = timeOfFrame(frame);
+        struct timespec ts;
+        ts.tv_sec = static_cast<time_t>(deadlineNs / 1000000000LL);
+        ts.tv_nsec = static_cast<long>(deadlineNs % 1000000000LL);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR && !sExitRequested) {
+        }
+    }
+
+private:
+    int32_t mSampleRate;
+    bool mRealtime;
+    double mOffset; // relative rate error of the simulated device clock
+    int64_t mStartNs = 0;
+};
+
+// Stand-in capture stream producing a 1kHz sine at -6dBFS, for running operations without an audio server.
+// The sine phase follows the monotonic clock, so streams started at different times carry the same waveform
+// at the same instant, like sources capturing one acoustic signal. The tone is generated on the simulated
+// output clock (--sim-ppm), as if the capture heard a 1kHz tone played by the simulated render device.
+// In realtime mode data accrues at the sample rate into a frameCount ring and overruns when not read in time;
+// otherwise reads return immediately.
+class SimulatedInputStream : public AudioInputStream {
+public:
+    SimulatedInputStream(const AudioConfig& config, const size_t frameCount, const bool realtime)
+        : mClock(config.sampleRate, realtime, config.simInputPpm), mSampleRate(config.sampleRate),
+          mToneHz(kToneHz * (1.0 + config.simOutputPpm * 1e-6)), mChannelCount(config.channelCount),
+          mFormat(config.format), mFrameSize(audio_bytes_per_sample(config.format) * config.channelCount),
+          mFrameCount(frameCount), mScratch(frameCount * config.channelCount) {}
+    ~SimulatedInputStream() override = default;
+
+    SimulatedInputStream(const SimulatedInputStream&) = delete;
+    SimulatedInputStream& operator=(const SimulatedInputStream&) = delete;
+
+    const char* getName() const override { return "SimulatedInput"; }
+    status_t start() override {
+        mClock.start();
+        mFramesRead = 0;
+        mFramesLost = 0;
+        return NO_ERROR;
+    }
+    void stop() override {}
+
+    ssize_t read(void* buffer, size_t size, bool blocking) override {
+        if (buffer == nullptr || mFrameSize == 0) {
+            return BAD_VALUE;
+        }
+        size_t framesWanted = size / mFrameSize;
+        if (mClock.isRealtime()) {
+            int64_t available = mClock.framesElapsed() - mFramesRead;
+            if (available > static_cast<int64_t>(mFrameCount)) {
+                // Ring overflowed: the oldest frames are gone, skip the read position past them
+                const int64_t lost = available - static_cast<int64_t>(mFrameCount);
+                mFramesLost += static_cast<uint64_t>(lost);
+                mFramesRead += lost;
+                available = static_cast<int64_t>(mFrameCount);
+            }
+            if (blocking && available < static_cast<int64_t>(framesWanted)) {
+                mClock.waitForFrame(mFramesRead + static_cast<int64_t>(framesWanted));
+                available = static_cast<int64_t>(framesWanted);
+            }
+            framesWanted = std::min(framesWanted, static_cast<size_t>(std::max<int64_t>(available, 0)));
+        }
+
+        // Synthesize in frameCount sized chunks through the float scratch buffer
+        char* out = static_cast<char*>(buffer);
+        size_t framesDone = 0;
+        while (framesDone < framesWanted) {
+            const size_t chunk = std::min(framesWanted - framesDone, mFrameCount);
+            for (size_t f = 0; f < chunk; ++f) {
+                const double t = mClock.timeOfFrame(mFramesRead + static_cast<int64_t>(f)) / 1e9;
+                const float v = static_cast<float>(0.5 * std::sin(2.0 * M_PI * mToneHz * t));
+                for (int32_t c = 0; c < mChannelCount; ++c) {
+                    mScratch[f * mChannelCount + c] = v;
+                }
+            }
+            AudioUtils::floatToPcm(mScratch.data(), out + framesDone * mFrameSize, chunk * mChannelCount, mFormat);
+            mFramesRead += static_cast<int64_t>(chunk);
+            framesDone += chunk;
+        }
+        return static_cast<ssize_t>(framesDone * mFrameSize);
+    }
+
+    uint32_t getOverrunFrames() override { return static_cast<uint32_t>(mFramesLost); }
+    size_t getFrameCount() const override { return mFrameCount; }
+    bool getTimestamp(int64_t& position, int64_t& timeNs) override {
+        if (mClock.isRealtime()) {
+            position = mClock.framesElapsed();
+            timeNs = mClock.timeOfFrame(position);
+        } else {
+            position = mFramesRead;
+            timeNs = AudioUtils::getMonotonicNs();
+        }
+        return true;
+    }
+
+private:
+    static constexpr double kToneHz = 1000.0;
+
+    SimulatedStreamClock mClock;
+    int32_t mSampleRate;
+    double mToneHz;
+    int32_t mChannelCount;
+    audio_format_t mFormat;
+    size_t mFrameSize;
+    size_t mFrameCount;
+    std::vector<float> mScratch;
+    int64_t mFramesRead = 0;
+    uint64_t mFramesLost = 0;
+};
+
+// Stand-in render stream that discards data. In realtime mode the device drains a frameCount buffer at the
+// sample rate, writes block while it is full, and an underrun is counted each time it runs dry.
+class SimulatedOutputStream : public AudioOutputStream {
+public:
+    SimulatedOutputStream(const AudioConfig& config, const size_t frameCount, const bool realtime)
+        : mClock(config.sampleRate, realtime, config.simOutputPpm),
+          mFrameSize(audio_bytes_per_sample(config.format) * config.channelCount), mFrameCount(frameCount) {}
+    ~SimulatedOutputStream() override = default;
+
+    SimulatedOutputStream(const SimulatedOutputStream&) = delete;
+    SimulatedOutputStream& operator=(const SimulatedOutputStream&) = delete;
+
+    const char* getName() const override { return "SimulatedOutput"; }
+    status_t start() override {
+        mClock.start();
+        mFramesWritten = 0;
+        mFramesConsumed = 0;
+        mSilenceFrames = 0;
+        mUnderrunCount = 0;
+        mInUnderrun = false;
+        return NO_ERROR;
+    }
+    void stop() override {}
+
+    ssize_t write(const void* buffer, size_t size, bool blocking) override {
+        if (buffer == nullptr || mFrameSize == 0) {
+            return BAD_VALUE;
+        }
+        const int64_t framesToWrite = static_cast<int64_t>(size / mFrameSize);
+        if (!mClock.isRealtime()) {
+            mFramesWritten += framesToWrite;
+            return static_cast<ssize_t>(framesToWrite * mFrameSize);
+        }
+
+        int64_t framesDone = 0;
+        while (framesDone < framesToWrite && !sExitRequested) {
+            updatePosition();
+            const int64_t space = static_cast<int64_t>(mFrameCount) - (mFramesWritten - mFramesConsumed);
+            if (space > 0) {
+                const int64_t chunk = std::min(space, framesToWrite - framesDone);
+                mFramesWritten += chunk;
+                framesDone += chunk;
+                mInUnderrun = false;
+                continue;
+            }
+            if (!blocking) {
+                break;
+            }
+            // Like AudioTrack, copy in pieces as space opens: wake once a quarter buffer (or the rest) is free
+            const int64_t needed = std::min(framesToWrite - framesDone,
+                                            std::max<int64_t>(static_cast<int64_t>(mFrameCount) / 4, 1));
+            mClock.waitForFrame(mFramesWritten - static_cast<int64_t>(mFrameCount) + needed + mSilenceFrames);
+        }
+        return static_cast<ssize_t>(framesDone * mFrameSize);
+    }
+
+    uint32_t getUnderrunCount() override {
+        updatePosition();
+        return mUnderrunCount;
+    }
+    size_t getFrameCount() const override { return mFrameCount; }
+    bool getTimestamp(int64_t& position, int64_t& timeNs) override {
+        if (!mClock.isRealtime()) {
+            position = mFramesWritten;
+            timeNs = AudioUtils::getMonotonicNs();
+            return true;
+        }
+        updatePosition();
+        position = mFramesConsumed;
+        timeNs = mClock.timeOfFrame(mFramesConsumed + mSilenceFrames);
+        return true;
+    }
+
+private:
+    // Advance the consumed position with time; when the queue runs dry the device plays silence instead
+    void updatePosition() {
+        int64_t consumed = mClock.framesElapsed() - mSilenceFrames;
+        if (consumed > mFramesWritten) {
+            if (mFramesWritten > 0 && !mInUnderrun) {
+                ++mUnderrunCount;
+                mInUnderrun = true;
+            }
+            mSilenceFrames += consumed - mFramesWritten;
+            consumed = mFramesWritten;
+        }
+        mFramesConsumed = consumed;
+    }
+
+    SimulatedStreamClock mClock;
+    size_t mFrameSize;
+    size_t mFrameCount;
+    int64_t mFramesWritten = 0;
+    int64_t mFramesConsumed = 0;
+    int64_t mSilenceFrames = 0; // frames of silence played during underruns
+    uint32_t mUnderrunCount = 0;
+    bool mInUnderrun = false;
+};
+
+// Lock-free single-producer single-consumer byte ring between a stream callback and an operation loop.
+// Both sides move whole frames, so the counts stay frame aligned.
+class CallbackRing {
+public:
+    explicit CallbackRing(const size_t capacity) : mData(capacity) {}
+
+    CallbackRing(const CallbackRing&) = delete;
+    CallbackRing& operator=(const CallbackRing&) = delete;
+
+    size_t capacity() const { return mData.size(); }
+    size_t available() const { return static_cast<size_t>(mWritten.load() - mRead.load()); }
+
+    // Only while the producer is stopped
+    void reset() {
+        mWritten = 0;
+        mRead = 0;
+    }
+
+    // Producer: copy in up to size bytes, returns the bytes copied
+    size_t write(const void* data, const size_t size) {
+        const uint64_t written = mWritten.load(std::memory_order_relaxed);
+        const size_t bytes =
+            std::min(size, mData.size() - static_cast<size_t>(written - mRead.load(std::memory_order_acquire)));
+        const size_t offset = static_cast<size_t>(written % mData.size());
+        const size_t first = std::min(bytes, mData.size() - offset);
+        memcpy(mData.data() + offset, data, first);
+        memcpy(mData.data(), static_cast<const char*>(data) + first, bytes - first);
+        mWritten.store(written + bytes, std::memory_order_release);
+        return bytes;
+    }
+
+    // Consumer: copy out up to size bytes, returns the bytes copied
+    size_t read(void* data, const size_t size) {
+        const uint64_t read = mRead.load(std::memory_order_relaxed);
+        const size_t bytes = std::min(size, static_cast<size_t>(mWritten.load(std::memory_order_acquire) - read));
+        const size_t offset = static_cast<size_t>(read % mData.size());
+        const size_t first = std::min(bytes, mData.size() - offset);
+        memcpy(data, mData.data() + offset, first);
+        memcpy(static_cast<char*>(data) + first, mData.data(), bytes - first);
+        mRead.store(read + bytes, std::memory_order_release);
+        return bytes;
+    }
+
+private:
+    std::vector<char> mData;
+    std::atomic<uint64_t> mWritten{0};
+    std::atomic<uint64_t> mRead{0};
+};
+
+// Device stream that runs its own thread and calls back once per burst: frames to consume (input) or to fill
+// (output). Implemented by AAudio on the device and by a clocked thread on the host.
+class CallbackStreamDriver {
+public:
+    // Receives the data callbacks, on the driver thread; must not block
+    class Client {
+    public:
+        virtual ~Client() = default;
+        virtual void onData(void* data, int32_t frames) = 0;
+    };
+
+    virtual ~CallbackStreamDriver() = default;
+
+    virtual const char* getName() const = 0;
+    virtual status_t start(Client* client) = 0;
+    // Returns once no callback runs any more
+    virtual void stop() = 0;
+    virtual int32_t getFramesPerBurst() const = 0;
+    // Device xruns since open
+    virtual int32_t getXRunCount() = 0;
+    virtual bool isDisconnected() const = 0;
+    virtual bool getTimestamp(int64_t& position, int64_t& timeNs) = 0;
+};
+
+#ifndef AUDIO_TEST_CLIENT_HOST
+// AAudio stream in exclusive low-latency mode with a data callback; the audio server maps the device buffer
+// (MMAP) when the HAL supports it. Whether MMAP and exclusive sharing were granted is printed on open.
+class AAudioStreamDriver : public CallbackStreamDriver {
+public:
+    ~AAudioStreamDriver() override {
+        if (mStream != nullptr) {
+            AAudioStream_close(mStream);
+        }
+    }
+
+    AAudioStreamDriver(const AAudioStreamDriver&) = delete;
+    AAudioStreamDriver& operator=(const AAudioStreamDriver&) = delete;
+
+    // Open a stream with exactly the configured rate, channels and format, nullptr on failure
+    static std::unique_ptr<AAudioStreamDriver> open(const AudioConfig& config, const bool input,
+                                                    const int32_t capacityFrames) {
+        const aaudio_format_t format = toAAudioFormat(config.format);
+        if (format == AAUDIO_FORMAT_INVALID) {
+            printf("Error: Format %d is not supported by AAudio\n", config.format);
+            return nullptr;
+        }
+        AAudioStreamBuilder* builder = nullptr;
+        aaudio_result_t result = AAudio_createStreamBuilder(&builder);
+        if (result != AAUDIO_OK) {
+            printf("Error: AAudio_createStreamBuilder failed: %s\n", AAudio_convertResultToText(result));
+            return nullptr;
+        }
+        std::unique_ptr<AAudioStreamDriver> driver(new AAudioStreamDriver(input));
+        AAudioStreamBuilder_setDirection(builder, input ? AAUDIO_DIRECTION_INPUT : AAUDIO_DIRECTION_OUTPUT);
+        AAudioStreamBuilder_setSharingMode(builder, AAUDIO_SHARING_MODE_EXCLUSIVE);
+        AAudioStreamBuilder_setPerformanceMode(builder, AAUDIO_PERFORMANCE_MODE_LOW_LATENCY);
+        AAudioStreamBuilder_setSampleRate(builder, config.sampleRate);
+        AAudioStreamBuilder_setChannelCount(builder, config.channelCount);
+        AAudioStreamBuilder_setFormat(builder, format);
+        AAudioStreamBuilder_setBufferCapacityInFrames(builder, capacityFrames);
+        if (input) {
+            // AAudio input presets share their values with the matching audio sources
+            static constexpr int32_t kPresets[] = {AAUDIO_INPUT_PRESET_GENERIC,
+                                                   AAUDIO_INPUT_PRESET_CAMCORDER,
+                                                   AAUDIO_INPUT_PRESET_VOICE_RECOGNITION,
+                                                   AAUDIO_INPUT_PRESET_VOICE_COMMUNICATION,
+                                                   AAUDIO_INPUT_PRESET_UNPROCESSED,
+                                                   AAUDIO_INPUT_PRESET_VOICE_PERFORMANCE};
+            if (std::find(std::begin(kPresets), std::end(kPresets), config.inputSource) != std::end(kPresets)) {
+                AAudioStreamBuilder_setInputPreset(builder, static_cast<aaudio_input_preset_t>(config.inputSource));
+            } else {
+                printf("Warning: Source %d has no AAudio input preset, using the default\n", config.inputSource);
+            }
+        } else {
+            AAudioStreamBuilder_setUsage(builder, static_cast<aaudio_usage_t>(config.usage));
+        }
+        AAudioStreamBuilder_setDataCallback(builder, onData, driver.get());
+        AAudioStreamBuilder_setErrorCallback(builder, onError, driver.get());
+        result = AAudioStreamBuilder_openStream(builder, &driver->mStream);
+        AAudioStreamBuilder_delete(builder);
+        if (result != AAUDIO_OK) {
+            printf("Error: AAudio %s stream open failed: %s\n", input ? "input" : "output",
+                   AAudio_convertResultToText(result));
+            ALOGE("AAudio %s stream open failed: %d", input ? "input" : "output", result);
+            return nullptr;
+        }
+
+        AAudioStream* stream = driver->mStream;
+        if (AAudioStream_getSampleRate(stream) != config.sampleRate ||
+            AAudioStream_getChannelCount(stream) != config.channelCount || AAudioStream_getFormat(stream) != format) {
+            printf("Error: AAudio opened %d Hz, %d channels, format %d instead of the requested configuration\n",
+                   AAudioStream_getSampleRate(stream), AAudioStream_getChannelCount(stream),
+                   AAudioStream_getFormat(stream));
+            return nullptr;
+        }
+        driver->mFramesPerBurst = AAudioStream_getFramesPerBurst(stream);
+        printf("Initialize AAudio %s: sampleRate=%d, channelCount=%d, format=%d, burst=%d, capacity=%d, "
+               "sharing=%s, MMAP=%s\n",
+               input ? "input" : "output", config.sampleRate, config.channelCount, config.format,
+               driver->mFramesPerBurst, AAudioStream_getBufferCapacityInFrames(stream),
+               AAudioStream_getSharingMode(stream) == AAUDIO_SHARING_MODE_EXCLUSIVE ? "exclusive" : "shared",
+               AAudioStream_isMMapUsed(stream) ? "yes" : "no");
+        return driver;
+    }
+
+    const char* getName() const override { return mInput ? "AAudioInput" : "AAudioOutput"; }
+
+    status_t start(Client* client) override {
+        mClient = client;
+        const aaudio_result_t result = AAudioStream_requestStart(mStream);
+        if (result != AAUDIO_OK) {
+            printf("Error: AAudioStream_requestStart failed: %s\n", AAudio_convertResultToText(result));
+            return INVALID_OPERATION;
+        }
+        return NO_ERROR;
+    }
+
+    void stop() override {
+        if (AAudioStream_requestStop(mStream) == AAUDIO_OK) {
+            aaudio_stream_state_t state = AAUDIO_STREAM_STATE_UNINITIALIZED;
+            AAudioStream_waitForStateChange(mStream, AAUDIO_STREAM_STATE_STOPPING, &state, kStopTimeoutNs);
+        }
+    }
+
+    int32_t getFramesPerBurst() const override { return mFramesPerBurst; }
+    int32_t getXRunCount() override { return AAudioStream_getXRunCount(mStream); }
+    bool isDisconnected() const override { return mDisconnected; }
+    bool getTimestamp(int64_t& position, int64_t& timeNs) override {
+        return AAudioStream_getTimestamp(mStream, CLOCK_MONOTONIC, &position, &timeNs) == AAUDIO_OK;
+    }
+
+private:
+    static constexpr int64_t kStopTimeoutNs = 200000000LL;
+
+    explicit AAudioStreamDriver(const bool input) : mInput(input) {}
+
+    static aaudio_format_t toAAudioFormat(const audio_format_t format) {
+        switch (format) {
+        case AUDIO_FORMAT_PCM_16_BIT:
+            return AAUDIO_FORMAT_PCM_I16;
+        case AUDIO_FORMAT_PCM_24_BIT_PACKED:
+            return AAUDIO_FORMAT_PCM_I24_PACKED;
+        case AUDIO_FORMAT_PCM_32_BIT:
+            return AAUDIO_FORMAT_PCM_I32;
+        case AUDIO_FORMAT_PCM_FLOAT:
+            return AAUDIO_FORMAT_PCM_FLOAT;
+        default:
+            return AAUDIO_FORMAT_INVALID;
+        }
+    }
+
+    static aaudio_data_callback_result_t onData(AAudioStream* stream, void* userData, void* audioData,
+                                                int32_t numFrames) {
+        AAudioStreamDriver* driver = static_cast<AAudioStreamDriver*>(userData);
+        if (driver->mClient != nullptr) {
+            driver->mClient->onData(audioData, numFrames);
+        }
+        return AAUDIO_CALLBACK_RESULT_CONTINUE;
+    }
+
+    // Called on a separate thread, e.g. when the device is disconnected; the stream cannot be restarted
+    static void onError(AAudioStream* stream, void* userData, aaudio_result_t error) {
+        AAudioStreamDriver* driver = static_cast<AAudioStreamDriver*>(userData);
+        driver->mDisconnected = true;
+        sLogger.error("%s error: %s\n", driver->getName(), AAudio_convertResultToText(error));
+    }
+
+    bool mInput;
+    AAudioStream* mStream = nullptr;
+    Client* mClient = nullptr;
+    int32_t mFramesPerBurst = 0;
+    std::atomic<bool> mDisconnected{false};
+};
+#endif // AUDIO_TEST_CLIENT_HOST
+
+// Host stand-in for the AAudio driver: a thread clocked to the sample rate calls back once per 2ms burst, with
+// the simulated 1kHz sine for input and a discarded buffer for output, so the callback streams run off-device
+class FakeCallbackDriver : public CallbackStreamDriver {
+public:
+    FakeCallbackDriver(const AudioConfig& config, const bool input)
+        : mClock(config.sampleRate, true, input ? config.simInputPpm : config.simOutputPpm), mInput(input),
+          mFramesPerBurst(std::max(config.sampleRate * kBurstMs / 1000, 1)),
+          mBuffer(static_cast<size_t>(mFramesPerBurst) * audio_bytes_per_sample(config.format) * config.channelCount),
+          mSource(config, static_cast<size_t>(mFramesPerBurst), false) {
+        printf("Initialize FakeAAudio %s: sampleRate=%d, channelCount=%d, format=%d, burst=%d\n",
+               input ? "input" : "output", config.sampleRate, config.channelCount, config.format, mFramesPerBurst);
+    }
+    ~FakeCallbackDriver() override { stop(); }
+
+    FakeCallbackDriver(const FakeCallbackDriver&) = delete;
+    FakeCallbackDriver& operator=(const FakeCallbackDriver&) = delete;
+
+    const char* getName() const override { return mInput ? "FakeAAudioInput" : "FakeAAudioOutput"; }
+
+    status_t start(Client* client) override {
+        stop();
+        mClient = client;
+        mPosition = 0;
+        mRunning = true;
+        mSource.start();
+        mClock.start();
+        mThread = std::thread(&FakeCallbackDriver::run, this);
+        return NO_ERROR;
+    }
+
+    void stop() override {
+        mRunning = false;
+        if (mThread.joinable()) {
+            mThread.join();
+        }
+    }
+
+    int32_t getFramesPerBurst() const override { return mFramesPerBurst; }
+    int32_t getXRunCount() override { return 0; }
+    bool isDisconnected() const override { return false; }
+    bool getTimestamp(int64_t& position, int64_t& timeNs) override {
+        position = mPosition;
+        timeNs = mClock.timeOfFrame(position);
+        return true;
+    }
+
+private:
+    static constexpr int32_t kBurstMs = 2;
+
+    // One callback each time the device clock completes a burst
+    void run() {
+        int64_t position = 0;
+        while (mRunning && !sExitRequested) {
+            mClock.waitForFrame(position + mFramesPerBurst);
+            if (mInput) {
+                mSource.read(mBuffer.data(), mBuffer.size(), true);
+            }
+            mClient->onData(mBuffer.data(), mFramesPerBurst);
+            position += mFramesPerBurst;
+            mPosition = position;
+        }
+    }
+
+    SimulatedStreamClock mClock;
+    bool mInput;
+    int32_t mFramesPerBurst;
+    std::vector<char> mBuffer;
+    SimulatedInputStream mSource; // unpaced, synthesizes the input bursts
+    Client* mClient = nullptr;
+    std::atomic<bool> mRunning{false};
+    std::atomic<int64_t> mPosition{0};
+    std::thread mThread;
+};
+
+// Capture stream on a callback driver: the callback copies every burst into a ring that read() drains.
+// Frames arriving while the ring is full are lost and reported as overrun frames, together with one burst for
+// every overrun the device reports.
+class CallbackInputStream : public AudioInputStream, private CallbackStreamDriver::Client {
+public:
+    CallbackInputStream(std::unique_ptr<CallbackStreamDriver> driver, const AudioConfig& config,
+                        const size_t frameCount)
+        : mDriver(std::move(driver)), mFrameSize(audio_bytes_per_sample(config.format) * config.channelCount),
+          mSampleRate(config.sampleRate), mFrameCount(frameCount), mRing(frameCount * mFrameSize) {}
+    ~CallbackInputStream() override { mDriver->stop(); }
+
+    CallbackInputStream(const CallbackInputStream&) = delete;
+    CallbackInputStream& operator=(const CallbackInputStream&) = delete;
+
+    const char* getName() const override { return mDriver->getName(); }
+    status_t start() override {
+        mRing.reset();
+        mLostFrames = 0;
+        mXRunBase = std::max(mDriver->getXRunCount(), 0);
+        return mDriver->start(this);
+    }
+    void stop() override { mDriver->stop(); }
+
+    // Blocking reads sleep for the missing frames instead of polling per burst
+    ssize_t read(void* buffer, size_t size, bool blocking) override {
+        if (buffer == nullptr || mFrameSize == 0) {
+            return BAD_VALUE;
+        }
+        if (mDriver->isDisconnected()) {
+            return DEAD_OBJECT;
+        }
+        size = size / mFrameSize * mFrameSize;
+        char* out = static_cast<char*>(buffer);
+        size_t done = mRing.read(out, size);
+        while (blocking && done < size && !sExitRequested && !mDriver->isDisconnected()) {
+            usleep(framesToUs((size - done) / mFrameSize));
+            done += mRing.read(out + done, size - done);
+        }
+        return static_cast<ssize_t>(done);
+    }
+
+    uint32_t getOverrunFrames() override {
+        const int32_t deviceXRuns = std::max(mDriver->getXRunCount() - mXRunBase, 0);
+        return static_cast<uint32_t>(mLostFrames.load() +
+                                     static_cast<uint64_t>(deviceXRuns) * mDriver->getFramesPerBurst());
+    }
+    size_t getFrameCount() const override { return mFrameCount; }
+    bool getTimestamp(int64_t& position, int64_t& timeNs) override { return mDriver->getTimestamp(position, timeNs); }
+
+private:
+    void onData(void* data, const int32_t frames) override {
+        const size_t bytes = static_cast<size_t>(frames) * mFrameSize;
+        const size_t copied = mRing.write(data, bytes);
+        if (copied < bytes) {
+            mLostFrames += (bytes - copied) / mFrameSize;
+        }
+    }
+
+    useconds_t framesToUs(const size_t frames) const {
+        return static_cast<useconds_t>(std::max<uint64_t>(frames * 1000000ULL / mSampleRate, 100));
+    }
+
+    std::unique_ptr<CallbackStreamDriver> mDriver;
+    size_t mFrameSize;
+    int32_t mSampleRate;
+    size_t mFrameCount;
+    CallbackRing mRing;
+    std::atomic<uint64_t> mLostFrames{0};
+    int32_t mXRunBase = 0; // device xruns before start(), the driver counts since open
+};
+
+// Render stream on a callback driver: write() fills a ring that the callback drains. When the ring runs dry
+// the callback plays silence and counts one underrun; underruns the device reports are added.
+class CallbackOutputStream : public AudioOutputStream, private CallbackStreamDriver::Client {
+public:
+    CallbackOutputStream(std::unique_ptr<CallbackStreamDriver> driver, const AudioConfig& config,
+                         const size_t frameCount)
+        : mDriver(std::move(driver)), mFrameSize(audio_bytes_per_sample(config.format) * config.channelCount),
+          mSampleRate(config.sampleRate), mFrameCount(frameCount), mRing(frameCount * mFrameSize) {}
+    ~CallbackOutputStream() override { mDriver->stop(); }
+
+    CallbackOutputStream(const CallbackOutputStream&) = delete;
+    CallbackOutputStream& operator=(const CallbackOutputStream&) = delete;
+
+    const char* getName() const override { return mDriver->getName(); }
+    status_t start() override {
+        mRing.reset();
+        mUnderrunCount = 0;
+        mPlaying = false;
+        mXRunBase = std::max(mDriver->getXRunCount(), 0);
+        return mDriver->start(this);
+    }
+    void stop() override { mDriver->stop(); }
+
+    // Blocking writes sleep until a quarter of the ring (or the rest of the data) has been played
+    ssize_t write(const void* buffer, size_t size, bool blocking) override {
+        if (buffer == nullptr || mFrameSize == 0) {
+            return BAD_VALUE;
+        }
+        if (mDriver->isDisconnected()) {
+            return DEAD_OBJECT;
+        }
+        size = size / mFrameSize * mFrameSize;
+        const char* in = static_cast<const char*>(buffer);
+        size_t done = mRing.write(in, size);
+        while (blocking && done < size && !sExitRequested && !mDriver->isDisconnected()) {
+            usleep(framesToUs(std::min((size - done) / mFrameSize, std::max<size_t>(mFrameCount / 4, 1))));
+            done += mRing.write(in + done, size - done);
+        }
+        return static_cast<ssize_t>(done);
+    }
+
+    uint32_t getUnderrunCount() override {
+        return mUnderrunCount + static_cast<uint32_t>(std::max(mDriver->getXRunCount() - mXRunBase, 0));
+    }
+    size_t getFrameCount() const override { return mFrameCount; }
+    bool getTimestamp(int64_t& position, int64_t& timeNs) override { return mDriver->getTimestamp(position, timeNs); }
+
+private:
+    void onData(void* data, const int32_t frames) override {
+        const size_t bytes = static_cast<size_t>(frames) * mFrameSize;
+        const size_t copied = mRing.read(data, bytes);
+        if (copied < bytes) {
+            memset(static_cast<char*>(data) + copied, 0, bytes - copied);
+            // Silence before the first write is the stream starting, not an underrun
+            if (mPlaying && !mInUnderrun) {
+                ++mUnderrunCount;
+            }
+            mInUnderrun = mPlaying;
+        } else {
+            mPlaying = true;
+            mInUnderrun = false;
+        }
+    }
+
+    useconds_t framesToUs(const size_t frames) const {
+        return static_cast<useconds_t>(std::max<uint64_t>(frames * 1000000ULL / mSampleRate, 100));
+    }
+
+    std::unique_ptr<CallbackStreamDriver> mDriver;
+    size_t mFrameSize;
+    int32_t mSampleRate;
+    size_t mFrameCount;
+    CallbackRing mRing;
+    std::atomic<uint32_t> mUnderrunCount{0};
+    bool mPlaying = false;    // callback thread only, after start()
+    bool mInUnderrun = false; // callback thread only
+    int32_t mXRunBase = 0;    // device xruns before start(), the driver counts since open
+};
+
+// Opened streams kept between runs of one process, keyed by stream configuration. A cached stream is handed
+// to one run at a time and returned after stop(), so consecutive runs with the same configuration skip the
+// AudioRecord/AudioTrack setup round trips.
+class AudioStreamCache {
+public:
+    AudioStreamCache() = default;
+    ~AudioStreamCache() = default;
+
+    AudioStreamCache(const AudioStreamCache&) = delete;
+    AudioStreamCache& operator=(const AudioStreamCache&) = delete;
+
+    // Take a cached input stream, restoring the minFrameCount it was opened with
+    std::unique_ptr<AudioInputStream> takeInput(const std::string& key, size_t& minFrameCount) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (auto it = mInputs.begin(); it != mInputs.end(); ++it) {
+            if (it->key == key) {
+                std::unique_ptr<AudioInputStream> stream = std::move(it->stream);
+                minFrameCount = it->minFrameCount;
+                mInputs.erase(it);
+                ++mHits;
+                return stream;
+            }
+        }
+        return nullptr;
+    }
+
+    // Take a cached output stream, restoring the minFrameCount it was opened with
+    std::unique_ptr<AudioOutputStream> takeOutput(const std::string& key, size_t& minFrameCount) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (auto it = mOutputs.begin(); it != mOutputs.end(); ++it) {
+            if (it->key == key) {
+                std::unique_ptr<AudioOutputStream> stream = std::move(it->stream);
+                minFrameCount = it->minFrameCount;
+                mOutputs.erase(it);
+                ++mHits;
+                return stream;
+            }
+        }
+        return nullptr;
+    }
+
+    void putInput(const std::string& key, const size_t minFrameCount, std::unique_ptr<AudioInputStream> stream) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mInputs.push_back({key, minFrameCount, std::move(stream)});
+    }
+
+    void putOutput(const std::string& key, const size_t minFrameCount, std::unique_ptr<AudioOutputStream> stream) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mOutputs.push_back({key, minFrameCount, std::move(stream)});
+    }
+
+    uint32_t getHits() const { return mHits; }
+
+private:
+    template <typename T> struct Entry {
+        std::string key;
+        size_t minFrameCount;
+        std::unique_ptr<T> stream;
+    };
+
+    std::mutex mMutex;
+    std::vector<Entry<AudioInputStream>> mInputs;
+    std::vector<Entry<AudioOutputStream>> mOutputs;
+    std::atomic<uint32_t> mHits{0};
+};
+
+/************************** Stream Trace ******************************/
+// Record and replay of the backend calls made by the streaming loops. --trace wraps the opened streams and logs
+// every read()/write() with its requested size, returned size or status, blocking flag, start time and
+// duration, plus the overrun/underrun counter queries. --replay feeds that exact sequence back through the
+// replay backend on any host, as fast as possible or with the original timing (--replay-realtime), so the loop
+// logic (partial transfers, non-blocking zero returns, error paths) runs deterministically. Read data is a
+// 1kHz sine at -6dBFS following the frame position, so replays produce identical files.
+struct StreamTraceHeader {
+    static constexpr uint32_t kMagic = 0x54435441; // "ATCT"
+    static constexpr uint32_t kVersion = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    int32_t sampleRate;
+    int32_t channelCount;
+    int32_t format;
+    uint32_t recordSize;
+};
+static_assert(sizeof(StreamTraceHeader) == 24, "trace header layout is part of the file format");
+
+struct StreamTraceRecord {
+    enum Kind : uint8_t { OPEN_INPUT = 0, OPEN_OUTPUT, READ, WRITE, OVERRUN, UNDERRUN, KIND_COUNT };
+    static constexpr uint8_t kBlocking = 0x01;
+
+    int64_t startNs;     // call start, relative to the trace start
+    uint32_t durationNs; // saturated at ~4.3s
+    uint32_t requested;  // bytes asked for; frame count for OPEN_*
+    int32_t result;      // bytes or status; counter value for OVERRUN/UNDERRUN; min frame count for OPEN_*
+    uint8_t kind;
+    uint8_t flags;
+    uint16_t reserved;
+};
+static_assert(sizeof(StreamTraceRecord) == 24, "trace record layout is part of the file format");
+
+class StreamTraceWriter {
+public:
+    StreamTraceWriter() = default;
+    ~StreamTraceWriter() { close(); }
+
+    StreamTraceWriter(const StreamTraceWriter&) = delete;
+    StreamTraceWriter& operator=(const StreamTraceWriter&) = delete;
+
+    bool open(const std::string& path, const AudioConfig& config) {
+        mFile.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!mFile.is_open()) {
+            printf("Error: Can't create trace file: %s\n", path.c_str());
+            return false;
+        }
+        const StreamTraceHeader header = {StreamTraceHeader::kMagic, StreamTraceHeader::kVersion, config.sampleRate,
+                                          config.channelCount, static_cast<int32_t>(config.format),
+                                          sizeof(StreamTraceRecord)};
+        mFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (!mFile.good()) {
+            printf("Error: Can't write trace file: %s\n", path.c_str());
+            mFile.close();
+            return false;
+        }
+        mPath = path;
+        mStartNs = AudioUtils::getMonotonicNs();
+        mPending.reserve(kFlushRecords);
+        return true;
+    }
+
+    void add(const StreamTraceRecord::Kind kind, const bool blocking, const int64_t startNs, const int64_t endNs,
+             const size_t requested, const int64_t result) {
+        StreamTraceRecord record{};
+        record.startNs = startNs - mStartNs;
+        record.durationNs = static_cast<uint32_t>(std::clamp<int64_t>(endNs - startNs, 0, UINT32_MAX));
+        record.requested = static_cast<uint32_t>(std::min<size_t>(requested, UINT32_MAX));
+        record.result = static_cast<int32_t>(std::clamp<int64_t>(result, INT32_MIN, INT32_MAX));
+        record.kind = kind;
+        record.flags = blocking ? StreamTraceRecord::kBlocking : 0;
+        std::lock_guard<std::mutex> lock(mMutex);
+        mPending.push_back(record);
+        ++mRecords;
+        // Written in large batches, the loops pay one buffered file write every few thousand calls
+        if (mPending.size() >= kFlushRecords) {
+            flushLocked();
+        }
+    }
+
+    // Flush and close the file, false when any write failed and the trace is incomplete
+    bool close() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mFile.is_open()) {
+            return !mFailed;
+        }
+        flushLocked();
+        mFile.close();
+        mFailed = mFailed || mFile.fail();
+        if (mFailed) {
+            printf("Error: Failed to write trace file: %s\n", mPath.c_str());
+            return false;
+        }
+        printf("Stream trace saved: %s (%" PRIu64 " records)\n", mPath.c_str(), mRecords);
+        return true;
+    }
+
+private:
+    static constexpr size_t kFlushRecords = 4096;
+
+    void flushLocked() {
+        if (!mFailed) {
+            mFile.write(reinterpret_cast<const char*>(mPending.data()),
+                        static_cast<std::streamsize>(mPending.size() * sizeof(StreamTraceRecord)));
+            mFailed = !mFile.good();
+        }
+        mPending.clear();
+    }
+
+    std::mutex mMutex;
+    std::ofstream mFile;
+    std::string mPath;
+    int64_t mStartNs = 0;
+    std::vector<StreamTraceRecord> mPending;
+    uint64_t mRecords = 0;
+    bool mFailed = false;
+};
+
+// Capture stream decorator logging every call into the trace
+class TracingInputStream : public AudioInputStream {
+public:
+    TracingInputStream(std::unique_ptr<AudioInputStream> stream, std::shared_ptr<StreamTraceWriter> trace,
+                       const size_t minFrameCount)
+        : mStream(std::move(stream)), mTrace(std::move(trace)) {
+        const int64_t nowNs = AudioUtils::getMonotonicNs();
+        mTrace->add(StreamTraceRecord::OPEN_INPUT, false, nowNs, nowNs, mStream->getFrameCount(),
+                    static_cast<int64_t>(minFrameCount));
+    }
+    ~TracingInputStream() override = default;
+
+    TracingInputStream(const TracingInputStream&) = delete;
+    TracingInputStream& operator=(const TracingInputStream&) = delete;
+
+    const char* getName() const override { return mStream->getName(); }
+    status_t start() override { return mStream->start(); }
+    void stop() override { mStream->stop(); }
+    ssize_t read(void* buffer, size_t size, bool blocking) override {
+        const int64_t startNs = AudioUtils::getMonotonicNs();
+        const ssize_t result = mStream->read(buffer, size, blocking);
+        mTrace->add(StreamTraceRecord::READ, blocking, startNs, AudioUtils::getMonotonicNs(), size, result);
+        return result;
+    }
+    uint32_t getOverrunFrames() override {
+        const uint32_t frames = mStream->getOverrunFrames();
+        const int64_t nowNs = AudioUtils::getMonotonicNs();
+        mTrace->add(StreamTraceRecord::OVERRUN, false, nowNs, nowNs, 0, frames);
+        return frames;
+    }
+    size_t getFrameCount() const override { return mStream->getFrameCount(); }
+    bool getTimestamp(int64_t& position, int64_t& timeNs) override { return mStream->getTimestamp(position, timeNs); }
+
+private:
+    std::unique_ptr<AudioInputStream> mStream;
+    std::shared_ptr<StreamTraceWriter> mTrace;
+};
+
+// Render stream decorator logging every call into the trace
+class TracingOutputStream : public AudioOutputStream {
+public:
+    TracingOutputStream(std::unique_ptr<AudioOutputStream> stream, std::shared_ptr<StreamTraceWriter> trace,
+                        const size_t minFrameCount)
+        : mStream(std::move(stream)), mTrace(std::move(trace)) {
+        const int64_t nowNs = AudioUtils::getMonotonicNs();
+        mTrace->add(StreamTraceRecord::OPEN_OUTPUT, false, nowNs, nowNs, mStream->getFrameCount(),
+                    static_cast<int64_t>(minFrameCount));
+    }
+    ~TracingOutputStream() override = default;
+
+    TracingOutputStream(const TracingOutputStream&) = delete;
+    TracingOutputStream& operator=(const TracingOutputStream&) = delete;
+
+    const char* getName() const override { return mStream->getName(); }
+    status_t start() override { return mStream->start(); }
+    void stop() override { mStream->stop(); }
+    ssize_t write(const void* buffer, size_t size, bool blocking) override {
+        const int64_t startNs = AudioUtils::getMonotonicNs();
+        const ssize_t result = mStream->write(buffer, size, blocking);
+        mTrace->add(StreamTraceRecord::WRITE, blocking, startNs, AudioUtils::getMonotonicNs(), size, result);
+        return result;
+    }
+    uint32_t getUnderrunCount() override {
+        const uint32_t count = mStream->getUnderrunCount();
+        const int64_t nowNs = AudioUtils::getMonotonicNs();
+        mTrace->add(StreamTraceRecord::UNDERRUN, false, nowNs, nowNs, 0, count);
+        return count;
+    }
+    size_t getFrameCount() const override { return mStream->getFrameCount(); }
+    bool getTimestamp(int64_t& position, int64_t& timeNs) override { return mStream->getTimestamp(position, timeNs); }
+
+private:
+    std::unique_ptr<AudioOutputStream> mStream;
+    std::shared_ptr<StreamTraceWriter> mTrace;
+};
+
+// A loaded trace, consumed per record kind by the replay streams. A call whose size or blocking mode differs
+// from the trace is a divergence: the loop logic under test no longer issues the recorded sequence.
+class StreamTraceReader {
+public:
+    StreamTraceReader() = default;
+    ~StreamTraceReader() {
+        if (!mRecords.empty()) {
+            printf("Replay finished: %" PRIu64 " read(s), %" PRIu64 " write(s) of %zu records, %" PRIu64
+                   " divergence(s)%s\n",
+                   mReplayed[StreamTraceRecord::READ], mReplayed[StreamTraceRecord::WRITE], mRecords.size(),
+                   mDivergences.load(), mEnded ? ", trace ended" : "");
+        }
+    }
+
+    StreamTraceReader(const StreamTraceReader&) = delete;
+    StreamTraceReader& operator=(const StreamTraceReader&) = delete;
+
+    bool load(const std::string& path, const bool realtime) {
+        std::ifstream file(path, std::ios::in | std::ios::binary);
+        if (!file.is_open()) {
+            printf("Error: Can't open trace file: %s\n", path.c_str());
+            return false;
+        }
+        if (!file.read(reinterpret_cast<char*>(&mHeader), sizeof(mHeader)) ||
+            mHeader.magic != StreamTraceHeader::kMagic || mHeader.version != StreamTraceHeader::kVersion ||
+            mHeader.recordSize != sizeof(StreamTraceRecord)) {
+            printf("Error: Not a stream trace: %s\n", path.c_str());
+            return false;
+        }
+        StreamTraceRecord record;
+        while (file.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+            mRecords.push_back(record);
+        }
+        mRealtime = realtime;
+        printf("Replaying %s: %zu records, %.2f s%s\n", path.c_str(), mRecords.size(),
+               mRecords.empty() ? 0.0 : mRecords.back().startNs / 1e9, realtime ? " (realtime)" : "");
+        return true;
+    }
+
+    const StreamTraceHeader& getHeader() const { return mHeader; }
+
+    // Next record of a kind, nullptr once the trace has no more of them
+    const StreamTraceRecord* next(const StreamTraceRecord::Kind kind) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        size_t& cursor = mCursor[kind];
+        while (cursor < mRecords.size() && mRecords[cursor].kind != kind) {
+            ++cursor;
+        }
+        if (cursor == mRecords.size()) {
+            return nullptr;
+        }
+        ++mReplayed[kind];
+        return &mRecords[cursor++];
+    }
+
+    // Compare a call against its record and hold it until its recorded return time in realtime mode
+    void replay(const StreamTraceRecord& record, const size_t requested, const bool blocking) {
+        const bool recordedBlocking = (record.flags & StreamTraceRecord::kBlocking) != 0;
+        if (record.requested != requested || recordedBlocking != blocking) {
+            const uint64_t count = ++mDivergences;
+            if (count <= kMaxLoggedDivergences) {
+                sLogger.error("Replay divergence at %.3f s: %s of %zu bytes%s, trace has %u bytes%s\n",
+                              record.startNs / 1e9, record.kind == StreamTraceRecord::READ ? "read" : "write",
+                              requested, blocking ? "" : " (non-blocking)", record.requested,
+                              recordedBlocking ? "" : " (non-blocking)");
+            }
+        }
+        if (!mRealtime) {
+            return;
+        }
+        // The first paced call anchors the recorded timeline to now
+        int64_t originNs = 0;
+        const int64_t candidateNs = AudioUtils::getMonotonicNs() - record.startNs;
+        if (mReplayOriginNs.compare_exchange_strong(originNs, candidateNs)) {
+            originNs = candidateNs;
+        }
+        const int64_t deadlineNs = originNs + record.startNs + record.durationNs;
+        struct timespec ts;
+        ts.tv_sec = static_cast<time_t>(deadlineNs / 1000000000LL);
+        ts.tv_nsec = static_cast<long>(deadlineNs % 1000000000LL);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR && !sExitRequested) {
+        }
+    }
+
+    // The loops stop like on Ctrl+C once the recorded calls are used up
+    void endOfTrace() {
+        if (!mEnded.exchange(true)) {
+            sLogger.info("Replay: end of trace\n");
+        }
+        sExitRequested = true;
+    }
+
+    uint64_t getDivergences() const { return mDivergences; }
+
+private:
+    static constexpr uint64_t kMaxLoggedDivergences = 10;
+
+    std::mutex mMutex;
+    StreamTraceHeader mHeader{};
+    std::vector<StreamTraceRecord> mRecords;
+    size_t mCursor[StreamTraceRecord::KIND_COUNT] = {};
+    uint64_t mReplayed[StreamTraceRecord::KIND_COUNT] = {};
+    std::atomic<uint64_t> mDivergences{0};
+    std::atomic<int64_t> mReplayOriginNs{0};
+    std::atomic<bool> mEnded{false};
+    bool mRealtime = false;
+};
+
+// Replay backend capture stream: returns the recorded read results with synthesized data
+class ReplayInputStream : public AudioInputStream {
+public:
+    ReplayInputStream(std::shared_ptr<StreamTraceReader> trace, const AudioConfig& config, const size_t frameCount)
+        : mTrace(std::move(trace)), mChannelCount(config.channelCount), mFormat(config.format),
+          mFrameSize(audio_bytes_per_sample(config.format) * config.channelCount), mFrameCount(frameCount),
+          mPhaseStep(2.0 * M_PI * kToneHz / config.sampleRate) {}
+    ~ReplayInputStream() override = default;
+
+    ReplayInputStream(const ReplayInputStream&) = delete;
+    ReplayInputStream& operator=(const ReplayInputStream&) = delete;
+
+    const char* getName() const override { return "ReplayInput"; }
+    status_t start() override { return NO_ERROR; }
+    void stop() override {}
+
+    ssize_t read(void* buffer, size_t size, bool blocking) override {
+        const StreamTraceRecord* record = mTrace->next(StreamTraceRecord::READ);
+        if (record == nullptr) {
+            mTrace->endOfTrace();
+            return 0;
+        }
+        mTrace->replay(*record, size, blocking);
+        if (record->result <= 0 || buffer == nullptr) {
+            return record->result;
+        }
+        // A changed loop may ask for less than was recorded, never return more than asked
+        const size_t frames = std::min<size_t>(record->result, size) / mFrameSize;
+        mScratch.resize(frames * mChannelCount);
+        for (size_t f = 0; f < frames; ++f) {
+            const float v = static_cast<float>(0.5 * std::sin(mPhaseStep * static_cast<double>(mFramesRead + f)));
+            std::fill_n(mScratch.begin() + f * mChannelCount, mChannelCount, v);
+        }
+        AudioUtils::floatToPcm(mScratch.data(), static_cast<char*>(buffer), mScratch.size(), mFormat);
+        mFramesRead += frames;
+        return static_cast<ssize_t>(frames * mFrameSize);
+    }
+    uint32_t getOverrunFrames() override {
+        const StreamTraceRecord* record = mTrace->next(StreamTraceRecord::OVERRUN);
+        if (record != nullptr) {
+            mOverrunFrames = static_cast<uint32_t>(record->result);
+        }
+        return mOverrunFrames;
+    }
+    size_t getFrameCount() const override { return mFrameCount; }
+    bool getTimestamp(int64_t& /* position */, int64_t& /* timeNs */) override { return false; }
+
+private:
+    static constexpr double kToneHz = 1000.0;
+
+    std::shared_ptr<StreamTraceReader> mTrace;
+    int32_t mChannelCount;
+    audio_format_t mFormat;
+    size_t mFrameSize;
+    size_t mFrameCount;
+    double mPhaseStep;
+    std::vector<float> mScratch;
+    uint64_t mFramesRead = 0;
+    uint32_t mOverrunFrames = 0;
+};
+
+// Replay backend render stream: returns the recorded write results and discards the data
+class ReplayOutputStream : public AudioOutputStream {
+public:
+    ReplayOutputStream(std::shared_ptr<StreamTraceReader> trace, const size_t frameCount)
+        : mTrace(std::move(trace)), mFrameCount(frameCount) {}
+    ~ReplayOutputStream() override = default;
+
+    ReplayOutputStream(const ReplayOutputStream&) = delete;
+    ReplayOutputStream& operator=(const ReplayOutputStream&) = delete;
+
+    const char* getName() const override { return "ReplayOutput"; }
+    status_t start() override { return NO_ERROR; }
+    void stop() override {}
+
+    ssize_t write(const void* /* buffer */, size_t size, bool blocking) override {
+        const StreamTraceRecord* record = mTrace->next(StreamTraceRecord::WRITE);
+        if (record == nullptr) {
+            mTrace->endOfTrace();
+            return 0;
+        }
+        mTrace->replay(*record, size, blocking);
+        return record->result <= 0 ? record->result : static_cast<ssize_t>(std::min<size_t>(record->result, size));
+    }
+    uint32_t getUnderrunCount() override {
+        const StreamTraceRecord* record = mTrace->next(StreamTraceRecord::UNDERRUN);
+        if (record != nullptr) {
+            mUnderrunCount = static_cast<uint32_t>(record->result);
+        }
+        return mUnderrunCount;
+    }
+    size_t getFrameCount() const override { return mFrameCount; }
+    bool getTimestamp(int64_t& /* position */, int64_t& /* timeNs */) override { return false; }
+
+private:
+    std::shared_ptr<StreamTraceReader> mTrace;
+    size_t mFrameCount;
+    uint32_t mUnderrunCount = 0;
+};
+
+/************************** Audio Operation Base Class ******************************/
+// Counters of one execute(), consumed by batch result tables
+struct AudioRunStats {
+    uint64_t bytesCaptured = 0; // bytes read from the input stream
+    uint64_t bytesRendered = 0; // bytes written to the output stream
+    uint32_t overrunFrames = 0; // input frames lost
+    uint32_t underrunCount = 0; // output underrun events
+    int64_t loopTimeNs = 0;     // time spent in the streaming loop
+    uint64_t readCalls = 0;     // input stream read calls
+    uint64_t writeCalls = 0;    // output stream write calls
+};
+
+class AudioOperation {
+public:
+    explicit AudioOperation(const AudioConfig& config) : mConfig(config), mAudioParamManager(config) {
+        setupSignalHandler();
+    }
+    virtual ~AudioOperation() = default;
+    // Disable copy operations to prevent issues with configuration and audio parameters
+    AudioOperation(const AudioOperation&) = delete;
+    AudioOperation& operator=(const AudioOperation&) = delete;
+
+    virtual int32_t execute() = 0;
+
+    // Share buffers and opened streams with other runs in the same process (nullptr = private resources)
+    void setSharedResources(BufferPool* bufferPool, AudioStreamCache* streamCache) {
+        mBufferPool = bufferPool;
+        mStreamCache = streamCache;
+    }
+
+    // Statistics of the last execute()
+    const AudioRunStats& getRunStats() const { return mRunStats; }
+
+    // Startup phases of this run; the caller may add process-level phases before execute()
+    StartupTimeline& getStartupTimeline() { return mStartupTimeline; }
+
+    // A replay whose loops issued other calls than the trace, the run is not a faithful reproduction
+    bool hasReplayDivergence() const { return getReplayDivergences() > 0; }
+    uint64_t getReplayDivergences() const { return mReplayTrace != nullptr ? mReplayTrace->getDivergences() : 0; }
+
+    // Close the --trace file after execute(), true when it could not be written completely
+    bool hasTraceError() { return mTraceWriter != nullptr && !mTraceWriter->close(); }
+
+protected:
+    static constexpr uint32_t kMaxAudioDataSize = 2u * 1024u * 1024u * 1024u; // 2 GiB
+    static constexpr uint32_t kProgressReportInterval = 10;                   // report progress every 10 seconds
+    static constexpr uint32_t kLevelMeterInterval = 25;                       // Update level meter every 30 frames
+    static constexpr int32_t kSimulatedMinFrameMs = 20;                       // stand-in backend minimum buffer
+    static constexpr int32_t kMetricsIntervalMs = 100;                        // live metrics publish period
+
+    AudioConfig mConfig;
+    AudioParameterManager mAudioParamManager;
+    uint32_t mLevelMeterCounter = 0;  // For level meter updates
+    uint64_t mNextProgressReport = 0; // For progress reporting
+    AudioRunStats mRunStats;
+    BufferPool* mBufferPool = nullptr;       // shared buffer pool, nullptr = allocate per loop
+    AudioStreamCache* mStreamCache = nullptr; // shared stream cache, nullptr = streams closed after each run
+    std::string mInputStreamKey;
+    std::string mOutputStreamKey;
+    size_t mInputMinFrameCount = 0;
+    size_t mOutputMinFrameCount = 0;
+    StartupTimeline mStartupTimeline;
+    LiveMetricsPublisher mLiveMetrics;
+    TimestampSidecarWriter mTimestampSidecar;
+    ResourceMeter mResourceMeter;
+    SpectrumMonitor mSpectrum;
+    DspGraph mDspGraph;
+    std::shared_ptr<StreamTraceWriter> mTraceWriter;  // --trace, shared by the input and output stream
+    std::shared_ptr<StreamTraceReader> mReplayTrace;  // replay backend, shared by the input and output stream
+
+    // Calculate required buffer size based on audio configuration
+    size_t calculateBufferSize() const {
+        const size_t bytesPerSample = audio_bytes_per_sample(mConfig.format);
+        // An explicit stream buffer is transferred in halves, so one half is queued while the other is copied
+        if (mConfig.frameCount > 0) {
+            return std::max<size_t>(mConfig.frameCount / 2, 1) * mConfig.channelCount * bytesPerSample;
+        }
+        return (mConfig.minFrameCount * 2) * mConfig.channelCount * bytesPerSample;
+    }
+
+    // Calculate frame count with minimum buffer considerations
+    size_t calculateFrameCount() const {
+        if (mConfig.frameCount > 0) {
+            return mConfig.frameCount;
+        }
+        const size_t minFrames = static_cast<size_t>((mConfig.sampleRate * 10) / 1000);
+        const size_t adjustedMinFrameCount = std::max(mConfig.minFrameCount, minFrames);
+        return adjustedMinFrameCount * 2;
+    }
+
+    // Calculate bytes per second based on audio configuration
+    uint64_t calculateBytesPerSecond() const {
+        const size_t bytesPerSample = audio_bytes_per_sample(mConfig.format);
+        return static_cast<uint64_t>(mConfig.sampleRate) * mConfig.channelCount * bytesPerSample;
+    }
+
+    // Validate audio parameters for correctness
+    bool validateAudioParameters() const {
+        if (mConfig.sampleRate <= 0 || mConfig.channelCount <= 0) {
+            printf("Error: Invalid sample rate or channel count\n");
+            return false;
+        }
+        if (mConfig.format == AUDIO_FORMAT_INVALID) {
+            printf("Error: Invalid audio format\n");
+            return false;
+        }
+#ifdef AUDIO_TEST_CLIENT_HOST
+        if (mConfig.backend == BACKEND_LEGACY || mConfig.backend == BACKEND_AAUDIO) {
+            printf("Error: Host builds have no audio server, use --backend sim, sim-fast, aaudio-fake or replay\n");
+            return false;
+        }
+#endif
+        return true;
+    }
+
+#ifndef AUDIO_TEST_CLIENT_HOST
+    // Create attribution source for audio operations
+    AttributionSourceState createAttributionSource() {
+        AttributionSourceState attributionSource;
+        attributionSource.packageName = std::string("Audio Test Client");
+        attributionSource.token = sp<BBinder>::make();
+        attributionSource.uid = getuid();
+        attributionSource.pid = getpid();
+        return attributionSource;
+    }
+
+    // Initialize AudioRecord with audio configuration
+    bool initializeAudioRecord(sp<AudioRecord>& audioRecord) {
+        audio_channel_mask_t channelMask = audio_channel_in_mask_from_count(mConfig.channelCount);
+        if (AudioRecord::getMinFrameCount(&mConfig.minFrameCount, mConfig.sampleRate, mConfig.format, channelMask) !=
+            NO_ERROR) {
+            printf("Warning: Cannot get min frame count, using default value\n");
+        }
+        mStartupTimeline.mark("input_min_frame_count");
+        const size_t frameCount = calculateFrameCount();
+
+        printf("Initialize AudioRecord: source=%d, sampleRate=%d, channelCount=%d, format=%d, channelMask=0x%x, "
+               "frameCount=%zu\n",
+               mConfig.inputSource, mConfig.sampleRate, mConfig.channelCount, mConfig.format, channelMask, frameCount);
+        ALOGI("Initialize AudioRecord: source=%d, sampleRate=%d, channelCount=%d, format=%d, channelMask=0x%x, "
+              "frameCount=%zu",
+              mConfig.inputSource, mConfig.sampleRate, mConfig.channelCount, mConfig.format, channelMask, frameCount);
+
+        AttributionSourceState attributionSource = createAttributionSource();
+        audio_attributes_t attributes{};
+        attributes.source = mConfig.inputSource;
+        audioRecord = sp<AudioRecord>::make(attributionSource);
+        if (audioRecord->set(mConfig.inputSource, // input source
+                             mConfig.sampleRate,  // sample rate
+                             mConfig.format,      // audio format
+                             channelMask,         // channel mask
+                             frameCount,          // frame count
+                             nullptr,             // callback/IAudioRecordCallback. use TRANSFER_CALLBACK
+#ifndef ANDROID_API_14_PLUS
+                             nullptr, // user mCallbackData
+#endif
+                             0,                          // notificationFrames
+                             false,                      // threadCanCallJava
+                             AUDIO_SESSION_ALLOCATE,     // sessionId
+                             AudioRecord::TRANSFER_SYNC, // transferType
+                             mConfig.inputFlag,          // inputFlag
+                             getuid(),                   // uid
+                             getpid(),                   // pid
+                             &attributes,                // audioAttributes
+                             AUDIO_PORT_HANDLE_NONE      // selectedDeviceId
+                             ) != NO_ERROR) {
+            printf("Error: Failed to initialize AudioRecord parameters\n");
+            ALOGE("Failed to initialize AudioRecord parameters");
+            return false;
+        }
+        mStartupTimeline.mark("input_set");
+
+        if (audioRecord->initCheck() != NO_ERROR) {
+            printf("Error: AudioRecord initialization check failed\n");
+            ALOGE("AudioRecord initialization check failed");
+            return false;
+        }
+        mStartupTimeline.mark("input_init_check");
+
+        printf("AudioRecord initialized successfully\n");
+        return true;
+    }
+
+    // Initialize AudioTrack with audio configuration
+    bool initializeAudioTrack(sp<AudioTrack>& audioTrack) {
+        audio_channel_mask_t channelMask = audio_channel_out_mask_from_count(mConfig.channelCount);
+
+        // Get minimum frame count using AudioTrack static method with streamType
+        // Since we use audio_attributes_t, we need to convert usage to streamType
+        audio_stream_type_t streamType = AudioUtils::usageToStreamType(mConfig.usage);
+        if (AudioTrack::getMinFrameCount(&mConfig.minFrameCount, streamType, mConfig.sampleRate) != NO_ERROR) {
+            printf("Warning: Cannot get min frame count using streamType, using default value\n");
+        }
+        mStartupTimeline.mark("output_min_frame_count");
+        const size_t frameCount = calculateFrameCount();
+
+        printf("Initialize AudioTrack: usage=%d, sampleRate=%d, channelCount=%d, format=%d, channelMask=0x%x, "
+               "frameCount=%zu\n",
+               mConfig.usage, mConfig.sampleRate, mConfig.channelCount, mConfig.format, channelMask, frameCount);
+        ALOGI("Initialize AudioTrack: usage=%d, sampleRate=%d, channelCount=%d, format=%d, channelMask=0x%x, "
+              "frameCount=%zu",
+              mConfig.usage, mConfig.sampleRate, mConfig.channelCount, mConfig.format, channelMask, frameCount);
+
+        AttributionSourceState attributionSource = createAttributionSource();
+        audio_attributes_t attributes{};
+        attributes.usage = mConfig.usage;
+        attributes.content_type = AudioUtils::usageToContentType(mConfig.usage);
+        audioTrack = sp<AudioTrack>::make(attributionSource);
+        if (audioTrack->set(AUDIO_STREAM_DEFAULT, // streamType
+                            mConfig.sampleRate,   // sampleRate
+                            mConfig.format,       // audioFormat
+                            channelMask,          // channelMask
+                            frameCount,           // frameCount
+                            mConfig.outputFlag,   // outputFlag
+                            nullptr,              // callback/IAudioTrackCallback. use TRANSFER_CALLBACK
+#ifndef ANDROID_API_14_PLUS
+                            nullptr, // userCallbackData
+#endif
+                            0,                         // notificationFrames
+                            nullptr,                   // sharedBuffer, use TRANSFER_SHARED
+                            false,                     // threadCanCallJava
+                            AUDIO_SESSION_ALLOCATE,    // sessionId
+                            AudioTrack::TRANSFER_SYNC, // transferType
+                            nullptr,                   // offloadInfo
+                            attributionSource,         // attributionSource
+                            &attributes,               // pAttributes
+                            false,                     // doNotReconnect
+                            1.0f,                      // maxRequiredSpeed
+                            AUDIO_PORT_HANDLE_NONE     // selectedDeviceId
+                            ) != NO_ERROR) {
+            printf("Error: Failed to initialize AudioTrack parameters\n");
+            ALOGE("Failed to initialize AudioTrack parameters");
+            return false;
+        }
+        mStartupTimeline.mark("output_set");
+
+        if (audioTrack->initCheck() != NO_ERROR) {
+            printf("Error: AudioTrack initialization check failed\n");
+            ALOGE("AudioTrack initialization check failed");
+            return false;
+        }
+        mStartupTimeline.mark("output_init_check");
+
+        printf("AudioTrack initialized successfully\n");
+        return true;
+    }
+#endif // AUDIO_TEST_CLIENT_HOST
+
+    // Stream cache key: every configuration field that affects how the input stream is opened
+    std::string makeInputStreamKey() const {
+        return String8::format("in:%d:%d:%d:%d:%d:%d:%zu:%zu", mConfig.backend, mConfig.inputSource,
+                               mConfig.sampleRate, mConfig.channelCount, mConfig.format, mConfig.inputFlag,
+                               mConfig.minFrameCount, mConfig.frameCount)
+            .c_str();
+    }
+
+    // Stream cache key: every configuration field that affects how the output stream is opened
+    std::string makeOutputStreamKey() const {
+        return String8::format("out:%d:%d:%d:%d:%d:%d:%zu:%zu", mConfig.backend, mConfig.usage, mConfig.sampleRate,
+                               mConfig.channelCount, mConfig.format, mConfig.outputFlag, mConfig.minFrameCount,
+                               mConfig.frameCount)
+            .c_str();
+    }
+
+    bool isCallbackBackend() const {
+        return mConfig.backend == BACKEND_AAUDIO || mConfig.backend == BACKEND_AAUDIO_FAKE;
+    }
+
+    // Open the device side of a callback backend. The client ring holds frameCount frames, the device buffer
+    // is sized to the same capacity; the burst is chosen by the device.
+    std::unique_ptr<CallbackStreamDriver> openCallbackDriver(const bool input) {
+        if (mConfig.minFrameCount == 0) {
+            mConfig.minFrameCount = static_cast<size_t>(mConfig.sampleRate * kSimulatedMinFrameMs / 1000);
+        }
+        if (mConfig.backend == BACKEND_AAUDIO_FAKE) {
+            return std::make_unique<FakeCallbackDriver>(mConfig, input);
+        }
+#ifndef AUDIO_TEST_CLIENT_HOST
+        return AAudioStreamDriver::open(mConfig, input, static_cast<int32_t>(calculateFrameCount()));
+#else
+        return nullptr;
+#endif
+    }
+
+    // The trace file is created with the first stream the operation opens
+    bool openTraceWriter() {
+        if (mTraceWriter == nullptr) {
+            auto writer = std::make_shared<StreamTraceWriter>();
+            if (!writer->open(mConfig.tracePath, mConfig)) {
+                return false;
+            }
+            mTraceWriter = std::move(writer);
+        }
+        return true;
+    }
+
+    // Replay backend: load the trace once and take the next open of the direction. The recorded minimum frame
+    // count is restored unless -F is given, so the loops request the recorded transfer sizes.
+    const StreamTraceRecord* openReplayStream(const StreamTraceRecord::Kind kind) {
+        if (mReplayTrace == nullptr) {
+            if (mConfig.replayPath.empty()) {
+                printf("Error: The replay backend needs --replay {file}\n");
+                return nullptr;
+            }
+            auto trace = std::make_shared<StreamTraceReader>();
+            if (!trace->load(mConfig.replayPath, mConfig.replayRealtime)) {
+                return nullptr;
+            }
+            mReplayTrace = std::move(trace);
+        }
+        const StreamTraceHeader& header = mReplayTrace->getHeader();
+        if (header.sampleRate != mConfig.sampleRate || header.channelCount != mConfig.channelCount ||
+            header.format != static_cast<int32_t>(mConfig.format)) {
+            printf("Error: Trace was recorded with -r%d -c%d format %d, replay with the same stream parameters\n",
+                   header.sampleRate, header.channelCount, header.format);
+            return nullptr;
+        }
+        const StreamTraceRecord* open = mReplayTrace->next(kind);
+        if (open == nullptr) {
+            printf("Error: Trace has no %s stream left to replay\n",
+                   kind == StreamTraceRecord::OPEN_INPUT ? "input" : "output");
+            return nullptr;
+        }
+        if (mConfig.minFrameCount == 0) {
+            mConfig.minFrameCount = static_cast<size_t>(std::max(open->result, 0));
+        }
+        printf("Initialize %s: sampleRate=%d, channelCount=%d, format=%d, frameCount=%u\n",
+               kind == StreamTraceRecord::OPEN_INPUT ? "ReplayInput" : "ReplayOutput", mConfig.sampleRate,
+               mConfig.channelCount, mConfig.format, open->requested);
+        return open;
+    }
+
+    // Open capture stream on the configured backend, reusing a cached one when available
+    std::unique_ptr<AudioInputStream> openInputStream() {
+        mInputStreamKey = makeInputStreamKey();
+        // A traced stream records into this operation's file, so tracing runs neither take nor keep cached ones
+        if (mStreamCache != nullptr && mConfig.tracePath.empty()) {
+            std::unique_ptr<AudioInputStream> cached = mStreamCache->takeInput(mInputStreamKey, mConfig.minFrameCount);
+            if (cached != nullptr) {
+                printf("Reusing opened %s\n", cached->getName());
+                mStartupTimeline.mark("input_cache_hit");
+                mInputMinFrameCount = mConfig.minFrameCount;
+                return cached;
+            }
+        }
+
+        std::unique_ptr<AudioInputStream> stream;
+        if (mConfig.backend == BACKEND_LEGACY) {
+#ifndef AUDIO_TEST_CLIENT_HOST
+            sp<AudioRecord> audioRecord;
+            if (initializeAudioRecord(audioRecord)) {
+                stream = std::make_unique<AudioRecordStream>(audioRecord);
+            }
+#endif
+        } else if (isCallbackBackend()) {
+            std::unique_ptr<CallbackStreamDriver> driver = openCallbackDriver(true);
+            if (driver != nullptr) {
+                stream = std::make_unique<CallbackInputStream>(std::move(driver), mConfig, calculateFrameCount());
+            }
+            mStartupTimeline.mark("input_open");
+        } else if (mConfig.backend == BACKEND_REPLAY) {
+            const StreamTraceRecord* open = openReplayStream(StreamTraceRecord::OPEN_INPUT);
+            if (open != nullptr) {
+                stream = std::make_unique<ReplayInputStream>(mReplayTrace, mConfig, open->requested);
+            }
+            mStartupTimeline.mark("input_open");
+        } else {
+            if (mConfig.minFrameCount == 0) {
+                mConfig.minFrameCount = static_cast<size_t>(mConfig.sampleRate * kSimulatedMinFrameMs / 1000);
+            }
+            const size_t frameCount = calculateFrameCount();
+            printf("Initialize SimulatedInput: sampleRate=%d, channelCount=%d, format=%d, frameCount=%zu%s\n",
+                   mConfig.sampleRate, mConfig.channelCount, mConfig.format, frameCount,
+                   mConfig.backend == BACKEND_SIM ? "" : " (unpaced)");
+            stream = std::make_unique<SimulatedInputStream>(mConfig, frameCount, mConfig.backend == BACKEND_SIM);
+            mStartupTimeline.mark("input_open");
+        }
+        if (stream != nullptr && !mConfig.tracePath.empty()) {
+            if (!openTraceWriter()) {
+                return nullptr;
+            }
+            stream = std::make_unique<TracingInputStream>(std::move(stream), mTraceWriter, mConfig.minFrameCount);
+        }
+        mInputMinFrameCount = mConfig.minFrameCount;
+        return stream;
+    }
+
+    // Open render stream on the configured backend, reusing a cached one when available
+    std::unique_ptr<AudioOutputStream> openOutputStream() {
+        mOutputStreamKey = makeOutputStreamKey();
+        if (mStreamCache != nullptr && mConfig.tracePath.empty()) {
+            std::unique_ptr<AudioOutputStream> cached =
+                mStreamCache->takeOutput(mOutputStreamKey, mConfig.minFrameCount);
+            if (cached != nullptr) {
+                printf("Reusing opened %s\n", cached->getName());
+                mStartupTimeline.mark("output_cache_hit");
+                mOutputMinFrameCount = mConfig.minFrameCount;
+                return cached;
+            }
+        }
+
+        std::unique_ptr<AudioOutputStream> stream;
+        if (mConfig.backend == BACKEND_LEGACY) {
+#ifndef AUDIO_TEST_CLIENT_HOST
+            sp<AudioTrack> audioTrack;
+            if (initializeAudioTrack(audioTrack)) {
+                stream = std::make_unique<AudioTrackStream>(audioTrack);
+            }
+#endif
+        } else if (isCallbackBackend()) {
+            std::unique_ptr<CallbackStreamDriver> driver = openCallbackDriver(false);
+            if (driver != nullptr) {
+                stream = std::make_unique<CallbackOutputStream>(std::move(driver), mConfig, calculateFrameCount());
+            }
+            mStartupTimeline.mark("output_open");
+        } else if (mConfig.backend == BACKEND_REPLAY) {
+            const StreamTraceRecord* open = openReplayStream(StreamTraceRecord::OPEN_OUTPUT);
+            if (open != nullptr) {
+                stream = std::make_unique<ReplayOutputStream>(mReplayTrace, open->requested);
+            }
+            mStartupTimeline.mark("output_open");
+        } else {
+            if (mConfig.minFrameCount == 0) {
+                mConfig.minFrameCount = static_cast<size_t>(mConfig.sampleRate * kSimulatedMinFrameMs / 1000);
+            }
+            const size_t frameCount = calculateFrameCount();
+            printf("Initialize SimulatedOutput: sampleRate=%d, channelCount=%d, format=%d, frameCount=%zu%s\n",
+                   mConfig.sampleRate, mConfig.channelCount, mConfig.format, frameCount,
+                   mConfig.backend == BACKEND_SIM ? "" : " (unpaced)");
+            stream = std::make_unique<SimulatedOutputStream>(mConfig, frameCount, mConfig.backend == BACKEND_SIM);
+            mStartupTimeline.mark("output_open");
+        }
+        if (stream != nullptr && !mConfig.tracePath.empty()) {
+            if (!openTraceWriter()) {
+                return nullptr;
+            }
+            stream = std::make_unique<TracingOutputStream>(std::move(stream), mTraceWriter, mConfig.minFrameCount);
+        }
+        mOutputMinFrameCount = mConfig.minFrameCount;
+        return stream;
+    }
+
+    // Release capture stream: keep it in the shared cache for the next run, or close it
+    void closeInputStream(std::unique_ptr<AudioInputStream>& stream) {
+        if (stream != nullptr && mStreamCache != nullptr && mConfig.tracePath.empty()) {
+            mStreamCache->putInput(mInputStreamKey, mInputMinFrameCount, std::move(stream));
+        }
+        stream.reset();
+    }
+
+    // Release render stream: keep it in the shared cache for the next run, or close it
+    void closeOutputStream(std::unique_ptr<AudioOutputStream>& stream) {
+        if (stream != nullptr && mStreamCache != nullptr && mConfig.tracePath.empty()) {
+            mStreamCache->putOutput(mOutputStreamKey, mOutputMinFrameCount, std::move(stream));
+        }
+        stream.reset();
+    }
+
+    // Start audio component (input or output stream) with parameter setup
+    template <typename T> bool startAudioComponent(const std::unique_ptr<T>& component) {
+        // set params before AudioTrack.start()
+        if constexpr (std::is_same_v<T, AudioOutputStream>) {
+            mAudioParamManager.setOpenSourceWithUsage(mConfig.usage);
+        }
+
+        printf("Starting audio component\n");
+        ALOGI("Starting audio component");
+        status_t startResult = component->start();
+        if (startResult != NO_ERROR) {
+            printf("Error: %s start failed with status %d\n", component->getName(), startResult);
+            ALOGE("%s start failed with status %d", component->getName(), startResult);
+            return false;
+        }
+        mStartupTimeline.mark(std::is_same_v<T, AudioInputStream> ? "input_start" : "output_start");
+        return true;
+    }
+
+    // Stop audio component and clean up parameters
+    template <typename T> void stopAudioComponent(const std::unique_ptr<T>& audioComponent) {
+        if (audioComponent != nullptr) {
+            printf("Stopping audio component\n");
+            ALOGI("Stopping audio component");
+            audioComponent->stop();
+            if constexpr (std::is_same_v<T, AudioOutputStream>) {
+                mAudioParamManager.setCloseSourceWithUsage(mConfig.usage);
+            }
+        }
+    }
+
+    // Setup WAV file for audio recording with configuration, fileChannels 0 = the stream's channel count
+    bool setupWavFileForRecording(WAVFile& wavFile, const int32_t fileChannels = 0) {
+        size_t bytesPerSample = audio_bytes_per_sample(mConfig.format);
+        const int32_t channels = fileChannels > 0 ? fileChannels : mConfig.channelCount;
+
+        mConfig.recordFilePath =
+            AudioUtils::makeRecordFilePath(mConfig.sampleRate, channels, bytesPerSample * 8, mConfig.recordFilePath);
+
+        printf("Recording audio to file: %s\n", mConfig.recordFilePath.c_str());
+        if (!wavFile.createForWriting(mConfig.recordFilePath, mConfig.sampleRate, channels, bytesPerSample * 8,
+                                      mConfig.rawPcm)) {
+            printf("Error: Can't create record file: %s\n", mConfig.recordFilePath.c_str());
+            return false;
+        }
+        mStartupTimeline.mark("wav_setup");
+
+        return true;
+    }
+
+    // Setup WAV file for audio playback and extract audio parameters
+    bool setupWavFileForPlayback(WAVFile& wavFile) {
+        if (mConfig.playFilePath.empty() ||
+            (!WAVFile::isStdio(mConfig.playFilePath) && access(mConfig.playFilePath.c_str(), F_OK) == -1)) {
+            printf("Error: File does not exist: %s\n", mConfig.playFilePath.c_str());
+            return false;
+        }
+
+        // Raw PCM has the layout of the -r/-c/-f options
+        if (mConfig.rawPcm) {
+            if (!wavFile.openRawForReading(mConfig.playFilePath, mConfig.sampleRate, mConfig.channelCount,
+                                           audio_bytes_per_sample(mConfig.format) * 8)) {
+                printf("Error: Failed to open raw PCM file: %s\n", mConfig.playFilePath.c_str());
+                return false;
+            }
+        } else if (!wavFile.openForReading(mConfig.playFilePath)) {
+            printf("Error: Failed to open WAV file: %s\n", mConfig.playFilePath.c_str());
+            return false;
+        }
+
+        if (!mConfig.rawPcm) {
+            mConfig.sampleRate = wavFile.getSampleRate();
+            mConfig.channelCount = wavFile.getNumChannels();
+            mConfig.format = wavFile.getAudioFormat();
+        }
+        printf("audio file info: %s, sampleRate: %d, channelCount: %d, format: %d\n", mConfig.playFilePath.c_str(),
+               mConfig.sampleRate, mConfig.channelCount, mConfig.format);
+        mStartupTimeline.mark("wav_setup");
+
+        return true;
+    }
+
+    // Report progress during audio recording or playback
+    template <typename T>
+    bool reportProgress(const std::unique_ptr<T>& component,
+                        const uint64_t totalBytesProcessed,
+                        const uint64_t bytesPerSecond,
+                        WAVFile* wavFile = nullptr) {
+        if (component == nullptr) {
+            return false;
+        }
+
+        if (totalBytesProcessed >= mNextProgressReport) {
+            const char* operationTypeName = std::is_same_v<T, AudioInputStream> ? "Recording" : "Playing";
+            sLogger.print("%s ... , processed %.2f seconds, %.2f MB\n", operationTypeName,
+                          static_cast<float>(totalBytesProcessed) / bytesPerSecond,
+                          static_cast<float>(totalBytesProcessed) / (1024u * 1024u));
+            mNextProgressReport += bytesPerSecond * kProgressReportInterval;
+
+            if constexpr (std::is_same_v<T, AudioInputStream>) {
+                if (wavFile) {
+                    wavFile->updateHeader();
+                }
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // Tuning file key: tuned mode plus every setting the glitch-free buffer size depends on
+    std::string makeTuningKey(const int32_t target) const {
+        static const char* const kTargetNames[] = {"record", "play", "loopback"};
+        return String8::format("%s:%d:%d:%d:%d:%d:%d", kTargetNames[std::clamp(target, 0, 2)], mConfig.backend,
+                               mConfig.sampleRate, mConfig.channelCount, mConfig.format, mConfig.inputSource,
+                               mConfig.usage)
+            .c_str();
+    }
+
+    // Apply the buffer size and flags saved by the tuner (-m3) for this setup when --tuned is given
+    void applyTuning(const int32_t target) {
+        if (!mConfig.useTuning) {
+            return;
+        }
+        const std::string key = makeTuningKey(target);
+        std::ifstream file(mConfig.tuneFilePath);
+        std::string line;
+        while (std::getline(file, line)) {
+            char entryKey[128];
+            size_t frameCount = 0;
+            int32_t inputFlag = 0;
+            int32_t outputFlag = 0;
+            if (sscanf(line.c_str(), "%127s %zu %d %d", entryKey, &frameCount, &inputFlag, &outputFlag) == 4 &&
+                key == entryKey && frameCount > 0) {
+                mConfig.frameCount = frameCount;
+                mConfig.inputFlag = static_cast<audio_input_flags_t>(inputFlag);
+                mConfig.outputFlag = static_cast<audio_output_flags_t>(outputFlag);
+                printf("Using tuned buffer: frameCount=%zu, inputFlag=%d, outputFlag=%d\n", frameCount, inputFlag,
+                       outputFlag);
+                return;
+            }
+        }
+        printf("Warning: No tuning for %s in %s, using default buffer\n", key.c_str(), mConfig.tuneFilePath.c_str());
+    }
+
+    // Start publishing live metrics when --metrics is set
+    bool openLiveMetrics(const AudioMode mode) {
+        if (mConfig.metricsPath.empty()) {
+            return true;
+        }
+        const int32_t intervalMs = mConfig.metricsIntervalMs > 0 ? mConfig.metricsIntervalMs : kMetricsIntervalMs;
+        return mLiveMetrics.open(mConfig.metricsPath, mode, mConfig.sampleRate, mConfig.channelCount, mConfig.format,
+                                 intervalMs);
+    }
+
+    // Account one transfer that started at startNs and publish once per interval. The xrun counters are only
+    // queried when a snapshot is due, since AudioRecord reports lost frames through the audio server.
+    void updateLiveMetrics(const bool capture,
+                           const int64_t startNs,
+                           const char* buffer,
+                           const size_t bytes,
+                           AudioInputStream* input,
+                           AudioOutputStream* output) {
+        ++(capture ? mRunStats.readCalls : mRunStats.writeCalls);
+        if (!mLiveMetrics.isOpen()) {
+            return;
+        }
+        const int64_t nowNs = AudioUtils::getMonotonicNs();
+        mLiveMetrics.addTransfer(capture, nowNs - startNs, buffer, bytes);
+        if (mLiveMetrics.isDue(nowNs)) {
+            mLiveMetrics.publish(nowNs, input ? input->getOverrunFrames() : 0,
+                                 output ? output->getUnderrunCount() : 0);
+        }
+    }
+
+    // Publish the final snapshot, marked finished, and unmap the page
+    void finishLiveMetrics(AudioInputStream* input, AudioOutputStream* output) {
+        if (!mLiveMetrics.isOpen()) {
+            return;
+        }
+        mLiveMetrics.publish(AudioUtils::getMonotonicNs(), input ? input->getOverrunFrames() : 0,
+                             output ? output->getUnderrunCount() : 0, true);
+        mLiveMetrics.close();
+    }
+
+    // Start the per-read timestamp index next to the recording when --timestamps is set
+    bool openTimestampSidecar() {
+        if (!mConfig.timestampSidecar) {
+            return true;
+        }
+        if (WAVFile::isStdio(mConfig.recordFilePath)) {
+            printf("Error: --timestamps needs a record file, not stdout\n");
+            return false;
+        }
+        return mTimestampSidecar.open(mConfig.recordFilePath + ".ts", mConfig.sampleRate, mConfig.channelCount,
+                                      audio_bytes_per_sample(mConfig.format) * mConfig.channelCount);
+    }
+
+    // Index one read that started at WAV byte offset bytesBefore, with the stream timestamp right after it
+    void addReadTimestamp(AudioInputStream* input, const uint64_t bytesBefore, const size_t bytes) {
+        if (!mTimestampSidecar.isOpen()) {
+            return;
+        }
+        TimestampSidecarRecord record{};
+        record.returnNs = AudioUtils::getMonotonicNs();
+        record.framePosition = bytesBefore / (audio_bytes_per_sample(mConfig.format) * mConfig.channelCount);
+        record.bytes = static_cast<uint32_t>(bytes);
+        if (input->getTimestamp(record.streamPosition, record.streamTimeNs)) {
+            record.flags = TimestampSidecarRecord::kFlagTimestampValid;
+        }
+        mTimestampSidecar.add(record);
+    }
+
+    // Start CPU accounting when --cpu is set, before any loop thread begins
+    void startResourceUsage() {
+        if (!mConfig.cpuUsage) {
+            return;
+        }
+        pid_t serverPid = -1;
+        if (!mConfig.cpuServer.empty()) {
+            serverPid = ResourceUsage::findProcess(mConfig.cpuServer);
+            if (serverPid < 0) {
+                printf("Warning: Process %s not found, accounting the client only\n", mConfig.cpuServer.c_str());
+            }
+        }
+        mResourceMeter.start(serverPid, mConfig.cpuServer);
+    }
+
+    // Single-thread loops: start accounting the process and the calling loop thread
+    void beginLoopResourceUsage() {
+        startResourceUsage();
+        if (mResourceMeter.isStarted()) {
+            mResourceMeter.beginThread("loop");
+        }
+    }
+
+    // Single-thread loops: stop accounting on the loop thread, after the loop
+    void endLoopResourceUsage() {
+        if (mResourceMeter.isStarted()) {
+            mResourceMeter.endThread(0, mRunStats.readCalls + mRunStats.writeCalls);
+            mResourceMeter.stop();
+        }
+    }
+
+    // Open the --report file for writing. The first open of the run truncates it and every later one appends,
+    // so records written by different stages of a run (resource usage, startup, results) all stay in the file.
+    bool openReportFile(std::ofstream& report) const {
+        static std::mutex sReportMutex;
+        static bool sReportTruncated = false;
+        std::lock_guard<std::mutex> lock(sReportMutex);
+        report.open(mConfig.reportPath, std::ios::out | (sReportTruncated ? std::ios::app : std::ios::trunc));
+        if (!report.is_open()) {
+            return false;
+        }
+        sReportTruncated = true;
+        return true;
+    }
+
+    // Print the CPU usage of the run and append it to the report file; audioSeconds < 0 = from mRunStats
+    void reportResourceUsage(const AudioMode mode, double audioSeconds = -1.0) {
+        if (!mResourceMeter.isStarted()) {
+            return;
+        }
+        if (audioSeconds < 0.0) {
+            audioSeconds = static_cast<double>(std::max(mRunStats.bytesCaptured, mRunStats.bytesRendered)) /
+                           std::max<uint64_t>(calculateBytesPerSecond(), 1);
+        }
+        mResourceMeter.print(audioSeconds);
+        if (!mConfig.reportPath.empty()) {
+            std::ofstream report;
+            if (!openReportFile(report)) {
+                printf("Error: Can't create report file: %s\n", mConfig.reportPath.c_str());
+                return;
+            }
+            report << mResourceMeter.toJsonLine(mode, audioSeconds) << '\n';
+        }
+    }
+
+    // Print the startup breakdown of a streaming run and append it to the report file
+    void reportStartup() {
+        if (!mConfig.startupReport || mStartupTimeline.empty()) {
+            return;
+        }
+        mStartupTimeline.print("Startup timeline");
+        if (!mConfig.reportPath.empty()) {
+            std::ofstream report;
+            if (!openReportFile(report)) {
+                printf("Error: Can't create report file: %s\n", mConfig.reportPath.c_str());
+                return;
+            }
+            report << mStartupTimeline.toJsonLine(0) << '\n';
+            printf("Startup report saved: %s\n", mConfig.reportPath.c_str());
+        }
+    }
+
+    // Measure mConfig.startupCycles open/start/first frame/stop/close cycles instead of streaming.
+    // Cycle 0 is cold (it also carries the process phases), the later cycles show the warm cost.
+    int32_t runStartupCycles(const bool withInput, const bool withOutput) {
+        printf("Startup profiling: %d open/start/stop cycles\n", mConfig.startupCycles);
+        std::vector<StartupTimeline> cycles;
+        cycles.reserve(mConfig.startupCycles);
+        for (int32_t cycle = 0; cycle < mConfig.startupCycles && !sExitRequested; ++cycle) {
+            if (cycle > 0) {
+                mStartupTimeline.clear();
+            }
+            mStartupTimeline.mark("cycle_start");
+            if (!runStartupCycle(withInput, withOutput)) {
+                printf("Error: Startup cycle %d failed\n", cycle);
+                return -1;
+            }
+            cycles.push_back(mStartupTimeline);
+        }
+        if (cycles.empty()) {
+            return -1;
+        }
+
+        cycles.front().print("Startup timeline (cycle 0, cold)");
+        printStartupSummary(cycles);
+        if (!mConfig.reportPath.empty()) {
+            std::ofstream report;
+            if (!openReportFile(report)) {
+                printf("Error: Can't create report file: %s\n", mConfig.reportPath.c_str());
+                return -1;
+            }
+            for (size_t i = 0; i < cycles.size(); ++i) {
+                report << cycles[i].toJsonLine(static_cast<int32_t>(i)) << '\n';
+            }
+            report << startupSummaryJsonLine(cycles) << '\n';
+            printf("Startup report saved: %s\n", mConfig.reportPath.c_str());
+        }
+        return 0;
+    }
+
+    // Streams of one open/start/stop cycle, used by startup profiling and the buffer tuner
+    struct StreamPair {
+        std::unique_ptr<AudioInputStream> input;
+        std::unique_ptr<AudioOutputStream> output;
+        bool inputStarted = false;
+        bool outputStarted = false;
+    };
+
+    // Open and start the requested streams; on failure closeStreams() still releases what was opened
+    bool openStreams(const bool withInput, const bool withOutput, StreamPair& streams) {
+        bool success = (!withInput || (streams.input = openInputStream()) != nullptr) &&
+                       (!withOutput || (streams.output = openOutputStream()) != nullptr);
+        if (success && withInput) {
+            success = streams.inputStarted = startAudioComponent(streams.input);
+        }
+        if (success && withOutput) {
+            success = streams.outputStarted = startAudioComponent(streams.output);
+        }
+        return success;
+    }
+
+    void closeStreams(StreamPair& streams) {
+        if (streams.inputStarted) {
+            stopAudioComponent(streams.input);
+            mStartupTimeline.mark("input_stop");
+        }
+        if (streams.outputStarted) {
+            stopAudioComponent(streams.output);
+            mStartupTimeline.mark("output_stop");
+        }
+        closeInputStream(streams.input);
+        closeOutputStream(streams.output);
+        mStartupTimeline.mark("close");
+    }
+
+    // Queue one transfer of silence on a duplex output, so it holds a transfer in reserve instead of running
+    // near empty every time the capture side completes a read
+    bool primeOutput(const std::unique_ptr<AudioOutputStream>& output, char* buffer, const size_t size) {
+        memset(buffer, 0, size);
+        size_t bytesWritten = 0;
+        while (bytesWritten < size && !sExitRequested) {
+            const ssize_t written = output->write(buffer + bytesWritten, size - bytesWritten);
+            if (written < 0) {
+                printf("Error: %s write failed: %zd\n", output->getName(), written);
+                return false;
+            }
+            bytesWritten += static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    // One startup cycle: open, start, transfer the first buffer, stop and close
+    bool runStartupCycle(const bool withInput, const bool withOutput) {
+        StreamPair streams;
+        bool success = openStreams(withInput, withOutput, streams);
+        if (success) {
+            BufferPool::Lease bufferLease = BufferPool::acquire(mBufferPool, calculateBufferSize());
+            BufferManager& bufferManager = bufferLease.get();
+            success = bufferManager.isValid();
+            if (success) {
+                // Output-only cycles render silence, loopback cycles render the captured buffer
+                char* const buffer = bufferManager.get();
+                const size_t bufferSize = calculateBufferSize();
+                memset(buffer, 0, bufferSize);
+                if (withInput) {
+                    success = readFirstFrame(streams.input, buffer, bufferSize);
+                }
+                if (success && withOutput) {
+                    success = writeFirstFrame(streams.output, buffer, bufferSize);
+                }
+            }
+        }
+        closeStreams(streams);
+        return success;
+    }
+
+    bool readFirstFrame(const std::unique_ptr<AudioInputStream>& input, char* buffer, const size_t size) {
+        while (!sExitRequested) {
+            const ssize_t bytesRead = input->read(buffer, size);
+            if (bytesRead < 0) {
+                printf("Error: %s read failed: %zd\n", input->getName(), bytesRead);
+                return false;
+            }
+            if (bytesRead > 0) {
+                mStartupTimeline.mark("first_read");
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool writeFirstFrame(const std::unique_ptr<AudioOutputStream>& output, const char* buffer, const size_t size) {
+        while (!sExitRequested) {
+            const ssize_t written = output->write(buffer, size);
+            if (written < 0) {
+                printf("Error: %s write failed: %zd\n", output->getName(), written);
+                return false;
+            }
+            if (written > 0) {
+                mStartupTimeline.mark("first_write");
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Per-phase statistics over all cycles: phase time of the cold cycle and min/median/max of the warm ones.
+    // The "first_frame" row is measured from cycle_start, so cold and warm values are comparable.
+    struct StartupPhaseStats {
+        const char* phase;
+        int64_t coldNs;
+        int64_t warmMinNs;
+        int64_t warmMedianNs;
+        int64_t warmMaxNs;
+    };
+
+    static std::vector<StartupPhaseStats> computeStartupStats(const std::vector<StartupTimeline>& cycles) {
+        std::vector<const char*> phases;
+        for (const StartupTimeline& cycle : cycles) {
+            for (const StartupTimeline::Mark& m : cycle.getMarks()) {
+                if (std::none_of(phases.begin(), phases.end(),
+                                 [&m](const char* phase) { return strcmp(phase, m.phase) == 0; })) {
+                    phases.push_back(m.phase);
+                }
+            }
+        }
+        phases.push_back("first_frame");
+
+        std::vector<StartupPhaseStats> stats;
+        for (const char* phase : phases) {
+            const bool isFirstFrame = strcmp(phase, "first_frame") == 0;
+            auto durationOf = [isFirstFrame, phase](const StartupTimeline& cycle) {
+                return isFirstFrame ? cycle.getTimeToFirstFrameNs("cycle_start") : cycle.getPhaseDurationNs(phase);
+            };
+            std::vector<int64_t> warm;
+            for (size_t i = 1; i < cycles.size(); ++i) {
+                const int64_t durationNs = durationOf(cycles[i]);
+                if (durationNs >= 0) {
+                    warm.push_back(durationNs);
+                }
+            }
+            std::sort(warm.begin(), warm.end());
+            const bool hasWarm = !warm.empty();
+            stats.push_back({phase, durationOf(cycles.front()), hasWarm ? warm.front() : -1,
+                             hasWarm ? warm[warm.size() / 2] : -1, hasWarm ? warm.back() : -1});
+        }
+        return stats;
+    }
+
+    static void printStartupSummary(const std::vector<StartupTimeline>& cycles) {
+        printf("Startup summary: 1 cold + %zu warm cycles (ms)\n", cycles.size() - 1);
+        printf("  %-24s %10s %10s %10s %10s\n", "phase", "cold", "warm min", "warm med", "warm max");
+        auto toMs = [](const int64_t ns) { return ns >= 0 ? String8::format("%.3f", ns / 1e6) : String8("-"); };
+        for (const StartupPhaseStats& s : computeStartupStats(cycles)) {
+            printf("  %-24s %10s %10s %10s %10s\n", s.phase, toMs(s.coldNs).c_str(), toMs(s.warmMinNs).c_str(),
+                   toMs(s.warmMedianNs).c_str(), toMs(s.warmMaxNs).c_str());
+        }
+    }
+
+    // Summary as a single-line JSON object, -1 marks a phase missing from the cold or all warm cycles
+    static std::string startupSummaryJsonLine(const std::vector<StartupTimeline>& cycles) {
+        std::string line = String8::format("{\"version\":\"%s\",\"type\":\"startup_summary\",\"cycles\":%zu,"
+                                           "\"phases\":[",
+                                           AUDIO_TEST_CLIENT_VERSION, cycles.size())
+                               .c_str();
+        auto toMs = [](const int64_t ns) { return ns >= 0 ? ns / 1e6 : -1.0; };
+        bool first = true;
+        for (const StartupPhaseStats& s : computeStartupStats(cycles)) {
+            line += String8::format("%s{\"phase\":\"%s\",\"cold_ms\":%.3f,\"warm_min_ms\":%.3f,"
+                                    "\"warm_median_ms\":%.3f,\"warm_max_ms\":%.3f}",
+                                    first ? "" : ",", s.phase, toMs(s.coldNs), toMs(s.warmMinNs),
+                                    toMs(s.warmMedianNs), toMs(s.warmMaxNs))
+                        .c_str();
+            first = false;
+        }
+        line += "]}";
+        return line;
+    }
+
+    // Handle SIGINT signal (Ctrl+C) for graceful shutdown, and SIGUSR1 as the external trigger of -m6
+    static void signalHandler(int signal) {
+        if (signal == SIGINT) {
+            sExitRequested.store(true);
+        } else if (signal == SIGUSR1) {
+            sTriggerRequested.store(true);
+        }
+    }
+
+    // Setup SIGINT signal handler for graceful termination
+    void setupSignalHandler() { signal(SIGINT, signalHandler); }
+
+    // Update audio level meter with low CPU usage
+    void updateLevelMeter(const char* buffer, size_t size) {
+        // Only update level meter every kLevelMeterInterval frames
+        if (++mLevelMeterCounter % kLevelMeterInterval != 0) {
+            return;
+        }
+
+        constexpr float DB_FLOOR = -60.0f;
+
+        const size_t bytesPerSample = audio_bytes_per_sample(mConfig.format);
+        if (size == 0 || bytesPerSample == 0) {
+            sLogger.error("Invalid input size or bytesPerSample\n");
+            return;
+        }
+
+        const float peakAmplitude = AudioUtils::computePeakAmplitude(buffer, size, mConfig.format);
+        if (peakAmplitude < 0.0f) {
+            sLogger.error("Unsupported audio format for level meter\n");
+            return;
+        }
+
+        // Convert to dB scale (with floor at -60dB)
+        const float dbLevel = peakAmplitude > 0.0f ? std::max(20.0f * std::log10(peakAmplitude), DB_FLOOR) : DB_FLOOR;
+        sLogger.printTimed("Audio Level: %.1f dB, bytes: %zu\n", dbLevel, size);
+    }
+
+    // Start the spectrum analyzer thread when --spectrum is set
+    bool startSpectrum() {
+        if (!mConfig.spectrum) {
+            return true;
+        }
+        return mSpectrum.start(mConfig.sampleRate, mConfig.channelCount, mConfig.format, mConfig.spectrumChannels,
+                               static_cast<uint32_t>(mConfig.spectrumFftSize), mConfig.spectrumRate,
+                               mConfig.spectrumPath);
+    }
+
+    // Hand one captured buffer to the analyzer, a copy without waiting
+    void feedSpectrum(const char* buffer, const size_t bytes) {
+        if (mSpectrum.isRunning()) {
+            mSpectrum.feed(buffer, bytes);
+        }
+    }
+
+    // Build the --dsp graph for a data path carrying inputChannels; totalFrames (0 = unknown) places the fade-out
+    bool openDspGraph(const int32_t inputChannels, const uint64_t totalFrames) {
+        if (mConfig.dspSpec.empty()) {
+            return true;
+        }
+        return mDspGraph.configure(mConfig.dspSpec, mConfig.sampleRate, inputChannels, mConfig.format,
+                                   static_cast<size_t>(std::max(mConfig.dspBlockFrames, 1)), totalFrames);
+    }
+
+    // Frames of a -d limited run, 0 = unlimited
+    uint64_t getDurationFrames() const {
+        return mConfig.durationSeconds > 0 ? static_cast<uint64_t>(mConfig.durationSeconds) * mConfig.sampleRate : 0;
+    }
+};
+
+/************************** Audio Record Operation ******************************/
+class AudioRecordOperation : public AudioOperation {
+public:
+    // Constructor for audio recording operation
+    explicit AudioRecordOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~AudioRecordOperation() override = default;
+
+    // Disable copy operations (inherited from AudioOperation)
+    AudioRecordOperation(const AudioRecordOperation&) = delete;
+    AudioRecordOperation& operator=(const AudioRecordOperation&) = delete;
+
+    // Execute audio recording operation
+    int32_t execute() override {
+        WAVFile wavFile;
+        std::unique_ptr<AudioInputStream> audioRecord;
+
+        applyTuning(MODE_RECORD);
+        if (mConfig.startupCycles > 0) {
+            return validateAudioParameters() ? runStartupCycles(true, false) : -1;
+        }
+
+        // The file gets the channels leaving the DSP graph
+        if (!openDspGraph(mConfig.channelCount, getDurationFrames())) {
+            return -1;
+        }
+        const int32_t fileChannels = mDspGraph.isConfigured() ? mDspGraph.getOutputChannels() : mConfig.channelCount;
+        if (fileChannels != mConfig.channelCount && mConfig.gateAttackDb < 0.0f) {
+            printf("Error: The level gate can't be combined with a DSP graph that changes the channel count\n");
+            return -1;
+        }
+
+        // A splitting level gate writes numbered files only, the record path is their base name
+        if (isGateSplit()) {
+            mConfig.recordFilePath =
+                AudioUtils::makeRecordFilePath(mConfig.sampleRate, mConfig.channelCount,
+                                               audio_bytes_per_sample(mConfig.format) * 8, mConfig.recordFilePath);
+        } else if (!setupWavFileForRecording(wavFile, fileChannels)) {
+            printf("Error: Failed to setup WAV file or validate audio parameters\n");
+            return -1;
+        }
+        if (!validateAudioParameters()) {
+            printf("Error: Failed to setup WAV file or validate audio parameters\n");
+            return -1;
+        }
+
+        audioRecord = openInputStream();
+        if (!audioRecord) {
+            wavFile.close();
+            return -1;
+        }
+
+        if (!startAudioComponent(audioRecord)) {
+            wavFile.close();
+            return -1;
+        }
+
+        // Main recording loop
+        int32_t operationResult = recordLoop(audioRecord, wavFile);
+
+        // Cleanup
+        stopAudioComponent(audioRecord);
+        closeInputStream(audioRecord);
+        wavFile.finalize();
+        reportStartup();
+        reportResourceUsage(MODE_RECORD);
+
+        return operationResult;
+    }
+
+private:
+    bool isGateSplit() const { return mConfig.gateAttackDb < 0.0f && mConfig.gateSplit; }
+
+    // Main recording loop that handles audio data collection
+    int32_t recordLoop(const std::unique_ptr<AudioInputStream>& audioRecord, WAVFile& wavFile) {
+        // Setup buffer
+        BufferPool::Lease bufferLease = BufferPool::acquire(mBufferPool, calculateBufferSize());
+        BufferManager& bufferManager = bufferLease.get();
+        if (!bufferManager.isValid()) {
+            printf("Error: Failed to create valid buffer manager\n");
+            return -1;
+        }
+        char* const audioBuffer = bufferManager.get();
+
+        if (mConfig.durationSeconds > 0) {
+            printf("Recording for %d seconds...\n", mConfig.durationSeconds);
+        }
+
+        printf("Recording in progress. Press Ctrl+C to stop\n");
+        ALOGI("Recording in progress.");
+        const uint64_t bytesPerSecond = calculateBytesPerSecond();
+        const uint64_t maxBytesToRecord =
+            (mConfig.durationSeconds > 0) ? std::min(static_cast<uint64_t>(mConfig.durationSeconds) * bytesPerSecond,
+                                                     static_cast<uint64_t>(kMaxAudioDataSize))
+                                          : static_cast<uint64_t>(kMaxAudioDataSize);
+        mNextProgressReport = bytesPerSecond * kProgressReportInterval;
+        if (!openLiveMetrics(MODE_RECORD) || !openTimestampSidecar() || !startSpectrum()) {
+            return -1;
+        }
+        const size_t frameSize = audio_bytes_per_sample(mConfig.format) * mConfig.channelCount;
+        std::vector<char> dspBuffer(mDspGraph.isConfigured()
+                                        ? calculateBufferSize() / frameSize * mDspGraph.getOutputFrameSize()
+                                        : 0);
+        std::unique_ptr<LevelGateWriter> levelGate;
+        if (mConfig.gateAttackDb < 0.0f) {
+            levelGate = std::make_unique<LevelGateWriter>(mConfig);
+            levelGate->open(&wavFile, mConfig.recordFilePath);
+        }
+
+        beginLoopResourceUsage();
+        const int64_t loopStartNs = AudioUtils::getMonotonicNs();
+        uint64_t totalBytesRead = 0;
+        while (totalBytesRead < maxBytesToRecord && !sExitRequested) {
+            const int64_t readStartNs = AudioUtils::getMonotonicNs();
+            const ssize_t bytesRead = audioRecord->read(audioBuffer, calculateBufferSize());
+            if (bytesRead < 0) {
+                sLogger.error("AudioRecord read failed: %zd\n", bytesRead);
+                break;
+            }
+            if (bytesRead == 0) {
+                continue;
+            }
+            if (totalBytesRead == 0) {
+                mStartupTimeline.mark("first_read");
+            }
+            addReadTimestamp(audioRecord.get(), totalBytesRead, static_cast<size_t>(bytesRead));
+            totalBytesRead += static_cast<uint64_t>(bytesRead);
+            updateLiveMetrics(true, readStartNs, audioBuffer, static_cast<size_t>(bytesRead), audioRecord.get(),
+                              nullptr);
+
+            // Update level meter
+            updateLevelMeter(audioBuffer, static_cast<size_t>(bytesRead));
+            feedSpectrum(audioBuffer, static_cast<size_t>(bytesRead));
+
+            // The file gets the DSP graph output, the meters above see the capture
+            const char* fileData = audioBuffer;
+            size_t fileBytes = static_cast<size_t>(bytesRead);
+            if (mDspGraph.isConfigured()) {
+                fileBytes = mDspGraph.process(audioBuffer, fileBytes, dspBuffer.data());
+                fileData = dspBuffer.data();
+            }
+
+            // Write data to WAV file, only the active regions when gated
+            if (levelGate) {
+                if (!levelGate->write(fileData, fileBytes)) {
+                    break;
+                }
+            } else if (wavFile.writeData(fileData, fileBytes) != fileBytes) {
+                sLogger.error("Failed to save audio data to file\n");
+                break;
+            }
+
+            // Report progress
+            reportProgress(audioRecord, totalBytesRead, calculateBytesPerSecond(), &wavFile);
+        }
+
+        // Everything the loop queued goes out before the direct output below
+        sLogger.flush();
+        endLoopResourceUsage();
+        finishLiveMetrics(audioRecord.get(), nullptr);
+        mSpectrum.stop();
+        mTimestampSidecar.close();
+        mRunStats.loopTimeNs = AudioUtils::getMonotonicNs() - loopStartNs;
+        mRunStats.bytesCaptured = totalBytesRead;
+        mRunStats.overrunFrames = audioRecord->getOverrunFrames();
+        mDspGraph.printReport();
+
+        if (isGateSplit()) {
+            printf("Recording finished: Recorded %" PRIu64 " bytes, Segments saved: %s_<n>.wav\n", totalBytesRead,
+                   mConfig.recordFilePath.substr(0, mConfig.recordFilePath.rfind(".wav")).c_str());
+        } else {
+            printf("Recording finished: Recorded %" PRIu64 " bytes, File saved: %s\n", totalBytesRead,
+                   wavFile.getFilePath().c_str());
+        }
+        if (levelGate) {
+            sLogger.flush();
+            return levelGate->finish() ? 0 : -1;
+        }
+
+        return 0;
+    }
+};
+
+/************************** Audio Play Operation ******************************/
+class AudioPlayOperation : public AudioOperation {
+public:
+    // Constructor for audio playback operation
+    explicit AudioPlayOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~AudioPlayOperation() override = default;
+
+    // Disable copy operations (inherited from AudioOperation)
+    AudioPlayOperation(const AudioPlayOperation&) = delete;
+    AudioPlayOperation& operator=(const AudioPlayOperation&) = delete;
+
+    // Execute audio playback operation
+    int32_t execute() override {
+        WAVFile wavFile;
+        std::unique_ptr<AudioOutputStream> audioTrack;
+
+        if (!setupWavFileForPlayback(wavFile) || !validateAudioParameters()) {
+            printf("Error: Failed to setup WAV file or validate audio parameters\n");
+            return -1;
+        }
+        // The stream gets the channels leaving the DSP graph
+        const size_t fileFrameSize = audio_bytes_per_sample(mConfig.format) * mConfig.channelCount;
+        const uint32_t dataSize = wavFile.getHeader().dataSize;
+        if (!openDspGraph(mConfig.channelCount, dataSize != UINT32_MAX ? dataSize / fileFrameSize : 0)) {
+            wavFile.close();
+            return -1;
+        }
+        if (mDspGraph.isConfigured()) {
+            mConfig.channelCount = mDspGraph.getOutputChannels();
+        }
+        applyTuning(MODE_PLAY);
+
+        if (mConfig.startupCycles > 0) {
+            wavFile.close();
+            return runStartupCycles(false, true);
+        }
+
+        audioTrack = openOutputStream();
+        if (!audioTrack) {
+            wavFile.close();
+            return -1;
+        }
+
+        // Start playback
+        if (!startAudioComponent(audioTrack)) {
+            wavFile.close();
+            return -1;
+        }
+
+        // Main playback loop
+        int32_t operationResult = playLoop(audioTrack, wavFile);
+
+        // Cleanup
+        stopAudioComponent(audioTrack);
+        closeOutputStream(audioTrack);
+        wavFile.close();
+        reportStartup();
+        reportResourceUsage(MODE_PLAY);
+
+        return operationResult;
+    }
+
+private:
+    // Main playback loop that handles audio data playback
+    int32_t playLoop(const std::unique_ptr<AudioOutputStream>& audioTrack, WAVFile& wavFile) {
+        // Setup buffer
+        BufferPool::Lease bufferLease = BufferPool::acquire(mBufferPool, calculateBufferSize());
+        BufferManager& bufferManager = bufferLease.get();
+        if (!bufferManager.isValid()) {
+            printf("Error: Failed to create valid buffer manager\n");
+            return -1;
+        }
+        char* const audioBuffer = bufferManager.get();
+
+        printf("Playing in progress. Press Ctrl+C to stop\n");
+        ALOGI("Playing in progress.");
+        const uint64_t bytesPerSecond = calculateBytesPerSecond();
+        mNextProgressReport = bytesPerSecond * kProgressReportInterval;
+        if (!openLiveMetrics(MODE_PLAY)) {
+            return -1;
+        }
+        // With a DSP graph the file is read into its own buffer and processed into the stream buffer
+        std::vector<char> fileBuffer(mDspGraph.isConfigured() ? calculateBufferSize() /
+                                                                    mDspGraph.getOutputFrameSize() *
+                                                                    mDspGraph.getInputFrameSize()
+                                                              : 0);
+        beginLoopResourceUsage();
+        const int64_t loopStartNs = AudioUtils::getMonotonicNs();
+        uint64_t totalBytesPlayed = 0;
+        while (!sExitRequested) {
+            size_t bytesRead = 0;
+            if (mDspGraph.isConfigured()) {
+                bytesRead = mDspGraph.process(fileBuffer.data(), wavFile.readData(fileBuffer.data(), fileBuffer.size()),
+                                              audioBuffer);
+            } else {
+                bytesRead = wavFile.readData(audioBuffer, calculateBufferSize());
+            }
+            if (bytesRead == 0) {
+                sLogger.print("End of file reached\n");
+                break;
+            }
+
+            size_t bytesWritten = 0;
+            const size_t bytesToWrite = bytesRead;
+            while (bytesWritten < bytesToWrite && !sExitRequested) {
+                const int64_t writeStartNs = AudioUtils::getMonotonicNs();
+                const ssize_t written = audioTrack->write(audioBuffer + bytesWritten, bytesToWrite - bytesWritten);
+                if (written < 0) {
+                    sLogger.error("AudioTrack write failed: %zd\n", written);
+                    sLogger.flush();
+                    mRunStats.bytesRendered = totalBytesPlayed + bytesWritten;
+                    endLoopResourceUsage();
+                    finishLiveMetrics(nullptr, audioTrack.get());
+                    return -1;
+                }
+                if (totalBytesPlayed + bytesWritten == 0 && written > 0) {
+                    mStartupTimeline.mark("first_write");
+                }
+                updateLiveMetrics(false, writeStartNs, audioBuffer + bytesWritten, static_cast<size_t>(written),
+                                  nullptr, audioTrack.get());
+                bytesWritten += static_cast<size_t>(written);
+            }
+            // Update total bytes played
+            totalBytesPlayed += static_cast<uint64_t>(bytesWritten);
+
+            // Update level meter
+            updateLevelMeter(audioBuffer, bytesRead);
+
+            // Report progress
+            reportProgress(audioTrack, totalBytesPlayed, calculateBytesPerSecond());
+        }
+        sLogger.flush();
+        endLoopResourceUsage();
+        finishLiveMetrics(nullptr, audioTrack.get());
+        mRunStats.loopTimeNs = AudioUtils::getMonotonicNs() - loopStartNs;
+        mRunStats.bytesRendered = totalBytesPlayed;
+        mRunStats.underrunCount = audioTrack->getUnderrunCount();
+        mDspGraph.printReport();
+        printf("Playback finished: Total bytes played: %" PRIu64 "\n", totalBytesPlayed);
+
+        return 0;
+    }
+};
+
+/************************** Audio Loopback Operation ******************************/
+class AudioLoopbackOperation : public AudioOperation {
+public:
+    // Constructor for audio loopback operation (record + playback)
+    explicit AudioLoopbackOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~AudioLoopbackOperation() override = default;
+
+    // Disable copy operations (inherited from AudioOperation)
+    AudioLoopbackOperation(const AudioLoopbackOperation&) = delete;
+    AudioLoopbackOperation& operator=(const AudioLoopbackOperation&) = delete;
+
+    // Execute audio loopback operation (simultaneous recording and playback)
+    int32_t execute() override {
+        WAVFile wavFile;
+        std::unique_ptr<AudioInputStream> audioRecord;
+        std::unique_ptr<AudioOutputStream> audioTrack;
+
+        applyTuning(MODE_LOOPBACK);
+        if (mConfig.startupCycles > 0) {
+            return validateAudioParameters() ? runStartupCycles(true, true) : -1;
+        }
+
+        // The DSP graph processes the render path, input and output share the channel count
+        if (!openDspGraph(mConfig.channelCount, getDurationFrames())) {
+            return -1;
+        }
+        if (mDspGraph.isConfigured() && mDspGraph.getOutputChannels() != mConfig.channelCount) {
+            printf("Error: The loopback DSP graph can't change the channel count\n");
+            return -1;
+        }
+
+        if (!setupWavFileForRecording(wavFile) || !validateAudioParameters()) {
+            printf("Error: Failed to setup WAV file or validate audio parameters\n");
+            return -1;
+        }
+
+        audioRecord = openInputStream();
+        if (!audioRecord) {
+            wavFile.close();
+            return -1;
+        }
+
+        audioTrack = openOutputStream();
+        if (!audioTrack) {
+            closeInputStream(audioRecord);
+            wavFile.close();
+            return -1;
+        }
+
+        // Start recording and playback
+        if (!startAudioComponent(audioRecord)) {
+            wavFile.close();
+            return -1;
+        }
+        if (!startAudioComponent(audioTrack)) {
+            stopAudioComponent(audioRecord);
+            wavFile.close();
+            return -1;
+        }
+
+        // Main loopback loop
+        int32_t operationResult = loopbackLoop(audioRecord, audioTrack, wavFile);
+
+        // Cleanup
+        stopAudioComponent(audioRecord);
+        stopAudioComponent(audioTrack);
+        closeInputStream(audioRecord);
+        closeOutputStream(audioTrack);
+        wavFile.finalize();
+        reportStartup();
+        reportResourceUsage(MODE_LOOPBACK);
+
+        return operationResult;
+    }
+
+private:
+    // Main loopback loop for simultaneous recording and playback
+    int32_t loopbackLoop(const std::unique_ptr<AudioInputStream>& audioRecord,
+                         const std::unique_ptr<AudioOutputStream>& audioTrack,
+                         WAVFile& wavFile) {
+        // Setup buffer
+        BufferPool::Lease bufferLease = BufferPool::acquire(mBufferPool, calculateBufferSize());
+        BufferManager& bufferManager = bufferLease.get();
+        if (!bufferManager.isValid()) {
+            printf("Error: Failed to create valid buffer manager\n");
+            return -1;
+        }
+        char* const audioBuffer = bufferManager.get();
+
+        if (mConfig.durationSeconds > 0) {
+            printf("Duplex audio started: Recording for %d seconds...\n", mConfig.durationSeconds);
+        }
+
+        printf("Duplex audio in progress. Press Ctrl+C to stop\n");
+        ALOGI("Duplex audio in progress.");
+        const uint64_t bytesPerSecond = calculateBytesPerSecond();
+        const uint64_t maxBytesToRecord =
+            (mConfig.durationSeconds > 0) ? std::min(static_cast<uint64_t>(mConfig.durationSeconds) * bytesPerSecond,
+                                                     static_cast<uint64_t>(kMaxAudioDataSize))
+                                          : static_cast<uint64_t>(kMaxAudioDataSize);
+        mNextProgressReport = bytesPerSecond * kProgressReportInterval;
+
+        // An explicit (tuned) buffer is sized for a primed output
+        if (mConfig.frameCount > 0 && !primeOutput(audioTrack, audioBuffer, calculateBufferSize())) {
+            return -1;
+        }
+        if (!openLiveMetrics(MODE_LOOPBACK) || !openTimestampSidecar() || !startSpectrum()) {
+            return -1;
+        }
+
+        beginLoopResourceUsage();
+        const int64_t loopStartNs = AudioUtils::getMonotonicNs();
+        uint64_t totalBytesRead = 0;
+        uint64_t totalBytesPlayed = 0;
+        bool duplexError = false; // Track if any error occurred during duplex operation
+        if (mConfig.eventLoop) {
+            duplexError = !eventLoop(audioRecord, audioTrack, wavFile, maxBytesToRecord, totalBytesRead,
+                                     totalBytesPlayed);
+        } else {
+            while (totalBytesRead < maxBytesToRecord && !sExitRequested && !duplexError) {
+                const int64_t readStartNs = AudioUtils::getMonotonicNs();
+                const ssize_t bytesRead = audioRecord->read(audioBuffer, calculateBufferSize());
+                if (bytesRead < 0) {
+                    sLogger.error("AudioRecord read failed: %zd\n", bytesRead);
+                    break;
+                }
+                if (bytesRead == 0) {
+                    continue;
+                }
+                if (totalBytesRead == 0) {
+                    mStartupTimeline.mark("first_read");
+                }
+                addReadTimestamp(audioRecord.get(), totalBytesRead, static_cast<size_t>(bytesRead));
+                totalBytesRead += static_cast<uint64_t>(bytesRead);
+                updateLiveMetrics(true, readStartNs, audioBuffer, static_cast<size_t>(bytesRead), audioRecord.get(),
+                                  audioTrack.get());
+
+                // Update level meter for recording
+                updateLevelMeter(audioBuffer, static_cast<size_t>(bytesRead));
+                feedSpectrum(audioBuffer, static_cast<size_t>(bytesRead));
+
+                // Write to WAV file
+                if (wavFile.writeData(audioBuffer, static_cast<size_t>(bytesRead)) != static_cast<size_t>(bytesRead)) {
+                    sLogger.error("Failed to save audio data to file\n");
+                    // break; // Continue playing if save failed
+                }
+
+                // Report progress for recording
+                reportProgress(audioRecord, totalBytesRead, calculateBytesPerSecond(), &wavFile);
+
+                // Check recording finish
+                if (totalBytesRead >= maxBytesToRecord) {
+                    break;
+                }
+                if (mDspGraph.isConfigured()) {
+                    mDspGraph.process(audioBuffer, static_cast<size_t>(bytesRead), audioBuffer);
+                }
+
+                size_t bytesWritten = 0;
+                const size_t bytesToWrite = static_cast<size_t>(bytesRead);
+                while (bytesWritten < bytesToWrite && !sExitRequested) {
+                    const int64_t writeStartNs = AudioUtils::getMonotonicNs();
+                    const ssize_t written = audioTrack->write(audioBuffer + bytesWritten, bytesToWrite - bytesWritten);
+                    if (written < 0) {
+                        sLogger.error("AudioTrack write failed: %zd\n", written);
+                        duplexError = true;
+                        break;
+                    }
+                    if (totalBytesPlayed + bytesWritten == 0 && written > 0) {
+                        mStartupTimeline.mark("first_write");
+                    }
+                    updateLiveMetrics(false, writeStartNs, audioBuffer + bytesWritten, static_cast<size_t>(written),
+                                      audioRecord.get(), audioTrack.get());
+                    bytesWritten += static_cast<size_t>(written);
+                }
+                totalBytesPlayed += static_cast<uint64_t>(bytesWritten);
+            }
+        }
+
+        sLogger.flush();
+        endLoopResourceUsage();
+        finishLiveMetrics(audioRecord.get(), audioTrack.get());
+        mSpectrum.stop();
+        mTimestampSidecar.close();
+        mRunStats.loopTimeNs = AudioUtils::getMonotonicNs() - loopStartNs;
+        mRunStats.bytesCaptured = totalBytesRead;
+        mRunStats.bytesRendered = totalBytesPlayed;
+        mRunStats.overrunFrames = audioRecord->getOverrunFrames();
+        mRunStats.underrunCount = audioTrack->getUnderrunCount();
+        mDspGraph.printReport();
+
+        printf("Loopback audio completed: Total bytes read: %" PRIu64 ", Total bytes played: %" PRIu64
+               ", File saved: %s\n",
+               totalBytesRead, totalBytesPlayed, wavFile.getFilePath().c_str());
+        if (mConfig.eventLoop) {
+            printEventLoopStats();
+        }
+
+        return 0;
+    }
+
+    static constexpr size_t kEventFifoChunks = 4; // render FIFO of the event loop, in transfer buffers
+
+    // Captured data waiting for the output, in whole frames
+    struct RenderFifo {
+        std::vector<char> data;
+        size_t head = 0;
+        size_t size = 0;
+
+        explicit RenderFifo(const size_t capacity) : data(capacity) {}
+        char* front() { return data.data() + head; }
+        char* back() { return data.data() + (head + size) % data.size(); }
+        size_t contiguousUsed() const { return std::min(size, data.size() - head); }
+        size_t contiguousFree() const {
+            return std::min(data.size() - (head + size) % data.size(), data.size() - size);
+        }
+        void push(const size_t bytes) { size += bytes; }
+        void pop(const size_t bytes) {
+            head = (head + bytes) % data.size();
+            size -= bytes;
+        }
+    };
+
+    struct EventLoopStats {
+        int64_t periodNs = 0;
+        int64_t elapsedNs = 0;
+        uint64_t wakeups = 0;      // timer sleeps that ended
+        uint64_t lateTicks = 0;    // ticks whose work overran the period, serviced without sleeping
+        uint64_t reads = 0;
+        uint64_t emptyReads = 0;   // input had nothing ready
+        uint64_t writes = 0;
+        uint64_t fullWrites = 0;   // output had no space
+        uint64_t droppedBytes = 0; // render data dropped because the output stalled
+        size_t maxFifoBytes = 0;   // deepest render FIFO after a tick, the added output latency
+    };
+
+    // Single-thread duplex loop driven by a periodic timer. Each tick drains everything the input has ready into
+    // the file and the render FIFO, then gives the output as much of the FIFO as it takes, all with non-blocking
+    // calls. Neither stream waits for the other, and the wakeups follow the period instead of the stream buffers.
+    // When the output stalls the FIFO drops its oldest data, so the capture is never held back by it.
+    bool eventLoop(const std::unique_ptr<AudioInputStream>& audioRecord,
+                   const std::unique_ptr<AudioOutputStream>& audioTrack,
+                   WAVFile& wavFile,
+                   const uint64_t maxBytesToRecord,
+                   uint64_t& totalBytesRead,
+                   uint64_t& totalBytesPlayed) {
+        const size_t frameSize = audio_bytes_per_sample(mConfig.format) * mConfig.channelCount;
+        const size_t chunkSize = calculateBufferSize();
+        const uint64_t bytesPerSecond = calculateBytesPerSecond();
+        const uint64_t maxBytes = maxBytesToRecord / frameSize * frameSize;
+        mEventStats = EventLoopStats();
+        mEventStats.periodNs =
+            mConfig.eventPeriodMs > 0
+                ? static_cast<int64_t>(mConfig.eventPeriodMs) * 1000000LL
+                : std::max<int64_t>(static_cast<int64_t>(chunkSize * 500000000ULL / bytesPerSecond), 1000000LL);
+        RenderFifo fifo(kEventFifoChunks * chunkSize);
+
+        const int64_t startNs = AudioUtils::getMonotonicNs();
+        int64_t nextTickNs = startNs;
+        while (totalBytesRead < maxBytes && !sExitRequested) {
+            // A FIFO still full from the last tick means the output stalled: drop its oldest buffer
+            if (fifo.size == fifo.data.size()) {
+                const size_t dropped = std::min(fifo.size, chunkSize);
+                fifo.pop(dropped);
+                mEventStats.droppedBytes += dropped;
+            }
+
+            // Alternate both stages until the input is drained, or the FIFO is full and the output takes no more
+            bool inputDrained = false;
+            bool outputFull = false;
+            while (!inputDrained && !outputFull && totalBytesRead < maxBytes && !sExitRequested) {
+                // Input: read until the stream has nothing ready or the FIFO is full
+                while (totalBytesRead < maxBytes && fifo.size < fifo.data.size()) {
+                    const size_t wanted = static_cast<size_t>(
+                        std::min<uint64_t>(std::min(fifo.contiguousFree(), chunkSize), maxBytes - totalBytesRead));
+                    char* const data = fifo.back();
+                    const int64_t readStartNs = AudioUtils::getMonotonicNs();
+                    const ssize_t bytesRead = audioRecord->read(data, wanted, false);
+                    ++mEventStats.reads;
+                    if (bytesRead < 0) {
+                        sLogger.error("AudioRecord read failed: %zd\n", bytesRead);
+                        return false;
+                    }
+                    if (bytesRead == 0) {
+                        ++mEventStats.emptyReads;
+                        inputDrained = true;
+                        break;
+                    }
+                    const size_t bytes = static_cast<size_t>(bytesRead);
+                    if (totalBytesRead == 0) {
+                        mStartupTimeline.mark("first_read");
+                    }
+                    addReadTimestamp(audioRecord.get(), totalBytesRead, bytes);
+                    totalBytesRead += bytes;
+                    updateLiveMetrics(true, readStartNs, data, bytes, audioRecord.get(), audioTrack.get());
+                    updateLevelMeter(data, bytes);
+                    feedSpectrum(data, bytes);
+                    if (wavFile.writeData(data, bytes) != bytes) {
+                        sLogger.error("Failed to save audio data to file\n");
+                    }
+                    reportProgress(audioRecord, totalBytesRead, bytesPerSecond, &wavFile);
+                    if (mDspGraph.isConfigured()) {
+                        mDspGraph.process(data, bytes, data);
+                    }
+                    fifo.push(bytes);
+                    if (bytes < wanted) {
+                        inputDrained = true;
+                        break;
+                    }
+                }
+
+                // Output: write until the FIFO is empty or the stream buffer is full
+                outputFull = false;
+                while (fifo.size > 0 && !sExitRequested) {
+                    const size_t pending = fifo.contiguousUsed();
+                    const int64_t writeStartNs = AudioUtils::getMonotonicNs();
+                    const ssize_t written = audioTrack->write(fifo.front(), pending, false);
+                    ++mEventStats.writes;
+                    if (written < 0) {
+                        sLogger.error("AudioTrack write failed: %zd\n", written);
+                        return false;
+                    }
+                    if (written == 0) {
+                        ++mEventStats.fullWrites;
+                        outputFull = true;
+                        break;
+                    }
+                    if (totalBytesPlayed == 0) {
+                        mStartupTimeline.mark("first_write");
+                    }
+                    updateLiveMetrics(false, writeStartNs, fifo.front(), static_cast<size_t>(written),
+                                      audioRecord.get(), audioTrack.get());
+                    totalBytesPlayed += static_cast<uint64_t>(written);
+                    fifo.pop(static_cast<size_t>(written));
+                    if (static_cast<size_t>(written) < pending) {
+                        outputFull = true;
+                        break;
+                    }
+                }
+            }
+            mEventStats.maxFifoBytes = std::max(mEventStats.maxFifoBytes, fifo.size);
+
+            // Sleep to the next tick; a tick missed by the work above runs at once and re-anchors the timer
+            nextTickNs += mEventStats.periodNs;
+            const int64_t nowNs = AudioUtils::getMonotonicNs();
+            if (nextTickNs <= nowNs) {
+                ++mEventStats.lateTicks;
+                nextTickNs = nowNs;
+                continue;
+            }
+            struct timespec ts;
+            ts.tv_sec = static_cast<time_t>(nextTickNs / 1000000000LL);
+            ts.tv_nsec = static_cast<long>(nextTickNs % 1000000000LL);
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR && !sExitRequested) {
+            }
+            ++mEventStats.wakeups;
+        }
+        mEventStats.elapsedNs = AudioUtils::getMonotonicNs() - startNs;
+        return true;
+    }
+
+    void printEventLoopStats() const {
+        const EventLoopStats& stats = mEventStats;
+        const double seconds = std::max(stats.elapsedNs / 1e9, 1e-9);
+        printf("Event loop: period %.2fms, %" PRIu64 " wakeups (%.1f/s), %" PRIu64 " late ticks\n",
+               stats.periodNs / 1e6, stats.wakeups, stats.wakeups / seconds, stats.lateTicks);
+        printf("  reads %" PRIu64 " (%" PRIu64 " empty), writes %" PRIu64 " (%" PRIu64 " full), "
+               "max FIFO %.2fms, dropped %" PRIu64 " bytes\n",
+               stats.reads, stats.emptyReads, stats.writes, stats.fullWrites,
+               stats.maxFifoBytes * 1000.0 / std::max<uint64_t>(calculateBytesPerSecond(), 1), stats.droppedBytes);
+    }
+
+    EventLoopStats mEventStats;
+};
+
+/************************** Buffer Tuner Operation ******************************/
+// Finds the smallest stream buffer that runs without xruns for one rate/channel/format setup. A doubling sweep
+// from kMinBufferMs finds the first clean size, then bisection against the last glitching size narrows it to 1ms.
+// Every candidate streams silence and/or capture for a warm-up plus tuneIntervalMs and must stay clean for
+// tuneTrials runs in a row. The best result over all swept flags is saved to the tuning file for --tuned runs.
+class AudioTunerOperation : public AudioOperation {
+public:
+    // Constructor for buffer tuner operation
+    explicit AudioTunerOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~AudioTunerOperation() override = default;
+
+    // Disable copy operations (inherited from AudioOperation)
+    AudioTunerOperation(const AudioTunerOperation&) = delete;
+    AudioTunerOperation& operator=(const AudioTunerOperation&) = delete;
+
+    // Execute the sweep for every flag and save the best result
+    int32_t execute() override {
+        if (!validateAudioParameters()) {
+            return -1;
+        }
+        if (mConfig.tuneIntervalMs <= 0 || mConfig.tuneTrials <= 0) {
+            printf("Error: Invalid tuning interval %d ms or trials %d\n", mConfig.tuneIntervalMs, mConfig.tuneTrials);
+            return -1;
+        }
+        mWithInput = mConfig.tuneTarget != MODE_PLAY;
+        mWithOutput = mConfig.tuneTarget != MODE_RECORD;
+
+        // Flags are swept on the output side unless only the input is tuned
+        std::vector<int32_t> flags = mConfig.tuneFlags;
+        if (flags.empty()) {
+            flags.push_back(mWithOutput ? static_cast<int32_t>(mConfig.outputFlag)
+                                        : static_cast<int32_t>(mConfig.inputFlag));
+        }
+
+        const std::string key = makeTuningKey(mConfig.tuneTarget);
+        printf("Tuning %s: interval=%d ms, trials=%d, range=%d-%d ms\n", key.c_str(), mConfig.tuneIntervalMs,
+               mConfig.tuneTrials, kMinBufferMs, kMaxBufferMs);
+
+        std::vector<TuneResult> results;
+        for (const int32_t flag : flags) {
+            if (sExitRequested) {
+                break;
+            }
+            setSweptFlag(flag);
+            results.push_back(tuneFlag(flag));
+        }
+        printResults(results);
+
+        const TuneResult* best = nullptr;
+        for (const TuneResult& r : results) {
+            if (r.frameCount > 0 && (best == nullptr || r.latencyMs < best->latencyMs)) {
+                best = &r;
+            }
+        }
+        if (best == nullptr) {
+            printf("Error: No glitch-free buffer found up to %d ms\n", kMaxBufferMs);
+            return 1;
+        }
+        setSweptFlag(best->flag);
+        mConfig.frameCount = best->frameCount;
+        printf("Best: frameCount=%zu, latency=%.2f ms, flag=%d\n", best->frameCount, best->latencyMs, best->flag);
+        return saveTuning(key, *best) ? 0 : -1;
+    }
+
+private:
+    static constexpr int32_t kMinBufferMs = 2;   // first candidate of the doubling sweep
+    static constexpr int32_t kMaxBufferMs = 512; // give up above this size
+    static constexpr int32_t kWarmupMs = 200;    // not measured: stream start and initial fill
+
+    enum TrialOutcome { TRIAL_CLEAN, TRIAL_GLITCH, TRIAL_FAILED };
+
+    // Smallest clean buffer of one flag (frameCount 0 = none found)
+    struct TuneResult {
+        int32_t flag = 0;
+        size_t frameCount = 0;   // requested frames
+        size_t actualFrames = 0; // frames granted by the stream(s), summed for loopback
+        double latencyMs = 0.0;  // buffer latency of the granted frames
+        int32_t trials = 0;      // trials run for this flag
+    };
+
+    bool mWithInput = false;
+    bool mWithOutput = true;
+
+    void setSweptFlag(const int32_t flag) {
+        if (mWithOutput) {
+            mConfig.outputFlag = static_cast<audio_output_flags_t>(flag);
+        } else {
+            mConfig.inputFlag = static_cast<audio_input_flags_t>(flag);
+        }
+    }
+
+    // Doubling sweep up to the first clean size, then bisection down to 1ms granularity
+    TuneResult tuneFlag(const int32_t flag) {
+        TuneResult result;
+        result.flag = flag;
+        const size_t step = std::max<size_t>(static_cast<size_t>(mConfig.sampleRate) / 1000, 1);
+        size_t glitching = 0; // largest size that glitched or failed to open
+        size_t clean = 0;     // smallest size that stayed clean
+        for (size_t frames = kMinBufferMs * step; frames <= kMaxBufferMs * step && !sExitRequested; frames *= 2) {
+            if (evaluate(frames, result)) {
+                clean = frames;
+                break;
+            }
+            glitching = frames;
+        }
+        // Both bounds are multiples of step, so the midpoint rounded down to step lies strictly between them
+        while (clean > 0 && clean - glitching > step && !sExitRequested) {
+            const size_t middle = (glitching + clean) / 2 / step * step;
+            if (evaluate(middle, result)) {
+                clean = middle;
+            } else {
+                glitching = middle;
+            }
+        }
+        return result;
+    }
+
+    // Run a candidate tuneTrials times and record it in result when every trial is clean
+    bool evaluate(const size_t frames, TuneResult& result) {
+        size_t actualFrames = 0;
+        for (int32_t trial = 0; trial < mConfig.tuneTrials; ++trial) {
+            ++result.trials;
+            if (runTrial(frames, actualFrames) != TRIAL_CLEAN) {
+                return false;
+            }
+        }
+        result.frameCount = frames;
+        result.actualFrames = actualFrames;
+        result.latencyMs = actualFrames * 1000.0 / mConfig.sampleRate;
+        return true;
+    }
+
+    // One trial: open and start the streams with the candidate size, transfer for warm-up plus interval, close
+    TrialOutcome runTrial(const size_t frames, size_t& actualFrames) {
+        mConfig.frameCount = frames;
+        StreamPair streams;
+        TrialOutcome outcome = TRIAL_FAILED;
+        if (openStreams(mWithInput, mWithOutput, streams)) {
+            const size_t inputFrames = streams.input ? streams.input->getFrameCount() : 0;
+            const size_t outputFrames = streams.output ? streams.output->getFrameCount() : 0;
+            actualFrames = inputFrames + outputFrames;
+            // With two streams the smaller buffer is the first to run dry
+            const size_t gapLimitFrames = inputFrames == 0    ? outputFrames
+                                          : outputFrames == 0 ? inputFrames
+                                                              : std::min(inputFrames, outputFrames);
+            outcome = transfer(streams, frames, actualFrames, gapLimitFrames);
+            sLogger.flush();
+        }
+        closeStreams(streams);
+        return outcome;
+    }
+
+    // Stream for the trial duration, watching xrun counters and the longest gap between transfers.
+    // A gap longer than the granted buffer glitches even where the counters are not reported.
+    TrialOutcome transfer(const StreamPair& streams,
+                          const size_t frames,
+                          const size_t actualFrames,
+                          const size_t gapLimitFrames) {
+        const size_t chunkBytes = calculateBufferSize();
+        BufferPool::Lease bufferLease = BufferPool::acquire(mBufferPool, chunkBytes);
+        BufferManager& bufferManager = bufferLease.get();
+        if (!bufferManager.isValid()) {
+            printf("Error: Failed to create valid buffer manager\n");
+            return TRIAL_FAILED;
+        }
+        char* const buffer = bufferManager.get();
+        memset(buffer, 0, chunkBytes);
+        if (streams.input != nullptr && streams.output != nullptr && !primeOutput(streams.output, buffer, chunkBytes)) {
+            return TRIAL_FAILED;
+        }
+
+        const int64_t startNs = AudioUtils::getMonotonicNs();
+        const int64_t measureStartNs = startNs + kWarmupMs * 1000000LL;
+        const int64_t endNs = measureStartNs + mConfig.tuneIntervalMs * 1000000LL;
+        uint32_t baseUnderruns = 0;
+        uint32_t baseOverrunFrames = 0;
+        bool measuring = false;
+        int64_t lastNs = startNs;
+        int64_t maxGapNs = 0;
+        for (int64_t nowNs = startNs; nowNs < endNs && !sExitRequested; nowNs = AudioUtils::getMonotonicNs()) {
+            if (!measuring && nowNs >= measureStartNs) {
+                measuring = true;
+                baseUnderruns = streams.output ? streams.output->getUnderrunCount() : 0;
+                baseOverrunFrames = streams.input ? streams.input->getOverrunFrames() : 0;
+                lastNs = nowNs;
+            }
+            if (streams.input != nullptr && streams.input->read(buffer, chunkBytes) < 0) {
+                sLogger.error("%s read failed\n", streams.input->getName());
+                return TRIAL_FAILED;
+            }
+            size_t bytesWritten = 0;
+            while (streams.output != nullptr && bytesWritten < chunkBytes && !sExitRequested) {
+                const ssize_t written = streams.output->write(buffer + bytesWritten, chunkBytes - bytesWritten);
+                if (written < 0) {
+                    sLogger.error("%s write failed: %zd\n", streams.output->getName(), written);
+                    return TRIAL_FAILED;
+                }
+                bytesWritten += static_cast<size_t>(written);
+            }
+            const int64_t doneNs = AudioUtils::getMonotonicNs();
+            if (measuring) {
+                maxGapNs = std::max(maxGapNs, doneNs - lastNs);
+            }
+            lastNs = doneNs;
+        }
+
+        const uint32_t underruns = streams.output ? streams.output->getUnderrunCount() - baseUnderruns : 0;
+        const uint32_t overrunFrames = streams.input ? streams.input->getOverrunFrames() - baseOverrunFrames : 0;
+        const int64_t bufferNs = static_cast<int64_t>(gapLimitFrames) * 1000000000LL / mConfig.sampleRate;
+        const bool clean = underruns == 0 && overrunFrames == 0 && maxGapNs <= bufferNs;
+        sLogger.print("Trial frameCount=%zu (granted %zu): underruns=%u, overrun frames=%u, max gap=%.2f ms -> %s\n",
+                      frames, actualFrames, underruns, overrunFrames, maxGapNs / 1e6, clean ? "clean" : "glitch");
+        return clean ? TRIAL_CLEAN : TRIAL_GLITCH;
+    }
+
+    void printResults(const std::vector<TuneResult>& results) const {
+        printf("\nTuning results (sampleRate=%d, channelCount=%d, format=%d):\n", mConfig.sampleRate,
+               mConfig.channelCount, mConfig.format);
+        printf("  %-8s %12s %12s %12s %8s\n", "flag", "frameCount", "granted", "latency(ms)", "trials");
+        for (const TuneResult& r : results) {
+            if (r.frameCount == 0) {
+                printf("  %-8d %12s %12s %12s %8d\n", r.flag, "none", "-", "-", r.trials);
+            } else {
+                printf("  %-8d %12zu %12zu %12.2f %8d\n", r.flag, r.frameCount, r.actualFrames, r.latencyMs,
+                       r.trials);
+            }
+        }
+    }
+
+    // Replace or add the entry of this setup: "<key> <frameCount> <inputFlag> <outputFlag> <latencyMs>"
+    bool saveTuning(const std::string& key, const TuneResult& best) const {
+        std::vector<std::string> lines;
+        std::ifstream existing(mConfig.tuneFilePath);
+        std::string line;
+        while (std::getline(existing, line)) {
+            if (line.compare(0, key.size() + 1, key + " ") != 0) {
+                lines.push_back(line);
+            }
+        }
+        existing.close();
+        if (lines.empty()) {
+            lines.push_back("# key frame_count input_flag output_flag latency_ms");
+        }
+        lines.push_back(String8::format("%s %zu %d %d %.2f", key.c_str(), best.frameCount, mConfig.inputFlag,
+                                        mConfig.outputFlag, best.latencyMs)
+                            .c_str());
+
+        std::ofstream file(mConfig.tuneFilePath, std::ios::out | std::ios::trunc);
+        if (!file.is_open()) {
+            printf("Error: Can't create tuning file: %s\n", mConfig.tuneFilePath.c_str());
+            return false;
+        }
+        for (const std::string& l : lines) {
+            file << l << '\n';
+        }
+        printf("Tuning saved: %s\n", mConfig.tuneFilePath.c_str());
+        return file.good();
+    }
+};
+
+/************************** Bit-Exact Verify Operation ******************************/
+// Plays the bit-exact pattern and verifies the capture of the same setup block by block, e.g. a BIT_PERFECT
+// output looped back through REMOTE_SUBMIX. The capture is saved like in loopback mode so it can be checked
+// again offline with -m203.
+class BitExactVerifyOperation : public AudioOperation {
+public:
+    // Constructor for live bit-exact verification (pattern playback + capture)
+    explicit BitExactVerifyOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~BitExactVerifyOperation() override = default;
+
+    // Disable copy operations (inherited from AudioOperation)
+    BitExactVerifyOperation(const BitExactVerifyOperation&) = delete;
+    BitExactVerifyOperation& operator=(const BitExactVerifyOperation&) = delete;
+
+    // Execute pattern playback and capture verification
+    int32_t execute() override {
+        if (!BitExactPattern::isSupportedFormat(mConfig.format)) {
+            printf("Error: Format %d is not supported for bit-exact verification\n", mConfig.format);
+            return -1;
+        }
+        WAVFile wavFile;
+        if (!setupWavFileForRecording(wavFile) || !validateAudioParameters()) {
+            printf("Error: Failed to setup WAV file or validate audio parameters\n");
+            return -1;
+        }
+
+        std::unique_ptr<AudioInputStream> audioRecord = openInputStream();
+        if (!audioRecord) {
+            wavFile.close();
+            return -1;
+        }
+        std::unique_ptr<AudioOutputStream> audioTrack = openOutputStream();
+        if (!audioTrack) {
+            closeInputStream(audioRecord);
+            wavFile.close();
+            return -1;
+        }
+        if (!startAudioComponent(audioRecord)) {
+            wavFile.close();
+            return -1;
+        }
+        if (!startAudioComponent(audioTrack)) {
+            stopAudioComponent(audioRecord);
+            wavFile.close();
+            return -1;
+        }
+
+        BitExactVerifier verifier(mConfig.format, mConfig.channelCount);
+        const int32_t loopResult = verifyLoop(audioRecord, audioTrack, wavFile, verifier);
+
+        stopAudioComponent(audioRecord);
+        stopAudioComponent(audioTrack);
+        closeInputStream(audioRecord);
+        closeOutputStream(audioTrack);
+        wavFile.finalize();
+        if (loopResult != 0) {
+            return loopResult;
+        }
+
+        verifier.print("Bit-exact verification", mConfig.sampleRate);
+        if (!mConfig.reportPath.empty()) {
+            std::ofstream report;
+            if (!openReportFile(report)) {
+                printf("Error: Can't create report file: %s\n", mConfig.reportPath.c_str());
+                return -1;
+            }
+            report << verifier.toJsonLine(wavFile.getFilePath().c_str()) << '\n';
+        }
+        return verifier.isBitExact() ? 0 : 1;
+    }
+
+private:
+    // Write the pattern chunk by chunk and feed every captured chunk to the verifier
+    int32_t verifyLoop(const std::unique_ptr<AudioInputStream>& audioRecord,
+                       const std::unique_ptr<AudioOutputStream>& audioTrack,
+                       WAVFile& wavFile,
+                       BitExactVerifier& verifier) {
+        const size_t bufferSize = calculateBufferSize();
+        BufferPool::Lease captureLease = BufferPool::acquire(mBufferPool, bufferSize);
+        BufferPool::Lease patternLease = BufferPool::acquire(mBufferPool, bufferSize);
+        BufferManager& captureManager = captureLease.get();
+        BufferManager& patternManager = patternLease.get();
+        if (!captureManager.isValid() || !patternManager.isValid()) {
+            printf("Error: Failed to create valid buffer manager\n");
+            return -1;
+        }
+        char* const captureBuffer = captureManager.get();
+        char* const patternBuffer = patternManager.get();
+        const size_t frameSize = audio_bytes_per_sample(mConfig.format) * mConfig.channelCount;
+
+        printf("Bit-exact verification in progress. Press Ctrl+C to stop\n");
+        ALOGI("Bit-exact verification in progress.");
+        const uint64_t bytesPerSecond = calculateBytesPerSecond();
+        const uint64_t maxBytesToRecord =
+            (mConfig.durationSeconds > 0) ? std::min(static_cast<uint64_t>(mConfig.durationSeconds) * bytesPerSecond,
+                                                     static_cast<uint64_t>(kMaxAudioDataSize))
+                                          : static_cast<uint64_t>(kMaxAudioDataSize);
+        mNextProgressReport = bytesPerSecond * kProgressReportInterval;
+
+        // One chunk ahead, so the output does not start with an underrun
+        uint64_t patternFrame = 0;
+        if (!writePattern(audioTrack, patternBuffer, bufferSize / frameSize, patternFrame)) {
+            return -1;
+        }
+
+        uint64_t totalBytesRead = 0;
+        while (totalBytesRead < maxBytesToRecord && !sExitRequested) {
+            const ssize_t bytesRead = audioRecord->read(captureBuffer, bufferSize);
+            if (bytesRead < 0) {
+                sLogger.error("AudioRecord read failed: %zd\n", bytesRead);
+                break;
+            }
+            if (bytesRead == 0) {
+                continue;
+            }
+            totalBytesRead += static_cast<uint64_t>(bytesRead);
+            verifier.feed(captureBuffer, static_cast<size_t>(bytesRead));
+            if (wavFile.writeData(captureBuffer, static_cast<size_t>(bytesRead)) != static_cast<size_t>(bytesRead)) {
+                sLogger.error("Failed to save audio data to file\n");
+            }
+            reportProgress(audioRecord, totalBytesRead, bytesPerSecond, &wavFile);
+            if (!writePattern(audioTrack, patternBuffer, static_cast<size_t>(bytesRead) / frameSize, patternFrame)) {
+                break;
+            }
+        }
+        sLogger.flush();
+        printf("Bit-exact verification finished: played %" PRIu64 " frames, captured %" PRIu64
+               " bytes, File saved: %s\n",
+               patternFrame, totalBytesRead, wavFile.getFilePath().c_str());
+        return 0;
+    }
+
+    // Generate the next frames of the pattern and write them completely
+    bool writePattern(const std::unique_ptr<AudioOutputStream>& audioTrack,
+                      char* buffer,
+                      const size_t frames,
+                      uint64_t& patternFrame) {
+        const size_t bytes = frames * audio_bytes_per_sample(mConfig.format) * mConfig.channelCount;
+        BitExactPattern::fill(patternFrame, frames, buffer, mConfig.format, mConfig.channelCount);
+        size_t bytesWritten = 0;
+        while (bytesWritten < bytes && !sExitRequested) {
+            const ssize_t written = audioTrack->write(buffer + bytesWritten, bytes - bytesWritten);
+            if (written < 0) {
+                sLogger.error("AudioTrack write failed: %zd\n", written);
+                return false;
+            }
+            bytesWritten += static_cast<size_t>(written);
+        }
+        patternFrame += frames;
+        return true;
+    }
+};
+
+/************************** Multi-Source Capture Operation ******************************/
+// Captures several sources at once, e.g. MIC + ECHO_REFERENCE for echo canceller tests, into one multichannel WAV
+// aligned on their timestamps. Every source has a reader thread feeding a MultiSourceAligner; the calling thread
+// is the only writer.
+class MultiCaptureOperation : public AudioOperation {
+public:
+    // Constructor for multi-source capture, sources from config.captureSources
+    explicit MultiCaptureOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~MultiCaptureOperation() override = default;
+
+    // Disable copy operations (inherited from AudioOperation)
+    MultiCaptureOperation(const MultiCaptureOperation&) = delete;
+    MultiCaptureOperation& operator=(const MultiCaptureOperation&) = delete;
+
+    // Execute aligned capture of all sources
+    int32_t execute() override {
+        const std::vector<int32_t> sources = mConfig.captureSources;
+        if (sources.size() < 2) {
+            printf("Error: Multi-source capture needs at least two --sources\n");
+            return -1;
+        }
+        if (!validateAudioParameters()) {
+            return -1;
+        }
+        const size_t frameSize = audio_bytes_per_sample(mConfig.format) * mConfig.channelCount;
+        MultiSourceAligner aligner(sources.size(), frameSize, mConfig.sampleRate,
+                                   static_cast<size_t>(mConfig.sampleRate) * kRingSeconds);
+
+        WAVFile wavFile;
+        if (!setupWavFile(wavFile, static_cast<int32_t>(sources.size()) * mConfig.channelCount)) {
+            return -1;
+        }
+
+        std::vector<std::unique_ptr<AudioInputStream>> streams;
+        for (const int32_t source : sources) {
+            mConfig.inputSource = static_cast<audio_source_t>(source);
+            streams.push_back(openInputStream());
+            if (!streams.back()) {
+                printf("Error: Failed to open source %d\n", source);
+                closeStreams(streams);
+                wavFile.close();
+                return -1;
+            }
+        }
+
+        // Each reader starts right after its stream, so no stream accumulates data before it is read
+        startResourceUsage();
+        mStopReaders = false;
+        mReaderFailed = false;
+        std::vector<std::thread> readers;
+        bool started = true;
+        for (size_t i = 0; i < streams.size() && started; ++i) {
+            if (i > 0 && mConfig.sourceStaggerMs > 0) {
+                usleep(static_cast<useconds_t>(mConfig.sourceStaggerMs) * 1000);
+            }
+            started = startAudioComponent(streams[i]);
+            if (started) {
+                readers.emplace_back(&MultiCaptureOperation::readerLoop, this, i, streams[i].get(),
+                                     std::ref(aligner));
+            }
+        }
+
+        const size_t writerScope = mResourceMeter.isStarted() ? mResourceMeter.beginThread("writer") : 0;
+        const int32_t loopResult = started ? writerLoop(aligner, wavFile) : -1;
+        if (mResourceMeter.isStarted()) {
+            mResourceMeter.endThread(writerScope, 0);
+        }
+
+        mStopReaders = true;
+        for (std::thread& reader : readers) {
+            reader.join();
+        }
+        if (mResourceMeter.isStarted()) {
+            mResourceMeter.stop();
+        }
+        std::vector<uint32_t> overruns;
+        for (std::unique_ptr<AudioInputStream>& stream : streams) {
+            overruns.push_back(stream->getOverrunFrames());
+        }
+        closeStreams(streams);
+        wavFile.finalize();
+        if (loopResult != 0) {
+            return loopResult;
+        }
+
+        printReport(aligner, sources, overruns, wavFile.getFilePath());
+        if (!mConfig.reportPath.empty() && !writeReport(aligner, sources, overruns, wavFile.getFilePath())) {
+            return -1;
+        }
+        reportResourceUsage(MODE_MULTI_CAPTURE,
+                            static_cast<double>(aligner.getMergedFrames()) / std::max(mConfig.sampleRate, 1));
+        return 0;
+    }
+
+private:
+    static constexpr size_t kRingSeconds = 2;        // per-source buffering between reader and writer
+    static constexpr int64_t kAnchorWindowMs = 200;  // wait this long for a valid stream timestamp
+    static constexpr int64_t kAlignTimeoutMs = 2000; // after the last source started
+
+    // WAV file with the channels of all sources
+    bool setupWavFile(WAVFile& wavFile, const int32_t channelCount) {
+        const size_t bitsPerSample = audio_bytes_per_sample(mConfig.format) * 8;
+        mConfig.recordFilePath = AudioUtils::makeRecordFilePath(mConfig.sampleRate, channelCount, bitsPerSample,
+                                                                mConfig.recordFilePath);
+        printf("Recording audio to file: %s\n", mConfig.recordFilePath.c_str());
+        if (!wavFile.createForWriting(mConfig.recordFilePath, mConfig.sampleRate, channelCount, bitsPerSample,
+                                      mConfig.rawPcm)) {
+            printf("Error: Can't create record file: %s\n", mConfig.recordFilePath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    void closeStreams(std::vector<std::unique_ptr<AudioInputStream>>& streams) {
+        for (std::unique_ptr<AudioInputStream>& stream : streams) {
+            stopAudioComponent(stream);
+            closeInputStream(stream);
+        }
+    }
+
+    // Per-source thread: read, push, and anchor the source with the first valid timestamp. A source without
+    // timestamps is anchored by the read return time once kAnchorWindowMs of data arrived.
+    void readerLoop(const size_t index, AudioInputStream* stream, MultiSourceAligner& aligner) {
+        const size_t bufferSize = calculateBufferSize();
+        BufferPool::Lease lease = BufferPool::acquire(mBufferPool, bufferSize);
+        BufferManager& bufferManager = lease.get();
+        if (!bufferManager.isValid()) {
+            sLogger.error("Failed to create valid buffer manager\n");
+            mReaderFailed = true;
+            return;
+        }
+        char* const buffer = bufferManager.get();
+        const size_t frameSize = audio_bytes_per_sample(mConfig.format) * mConfig.channelCount;
+        const int64_t anchorWindowFrames = static_cast<int64_t>(mConfig.sampleRate) * kAnchorWindowMs / 1000;
+        const size_t usageScope =
+            mResourceMeter.isStarted() ? mResourceMeter.beginThread(String8::format("reader %zu", index).c_str()) : 0;
+        uint64_t readCalls = 0;
+
+        int64_t framesRead = 0;
+        while (!mStopReaders && !sExitRequested) {
+            const ssize_t bytesRead = stream->read(buffer, bufferSize);
+            ++readCalls;
+            if (bytesRead < 0) {
+                sLogger.error("%s read failed: %zd\n", stream->getName(), bytesRead);
+                mReaderFailed = true;
+                break;
+            }
+            if (bytesRead == 0) {
+                continue;
+            }
+            const int64_t returnNs = AudioUtils::getMonotonicNs();
+            const size_t frames = static_cast<size_t>(bytesRead) / frameSize;
+            aligner.push(index, buffer, frames);
+            framesRead += static_cast<int64_t>(frames);
+            if (!aligner.isAnchored(index)) {
+                int64_t position = 0;
+                int64_t timeNs = 0;
+                if (stream->getTimestamp(position, timeNs)) {
+                    aligner.anchor(index, position, timeNs, true);
+                } else if (framesRead >= anchorWindowFrames) {
+                    aligner.anchor(index, framesRead, returnNs, false);
+                }
+            }
+        }
+
+        if (mResourceMeter.isStarted()) {
+            mResourceMeter.endThread(usageScope, readCalls);
+        }
+
+        int64_t position = 0;
+        int64_t timeNs = 0;
+        if (stream->getTimestamp(position, timeNs)) {
+            aligner.setEndTimestamp(index, position, timeNs);
+        }
+    }
+
+    // Merge aligned frames of all sources into the WAV file until the duration is reached
+    int32_t writerLoop(MultiSourceAligner& aligner, WAVFile& wavFile) {
+        const size_t outFrameSize = aligner.getOutputFrameSize();
+        const size_t frameSize = audio_bytes_per_sample(mConfig.format) * mConfig.channelCount;
+        const size_t chunkFrames = calculateBufferSize() / frameSize;
+        BufferPool::Lease lease = BufferPool::acquire(mBufferPool, chunkFrames * outFrameSize);
+        BufferManager& bufferManager = lease.get();
+        if (!bufferManager.isValid()) {
+            printf("Error: Failed to create valid buffer manager\n");
+            return -1;
+        }
+        char* const buffer = bufferManager.get();
+
+        printf("Multi-source capture in progress. Press Ctrl+C to stop\n");
+        ALOGI("Multi-source capture in progress.");
+        const uint64_t bytesPerSecond = static_cast<uint64_t>(mConfig.sampleRate) * outFrameSize;
+        const uint64_t maxBytes =
+            (mConfig.durationSeconds > 0) ? std::min(static_cast<uint64_t>(mConfig.durationSeconds) * bytesPerSecond,
+                                                     static_cast<uint64_t>(kMaxAudioDataSize))
+                                          : static_cast<uint64_t>(kMaxAudioDataSize);
+        const uint64_t maxFrames = maxBytes / outFrameSize;
+        const useconds_t idleUs = static_cast<useconds_t>(chunkFrames * 250000 / mConfig.sampleRate);
+        const int64_t alignDeadlineNs = AudioUtils::getMonotonicNs() + kAlignTimeoutMs * 1000000LL;
+        mNextProgressReport = bytesPerSecond * kProgressReportInterval;
+
+        uint64_t framesWritten = 0;
+        while (framesWritten < maxFrames && !sExitRequested && !mReaderFailed) {
+            const size_t frames =
+                aligner.merge(buffer, static_cast<size_t>(std::min<uint64_t>(chunkFrames, maxFrames - framesWritten)));
+            if (frames == 0) {
+                if (!aligner.isAligned() && AudioUtils::getMonotonicNs() > alignDeadlineNs) {
+                    printf("Error: Sources could not be aligned, no data or timestamps within %" PRId64 "ms\n",
+                           kAlignTimeoutMs);
+                    return -1;
+                }
+                usleep(idleUs);
+                continue;
+            }
+            const size_t bytes = frames * outFrameSize;
+            if (wavFile.writeData(buffer, bytes) != bytes) {
+                sLogger.error("Failed to save audio data to file\n");
+            }
+            framesWritten += frames;
+            if (framesWritten * outFrameSize >= mNextProgressReport) {
+                sLogger.print("Recording ... , processed %.2f seconds, %.2f MB\n",
+                              static_cast<float>(framesWritten) / mConfig.sampleRate,
+                              static_cast<float>(framesWritten * outFrameSize) / (1024u * 1024u));
+                mNextProgressReport += bytesPerSecond * kProgressReportInterval;
+                wavFile.updateHeader();
+            }
+        }
+        sLogger.flush();
+        return mReaderFailed ? -1 : 0;
+    }
+
+    void printReport(const MultiSourceAligner& aligner,
+                     const std::vector<int32_t>& sources,
+                     const std::vector<uint32_t>& overruns,
+                     const std::string& filePath) const {
+        printf("\nMulti-source capture: %zu sources, %" PRIu64 " frames, File saved: %s\n", sources.size(),
+               aligner.getMergedFrames(), filePath.c_str());
+        printf("  %-6s %-8s %-9s %12s %9s %15s %13s %8s %8s %s\n", "Stream", "Source", "Channels", "Start(ms)",
+               "Skipped", "Residual start", "Residual end", "Dropped", "Overrun", "Anchor");
+        for (size_t i = 0; i < sources.size(); ++i) {
+            const MultiSourceAligner::StreamResult result = aligner.getResult(i);
+            const String8 channels = String8::format("%zu-%zu", i * mConfig.channelCount,
+                                                     (i + 1) * mConfig.channelCount - 1);
+            const String8 residualEnd =
+                std::isnan(result.residualEnd) ? String8("n/a") : String8::format("%+.3f", result.residualEnd);
+            printf("  %-6zu %-8d %-9s %+12.3f %9" PRIu64 " %+15.3f %13s %8" PRIu64 " %8u %s\n", i, sources[i],
+                   channels.c_str(), result.startOffsetMs, result.skippedFrames, result.residualStart,
+                   residualEnd.c_str(), result.droppedFrames, overruns[i],
+                   result.fromTimestamp ? "timestamp" : "read time");
+        }
+        printf("Residual offsets are in frames against stream 0, positive = captured later\n");
+    }
+
+    bool writeReport(const MultiSourceAligner& aligner,
+                     const std::vector<int32_t>& sources,
+                     const std::vector<uint32_t>& overruns,
+                     const std::string& filePath) const {
+        std::ofstream report;
+        if (!openReportFile(report)) {
+            printf("Error: Can't create report file: %s\n", mConfig.reportPath.c_str());
+            return false;
+        }
+        report << String8::format("{\"type\":\"multi_capture\",\"file\":\"%s\",\"sample_rate\":%d,\"frames\":%" PRIu64
+                                  ",\"streams\":[",
+                                  filePath.c_str(), mConfig.sampleRate, aligner.getMergedFrames())
+                      .c_str();
+        for (size_t i = 0; i < sources.size(); ++i) {
+            const MultiSourceAligner::StreamResult result = aligner.getResult(i);
+            const String8 residualEnd =
+                std::isnan(result.residualEnd) ? String8("null") : String8::format("%.3f", result.residualEnd);
+            report << String8::format("%s{\"source\":%d,\"start_offset_ms\":%.3f,\"skipped\":%" PRIu64
+                                      ",\"residual_start\":%.3f,\"residual_end\":%s,\"dropped\":%" PRIu64
+                                      ",\"overrun\":%u,\"anchor\":\"%s\"}",
+                                      i > 0 ? "," : "", sources[i], result.startOffsetMs, result.skippedFrames,
+                                      result.residualStart, residualEnd.c_str(), result.droppedFrames, overruns[i],
+                                      result.fromTimestamp ? "timestamp" : "read_time")
+                          .c_str();
+        }
+        report << "]}\n";
+        return true;
+    }
+
+    std::atomic<bool> mStopReaders{false};
+    std::atomic<bool> mReaderFailed{false};
+};
+
+/************************** Pre-Trigger Capture Operation ******************************/
+// Keeps the last --pre-trigger seconds of capture in a preallocated ring and, when a trigger fires, saves that
+// window plus --post-trigger seconds to "<file>_<n>.wav". The capture thread only copies into the ring and runs
+// the detectors; a dump thread writes the event files from the ring and reads the trigger FIFO. Triggers are
+// ignored while an event is being saved.
+class PreTriggerOperation : public AudioOperation {
+public:
+    // Constructor for pre-trigger capture
+    explicit PreTriggerOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~PreTriggerOperation() override = default;
+
+    // Disable copy operations (inherited from AudioOperation)
+    PreTriggerOperation(const PreTriggerOperation&) = delete;
+    PreTriggerOperation& operator=(const PreTriggerOperation&) = delete;
+
+    // Execute capture until -d seconds passed or Ctrl+C, saving one file per trigger
+    int32_t execute() override {
+        if (!validateAudioParameters()) {
+            return -1;
+        }
+        if (mConfig.preTriggerSeconds < 0 || mConfig.postTriggerSeconds <= 0) {
+            printf("Error: Invalid trigger window: %d s before, %d s after\n", mConfig.preTriggerSeconds,
+                   mConfig.postTriggerSeconds);
+            return -1;
+        }
+        mFrameSize = audio_bytes_per_sample(mConfig.format) * mConfig.channelCount;
+        mPreFrames = static_cast<uint64_t>(mConfig.preTriggerSeconds) * mConfig.sampleRate;
+        mPostFrames = static_cast<uint64_t>(mConfig.postTriggerSeconds) * mConfig.sampleRate;
+        mRingFrames = mPreFrames + mPostFrames + static_cast<uint64_t>(kSlackSeconds) * mConfig.sampleRate;
+        if (mRingFrames * mFrameSize > kMaxRingBytes) {
+            printf("Error: Trigger window needs %" PRIu64 " bytes of memory, limit is %zu\n", mRingFrames * mFrameSize,
+                   kMaxRingBytes);
+            return -1;
+        }
+        // Value-initialized, so every page of the ring is touched before the capture starts
+        BufferManager ring(static_cast<size_t>(mRingFrames * mFrameSize));
+        if (!ring.isValid()) {
+            return -1;
+        }
+        mRing = ring.get();
+        mBasePath = AudioUtils::makeRecordFilePath(mConfig.sampleRate, mConfig.channelCount,
+                                                   audio_bytes_per_sample(mConfig.format) * 8, mConfig.recordFilePath);
+
+        if (!openTriggerFifo()) {
+            return -1;
+        }
+        std::unique_ptr<AudioInputStream> audioRecord = openInputStream();
+        if (!audioRecord || !startAudioComponent(audioRecord)) {
+            closeInputStream(audioRecord);
+            closeTriggerFifo();
+            return -1;
+        }
+        sTriggerRequested = false;
+        signal(SIGUSR1, signalHandler);
+
+        mCaptureEnded = false;
+        std::thread dumpThread(&PreTriggerOperation::dumpLoop, this);
+        const int32_t loopResult = captureLoop(audioRecord);
+        mCaptureEnded = true;
+        dumpThread.join();
+        sLogger.flush();
+
+        signal(SIGUSR1, SIG_DFL);
+        stopAudioComponent(audioRecord);
+        closeInputStream(audioRecord);
+        closeTriggerFifo();
+        printf("Pre-trigger capture finished: %d event(s) saved, %d failed\n", mSavedEvents, mFailedEvents);
+        return (loopResult == 0 && !mDumpFailed) ? 0 : -1;
+    }
+
+private:
+    static constexpr uint32_t kSlackSeconds = 2;                 // ring beyond the window, time the dump has
+    static constexpr size_t kMaxRingBytes = 64 * 1024 * 1024;    // BufferManager limit
+    static constexpr int64_t kOverrunPollMs = 100;               // lost frames query is a binder call
+    static constexpr useconds_t kDumpPollUs = 20000;
+    static constexpr uint64_t kDumpChunkFrames = 4096;           // keeps the overwrite check fresh
+
+    // Trigger handed from the capture thread to the dump thread
+    struct TriggerEvent {
+        int32_t index;
+        TriggerReason reason;
+        float value;
+        uint64_t triggerFrame;
+        uint64_t startFrame;
+        uint64_t endFrame;
+        int64_t realtimeNs;
+    };
+
+    // Read, store in the ring and run the detectors on every buffer while armed
+    int32_t captureLoop(const std::unique_ptr<AudioInputStream>& audioRecord) {
+        const size_t bufferSize = calculateBufferSize();
+        BufferPool::Lease lease = BufferPool::acquire(mBufferPool, bufferSize);
+        BufferManager& bufferManager = lease.get();
+        if (!bufferManager.isValid()) {
+            printf("Error: Failed to create valid buffer manager\n");
+            return -1;
+        }
+        char* const buffer = bufferManager.get();
+        mMaxReadFrames = bufferSize / mFrameSize;
+
+        TriggerDetector detector(mConfig.format, mConfig.channelCount, mConfig.triggerLevelDb, mConfig.triggerStepDb,
+                                 mConfig.triggerClip);
+        printf("Pre-trigger capture armed: keeping %d s, saving %d s after a trigger to %s_<n>.wav\n",
+               mConfig.preTriggerSeconds, mConfig.postTriggerSeconds, makeEventPath(-1).c_str());
+        printf("Triggers: %s%s%s%sSIGUSR1 (kill -USR1 %d)%s. Press Ctrl+C to stop\n",
+               mConfig.triggerLevelDb < 0.0f ? "level, " : "", mConfig.triggerStepDb < 0.0f ? "step, " : "",
+               mConfig.triggerClip ? "clip, " : "", mConfig.triggerOverrun ? "overrun, " : "", getpid(),
+               mFifoFd >= 0 ? ", FIFO commands" : "");
+        ALOGI("Pre-trigger capture armed.");
+
+        const uint64_t maxFrames = (mConfig.durationSeconds > 0)
+                                       ? static_cast<uint64_t>(mConfig.durationSeconds) * mConfig.sampleRate
+                                       : UINT64_MAX;
+        uint32_t overrunFrames = audioRecord->getOverrunFrames();
+        int64_t nextOverrunPollNs = 0;
+        uint64_t framesCaptured = 0;
+        bool armed = true;
+        while (framesCaptured < maxFrames && !sExitRequested && !mDumpFailed) {
+            const ssize_t bytesRead = audioRecord->read(buffer, bufferSize);
+            if (bytesRead < 0) {
+                sLogger.error("AudioRecord read failed: %zd\n", bytesRead);
+                sLogger.flush();
+                return -1;
+            }
+            if (bytesRead == 0) {
+                continue;
+            }
+            const size_t frames = static_cast<size_t>(bytesRead) / mFrameSize;
+            storeFrames(buffer, framesCaptured, frames);
+            const uint64_t bufferStart = framesCaptured;
+            framesCaptured += frames;
+            mCapturedFrames.store(framesCaptured, std::memory_order_release);
+            updateLevelMeter(buffer, static_cast<size_t>(bytesRead));
+
+            uint32_t lostFrames = 0;
+            if (mConfig.triggerOverrun) {
+                const int64_t nowNs = AudioUtils::getMonotonicNs();
+                if (nowNs >= nextOverrunPollNs) {
+                    const uint32_t current = audioRecord->getOverrunFrames();
+                    lostFrames = current - overrunFrames;
+                    overrunFrames = current;
+                    nextOverrunPollNs = nowNs + kOverrunPollMs * 1000000LL;
+                }
+            }
+
+            // Rearm once the dump thread saved the event; triggers raised meanwhile are dropped
+            if (!armed) {
+                if (mEventPending.load(std::memory_order_acquire)) {
+                    continue;
+                }
+                armed = true;
+                detector.reset();
+                const bool signalled = sTriggerRequested.exchange(false);
+                if (mCommandRequested.exchange(false) || signalled) {
+                    sLogger.print("External trigger ignored, it arrived while event #%d was saved\n", mEventCount);
+                }
+            }
+
+            TriggerReason reason = detector.scan(buffer, static_cast<size_t>(bytesRead));
+            float value = detector.getValue();
+            uint64_t triggerFrame = bufferStart + detector.getFrame();
+            if (reason == TRIGGER_NONE) {
+                triggerFrame = bufferStart;
+                value = 0.0f;
+                if (lostFrames > 0) {
+                    reason = TRIGGER_OVERRUN;
+                    value = static_cast<float>(lostFrames);
+                } else if (sTriggerRequested.exchange(false)) {
+                    reason = TRIGGER_SIGNAL;
+                } else if (mCommandRequested.exchange(false)) {
+                    reason = TRIGGER_COMMAND;
+                }
+            }
+            if (reason != TRIGGER_NONE) {
+                fireTrigger(reason, value, triggerFrame);
+                armed = false;
+            }
+        }
+        sLogger.flush();
+        return 0;
+    }
+
+    // Copy captured frames into the ring at their absolute frame position
+    void storeFrames(const char* data, const uint64_t position, const size_t frames) {
+        const size_t offset = static_cast<size_t>(position % mRingFrames);
+        const size_t first = std::min(frames, static_cast<size_t>(mRingFrames) - offset);
+        memcpy(mRing + offset * mFrameSize, data, first * mFrameSize);
+        memcpy(mRing, data + first * mFrameSize, (frames - first) * mFrameSize);
+    }
+
+    // Capture thread: hand the event to the dump thread, which does all formatting and I/O
+    void fireTrigger(const TriggerReason reason, const float value, const uint64_t triggerFrame) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        mEvent.index = ++mEventCount;
+        mEvent.reason = reason;
+        mEvent.value = value;
+        mEvent.triggerFrame = triggerFrame;
+        mEvent.startFrame = triggerFrame > mPreFrames ? triggerFrame - mPreFrames : 0;
+        mEvent.endFrame = triggerFrame + mPostFrames;
+        mEvent.realtimeNs = static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+        mEventPending.store(true, std::memory_order_release);
+    }
+
+    void dumpLoop() {
+        while (true) {
+            pollTriggerFifo();
+            if (mEventPending.load(std::memory_order_acquire)) {
+                if (!saveEvent(mEvent)) {
+                    mDumpFailed = true;
+                }
+                mEventPending.store(false, std::memory_order_release);
+                continue;
+            }
+            if (mCaptureEnded) {
+                break;
+            }
+            usleep(kDumpPollUs);
+        }
+    }
+
+    // Write [startFrame, endFrame) of the event from the ring as the capture goes on; a capture that ends
+    // early truncates the file
+    bool saveEvent(const TriggerEvent& event) {
+        const std::string path = makeEventPath(event.index);
+        sLogger.printTimed("Trigger #%d: %s, saving to %s\n", event.index, describeTrigger(event).c_str(),
+                           path.c_str());
+        WAVFile wavFile;
+        if (!wavFile.createForWriting(path, mConfig.sampleRate, mConfig.channelCount,
+                                      audio_bytes_per_sample(mConfig.format) * 8)) {
+            sLogger.error("Can't create event file: %s\n", path.c_str());
+            return false;
+        }
+
+        bool intact = true;
+        bool written = true;
+        uint64_t cursor = event.startFrame;
+        while (cursor < event.endFrame) {
+            const uint64_t captured = mCapturedFrames.load(std::memory_order_acquire);
+            if (captured > cursor && !isInRing(cursor, captured)) {
+                intact = false;
+                break;
+            }
+            const uint64_t available = captured > cursor ? std::min(captured, event.endFrame) - cursor : 0;
+            if (available == 0) {
+                if (mCaptureEnded) {
+                    break;
+                }
+                pollTriggerFifo();
+                usleep(kDumpPollUs);
+                continue;
+            }
+            const size_t frames = static_cast<size_t>(std::min(available, kDumpChunkFrames));
+            const size_t offset = static_cast<size_t>(cursor % mRingFrames);
+            const size_t first = std::min(frames, static_cast<size_t>(mRingFrames) - offset);
+            const size_t firstBytes = first * mFrameSize;
+            const size_t wrappedBytes = (frames - first) * mFrameSize;
+            if (wavFile.writeData(mRing + offset * mFrameSize, firstBytes) != firstBytes ||
+                wavFile.writeData(mRing, wrappedBytes) != wrappedBytes) {
+                written = false;
+                break;
+            }
+            // The capture thread may have overwritten the chunk while it was copied
+            if (!isInRing(cursor, mCapturedFrames.load(std::memory_order_acquire))) {
+                intact = false;
+                break;
+            }
+            cursor += frames;
+        }
+        wavFile.finalize();
+
+        if (!written) {
+            ++mFailedEvents;
+            sLogger.error("Failed to write event #%d to %s\n", event.index, path.c_str());
+            return false;
+        }
+        if (!intact) {
+            ++mFailedEvents;
+            sLogger.error("Event #%d was overwritten before it was saved, the storage is too slow\n", event.index);
+            return false;
+        }
+        ++mSavedEvents;
+        const double beforeSeconds = static_cast<double>(event.triggerFrame - event.startFrame) / mConfig.sampleRate;
+        const double afterSeconds =
+            cursor > event.triggerFrame ? static_cast<double>(cursor - event.triggerFrame) / mConfig.sampleRate : 0.0;
+        sLogger.print("Event #%d saved: %s (%.2f s before, %.2f s after the trigger)\n", event.index, path.c_str(),
+                      beforeSeconds, afterSeconds);
+        return writeReport(event, path, cursor - event.startFrame);
+    }
+
+    // Frame is still readable while the capture thread writes its next buffer
+    bool isInRing(const uint64_t frame, const uint64_t captured) const {
+        return captured + mMaxReadFrames <= frame + mRingFrames;
+    }
+
+    std::string describeTrigger(const TriggerEvent& event) const {
+        const String8 at = String8::format(" at %.3f s", static_cast<double>(event.triggerFrame) / mConfig.sampleRate);
+        switch (event.reason) {
+        case TRIGGER_LEVEL:
+        case TRIGGER_STEP:
+            return String8::format("%s %.1f dBFS%s", triggerReasonName(event.reason), 20.0f * std::log10(event.value),
+                                   at.c_str())
+                .c_str();
+        case TRIGGER_CLIP:
+            return String8::format("clip, %d samples at full scale%s", static_cast<int>(event.value), at.c_str())
+                .c_str();
+        case TRIGGER_OVERRUN:
+            return String8::format("overrun, %d frames lost%s", static_cast<int>(event.value), at.c_str()).c_str();
+        case TRIGGER_COMMAND:
+            return String8::format("command \"%s\"%s", mLastCommand.c_str(), at.c_str()).c_str();
+        default:
+            return String8::format("%s%s", triggerReasonName(event.reason), at.c_str()).c_str();
+        }
+    }
+
+    // "<base>_<n>.wav", or "<base>" for n < 0
+    std::string makeEventPath(const int32_t index) const {
+        std::string base = mBasePath;
+        const size_t extension = base.rfind(".wav");
+        if (extension != std::string::npos && extension + 4 == base.size()) {
+            base.resize(extension);
+        }
+        return index < 0 ? base : String8::format("%s_%03d.wav", base.c_str(), index).c_str();
+    }
+
+    bool writeReport(const TriggerEvent& event, const std::string& path, const uint64_t frames) const {
+        if (mConfig.reportPath.empty()) {
+            return true;
+        }
+        std::ofstream report;
+        if (!openReportFile(report)) {
+            sLogger.error("Can't create report file: %s\n", mConfig.reportPath.c_str());
+            return false;
+        }
+        report << String8::format("{\"type\":\"trigger_event\",\"index\":%d,\"reason\":\"%s\",\"value\":%.6f,"
+                                  "\"time\":\"%s\",\"trigger_frame\":%" PRIu64 ",\"start_frame\":%" PRIu64
+                                  ",\"frames\":%" PRIu64 ",\"file\":\"%s\"}\n",
+                                  event.index, triggerReasonName(event.reason), event.value,
+                                  AudioUtils::formatWallTime(event.realtimeNs).c_str(), event.triggerFrame,
+                                  event.startFrame, frames, path.c_str())
+                      .c_str();
+        return true;
+    }
+
+    // Create the FIFO if needed; any line written to it is a trigger, e.g. echo pop > file
+    bool openTriggerFifo() {
+        if (mConfig.triggerFifoPath.empty()) {
+            return true;
+        }
+        if (mkfifo(mConfig.triggerFifoPath.c_str(), 0666) != 0 && errno != EEXIST) {
+            printf("Error: Can't create trigger FIFO %s: %s\n", mConfig.triggerFifoPath.c_str(), strerror(errno));
+            return false;
+        }
+        mFifoFd = open(mConfig.triggerFifoPath.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (mFifoFd < 0) {
+            printf("Error: Can't open trigger FIFO %s: %s\n", mConfig.triggerFifoPath.c_str(), strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    void closeTriggerFifo() {
+        if (mFifoFd >= 0) {
+            close(mFifoFd);
+            mFifoFd = -1;
+        }
+    }
+
+    // Dump thread: a non-blocking read per poll, the last line becomes the command label
+    void pollTriggerFifo() {
+        if (mFifoFd < 0) {
+            return;
+        }
+        char text[256];
+        const ssize_t bytes = read(mFifoFd, text, sizeof(text) - 1);
+        if (bytes <= 0) {
+            return;
+        }
+        text[bytes] = '\0';
+        std::string command(text);
+        while (!command.empty() && isspace(static_cast<unsigned char>(command.back()))) {
+            command.pop_back();
+        }
+        const size_t lastLine = command.rfind('\n');
+        mLastCommand = lastLine == std::string::npos ? command : command.substr(lastLine + 1);
+        mCommandRequested = true;
+    }
+
+    size_t mFrameSize = 0;
+    uint64_t mPreFrames = 0;
+    uint64_t mPostFrames = 0;
+    uint64_t mRingFrames = 0;
+    uint64_t mMaxReadFrames = 0;
+    char* mRing = nullptr;
+    std::string mBasePath;
+    int mFifoFd = -1;
+    std::string mLastCommand; // dump thread only
+
+    std::atomic<uint64_t> mCapturedFrames{0};
+    std::atomic<bool> mEventPending{false}; // mEvent belongs to the dump thread while set
+    std::atomic<bool> mCommandRequested{false};
+    std::atomic<bool> mCaptureEnded{false};
+    std::atomic<bool> mDumpFailed{false};
+    TriggerEvent mEvent{};
+    int32_t mEventCount = 0;
+    int32_t mSavedEvents = 0;
+    int32_t mFailedEvents = 0; // not written completely, the capture stops at the first one
+};
+
+/************************** Playlist Operation ******************************/
+// Plays a list of WAV files back to back. While one file plays, a loader thread parses the next header and reads
+// the head of its data into memory, so no file system access sits between the last write of one file and the
+// first write of the next. Consecutive files with the same format stream into the same output stream; only a
+// format change stops it and opens a new one.
+class PlaylistOperation : public AudioOperation {
+public:
+    // Constructor for playlist playback, files from config.playlistPaths
+    explicit PlaylistOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~PlaylistOperation() override {
+        if (mLoader.joinable()) {
+            mLoader.join();
+        }
+    }
+
+    // Disable copy operations (inherited from AudioOperation)
+    PlaylistOperation(const PlaylistOperation&) = delete;
+    PlaylistOperation& operator=(const PlaylistOperation&) = delete;
+
+    // Execute gapless playback of all files
+    int32_t execute() override {
+        if (mConfig.playlistPaths.empty()) {
+            printf("Error: -m7 needs a directory, glob pattern, list file or WAV files\n");
+            return -1;
+        }
+        if (!AudioUtils::collectWavFiles(mConfig.playlistPaths, mFiles)) {
+            return -1;
+        }
+        if (mFiles.empty()) {
+            printf("Error: Playlist is empty\n");
+            return -1;
+        }
+        printf("Playlist: %zu file(s)\n", mFiles.size());
+        mResults.assign(mFiles.size(), FileResult());
+        mRequestedMinFrameCount = mConfig.minFrameCount;
+        mNextIndex = 0;
+        startLoad();
+
+        beginLoopResourceUsage();
+        const int64_t loopStartNs = AudioUtils::getMonotonicNs();
+        int32_t result = 0;
+        std::unique_ptr<LoadedFile> current = takeNext();
+        while (current != nullptr && !sExitRequested) {
+            if (!current->valid) {
+                current = takeNext();
+                continue;
+            }
+            mConfig.sampleRate = current->wavFile.getSampleRate();
+            mConfig.channelCount = current->wavFile.getNumChannels();
+            mConfig.format = current->wavFile.getAudioFormat();
+            mConfig.minFrameCount = mRequestedMinFrameCount; // derived again for the new format
+            std::unique_ptr<AudioOutputStream> track = openOutputStream();
+            if (!track || !startAudioComponent(track)) {
+                closeOutputStream(track);
+                result = -1;
+                break;
+            }
+            result = playTrack(track, current);
+            mRunStats.underrunCount += track->getUnderrunCount();
+            stopAudioComponent(track);
+            closeOutputStream(track);
+            ++mTrackCount;
+            if (result != 0) {
+                break;
+            }
+        }
+        if (mLoader.joinable()) {
+            mLoader.join();
+        }
+        endLoopResourceUsage();
+        sLogger.flush();
+        mRunStats.loopTimeNs = AudioUtils::getMonotonicNs() - loopStartNs;
+        if (result != 0) {
+            return result;
+        }
+
+        printReport();
+        if (!mConfig.reportPath.empty() && !writeReport()) {
+            return -1;
+        }
+        reportResourceUsage(MODE_PLAYLIST, playedSeconds());
+        return 0;
+    }
+
+private:
+    static constexpr int32_t kPrefetchMs = 250; // data read ahead by the loader thread
+
+    // A playlist file opened by the loader thread, with the head of its data already in memory
+    struct LoadedFile {
+        size_t index = 0;
+        WAVFile wavFile;
+        std::vector<char> head;      // first bytes of the data chunk, whole frames
+        uint64_t remainingBytes = 0; // data left in the file after head, UINT64_MAX = until end of file
+        bool valid = false;
+    };
+
+    // Playback result of one playlist file
+    struct FileResult {
+        bool played = false;
+        std::string error;     // why the file was skipped
+        int32_t sampleRate = 0;
+        int32_t channelCount = 0;
+        uint32_t bitsPerSample = 0;
+        bool isFloat = false;
+        int32_t track = -1;       // output stream the file was played on
+        uint64_t startFrame = 0;  // first frame of the file in that stream
+        uint64_t frames = 0;
+        double loadMs = 0;        // header parse and prefetch on the loader thread
+        double waitMs = 0;        // time the player waited for the loader
+        uint32_t underruns = 0;   // underruns counted while the file played
+    };
+
+    // Start loading mFiles[mNextIndex] on the loader thread
+    void startLoad() {
+        if (mNextIndex >= mFiles.size()) {
+            return;
+        }
+        mPending = std::make_unique<LoadedFile>();
+        mPending->index = mNextIndex;
+        mLoader = std::thread(&PlaylistOperation::loadFile, this, std::ref(*mPending));
+    }
+
+    // Wait for the loaded file and start loading the one after it, nullptr at the end of the playlist
+    std::unique_ptr<LoadedFile> takeNext() {
+        if (mNextIndex >= mFiles.size()) {
+            return nullptr;
+        }
+        const int64_t waitStartNs = AudioUtils::getMonotonicNs();
+        mLoader.join();
+        mResults[mNextIndex].waitMs = (AudioUtils::getMonotonicNs() - waitStartNs) / 1e6;
+        std::unique_ptr<LoadedFile> loaded = std::move(mPending);
+        ++mNextIndex;
+        startLoad();
+        if (!loaded->valid) {
+            sLogger.error("Skipping %s: %s\n", mFiles[loaded->index].c_str(), mResults[loaded->index].error.c_str());
+        }
+        return loaded;
+    }
+
+    // Loader thread: parse the header and read the first kPrefetchMs of data
+    void loadFile(LoadedFile& file) {
+        const int64_t startNs = AudioUtils::getMonotonicNs();
+        FileResult& result = mResults[file.index];
+        WAVFile& wavFile = file.wavFile;
+        if (!wavFile.openForReading(mFiles[file.index])) {
+            result.error = "not a PCM WAV file";
+        } else if (wavFile.getAudioFormat() == AUDIO_FORMAT_INVALID) {
+            result.error = "unsupported sample format";
+        } else {
+            const WAVFile::Header& header = wavFile.getHeader();
+            const size_t frameSize = audio_bytes_per_sample(wavFile.getAudioFormat()) * wavFile.getNumChannels();
+            result.sampleRate = wavFile.getSampleRate();
+            result.channelCount = wavFile.getNumChannels();
+            result.bitsPerSample = wavFile.getBitsPerSample();
+            result.isFloat = header.audioFormat == 3;
+            // A data size of 0 comes from a recording that was never finalized, play it to the end of the file
+            const uint64_t dataBytes = header.dataSize > 0 ? header.dataSize / frameSize * frameSize : UINT64_MAX;
+            const uint64_t headBytes =
+                std::min<uint64_t>(static_cast<uint64_t>(result.sampleRate) * kPrefetchMs / 1000 * frameSize,
+                                   dataBytes);
+            file.head.resize(static_cast<size_t>(headBytes));
+            const size_t bytesRead = wavFile.readData(file.head.data(), file.head.size());
+            file.head.resize(bytesRead / frameSize * frameSize);
+            if (bytesRead < headBytes) {
+                file.remainingBytes = 0; // the whole file fit into the head
+            } else {
+                file.remainingBytes = dataBytes == UINT64_MAX ? UINT64_MAX : dataBytes - headBytes;
+            }
+            file.valid = true;
+        }
+        result.loadMs = (AudioUtils::getMonotonicNs() - startNs) / 1e6;
+    }
+
+    // Play current and every following file with the same format into track. On return current is the first
+    // file that needs a different stream, or nullptr at the end of the playlist.
+    int32_t playTrack(const std::unique_ptr<AudioOutputStream>& track, std::unique_ptr<LoadedFile>& current) {
+        const size_t bufferSize = calculateBufferSize();
+        BufferPool::Lease bufferLease = BufferPool::acquire(mBufferPool, bufferSize);
+        BufferManager& bufferManager = bufferLease.get();
+        if (!bufferManager.isValid()) {
+            printf("Error: Failed to create valid buffer manager\n");
+            return -1;
+        }
+        char* const audioBuffer = bufferManager.get();
+        const size_t frameSize = audio_bytes_per_sample(mConfig.format) * mConfig.channelCount;
+        const size_t readSize = bufferSize / frameSize * frameSize;
+
+        uint64_t trackFrames = 0;
+        while (current != nullptr && !sExitRequested) {
+            if (current->valid) {
+                if (current->wavFile.getSampleRate() != mConfig.sampleRate ||
+                    current->wavFile.getNumChannels() != mConfig.channelCount ||
+                    current->wavFile.getAudioFormat() != mConfig.format) {
+                    sLogger.print("Format change at %s, reopening the output stream\n",
+                                  mFiles[current->index].c_str());
+                    sLogger.flush();
+                    return 0;
+                }
+                FileResult& result = mResults[current->index];
+                result.track = mTrackCount;
+                result.startFrame = trackFrames;
+                const uint32_t underrunsBefore = track->getUnderrunCount();
+                sLogger.print("Playing [%zu/%zu] %s at frame %" PRIu64 "\n", current->index + 1, mFiles.size(),
+                              mFiles[current->index].c_str(), trackFrames);
+
+                uint64_t bytesPlayed = 0;
+                if (!writeAll(track, current->head.data(), current->head.size(), bytesPlayed)) {
+                    return -1;
+                }
+                uint64_t remaining = current->remainingBytes;
+                while (remaining > 0 && !sExitRequested) {
+                    const size_t toRead = static_cast<size_t>(std::min<uint64_t>(readSize, remaining));
+                    // A file cut inside a frame would shift the channels of every following file
+                    const size_t bytesRead = current->wavFile.readData(audioBuffer, toRead) / frameSize * frameSize;
+                    if (bytesRead == 0) {
+                        break;
+                    }
+                    if (!writeAll(track, audioBuffer, bytesRead, bytesPlayed)) {
+                        return -1;
+                    }
+                    updateLevelMeter(audioBuffer, bytesRead);
+                    remaining = remaining == UINT64_MAX ? remaining : remaining - bytesRead;
+                }
+                result.frames = bytesPlayed / frameSize;
+                result.underruns = track->getUnderrunCount() - underrunsBefore;
+                result.played = true;
+                trackFrames += result.frames;
+                mRunStats.bytesRendered += bytesPlayed;
+            }
+            current = takeNext();
+        }
+        return 0;
+    }
+
+    bool writeAll(const std::unique_ptr<AudioOutputStream>& track, const char* data, const size_t size,
+                  uint64_t& bytesPlayed) {
+        size_t bytesWritten = 0;
+        while (bytesWritten < size && !sExitRequested) {
+            const ssize_t written = track->write(data + bytesWritten, size - bytesWritten);
+            if (written < 0) {
+                sLogger.error("%s write failed: %zd\n", track->getName(), written);
+                return false;
+            }
+            bytesWritten += static_cast<size_t>(written);
+            ++mRunStats.writeCalls;
+        }
+        bytesPlayed += bytesWritten;
+        return true;
+    }
+
+    // Seconds of audio played over all files, which may differ in sample rate
+    double playedSeconds() const {
+        double seconds = 0.0;
+        for (const FileResult& result : mResults) {
+            seconds += result.sampleRate > 0 ? static_cast<double>(result.frames) / result.sampleRate : 0.0;
+        }
+        return seconds;
+    }
+
+    void printReport() const {
+        size_t played = 0;
+        uint64_t frames = 0;
+        for (const FileResult& result : mResults) {
+            played += result.played ? 1 : 0;
+            frames += result.frames;
+        }
+        printf("\nPlaylist finished: %zu of %zu file(s) played on %d stream(s), %" PRIu64 " frames, %u underrun(s)\n",
+               played, mResults.size(), mTrackCount, frames, mRunStats.underrunCount);
+        printf("  %-4s %-6s %12s %10s %6s %3s %-5s %9s %9s %8s %s\n", "#", "Stream", "Start frame", "Frames", "Rate",
+               "Ch", "Bits", "Load(ms)", "Wait(ms)", "Underrun", "File");
+        for (size_t i = 0; i < mResults.size(); ++i) {
+            const FileResult& r = mResults[i];
+            if (!r.played) {
+                printf("  %-4zu %-6s %s: %s\n", i + 1, "-", mFiles[i].c_str(),
+                       r.error.empty() ? "not played" : r.error.c_str());
+                continue;
+            }
+            const String8 bits = String8::format("%u%s", r.bitsPerSample, r.isFloat ? "f" : "");
+            printf("  %-4zu %-6d %12" PRIu64 " %10" PRIu64 " %6d %3d %-5s %9.2f %9.2f %8u %s\n", i + 1, r.track,
+                   r.startFrame, r.frames, r.sampleRate, r.channelCount, bits.c_str(), r.loadMs, r.waitMs,
+                   r.underruns, mFiles[i].c_str());
+        }
+        printf("Start frames count from the start of each output stream\n");
+    }
+
+    bool writeReport() const {
+        std::ofstream report;
+        if (!openReportFile(report)) {
+            printf("Error: Can't create report file: %s\n", mConfig.reportPath.c_str());
+            return false;
+        }
+        report << String8::format("{\"type\":\"playlist\",\"streams\":%d,\"underruns\":%u,\"files\":[", mTrackCount,
+                                  mRunStats.underrunCount)
+                      .c_str();
+        for (size_t i = 0; i < mResults.size(); ++i) {
+            const FileResult& r = mResults[i];
+            report << String8::format("%s{\"file\":\"%s\",\"played\":%s,\"stream\":%d,\"start_frame\":%" PRIu64
+                                      ",\"frames\":%" PRIu64 ",\"sample_rate\":%d,\"channels\":%d,\"bits\":%u,"
+                                      "\"float\":%s,\"load_ms\":%.3f,\"wait_ms\":%.3f,\"underruns\":%u}",
+                                      i > 0 ? "," : "", mFiles[i].c_str(), r.played ? "true" : "false", r.track,
+                                      r.startFrame, r.frames, r.sampleRate, r.channelCount, r.bitsPerSample,
+                                      r.isFloat ? "true" : "false", r.loadMs, r.waitMs, r.underruns)
+                          .c_str();
+        }
+        report << "]}\n";
+        return true;
+    }
+
+    std::vector<std::string> mFiles;
+    std::vector<FileResult> mResults;
+    size_t mRequestedMinFrameCount = 0;
+    size_t mNextIndex = 0;                 // next file handed to the player
+    std::unique_ptr<LoadedFile> mPending;  // file being loaded by mLoader
+    std::thread mLoader;
+    int32_t mTrackCount = 0;
+};
+
+/************************** Capture Fan-Out ******************************/
+// One capture stream shared by several local processes. The -m8 server reads the input stream straight into a
+// ring in a memfd and publishes the written byte count; -m206 clients connect to its UNIX socket, receive the
+// memfd, map it read-only and copy out of the ring at their own pace, each with its own cursor. The server
+// never waits for a client and copies nothing per client; every client copies each chunk once. A client that
+// falls more than the ring minus one read behind has lost data: it counts an overrun and jumps forward; a copy
+// is only used once a re-check shows it was not overwritten meanwhile. Clients sleep on a futex on the publish
+// counter, so an idle client costs no polling. The memfd is sealed against resizing and, where the kernel
+// supports it, against new writable mappings; clients get a read-only descriptor and refuse an unsealed ring,
+// so no client can corrupt the ring for the others or make their mappings fault.
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010 // Linux 5.1, missing from older headers
+#endif
+
+struct FanoutRingHeader {
+    static constexpr uint32_t kMagic = 0x46435441; // "ATCF"
+    static constexpr uint32_t kVersion = 1;
+    static constexpr size_t kSize = 4096; // the ring data starts on the next page
+
+    uint32_t magic;
+    uint32_t version;
+    int32_t sampleRate;
+    int32_t channelCount;
+    int32_t format;
+    uint32_t frameSize;
+    uint64_t ringBytes;     // capacity of the data area, whole frames
+    uint64_t maxReadBytes;  // largest single read; that much before the oldest data may be changing
+    std::atomic<uint64_t> writePosition; // bytes published since the start
+    std::atomic<uint32_t> publishCount;  // futex word, bumped on every publish
+    std::atomic<uint32_t> finished;      // 1 once the server stopped capturing
+    std::atomic<uint32_t> clients;       // clients currently attached
+};
+static_assert(sizeof(FanoutRingHeader) <= FanoutRingHeader::kSize, "fan-out header must fit one page");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "write position is shared between processes");
+
+// Sent by the server with the memfd attached; the client answers with its statistics before it leaves
+struct FanoutHello {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t mapBytes;
+};
+
+struct FanoutClientStats {
+    uint64_t bytesRead;
+    uint64_t overruns;
+    uint64_t lostBytes;
+};
+
+class FanoutSocket {
+public:
+    // Address of a path, or of an abstract socket when it starts with '@'
+    static bool makeAddress(const std::string& path, sockaddr_un& address, socklen_t& length) {
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+            printf("Error: Invalid socket path: %s\n", path.c_str());
+            return false;
+        }
+        memcpy(address.sun_path, path.c_str(), path.size());
+        if (path[0] == '@') {
+            address.sun_path[0] = '\0';
+        }
+        length = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size());
+        return true;
+    }
+
+    static bool sendFd(const int socket, const void* data, const size_t size, const int fd) {
+        struct iovec iov = {const_cast<void*>(data), size};
+        char control[CMSG_SPACE(sizeof(int))] = {};
+        struct msghdr message {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        return sendmsg(socket, &message, MSG_NOSIGNAL) == static_cast<ssize_t>(size);
+    }
+
+    // Receive size bytes and the attached descriptor, -1 if none came with them
+    static int receiveFd(const int socket, void* data, const size_t size) {
+        struct iovec iov = {data, size};
+        char control[CMSG_SPACE(sizeof(int))] = {};
+        struct msghdr message {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(socket, &message, MSG_CMSG_CLOEXEC) != static_cast<ssize_t>(size)) {
+            return -1;
+        }
+        const struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+        if (cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            return -1;
+        }
+        int fd = -1;
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        return fd;
+    }
+
+    static void futexWake(std::atomic<uint32_t>& word) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+    }
+
+    // Sleep while word still holds expected, at most timeoutMs
+    static void futexWait(const std::atomic<uint32_t>& word, const uint32_t expected, const int32_t timeoutMs) {
+        struct timespec timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000000L};
+        syscall(SYS_futex, reinterpret_cast<const uint32_t*>(&word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+    }
+};
+
+class FanoutServerOperation : public AudioOperation {
+public:
+    // Constructor for the fan-out server, captures with the record options
+    explicit FanoutServerOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~FanoutServerOperation() override { closeRing(); }
+
+    // Disable copy operations (inherited from AudioOperation)
+    FanoutServerOperation(const FanoutServerOperation&) = delete;
+    FanoutServerOperation& operator=(const FanoutServerOperation&) = delete;
+
+    // Capture into the ring until -d seconds passed or Ctrl+C, serving clients on a side thread
+    int32_t execute() override {
+        if (!validateAudioParameters()) {
+            return -1;
+        }
+        // The ring is sized after the open, which settles the transfer size
+        std::unique_ptr<AudioInputStream> audioRecord = openInputStream();
+        if (!audioRecord || !createRing() || !listenSocket() || !startAudioComponent(audioRecord)) {
+            closeInputStream(audioRecord);
+            return -1;
+        }
+
+        mStopServing.store(false);
+        std::thread server(&FanoutServerOperation::serveClients, this);
+        const int32_t result = captureLoop(audioRecord);
+
+        // Wake every client so it sees the end, then let them say goodbye
+        mRing->finished.store(1, std::memory_order_release);
+        mRing->publishCount.fetch_add(1, std::memory_order_release);
+        FanoutSocket::futexWake(mRing->publishCount);
+        mStopServing.store(true);
+        server.join();
+        sLogger.flush();
+
+        stopAudioComponent(audioRecord);
+        closeInputStream(audioRecord);
+        reportResourceUsage(MODE_FANOUT_SERVER);
+        printf("Fan-out server finished: %.2f MB captured, %u client(s) served\n",
+               mRunStats.bytesCaptured / (1024.0 * 1024.0), mClientsServed);
+        return result;
+    }
+
+private:
+    static constexpr int32_t kMaxClients = 16;
+    static constexpr int32_t kPollMs = 100;
+
+    bool createRing() {
+        const size_t frameSize = audio_bytes_per_sample(mConfig.format) * mConfig.channelCount;
+        const uint64_t ringFrames =
+            std::max<uint64_t>(static_cast<uint64_t>(mConfig.sampleRate) * mConfig.fanoutRingMs / 1000, 1);
+        // At least four reads, so a client one read behind is never in the region being written
+        const uint64_t ringBytes = std::max<uint64_t>(ringFrames * frameSize, calculateBufferSize() * 4);
+        mMapBytes = FanoutRingHeader::kSize + static_cast<size_t>((ringBytes + 4095) / 4096 * 4096);
+        mRingFd = static_cast<int>(
+            syscall(SYS_memfd_create, "audio_test_fanout", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+        void* addr = MAP_FAILED;
+        if (mRingFd >= 0 && ftruncate(mRingFd, static_cast<off_t>(mMapBytes)) == 0) {
+            addr = mmap(nullptr, mMapBytes, PROT_READ | PROT_WRITE, MAP_SHARED, mRingFd, 0);
+        }
+        if (addr == MAP_FAILED) {
+            printf("Error: Can't create the fan-out ring: %s\n", strerror(errno));
+            return false;
+        }
+        mRing = new (addr) FanoutRingHeader();
+        mRing->magic = FanoutRingHeader::kMagic;
+        mRing->version = FanoutRingHeader::kVersion;
+        mRing->sampleRate = mConfig.sampleRate;
+        mRing->channelCount = mConfig.channelCount;
+        mRing->format = mConfig.format;
+        mRing->frameSize = static_cast<uint32_t>(frameSize);
+        mRing->ringBytes = ringBytes / frameSize * frameSize;
+        mRing->maxReadBytes = calculateBufferSize();
+        mData = static_cast<char*>(addr) + FanoutRingHeader::kSize;
+        if (!sealRing()) {
+            return false;
+        }
+        printf("Fan-out ring: %.1f KB (%" PRIu64 " ms)\n", mRing->ringBytes / 1024.0,
+               mRing->ringBytes * 1000 / calculateBytesPerSecond());
+        return true;
+    }
+
+    // Fix the size so no mapping can fault, and stop new writable mappings once the server's own exists. Clients
+    // get a descriptor reopened read-only: a PROT_WRITE mapping of it fails, and mprotect can't add write later.
+    bool sealRing() {
+        constexpr int kSizeSeals = F_SEAL_SHRINK | F_SEAL_GROW;
+        if (fcntl(mRingFd, F_ADD_SEALS, kSizeSeals | F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) != 0 &&
+            fcntl(mRingFd, F_ADD_SEALS, kSizeSeals | F_SEAL_SEAL) != 0) {
+            printf("Error: Can't seal the fan-out ring: %s\n", strerror(errno));
+            return false;
+        }
+        const std::string path = String8::format("/proc/self/fd/%d", mRingFd).c_str();
+        mClientFd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (mClientFd < 0) {
+            printf("Error: Can't open a read-only fan-out descriptor: %s\n", strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    bool listenSocket() {
+        sockaddr_un address;
+        socklen_t length;
+        if (!FanoutSocket::makeAddress(mConfig.fanoutSocketPath, address, length)) {
+            return false;
+        }
+        const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            printf("Error: Can't listen on %s: %s\n", mConfig.fanoutSocketPath.c_str(), strerror(errno));
+            return false;
+        }
+        bool bound = bind(fd, reinterpret_cast<sockaddr*>(&address), length) == 0;
+        if (!bound && errno == EADDRINUSE && mConfig.fanoutSocketPath[0] != '@') {
+            if (!removeStaleSocket(address, length)) {
+                ::close(fd);
+                return false;
+            }
+            bound = bind(fd, reinterpret_cast<sockaddr*>(&address), length) == 0;
+        }
+        if (!bound) {
+            printf("Error: Can't listen on %s: %s\n", mConfig.fanoutSocketPath.c_str(), strerror(errno));
+            ::close(fd);
+            return false;
+        }
+        // The socket file is ours from here on, closeRing() removes it
+        mListenFd = fd;
+        if (listen(mListenFd, kMaxClients) != 0) {
+            printf("Error: Can't listen on %s: %s\n", mConfig.fanoutSocketPath.c_str(), strerror(errno));
+            return false;
+        }
+        printf("Fan-out server listening on %s\n", mConfig.fanoutSocketPath.c_str());
+        return true;
+    }
+
+    // A socket file left by a server that died is refused by connect() and can go; a live server or any other
+    // file at the path is left alone
+    bool removeStaleSocket(const sockaddr_un& address, const socklen_t length) const {
+        const char* path = mConfig.fanoutSocketPath.c_str();
+        struct stat st {};
+        if (lstat(path, &st) != 0 || !S_ISSOCK(st.st_mode)) {
+            printf("Error: Can't listen on %s: the path exists and is not a socket\n", path);
+            return false;
+        }
+        const int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (probe < 0) {
+            printf("Error: Can't listen on %s: %s\n", path, strerror(errno));
+            return false;
+        }
+        const bool connected = connect(probe, reinterpret_cast<const sockaddr*>(&address), length) == 0;
+        const int connectError = errno;
+        ::close(probe);
+        if (connected) {
+            printf("Error: Another fan-out server is listening on %s\n", path);
+            return false;
+        }
+        if (connectError != ECONNREFUSED) {
+            printf("Error: Can't listen on %s: %s\n", path, strerror(connectError));
+            return false;
+        }
+        if (unlink(path) != 0) {
+            printf("Error: Can't remove stale socket %s: %s\n", path, strerror(errno));
+            return false;
+        }
+        printf("Removed stale socket %s\n", path);
+        return true;
+    }
+
+    void closeRing() {
+        for (const Client& client : mClients) {
+            ::close(client.fd);
+        }
+        mClients.clear();
+        if (mListenFd >= 0) {
+            ::close(mListenFd);
+            mListenFd = -1;
+            if (mConfig.fanoutSocketPath[0] != '@') {
+                unlink(mConfig.fanoutSocketPath.c_str());
+            }
+        }
+        if (mRing != nullptr) {
+            munmap(mRing, mMapBytes);
+            mRing = nullptr;
+        }
+        if (mRingFd >= 0) {
+            ::close(mRingFd);
+            mRingFd = -1;
+        }
+        if (mClientFd >= 0) {
+            ::close(mClientFd);
+            mClientFd = -1;
+        }
+    }
+
+    // Read straight into the ring; a read never wraps, it is cut at the end of the ring instead
+    int32_t captureLoop(const std::unique_ptr<AudioInputStream>& audioRecord) {
+        printf("Capturing for clients. Press Ctrl+C to stop\n");
+        ALOGI("Fan-out capture in progress.");
+        const uint64_t bytesPerSecond = calculateBytesPerSecond();
+        const uint64_t maxBytes = mConfig.durationSeconds > 0
+                                      ? static_cast<uint64_t>(mConfig.durationSeconds) * bytesPerSecond
+                                      : UINT64_MAX;
+        mNextProgressReport = bytesPerSecond * kProgressReportInterval;
+        if (!openLiveMetrics(MODE_FANOUT_SERVER)) {
+            return -1;
+        }
+        beginLoopResourceUsage();
+        const int64_t loopStartNs = AudioUtils::getMonotonicNs();
+        uint64_t position = 0;
+        int32_t result = 0;
+        while (position < maxBytes && !sExitRequested) {
+            const size_t offset = static_cast<size_t>(position % mRing->ringBytes);
+            const size_t wanted = std::min<size_t>(mRing->maxReadBytes, mRing->ringBytes - offset);
+            const int64_t readStartNs = AudioUtils::getMonotonicNs();
+            const ssize_t bytesRead = audioRecord->read(mData + offset, wanted);
+            if (bytesRead < 0) {
+                sLogger.error("AudioRecord read failed: %zd\n", bytesRead);
+                result = -1;
+                break;
+            }
+            if (bytesRead == 0) {
+                continue;
+            }
+            if (position == 0) {
+                mStartupTimeline.mark("first_read");
+            }
+            position += static_cast<uint64_t>(bytesRead);
+            mRing->writePosition.store(position, std::memory_order_release);
+            mRing->publishCount.fetch_add(1, std::memory_order_release);
+            FanoutSocket::futexWake(mRing->publishCount);
+
+            updateLiveMetrics(true, readStartNs, mData + offset, static_cast<size_t>(bytesRead), audioRecord.get(),
+                              nullptr);
+            updateLevelMeter(mData + offset, static_cast<size_t>(bytesRead));
+            reportProgress(audioRecord, position, bytesPerSecond);
+        }
+        sLogger.flush();
+        endLoopResourceUsage();
+        finishLiveMetrics(audioRecord.get(), nullptr);
+        mRunStats.loopTimeNs = AudioUtils::getMonotonicNs() - loopStartNs;
+        mRunStats.bytesCaptured = position;
+        mRunStats.overrunFrames = audioRecord->getOverrunFrames();
+        return result;
+    }
+
+    struct Client {
+        int fd;
+        uint32_t id;
+    };
+
+    // Accept clients, hand them the ring and log their statistics when they leave
+    void serveClients() {
+        while (true) {
+            std::vector<struct pollfd> fds;
+            fds.push_back({mListenFd, POLLIN, 0});
+            for (const Client& client : mClients) {
+                fds.push_back({client.fd, POLLIN, 0});
+            }
+            if (poll(fds.data(), fds.size(), kPollMs) < 0 && errno != EINTR) {
+                sLogger.error("Fan-out poll failed: %s\n", strerror(errno));
+                break;
+            }
+            for (size_t i = fds.size() - 1; i >= 1; --i) {
+                if (fds[i].revents != 0) {
+                    removeClient(i - 1);
+                }
+            }
+            if ((fds[0].revents & POLLIN) != 0) {
+                acceptClient();
+            }
+            // Clients get a moment after the end to report their statistics
+            if (mStopServing.load() && (mClients.empty() || ++mShutdownPolls > 10)) {
+                break;
+            }
+        }
+    }
+
+    void acceptClient() {
+        const int fd = accept4(mListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        const FanoutHello hello = {FanoutRingHeader::kMagic, FanoutRingHeader::kVersion, mMapBytes};
+        if (static_cast<int32_t>(mClients.size()) >= kMaxClients ||
+            !FanoutSocket::sendFd(fd, &hello, sizeof(hello), mClientFd)) {
+            sLogger.error("Fan-out client rejected\n");
+            ::close(fd);
+            return;
+        }
+        mClients.push_back(Client{fd, ++mClientsServed});
+        mRing->clients.store(static_cast<uint32_t>(mClients.size()));
+        sLogger.printTimed("Client %u attached, %zu client(s)\n", mClientsServed, mClients.size());
+    }
+
+    void removeClient(const size_t index) {
+        const Client client = mClients[index];
+        FanoutClientStats stats{};
+        if (recv(client.fd, &stats, sizeof(stats), MSG_DONTWAIT) == static_cast<ssize_t>(sizeof(stats))) {
+            sLogger.printTimed("Client %u left: %.2f MB read, %" PRIu64 " overrun(s), %" PRIu64 " bytes lost\n",
+                               client.id, stats.bytesRead / (1024.0 * 1024.0), stats.overruns, stats.lostBytes);
+        } else {
+            sLogger.printTimed("Client %u disconnected\n", client.id);
+        }
+        ::close(client.fd);
+        mClients.erase(mClients.begin() + static_cast<std::ptrdiff_t>(index));
+        mRing->clients.store(static_cast<uint32_t>(mClients.size()));
+    }
+
+    FanoutRingHeader* mRing = nullptr;
+    char* mData = nullptr;
+    size_t mMapBytes = 0;
+    int mRingFd = -1;
+    int mClientFd = -1; // read-only reopen of mRingFd, the one handed to clients
+    int mListenFd = -1;
+    std::atomic<bool> mStopServing{false};
+    std::vector<Client> mClients; // server thread only
+    uint32_t mClientsServed = 0;
+    int32_t mShutdownPolls = 0;
+};
+
+class FanoutClientOperation : public AudioOperation {
+public:
+    // Constructor for a fan-out client, the stream format comes from the server
+    explicit FanoutClientOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~FanoutClientOperation() override { detach(); }
+
+    // Disable copy operations (inherited from AudioOperation)
+    FanoutClientOperation(const FanoutClientOperation&) = delete;
+    FanoutClientOperation& operator=(const FanoutClientOperation&) = delete;
+
+    // Consume the shared capture until -d seconds passed, the server stopped or Ctrl+C
+    int32_t execute() override {
+        if (!attach()) {
+            return -1;
+        }
+        mConfig.sampleRate = mRing->sampleRate;
+        mConfig.channelCount = mRing->channelCount;
+        mConfig.format = static_cast<audio_format_t>(mRing->format);
+        printf("Attached to %s: %d Hz, %d channel(s), format %d, ring %.1f KB\n", mConfig.fanoutSocketPath.c_str(),
+               mConfig.sampleRate, mConfig.channelCount, mConfig.format, mRing->ringBytes / 1024.0);
+
+        WAVFile wavFile;
+        if (!mConfig.recordFilePath.empty() && !setupWavFileForRecording(wavFile)) {
+            return -1;
+        }
+        const int32_t result = consumeLoop(wavFile.getFilePath().empty() ? nullptr : &wavFile);
+        wavFile.finalize();
+
+        // Tell the server how this client did
+        const FanoutClientStats stats = {mBytesRead, mOverruns, mLostBytes};
+        send(mSocket, &stats, sizeof(stats), MSG_NOSIGNAL);
+        printf("Fan-out client finished: %.2f MB read, %" PRIu64 " overrun(s), %" PRIu64 " bytes lost%s%s\n",
+               mBytesRead / (1024.0 * 1024.0), mOverruns, mLostBytes,
+               wavFile.getFilePath().empty() ? "" : ", File saved: ", wavFile.getFilePath().c_str());
+        return result != 0 ? result : (mOverruns > 0 ? 1 : 0);
+    }
+
+private:
+    static constexpr int32_t kWaitMs = 100; // futex timeout, bounds the reaction to Ctrl+C
+
+    bool attach() {
+        sockaddr_un address;
+        socklen_t length;
+        if (!FanoutSocket::makeAddress(mConfig.fanoutSocketPath, address, length)) {
+            return false;
+        }
+        mSocket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (mSocket < 0 || connect(mSocket, reinterpret_cast<sockaddr*>(&address), length) != 0) {
+            printf("Error: Can't connect to %s: %s\n", mConfig.fanoutSocketPath.c_str(), strerror(errno));
+            return false;
+        }
+        FanoutHello hello{};
+        const int fd = FanoutSocket::receiveFd(mSocket, &hello, sizeof(hello));
+        if (fd < 0 || hello.magic != FanoutRingHeader::kMagic || hello.version != FanoutRingHeader::kVersion) {
+            printf("Error: No fan-out ring received from %s\n", mConfig.fanoutSocketPath.c_str());
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            return false;
+        }
+        // Only a ring that can't shrink under the mapping is used; it is mapped read-only whatever the fd allows
+        struct stat st;
+        const int seals = fcntl(fd, F_GET_SEALS);
+        if (seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) != (F_SEAL_SHRINK | F_SEAL_GROW) ||
+            fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < hello.mapBytes ||
+            hello.mapBytes <= FanoutRingHeader::kSize) {
+            printf("Error: The fan-out ring from %s is not sealed or too small\n", mConfig.fanoutSocketPath.c_str());
+            ::close(fd);
+            return false;
+        }
+        void* addr = mmap(nullptr, hello.mapBytes, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            printf("Error: Can't map the fan-out ring: %s\n", strerror(errno));
+            return false;
+        }
+        mRing = static_cast<const FanoutRingHeader*>(addr);
+        mMapBytes = hello.mapBytes;
+        mData = static_cast<const char*>(addr) + FanoutRingHeader::kSize;
+        return true;
+    }
+
+    void detach() {
+        if (mRing != nullptr) {
+            munmap(const_cast<FanoutRingHeader*>(mRing), mMapBytes);
+            mRing = nullptr;
+        }
+        if (mSocket >= 0) {
+            ::close(mSocket);
+            mSocket = -1;
+        }
+    }
+
+    // Oldest position that is safe to read when the writer is at writePosition
+    uint64_t oldestReadable(const uint64_t writePosition) const {
+        const uint64_t window = mRing->ringBytes - mRing->maxReadBytes;
+        return writePosition > window ? writePosition - window : 0;
+    }
+
+    // Skip to the oldest safe data after falling behind; the position stays frame aligned
+    void recoverOverrun(const uint64_t writePosition) {
+        const uint64_t resume = oldestReadable(writePosition) + mRing->ringBytes / 4;
+        const uint64_t aligned = resume - resume % mRing->frameSize;
+        ++mOverruns;
+        mLostBytes += aligned - mCursor;
+        sLogger.error("Fan-out overrun: %" PRIu64 " bytes lost\n", aligned - mCursor);
+        mCursor = aligned;
+    }
+
+    int32_t consumeLoop(WAVFile* wavFile) {
+        const uint64_t bytesPerSecond = calculateBytesPerSecond();
+        const uint64_t maxBytes = mConfig.durationSeconds > 0
+                                      ? static_cast<uint64_t>(mConfig.durationSeconds) * bytesPerSecond
+                                      : UINT64_MAX;
+        mNextProgressReport = bytesPerSecond * kProgressReportInterval;
+        // The ring data is copied out and checked before use, the server overwrites it without waiting. One
+        // copy takes at most one server read.
+        const size_t chunkBytes = static_cast<size_t>(std::max<uint64_t>(mRing->maxReadBytes, mRing->frameSize));
+        std::vector<char> chunkBuffer(chunkBytes);
+        char* const chunk = chunkBuffer.data();
+        // Start live, at the newest published data
+        mCursor = mRing->writePosition.load(std::memory_order_acquire);
+        beginLoopResourceUsage();
+        const int64_t loopStartNs = AudioUtils::getMonotonicNs();
+        int32_t result = 0;
+        while (mBytesRead < maxBytes && !sExitRequested) {
+            const uint32_t published = mRing->publishCount.load(std::memory_order_acquire);
+            const uint64_t writePosition = mRing->writePosition.load(std::memory_order_acquire);
+            if (writePosition == mCursor) {
+                if (mRing->finished.load(std::memory_order_acquire) != 0) {
+                    break;
+                }
+                FanoutSocket::futexWait(mRing->publishCount, published, kWaitMs);
+                continue;
+            }
+            if (mCursor < oldestReadable(writePosition)) {
+                recoverOverrun(writePosition);
+                continue;
+            }
+            const size_t offset = static_cast<size_t>(mCursor % mRing->ringBytes);
+            const size_t bytes = static_cast<size_t>(std::min<uint64_t>(
+                {writePosition - mCursor, mRing->ringBytes - offset, maxBytes - mBytesRead, chunkBytes}));
+            memcpy(chunk, mData + offset, bytes);
+            ++mRunStats.readCalls;
+
+            // The server may have lapped this client while the data was copied, then the copy is torn. The fence
+            // keeps the copy's loads before the position re-check.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const uint64_t writePositionAfterCopy = mRing->writePosition.load(std::memory_order_acquire);
+            if (mCursor < oldestReadable(writePositionAfterCopy)) {
+                recoverOverrun(writePositionAfterCopy);
+                continue;
+            }
+            if (wavFile != nullptr && wavFile->writeData(chunk, bytes) != bytes) {
+                sLogger.error("Failed to save audio data to file\n");
+                result = -1;
+                break;
+            }
+            updateLevelMeter(chunk, bytes);
+            mCursor += bytes;
+            mBytesRead += bytes;
+            mRunStats.bytesCaptured = mBytesRead;
+            if (mBytesRead >= mNextProgressReport) {
+                sLogger.print("Reading ... , processed %.2f seconds, %.2f MB, %" PRIu64 " overrun(s)\n",
+                              static_cast<float>(mBytesRead) / bytesPerSecond,
+                              static_cast<float>(mBytesRead) / (1024u * 1024u), mOverruns);
+                mNextProgressReport += bytesPerSecond * kProgressReportInterval;
+            }
+        }
+        endLoopResourceUsage();
+        sLogger.flush();
+        mRunStats.loopTimeNs = AudioUtils::getMonotonicNs() - loopStartNs;
+        reportResourceUsage(MODE_FANOUT_CLIENT);
+        return result;
+    }
+
+    const FanoutRingHeader* mRing = nullptr;
+    const char* mData = nullptr;
+    size_t mMapBytes = 0;
+    int mSocket = -1;
+    uint64_t mCursor = 0;
+    uint64_t mBytesRead = 0;
+    uint64_t mOverruns = 0;
+    uint64_t mLostBytes = 0;
+};
+
+/************************** Clock Drift Operation ******************************/
+// Least-squares line through (x, y) pairs, accumulated with Welford updates so hours of points stay exact
+class LinearFit {
+public:
+    void add(const double x, const double y) {
+        ++mCount;
+        const double dx = x - mMeanX;
+        const double dy = y - mMeanY;
+        mMeanX += dx / mCount;
+        mMeanY += dy / mCount;
+        mSxx += dx * (x - mMeanX);
+        mSxy += dx * (y - mMeanY);
+        mSyy += dy * (y - mMeanY);
+    }
+    void reset() { *this = LinearFit(); }
+
+    bool isValid() const { return mCount >= 3 && mSxx > 0.0; }
+    uint64_t getCount() const { return mCount; }
+    double getSlope() const { return mSxy / mSxx; }
+    // Standard error of the slope, from the scatter of the points around the line
+    double getSlopeError() const {
+        const double residual = std::max(mSyy - mSxy * mSxy / mSxx, 0.0);
+        return std::sqrt(residual / static_cast<double>(mCount - 2) / mSxx);
+    }
+
+private:
+    uint64_t mCount = 0;
+    double mMeanX = 0.0;
+    double mMeanY = 0.0;
+    double mSxx = 0.0;
+    double mSxy = 0.0;
+    double mSyy = 0.0;
+};
+
+// Slope over runs of contiguous points. An xrun steps the data (a stalled position, a skipped pilot phase), so
+// every segment between glitches gets its own line and the slopes are combined weighted by segment duration.
+// Segments shorter than kMinSeconds are discarded; with none left there is no estimate.
+class SegmentedFit {
+public:
+    static constexpr double kMinSeconds = 1.0;
+
+    void add(const double x, const double y) {
+        if (mCurrent.getCount() == 0) {
+            mStartX = x;
+        }
+        mEndX = x;
+        mCurrent.add(x, y);
+    }
+
+    // Close the current segment, the next point starts a new one
+    void breakSegment() {
+        if (isLongEnough()) {
+            accumulate(mSum, mEndX - mStartX, mCurrent);
+            ++mSegments;
+        } else if (mCurrent.getCount() > 0) {
+            ++mDiscarded;
+        }
+        mCount += mCurrent.getCount();
+        mCurrent.reset();
+    }
+
+    bool isValid() const { return combined().weight > 0.0; }
+    double getSlope() const { return combined().slope / combined().weight; }
+    double getSlopeError() const { return std::sqrt(combined().variance) / combined().weight; }
+    uint64_t getCount() const { return mCount + mCurrent.getCount(); }
+    uint32_t getSegments() const { return mSegments + (isLongEnough() ? 1 : 0); }
+    // Closed segments that were too short, plus the current one while it still is
+    uint32_t getDiscarded() const { return mDiscarded + (!isLongEnough() && mCurrent.getCount() > 0 ? 1 : 0); }
+
+private:
+    // Duration-weighted sums: slope = sum(w * s) / sum(w), error = sqrt(sum((w * e)^2)) / sum(w)
+    struct Sums {
+        double weight = 0.0;
+        double slope = 0.0;
+        double variance = 0.0;
+    };
+
+    bool isLongEnough() const { return mCurrent.isValid() && mEndX - mStartX >= kMinSeconds; }
+
+    static void accumulate(Sums& sums, const double weight, const LinearFit& fit) {
+        const double error = weight * fit.getSlopeError();
+        sums.weight += weight;
+        sums.slope += weight * fit.getSlope();
+        sums.variance += error * error;
+    }
+
+    Sums combined() const {
+        Sums sums = mSum;
+        if (isLongEnough()) {
+            accumulate(sums, mEndX - mStartX, mCurrent);
+        }
+        return sums;
+    }
+
+    LinearFit mCurrent;
+    double mStartX = 0.0;
+    double mEndX = 0.0;
+    Sums mSum;
+    uint64_t mCount = 0;
+    uint32_t mSegments = 0;
+    uint32_t mDiscarded = 0;
+};
+
+// Measures the rate offset between the render and capture clocks, for deciding whether a product needs ASRC.
+// A 1kHz pilot is played while the capture (through a loopback path) is correlated with the nominal pilot in
+// 100ms blocks: the phase of each block walks at 2*pi*(f_captured - f_pilot), so the slope of the unwrapped
+// phase gives the offset. Independently, both streams' timestamps are fitted as frame position against
+// CLOCK_MONOTONIC. Both estimates are printed every --drift-interval seconds with a 95% confidence interval.
+// Positive ppm: the render clock runs faster than the capture clock. An underrun stalls the render position and
+// shifts the pilot, an overrun skips capture positions: each starts a new segment of the affected fits.
+class ClockDriftOperation : public AudioOperation {
+public:
+    // Constructor for the drift measurement, plays and captures with the loopback options
+    explicit ClockDriftOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~ClockDriftOperation() override = default;
+
+    // Disable copy operations (inherited from AudioOperation)
+    ClockDriftOperation(const ClockDriftOperation&) = delete;
+    ClockDriftOperation& operator=(const ClockDriftOperation&) = delete;
+
+    // Estimates of the last execute() in ppm, NaN without enough data
+    double getPilotPpm() const { return pilotEstimate(mPilotFit).ppm; }
+    double getTimestampPpm() const {
+        return relativeEstimate(timestampEstimate(mInputFit), timestampEstimate(mOutputFit)).ppm;
+    }
+
+    // Play the pilot and analyze the capture until -d seconds passed or Ctrl+C
+    int32_t execute() override {
+        if (!validateAudioParameters() || !openReport()) {
+            return -1;
+        }
+        std::unique_ptr<AudioInputStream> audioRecord = openInputStream();
+        std::unique_ptr<AudioOutputStream> audioTrack = audioRecord ? openOutputStream() : nullptr;
+        if (!audioTrack || !startAudioComponent(audioRecord) || !startAudioComponent(audioTrack)) {
+            closeOutputStream(audioTrack);
+            closeInputStream(audioRecord);
+            return -1;
+        }
+
+        // Each stream runs on its own thread, so each is paced only by its own device clock
+        mStopRender = false;
+        std::thread render(&ClockDriftOperation::renderLoop, this, audioTrack.get());
+        const int32_t result = captureLoop(audioRecord);
+        mStopRender = true;
+        render.join();
+        sLogger.flush();
+
+        mRunStats.underrunCount = audioTrack->getUnderrunCount();
+        stopAudioComponent(audioTrack);
+        stopAudioComponent(audioRecord);
+        closeOutputStream(audioTrack);
+        closeInputStream(audioRecord);
+        return result != 0 ? result : printSummary();
+    }
+
+private:
+    static constexpr int32_t kPilotHz = 1000;
+    static constexpr float kPilotAmplitude = 0.25f; // -12dBFS
+    static constexpr int32_t kBlockMs = 100;
+    static constexpr double kMinPilotLevel = 0.01; // -40dBFS, weaker blocks are skipped
+    static constexpr double kConfidence95 = 1.96;
+
+    bool openReport() {
+        if (mConfig.reportPath.empty()) {
+            return true;
+        }
+        if (!openReportFile(mReport)) {
+            printf("Error: Can't create report file: %s\n", mConfig.reportPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Pilot on every channel, its phase computed exactly from the frame index so hours of play stay coherent
+    void renderLoop(AudioOutputStream* audioTrack) {
+        const size_t bytes = calculateBufferSize();
+        const size_t frameSize = audio_bytes_per_sample(mConfig.format) * mConfig.channelCount;
+        const size_t frames = bytes / frameSize;
+        const uint64_t sampleRate = static_cast<uint64_t>(mConfig.sampleRate);
+        std::vector<float> samples(frames * mConfig.channelCount);
+        std::vector<char> buffer(frames * frameSize);
+        uint64_t frame = 0;
+        uint32_t underruns = 0;
+        int64_t firstPosition = -1;
+        int64_t firstTimeNs = 0;
+        int64_t lastPosition = -1;
+        while (!mStopRender && !sExitRequested) {
+            for (size_t f = 0; f < frames; ++f) {
+                const uint64_t cycle = (frame + f) * kPilotHz % sampleRate;
+                const float v = kPilotAmplitude * static_cast<float>(std::sin(2.0 * M_PI * cycle / sampleRate));
+                std::fill_n(samples.begin() + f * mConfig.channelCount, mConfig.channelCount, v);
+            }
+            AudioUtils::floatToPcm(samples.data(), buffer.data(), samples.size(), mConfig.format);
+            size_t done = 0;
+            while (done < buffer.size() && !mStopRender && !sExitRequested) {
+                const ssize_t written = audioTrack->write(buffer.data() + done, buffer.size() - done, true);
+                if (written < 0) {
+                    sLogger.error("AudioTrack write failed: %zd\n", written);
+                    return;
+                }
+                done += static_cast<size_t>(written);
+            }
+            frame += frames;
+
+            // The position stalled while the timestamp went on: re-anchor after the step
+            const uint32_t underrunCount = audioTrack->getUnderrunCount();
+            if (underrunCount != underruns) {
+                underruns = underrunCount;
+                mUnderruns = underrunCount;
+                firstPosition = -1;
+                std::lock_guard<std::mutex> lock(mFitMutex);
+                mOutputFit.breakSegment();
+            }
+            int64_t position = 0;
+            int64_t timeNs = 0;
+            if (audioTrack->getTimestamp(position, timeNs) && position > 0 && position != lastPosition) {
+                if (firstPosition < 0) {
+                    firstPosition = position;
+                    firstTimeNs = timeNs;
+                }
+                lastPosition = position;
+                addTimestamp(mOutputFit, position - firstPosition, timeNs - firstTimeNs);
+            }
+        }
+    }
+
+    // Fit the distance from the nominal rate, so the large position itself never enters the sums.
+    // Unpaced stand-in streams have no device clock, their timestamps are skipped.
+    void addTimestamp(SegmentedFit& fit, const int64_t frames, const int64_t elapsedNs) {
+        if (mConfig.backend == BACKEND_SIM_FAST) {
+            return;
+        }
+        const double seconds = elapsedNs / 1e9;
+        std::lock_guard<std::mutex> lock(mFitMutex);
+        fit.add(seconds, static_cast<double>(frames) - seconds * mConfig.sampleRate);
+    }
+
+    int32_t captureLoop(const std::unique_ptr<AudioInputStream>& audioRecord) {
+        const size_t bufferSize = calculateBufferSize();
+        std::vector<char> buffer(bufferSize);
+        const uint64_t maxFrames = mConfig.durationSeconds > 0
+                                       ? static_cast<uint64_t>(mConfig.durationSeconds) * mConfig.sampleRate
+                                       : UINT64_MAX;
+        const uint64_t reportFrames = static_cast<uint64_t>(mConfig.driftIntervalSeconds) * mConfig.sampleRate;
+        mBlockFrames = static_cast<size_t>(mConfig.sampleRate) * kBlockMs / 1000;
+        printf("Measuring clock drift with a %d Hz pilot%s. Press Ctrl+C to stop\n", kPilotHz,
+               mConfig.durationSeconds > 0 ? "" : " until stopped");
+
+        const size_t frameSize = audio_bytes_per_sample(mConfig.format) * mConfig.channelCount;
+        uint64_t nextReport = reportFrames;
+        uint32_t overrunFrames = 0;
+        int64_t firstPosition = -1;
+        int64_t firstTimeNs = 0;
+        int64_t lastPosition = -1;
+        while (mCaptureFrame < maxFrames && !sExitRequested) {
+            const ssize_t bytesRead = audioRecord->read(buffer.data(), bufferSize);
+            if (bytesRead < 0) {
+                sLogger.error("AudioRecord read failed: %zd\n", bytesRead);
+                return -1;
+            }
+            // Lost frames advance the capture position, which keeps the pilot reference in phase
+            const uint32_t overrun = audioRecord->getOverrunFrames();
+            if (overrun != overrunFrames) {
+                mCaptureFrame += overrun - overrunFrames;
+                mBlockFill = 0;
+                overrunFrames = overrun;
+                firstPosition = -1;
+                std::lock_guard<std::mutex> lock(mFitMutex);
+                mInputFit.breakSegment();
+            }
+            dispatchFormat(mConfig.format, [&](auto traits) {
+                correlatePilot<decltype(traits)>(buffer.data(), static_cast<size_t>(bytesRead) / frameSize);
+            });
+
+            int64_t position = 0;
+            int64_t timeNs = 0;
+            if (audioRecord->getTimestamp(position, timeNs) && position > 0 && position != lastPosition) {
+                if (firstPosition < 0) {
+                    firstPosition = position;
+                    firstTimeNs = timeNs;
+                }
+                lastPosition = position;
+                addTimestamp(mInputFit, position - firstPosition, timeNs - firstTimeNs);
+            }
+            if (mCaptureFrame >= nextReport) {
+                reportInterval(static_cast<double>(mCaptureFrame) / mConfig.sampleRate);
+                nextReport += reportFrames;
+            }
+        }
+        mRunStats.overrunFrames = overrunFrames;
+        mRunStats.bytesCaptured = mCaptureFrame * frameSize;
+        return 0;
+    }
+
+    // Correlate channel 0 with the nominal pilot, its reference phase taken from the absolute frame index
+    template <typename T> void correlatePilot(const char* buffer, const size_t frames) {
+        const uint64_t sampleRate = static_cast<uint64_t>(mConfig.sampleRate);
+        const std::complex<double> step = std::polar(1.0, -2.0 * M_PI * kPilotHz / mConfig.sampleRate);
+        for (size_t f = 0; f < frames; ++f) {
+            if (mBlockFill == 0) {
+                mBlockStart = mCaptureFrame;
+                mReference = std::polar(1.0, -2.0 * M_PI * static_cast<double>(mCaptureFrame * kPilotHz % sampleRate) /
+                                                 mConfig.sampleRate);
+                mCorrelation = 0.0;
+            }
+            mCorrelation += static_cast<double>(T::toFloat(T::load(buffer, f * mConfig.channelCount))) * mReference;
+            mReference *= step;
+            ++mCaptureFrame;
+            if (++mBlockFill == mBlockFrames) {
+                finishBlock();
+                mBlockFill = 0;
+            }
+        }
+    }
+
+    void finishBlock() {
+        const double level = 2.0 * std::abs(mCorrelation) / mBlockFrames;
+        mPilotLevel = level;
+        if (level < kMinPilotLevel) {
+            ++mWeakBlocks;
+            return;
+        }
+        // Silence inserted by an underrun delays the pilot from then on: the phase steps, start a new segment
+        const uint32_t underruns = mUnderruns;
+        if (underruns != mPilotUnderruns) {
+            mPilotUnderruns = underruns;
+            mPilotFit.breakSegment();
+            mPilotIntervalFit.reset();
+            mPhaseAnchored = false;
+        }
+        // Unwrap against the previous block; limits the measurable offset to +-5000ppm at 100ms blocks
+        const double phase = std::arg(mCorrelation);
+        if (!mPhaseAnchored) {
+            mUnwrappedPhase = phase;
+            mPhaseAnchored = true;
+        } else {
+            mUnwrappedPhase += std::remainder(phase - mLastPhase, 2.0 * M_PI);
+        }
+        mLastPhase = phase;
+        const double seconds = (mBlockStart + mBlockFrames / 2.0) / mConfig.sampleRate;
+        mPilotFit.add(seconds, mUnwrappedPhase);
+        mPilotIntervalFit.add(seconds, mUnwrappedPhase);
+    }
+
+    // Estimates in ppm with their 95% confidence interval, NaN when there are not enough points yet
+    struct Estimate {
+        double ppm = NAN;
+        double ci95 = NAN;
+    };
+
+    template <typename Fit> static Estimate pilotEstimate(const Fit& fit) {
+        const double scale = 1e6 / (2.0 * M_PI * kPilotHz);
+        return fit.isValid() ? Estimate{fit.getSlope() * scale, kConfidence95 * fit.getSlopeError() * scale}
+                             : Estimate{};
+    }
+
+    Estimate timestampEstimate(const SegmentedFit& fit) const {
+        const double scale = 1e6 / mConfig.sampleRate;
+        return fit.isValid() ? Estimate{fit.getSlope() * scale, kConfidence95 * fit.getSlopeError() * scale}
+                             : Estimate{};
+    }
+
+    // Render rate over capture rate from the two timestamp fits, each against CLOCK_MONOTONIC
+    static Estimate relativeEstimate(const Estimate& input, const Estimate& output) {
+        return Estimate{((1.0 + output.ppm * 1e-6) / (1.0 + input.ppm * 1e-6) - 1.0) * 1e6,
+                        std::hypot(input.ci95, output.ci95)};
+    }
+
+    static std::string formatEstimate(const Estimate& estimate) {
+        return std::isnan(estimate.ppm) ? "n/a"
+                                        : String8::format("%+.3f +-%.3f ppm", estimate.ppm, estimate.ci95).c_str();
+    }
+
+    static std::string formatSegments(const SegmentedFit& fit) {
+        return String8::format("%u segment(s), %u discarded under %.0f s", fit.getSegments(), fit.getDiscarded(),
+                               SegmentedFit::kMinSeconds)
+            .c_str();
+    }
+
+    static std::string jsonNumber(const double value) {
+        return std::isnan(value) ? "null" : String8::format("%.4f", value).c_str();
+    }
+
+    void reportInterval(const double seconds) {
+        Estimate input;
+        Estimate output;
+        {
+            std::lock_guard<std::mutex> lock(mFitMutex);
+            input = timestampEstimate(mInputFit);
+            output = timestampEstimate(mOutputFit);
+        }
+        const Estimate pilot = pilotEstimate(mPilotFit);
+        const Estimate interval = pilotEstimate(mPilotIntervalFit);
+        const Estimate relative = relativeEstimate(input, output);
+        const double levelDb = 20.0 * std::log10(std::max(mPilotLevel, 1e-10));
+        sLogger.print("[%7.0f s] pilot %s (last %s, %.1f dBFS) | timestamps %s\n", seconds,
+                      formatEstimate(pilot).c_str(), std::isnan(interval.ppm) ? "n/a" :
+                      String8::format("%+.3f", interval.ppm).c_str(), levelDb, formatEstimate(relative).c_str());
+        if (mReport.is_open()) {
+            mReport << String8::format("{\"type\":\"drift\",\"seconds\":%.1f,\"pilot_ppm\":%s,\"pilot_ci95\":%s,"
+                                       "\"pilot_interval_ppm\":%s,\"pilot_dbfs\":%.1f,\"timestamp_ppm\":%s,"
+                                       "\"timestamp_ci95\":%s,\"input_ppm\":%s,\"output_ppm\":%s}\n",
+                                       seconds, jsonNumber(pilot.ppm).c_str(), jsonNumber(pilot.ci95).c_str(),
+                                       jsonNumber(interval.ppm).c_str(), levelDb, jsonNumber(relative.ppm).c_str(),
+                                       jsonNumber(relative.ci95).c_str(), jsonNumber(input.ppm).c_str(),
+                                       jsonNumber(output.ppm).c_str())
+                           .c_str();
+            mReport.flush();
+        }
+        mPilotIntervalFit.reset();
+    }
+
+    int32_t printSummary() {
+        const Estimate input = timestampEstimate(mInputFit);
+        const Estimate output = timestampEstimate(mOutputFit);
+        const Estimate pilot = pilotEstimate(mPilotFit);
+        printf("Clock drift after %.1f s (render relative to capture, 95%% confidence):\n",
+               static_cast<double>(mCaptureFrame) / mConfig.sampleRate);
+        printf("  Pilot correlation: %s (%" PRIu64 " blocks, %" PRIu64 " without pilot, %s)\n",
+               formatEstimate(pilot).c_str(), mPilotFit.getCount(), mWeakBlocks, formatSegments(mPilotFit).c_str());
+        printf("  Timestamps:        %s (capture %s, render %s vs CLOCK_MONOTONIC)\n",
+               formatEstimate(relativeEstimate(input, output)).c_str(), formatEstimate(input).c_str(),
+               formatEstimate(output).c_str());
+        printf("                     capture %s, render %s\n", formatSegments(mInputFit).c_str(),
+               formatSegments(mOutputFit).c_str());
+        printf("  Overrun frames: %u, underruns: %u\n", mRunStats.overrunFrames, mRunStats.underrunCount);
+        if (mReport.is_open()) {
+            printf("Drift time series saved: %s\n", mConfig.reportPath.c_str());
+        }
+        if (std::isnan(pilot.ppm) && std::isnan(input.ppm)) {
+            printf("Error: No pilot in the capture and no stream timestamps, nothing to estimate from\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    std::atomic<bool> mStopRender{false};
+    std::mutex mFitMutex;
+    SegmentedFit mInputFit;  // capture timestamps, mFitMutex
+    SegmentedFit mOutputFit; // render timestamps, mFitMutex
+    SegmentedFit mPilotFit;
+    LinearFit mPilotIntervalFit;
+    std::atomic<uint32_t> mUnderruns{0}; // render underruns, read by the capture thread
+    uint32_t mPilotUnderruns = 0;
+    bool mPhaseAnchored = false;
+    std::ofstream mReport;
+    uint64_t mCaptureFrame = 0;
+    uint64_t mBlockStart = 0;
+    size_t mBlockFrames = 0;
+    size_t mBlockFill = 0;
+    std::complex<double> mReference;
+    std::complex<double> mCorrelation;
+    double mUnwrappedPhase = 0.0;
+    double mLastPhase = 0.0;
+    double mPilotLevel = 0.0;
+    uint64_t mWeakBlocks = 0;
+};
+
+/************************** Routing Operation ******************************/
+// Channel routing and crosstalk of multichannel speaker/mic paths in one run. Output channel c plays its own
+// tone, all at once or one channel after the other (--route-stepped); a Goertzel bank measures every tone on
+// every input channel while capturing. The result is the output x input level matrix in dBFS, the input each
+// output reaches loudest and its isolation against the other inputs. Tone c is 1050 + 40*m[c] Hz with m a
+// Golomb ruler: whole cycles per 100ms block, and since no two tone pairs share a distance, no third-order
+// product (2f1-f2, f1+f2-f3) lands on another tone. Tones are 10 Hz above a multiple of 40 Hz while sums,
+// differences and the 2nd-4th harmonics are not, so second-order products miss them as well.
+class RoutingOperation : public AudioOperation {
+public:
+    // Constructor for the routing test, plays and captures with the loopback options
+    explicit RoutingOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~RoutingOperation() override = default;
+
+    // Disable copy operations (inherited from AudioOperation)
+    RoutingOperation(const RoutingOperation&) = delete;
+    RoutingOperation& operator=(const RoutingOperation&) = delete;
+
+    // Tone of every output channel, also used by the Goertzel benchmark
+    static std::vector<double> toneFrequencies(const int32_t channels) {
+        std::vector<double> frequencies;
+        for (int32_t c = 0; c < std::min(channels, GoertzelBank::kMaxChannels); ++c) {
+            frequencies.push_back(kBaseHz + kSpacingHz * kToneMarks[c]);
+        }
+        return frequencies;
+    }
+
+    // Play the tone schedule, measure the capture and print the routing matrix
+    int32_t execute() override {
+        if (!validateAudioParameters() || !planTones()) {
+            return -1;
+        }
+        std::unique_ptr<AudioInputStream> audioRecord = openInputStream();
+        std::unique_ptr<AudioOutputStream> audioTrack = audioRecord ? openOutputStream() : nullptr;
+        if (!audioTrack || !startAudioComponent(audioRecord) || !startAudioComponent(audioTrack)) {
+            closeOutputStream(audioTrack);
+            closeInputStream(audioRecord);
+            return -1;
+        }
+
+        mStopRender = false;
+        std::thread render(&RoutingOperation::renderLoop, this, audioTrack.get());
+        const int32_t result = captureLoop(audioRecord);
+        mStopRender = true;
+        render.join();
+        sLogger.flush();
+
+        stopAudioComponent(audioTrack);
+        stopAudioComponent(audioRecord);
+        closeOutputStream(audioTrack);
+        closeInputStream(audioRecord);
+        return result != 0 ? result : printMatrix();
+    }
+
+private:
+    static constexpr double kBaseHz = 1050.0;
+    static constexpr double kSpacingHz = 40.0;
+    // Optimal 16-mark Golomb ruler, every prefix keeps the distinct distances
+    static constexpr int32_t kToneMarks[] = {0, 1, 4, 11, 26, 32, 56, 68, 76, 115, 117, 134, 150, 163, 168, 177};
+    static_assert(sizeof(kToneMarks) / sizeof(kToneMarks[0]) == GoertzelBank::kMaxChannels, "one tone per channel");
+    static constexpr float kToneAmplitude = 0.25f; // -12dBFS per channel
+    static constexpr int32_t kBlockMs = 100;
+    static constexpr int32_t kMinStepBlocks = 4; // two blocks measured after the latency half
+    static constexpr double kDetectDb = -60.0; // an output quieter than this on every input is not routed
+
+    bool planTones() {
+        const int32_t channels = mConfig.channelCount;
+        if (channels > GoertzelBank::kMaxChannels) {
+            printf("Error: Routing test supports up to %d channels\n", GoertzelBank::kMaxChannels);
+            return false;
+        }
+        mFrequencies = toneFrequencies(channels);
+        if (mFrequencies.back() > 0.45 * mConfig.sampleRate || mConfig.sampleRate % (1000 / kBlockMs) != 0) {
+            printf("Error: %d channels need tones up to %.0f Hz, use a higher sample rate (multiple of 10 Hz)\n",
+                   channels, mFrequencies.back());
+            return false;
+        }
+        if (!mBank.configure(channels, mFrequencies, mConfig.sampleRate,
+                             static_cast<size_t>(mConfig.sampleRate) * kBlockMs / 1000)) {
+            printf("Error: Routing test supports up to %d channels\n", GoertzelBank::kMaxChannels);
+            return false;
+        }
+        mStepFrames = static_cast<uint64_t>(mConfig.sampleRate) * mConfig.routeStepMs / 1000;
+        if (mStepFrames < kMinStepBlocks * mBank.getBlockFrames()) {
+            printf("Error: Routing step too short: %d ms (minimum %d ms)\n", mConfig.routeStepMs,
+                   kMinStepBlocks * kBlockMs);
+            return false;
+        }
+        mSteps = mConfig.routeStepped ? channels : 1;
+        mPower.assign(static_cast<size_t>(channels) * channels, 0.0);
+        mBlocks.assign(channels, 0);
+        printf("Routing test: %d channels, %s, %d ms per step, tones %.0f-%.0f Hz\n", channels,
+               mConfig.routeStepped ? "stepped" : "simultaneous", mConfig.routeStepMs, mFrequencies.front(),
+               mFrequencies.back());
+        return true;
+    }
+
+    // Output channel c sounds during step c (stepped) or every channel during step 0, then silence
+    void renderLoop(AudioOutputStream* audioTrack) {
+        const int32_t channels = mConfig.channelCount;
+        const size_t frameSize = audio_bytes_per_sample(mConfig.format) * channels;
+        const size_t frames = calculateBufferSize() / frameSize;
+        const uint64_t sampleRate = static_cast<uint64_t>(mConfig.sampleRate);
+        std::vector<float> samples(frames * channels);
+        std::vector<char> buffer(frames * frameSize);
+        uint64_t frame = 0;
+        while (!mStopRender && !sExitRequested) {
+            for (size_t f = 0; f < frames; ++f) {
+                const uint64_t position = frame + f;
+                const uint64_t step = position / mStepFrames;
+                for (int32_t c = 0; c < channels; ++c) {
+                    const bool active = mConfig.routeStepped ? step == static_cast<uint64_t>(c) : step == 0;
+                    // Integer tone frequencies, so the phase is exact from the frame index
+                    const uint64_t cycle = position * static_cast<uint64_t>(mFrequencies[c]) % sampleRate;
+                    samples[f * channels + c] =
+                        active ? kToneAmplitude * static_cast<float>(std::sin(2.0 * M_PI * cycle / sampleRate)) : 0.0f;
+                }
+            }
+            AudioUtils::floatToPcm(samples.data(), buffer.data(), samples.size(), mConfig.format);
+            size_t done = 0;
+            while (done < buffer.size() && !mStopRender && !sExitRequested) {
+                const ssize_t written = audioTrack->write(buffer.data() + done, buffer.size() - done, true);
+                if (written < 0) {
+                    sLogger.error("AudioTrack write failed: %zd\n", written);
+                    return;
+                }
+                done += static_cast<size_t>(written);
+            }
+            frame += frames;
+        }
+    }
+
+    // Run the capture through the bank block by block until the last step is measured
+    int32_t captureLoop(const std::unique_ptr<AudioInputStream>& audioRecord) {
+        const int32_t channels = mConfig.channelCount;
+        const size_t frameSize = audio_bytes_per_sample(mConfig.format) * channels;
+        const size_t bufferSize = calculateBufferSize();
+        std::vector<char> buffer(bufferSize);
+        std::vector<float> samples(bufferSize / frameSize * channels);
+        const uint64_t endFrame = mSteps * mStepFrames;
+        const int64_t startNs = AudioUtils::getMonotonicNs();
+        uint32_t overrunFrames = 0;
+        uint64_t capturedFrame = 0;
+        uint64_t blockStart = 0;
+        beginLoopResourceUsage();
+        while (capturedFrame < endFrame && !sExitRequested) {
+            const ssize_t bytesRead = audioRecord->read(buffer.data(), bufferSize);
+            if (bytesRead < 0) {
+                sLogger.error("AudioRecord read failed: %zd\n", bytesRead);
+                endLoopResourceUsage();
+                return -1;
+            }
+            // Lost frames keep the schedule in step; the block they fell into is discarded
+            const uint32_t overrun = audioRecord->getOverrunFrames();
+            if (overrun != overrunFrames) {
+                capturedFrame += overrun - overrunFrames;
+                overrunFrames = overrun;
+                mBank.finishBlock();
+                blockStart = capturedFrame;
+            }
+            const size_t frames = static_cast<size_t>(bytesRead) / frameSize;
+            AudioUtils::pcmToFloat(buffer.data(), samples.data(), frames * channels, mConfig.format);
+            for (size_t done = 0; done < frames;) {
+                const size_t n = mBank.process(samples.data() + done * channels, frames - done);
+                done += n;
+                capturedFrame += n;
+                if (mBank.isBlockComplete()) {
+                    accumulateBlock(blockStart, mBank.finishBlock());
+                    blockStart = capturedFrame;
+                }
+            }
+            ++mRunStats.readCalls;
+        }
+        endLoopResourceUsage();
+        mRunStats.overrunFrames = overrunFrames;
+        mRunStats.bytesCaptured = capturedFrame * frameSize;
+        mRunStats.loopTimeNs = AudioUtils::getMonotonicNs() - startNs;
+        reportResourceUsage(MODE_ROUTING);
+        return 0;
+    }
+
+    // Blocks in the second half of a step count, the first half absorbs the round-trip latency
+    void accumulateBlock(const uint64_t blockStart, const std::vector<float>& amplitudes) {
+        const uint64_t step = blockStart / mStepFrames;
+        const uint64_t blockEnd = blockStart + mBank.getBlockFrames();
+        if (step >= mSteps || blockStart < step * mStepFrames + mStepFrames / 2 ||
+            blockEnd > (step + 1) * mStepFrames) {
+            return;
+        }
+        const int32_t channels = mConfig.channelCount;
+        for (int32_t out = 0; out < channels; ++out) {
+            if (mConfig.routeStepped && static_cast<uint64_t>(out) != step) {
+                continue;
+            }
+            for (int32_t in = 0; in < channels; ++in) {
+                const double amplitude = amplitudes[in * mBank.getToneCount() + out];
+                mPower[out * channels + in] += amplitude * amplitude;
+            }
+            ++mBlocks[out];
+        }
+    }
+
+    double levelDb(const int32_t out, const int32_t in) const {
+        const double power = mBlocks[out] > 0 ? mPower[out * mConfig.channelCount + in] / mBlocks[out] : 0.0;
+        return 10.0 * std::log10(std::max(power, 1e-14)); // floor -140dBFS
+    }
+
+    int32_t printMatrix() {
+        const int32_t channels = mConfig.channelCount;
+        std::ofstream report;
+        if (!mConfig.reportPath.empty()) {
+            if (!openReportFile(report)) {
+                printf("Error: Can't create report file: %s\n", mConfig.reportPath.c_str());
+                return -1;
+            }
+        }
+        printf("Routing matrix (dBFS, rows: output channel/tone, columns: input channel):\n%-14s", "");
+        for (int32_t in = 0; in < channels; ++in) {
+            printf(" %6s", String8::format("in%d", in).c_str());
+        }
+        printf("\n");
+        for (int32_t out = 0; out < channels; ++out) {
+            printf("out%-2d %6.0f Hz", out, mFrequencies[out]);
+            for (int32_t in = 0; in < channels; ++in) {
+                printf(" %6.1f", levelDb(out, in));
+            }
+            printf("\n");
+        }
+
+        int32_t failures = 0;
+        printf("Routes:\n");
+        for (int32_t out = 0; out < channels; ++out) {
+            int32_t loudest = 0;
+            for (int32_t in = 1; in < channels; ++in) {
+                loudest = levelDb(out, in) > levelDb(out, loudest) ? in : loudest;
+            }
+            double nextDb = -140.0;
+            for (int32_t in = 0; in < channels; ++in) {
+                nextDb = in != loudest ? std::max(nextDb, levelDb(out, in)) : nextDb;
+            }
+            const double mainDb = levelDb(out, loudest);
+            const double isolationDb = mainDb - nextDb;
+            const bool detected = mBlocks[out] > 0 && mainDb >= kDetectDb;
+            const bool isolated = mConfig.routeIsolationDb <= 0.0 || channels == 1 ||
+                                  isolationDb >= mConfig.routeIsolationDb;
+            if (!detected || !isolated) {
+                ++failures;
+            }
+            if (detected) {
+                printf("  out%d -> in%d  %6.1f dBFS, isolation %5.1f dB%s\n", out, loudest, mainDb, isolationDb,
+                       isolated ? "" : "  FAIL");
+            } else {
+                printf("  out%d -> not detected (loudest %.1f dBFS)  FAIL\n", out, mainDb);
+            }
+            if (report.is_open()) {
+                report << String8::format("{\"type\":\"route\",\"output\":%d,\"frequency\":%.0f,\"input\":%d,"
+                                          "\"level_dbfs\":%.2f,\"isolation_db\":%.2f,\"detected\":%s,\"levels_dbfs\":[",
+                                          out, mFrequencies[out], detected ? loudest : -1, mainDb, isolationDb,
+                                          detected ? "true" : "false")
+                              .c_str();
+                for (int32_t in = 0; in < channels; ++in) {
+                    report << String8::format("%s%.2f", in > 0 ? "," : "", levelDb(out, in)).c_str();
+                }
+                report << "]}\n";
+            }
+        }
+        if (report.is_open()) {
+            printf("Routing report saved: %s\n", mConfig.reportPath.c_str());
+        }
+        printf("Routing test %s: %d of %d output channels failed\n", failures == 0 ? "passed" : "FAILED", failures,
+               channels);
+        return failures == 0 ? 0 : 1;
+    }
+
+    GoertzelBank mBank;
+    std::vector<double> mFrequencies;
+    uint64_t mStepFrames = 0;
+    uint64_t mSteps = 0;
+    std::vector<double> mPower;    // output * channels + input, summed squared amplitudes
+    std::vector<uint64_t> mBlocks; // measured blocks per output
+    std::atomic<bool> mStopRender{false};
+};
+
+/************************** Set Parameters Operation ******************************/
+#ifndef AUDIO_TEST_CLIENT_HOST
+class SetParamsOperation : public AudioOperation {
+public:
+    // Constructor for parameter setting operation
+    explicit SetParamsOperation(const AudioConfig& config, const std::vector<int32_t>& params)
+        : AudioOperation(config), mTargetParameters(params) {}
+    ~SetParamsOperation() override = default;
+
+    // Disable copy operations (inherited from AudioOperation)
+    SetParamsOperation(const SetParamsOperation&) = delete;
+    SetParamsOperation& operator=(const SetParamsOperation&) = delete;
+
+    // Execute parameter setting operation
+    int32_t execute() override {
+        if (!mConfig.paramList.empty() || !mConfig.paramFilePath.empty()) {
+            return runParameterBatch();
+        }
+        if (mTargetParameters.empty()) {
+            printf("Error: No parameters provided\n");
+            return -1;
+        }
+
+        printf("SetParams operation started with %zu parameters\n", mTargetParameters.size());
+        for (size_t i = 0; i < mTargetParameters.size(); ++i) {
+            printf("  Parameter %zu: %d\n", i + 1, mTargetParameters[i]);
+        }
+
+        int32_t sourceType = mTargetParameters[0];
+        switch (sourceType) {
+        case 1: // open_source
+            if (mTargetParameters.size() >= 2) {
+                int32_t usageValue = mTargetParameters[1];
+                audio_usage_t usage = static_cast<audio_usage_t>(usageValue);
+                printf("Setting open_source with usage: %d\n", usage);
+                mAudioParamManager.setOpenSourceWithUsage(usage);
+            } else {
+                printf("Error: Audio usage parameter is required for open_source\n");
+            }
+            break;
+        case 2: // close_source
+            if (mTargetParameters.size() >= 2) {
+                int32_t usageValue = mTargetParameters[1];
+                audio_usage_t usage = static_cast<audio_usage_t>(usageValue);
+                printf("Setting close_source with usage: %d\n", usage);
+                mAudioParamManager.setCloseSourceWithUsage(usage);
+            } else {
+                printf("Error: Audio usage parameter is required for close_source\n");
+            }
+            break;
+        default:
+            printf("Error: Unknown primary parameter %d (1=open_source, 2=close_source)\n", sourceType);
+            return -1;
+        }
+
+        printf("SetParams operation completed\n");
+        return 0;
+    }
+
+private:
+    // One key/value operation; a barrier ends the current call before the next operation
+    struct ParamOperation {
+        std::string key;
+        std::string value;
+        bool barrier = false;
+        bool source = false; // open_source/close_source, always sent alone
+    };
+
+    // One setParameters round trip of a cycle, and the operations it carries
+    struct ParamCall {
+        String8 keyValuePairs;
+        std::vector<size_t> operations; // indices into mOperations
+    };
+
+    struct ParamKeyStats {
+        std::string key;
+        std::vector<int64_t> coldNs; // round trips of the first cycle, in call order
+        std::vector<int64_t> warmNs; // round trips of the later cycles
+        uint32_t failures = 0;
+        size_t sharedWith = 0;       // largest number of keys in the same call
+    };
+
+    // Send the --params/--params-file operations in coalesced calls, --params-cycles times, timing every call
+    int32_t runParameterBatch() {
+        if (!loadParamOperations()) {
+            return -1;
+        }
+        const std::vector<ParamCall> calls = coalesceParamCalls();
+        const int32_t cycles = std::max(mConfig.paramCycles, 1);
+        printf("SetParams batch: %zu operations in %zu calls per cycle, %d cycles\n", mOperations.size(),
+               calls.size(), cycles);
+        if (!AudioParameterManager::isEnabled()) {
+            printf("Note: Built with ENABLE_SET_PARAMS 0, parameters are not sent and only the client side is timed\n");
+        }
+
+        std::vector<ParamKeyStats> keyStats;
+        std::unordered_map<std::string, size_t> keyIndex;
+        for (const ParamOperation& op : mOperations) {
+            if (keyIndex.emplace(op.key, keyStats.size()).second) {
+                keyStats.push_back(ParamKeyStats());
+                keyStats.back().key = op.key;
+            }
+        }
+
+        uint32_t failedCalls = 0;
+        int64_t totalNs = 0;
+        for (int32_t cycle = 0; cycle < cycles && !sExitRequested; ++cycle) {
+            for (const ParamCall& call : calls) {
+                const int64_t startNs = AudioUtils::getMonotonicNs();
+                const status_t status = mAudioParamManager.setSystemParameters(call.keyValuePairs);
+                const int64_t roundTripNs = AudioUtils::getMonotonicNs() - startNs;
+                totalNs += roundTripNs;
+                if (status != NO_ERROR) {
+                    ++failedCalls;
+                }
+                // Every key of a coalesced call is charged the whole round trip
+                for (const size_t i : call.operations) {
+                    ParamKeyStats& stats = keyStats[keyIndex[mOperations[i].key]];
+                    (cycle == 0 ? stats.coldNs : stats.warmNs).push_back(roundTripNs);
+                    stats.failures += status != NO_ERROR ? 1 : 0;
+                    stats.sharedWith = std::max(stats.sharedWith, call.operations.size());
+                }
+                if (cycle == 0 || status != NO_ERROR) {
+                    sLogger.print("  [%d] %8.3f ms%s  %s\n", cycle + 1, roundTripNs / 1e6,
+                                  status != NO_ERROR ? String8::format("  status %d", status).c_str() : "",
+                                  call.keyValuePairs.c_str());
+                }
+            }
+        }
+
+        sLogger.flush();
+        const size_t callCount = std::max<size_t>(calls.size() * cycles, 1);
+        printf("SetParams batch finished: %zu calls, %.3f ms total, %.3f ms per call, %u failed\n",
+               calls.size() * cycles, totalNs / 1e6, totalNs / 1e6 / callCount, failedCalls);
+        printParamKeyStats(keyStats);
+        if (!writeParamReport(keyStats)) {
+            return -1;
+        }
+        return failedCalls == 0 ? 0 : 1;
+    }
+
+    // --params splits on ';', --params-file has one or more pairs per line and '#' comments. An empty segment or
+    // a blank line is a barrier. open_source/close_source accept an audio_usage_t number.
+    bool loadParamOperations() {
+        mOperations.clear();
+        bool barrier = false;
+        const auto addPairs = [this, &barrier](const std::string& text, const std::string& origin) {
+            std::istringstream pairs(text);
+            std::string pair;
+            while (std::getline(pairs, pair, ';')) {
+                pair.erase(0, pair.find_first_not_of(" \t\r"));
+                pair.erase(pair.find_last_not_of(" \t\r") + 1);
+                if (pair.empty()) {
+                    barrier = true;
+                    continue;
+                }
+                const size_t equals = pair.find('=');
+                if (equals == 0 || equals == std::string::npos) {
+                    printf("Error: %s: expected key=value: %s\n", origin.c_str(), pair.c_str());
+                    return false;
+                }
+                ParamOperation op;
+                op.key = pair.substr(0, equals);
+                op.value = pair.substr(equals + 1);
+                op.source = op.key == PARAM_OPEN_SOURCE.c_str() || op.key == PARAM_CLOSE_SOURCE.c_str();
+                if (op.source && !op.value.empty() && op.value.find_first_not_of("0123456789") == std::string::npos) {
+                    op.value = mAudioParamManager.getUsageValue(static_cast<audio_usage_t>(atoi(op.value.c_str())))
+                                   .c_str();
+                }
+                op.barrier = barrier && !mOperations.empty();
+                barrier = false;
+                mOperations.push_back(op);
+            }
+            return true;
+        };
+
+        if (!mConfig.paramFilePath.empty()) {
+            std::ifstream file(mConfig.paramFilePath);
+            if (!file.is_open()) {
+                printf("Error: Can't open parameter file: %s\n", mConfig.paramFilePath.c_str());
+                return false;
+            }
+            std::string line;
+            int32_t lineNumber = 0;
+            while (std::getline(file, line)) {
+                ++lineNumber;
+                const std::string text = line.substr(0, line.find('#'));
+                if (text.find_first_not_of(" \t\r") == std::string::npos) {
+                    barrier = barrier || line.find('#') == std::string::npos; // comment lines don't separate
+                    continue;
+                }
+                if (!addPairs(text, String8::format("%s:%d", mConfig.paramFilePath.c_str(), lineNumber).c_str())) {
+                    return false;
+                }
+            }
+        }
+        if (!mConfig.paramList.empty() && !addPairs(mConfig.paramList, "--params")) {
+            return false;
+        }
+        if (mOperations.empty()) {
+            printf("Error: No parameters provided\n");
+            return false;
+        }
+        return true;
+    }
+
+    // Consecutive operations share a call until a key repeats (AudioParameter keeps one value per key), a barrier
+    // or the --params-batch limit. AudioParameter sorts its keys, so open_source/close_source get calls of their
+    // own: sharing one would send "close_source" before "open_source" whatever the given order.
+    std::vector<ParamCall> coalesceParamCalls() const {
+        std::vector<ParamCall> calls;
+        AudioParameter parameter;
+        std::vector<size_t> operations;
+        const auto flush = [&]() {
+            if (!operations.empty()) {
+                calls.push_back({parameter.toString(), operations});
+                parameter = AudioParameter();
+                operations.clear();
+            }
+        };
+        for (size_t i = 0; i < mOperations.size(); ++i) {
+            const ParamOperation& op = mOperations[i];
+            const bool repeated = std::any_of(operations.begin(), operations.end(),
+                                              [&](const size_t j) { return mOperations[j].key == op.key; });
+            const bool full =
+                mConfig.paramBatchSize > 0 && operations.size() >= static_cast<size_t>(mConfig.paramBatchSize);
+            if (op.barrier || repeated || full || op.source) {
+                flush();
+            }
+            parameter.add(String8(op.key.c_str()), String8(op.value.c_str()));
+            operations.push_back(i);
+            if (op.source) {
+                flush();
+            }
+        }
+        flush();
+        return calls;
+    }
+
+    static void printParamKeyStats(std::vector<ParamKeyStats>& keyStats) {
+        printf("Per-key round trip (ms, a coalesced call is charged to each of its keys):\n");
+        printf("  %-32s %6s %9s %9s %9s %9s %9s %7s\n", "key", "keys", "cold", "cold max", "warm min", "warm med",
+               "warm max", "failed");
+        auto toMs = [](const int64_t ns) { return ns >= 0 ? String8::format("%.3f", ns / 1e6) : String8("-"); };
+        for (ParamKeyStats& stats : keyStats) {
+            std::sort(stats.warmNs.begin(), stats.warmNs.end());
+            const bool hasWarm = !stats.warmNs.empty();
+            const bool hasCold = !stats.coldNs.empty();
+            printf("  %-32s %6zu %9s %9s %9s %9s %9s %7u\n", stats.key.c_str(), stats.sharedWith,
+                   toMs(hasCold ? stats.coldNs.front() : -1).c_str(),
+                   toMs(hasCold ? *std::max_element(stats.coldNs.begin(), stats.coldNs.end()) : -1).c_str(),
+                   toMs(hasWarm ? stats.warmNs.front() : -1).c_str(),
+                   toMs(hasWarm ? stats.warmNs[stats.warmNs.size() / 2] : -1).c_str(),
+                   toMs(hasWarm ? stats.warmNs.back() : -1).c_str(), stats.failures);
+        }
+    }
+
+    // One JSON line per key, -1 marks missing warm values
+    bool writeParamReport(const std::vector<ParamKeyStats>& keyStats) const {
+        if (mConfig.reportPath.empty()) {
+            return true;
+        }
+        std::ofstream report;
+        if (!openReportFile(report)) {
+            printf("Error: Can't create report file: %s\n", mConfig.reportPath.c_str());
+            return false;
+        }
+        auto toMs = [](const int64_t ns) { return ns >= 0 ? ns / 1e6 : -1.0; };
+        for (const ParamKeyStats& stats : keyStats) {
+            const bool hasWarm = !stats.warmNs.empty();
+            const bool hasCold = !stats.coldNs.empty();
+            report << String8::format("{\"version\":\"%s\",\"type\":\"set_params\",\"key\":\"%s\","
+                                      "\"keys_per_call\":%zu,\"cold_count\":%zu,\"cold_ms\":%.3f,"
+                                      "\"cold_max_ms\":%.3f,\"warm_count\":%zu,"
+                                      "\"warm_min_ms\":%.3f,\"warm_median_ms\":%.3f,\"warm_max_ms\":%.3f,"
+                                      "\"failures\":%u}\n",
+                                      AUDIO_TEST_CLIENT_VERSION, escapeJson(stats.key).c_str(), stats.sharedWith,
+                                      stats.coldNs.size(), toMs(hasCold ? stats.coldNs.front() : -1),
+                                      toMs(hasCold ? *std::max_element(stats.coldNs.begin(), stats.coldNs.end())
+                                                   : -1),
+                                      stats.warmNs.size(),
+                                      toMs(hasWarm ? stats.warmNs.front() : -1),
+                                      toMs(hasWarm ? stats.warmNs[stats.warmNs.size() / 2] : -1),
+                                      toMs(hasWarm ? stats.warmNs.back() : -1), stats.failures)
+                          .c_str();
+        }
+        report.flush();
+        if (!report.good()) {
+            printf("Error: Failed to write report file: %s\n", mConfig.reportPath.c_str());
+            return false;
+        }
+        printf("SetParams report saved: %s\n", mConfig.reportPath.c_str());
+        return true;
+    }
+
+    // Keys come from the command line or a file: quote '"', '\' and control characters for the JSON string
+    static std::string escapeJson(const std::string& text) {
+        std::string escaped;
+        for (const char c : text) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+                escaped += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                escaped += String8::format("\\u%04x", static_cast<unsigned char>(c)).c_str();
+            } else {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    std::vector<int32_t> mTargetParameters;
+    std::vector<ParamOperation> mOperations;
+};
+#endif // AUDIO_TEST_CLIENT_HOST
+
+/************************** Benchmark Operation ******************************/
+class BenchmarkOperation : public AudioOperation {
+public:
+    // Constructor for microbenchmark operation (no audio device is opened)
+    explicit BenchmarkOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~BenchmarkOperation() override = default;
+
+    // Disable copy operations (inherited from AudioOperation)
+    BenchmarkOperation(const BenchmarkOperation&) = delete;
+    BenchmarkOperation& operator=(const BenchmarkOperation&) = delete;
+
+    // Execute benchmark suite, write report and compare with baseline if requested
+    int32_t execute() override {
+        if (mConfig.benchRepetitions <= 0) {
+            printf("Error: Invalid benchmark repetitions: %d\n", mConfig.benchRepetitions);
+            return -1;
+        }
+
+        printf("Benchmark started: repetitions=%d, scratch file=%s\n", mConfig.benchRepetitions,
+               getScratchFilePath().c_str());
+        std::vector<BenchmarkResult> results;
+        const bool wavOk = runWavFileBenchmarks(results);
+        if (wavOk) {
+            runLevelMeterBenchmarks(results);
+            runConversionBenchmarks(results);
+            runGoertzelBenchmarks(results);
+        }
+        sLogger.flush();
+        if (!wavOk) {
+            return -1;
+        }
+
+        printResults(results);
+        if (!mConfig.reportPath.empty() && !writeReport(results)) {
+            return -1;
+        }
+        if (!mConfig.benchBaselinePath.empty()) {
+            return compareWithBaseline(results);
+        }
+        return 0;
+    }
+
+private:
+    static constexpr size_t kWavBytesPerRep = 8u * 1024u * 1024u;         // bytes written/read per WAV repetition
+    static constexpr size_t kLevelMeterFramesPerRep = 2u * 1024u * 1024u; // frames metered per repetition
+    static constexpr size_t kLevelMeterBufferFrames = 960;                // 20ms at 48kHz, typical read size
+    static constexpr size_t kGoertzelFramesPerRep = 256u * 1024u;         // one tone per channel: channels^2 work
+    static constexpr uint32_t kBenchSeed = 0x12345678u;                   // fixed seed for reproducible data
+
+    struct BenchmarkResult {
+        std::string id;         // stable case identifier used for baseline comparison
+        size_t bufferBytes;     // bytes per call
+        size_t bytesPerFrame;   // frame size of the data
+        uint64_t bytesPerRep;   // bytes processed per repetition
+        int64_t medianNs;       // median repetition time
+        int64_t minNs;          // fastest repetition time
+        double framesPerSec;    // throughput derived from median time
+        double bytesPerSec;     // throughput derived from median time
+        double bestBytesPerSec; // throughput derived from fastest time, used for baseline comparison
+    };
+
+    float mSink = 0.0f; // keeps computed results observable so kernels are not optimized away
+
+    // Scratch WAV file used by I/O benchmarks (-P overrides the default location)
+    std::string getScratchFilePath() const {
+        return mConfig.recordFilePath.empty() ? std::string("/data/local/tmp/audio_test_bench.wav")
+                                              : mConfig.recordFilePath;
+    }
+
+    // Deterministic xorshift32 generator, independent of libc rand() implementation
+    static uint32_t nextRandom(uint32_t& state) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // Fill buffer with reproducible full-scale noise in the given format
+    static void fillTestSignal(char* buffer, const size_t numSamples, const audio_format_t format, uint32_t seed) {
+        dispatchFormat(format, [&](auto traits) {
+            for (size_t i = 0; i < numSamples; ++i) {
+                decltype(traits)::storeCode(buffer, i, nextRandom(seed)); // full 32-bit range
+            }
+        });
+    }
+
+    // Compiler barrier: buffer contents may have changed, so kernels can't be hoisted out of timing loops
+    static void clobberMemory() { asm volatile("" : : : "memory"); }
+
+    // Short format name used in case identifiers
+    static const char* formatName(const audio_format_t format) {
+        const char* name = "unknown";
+        dispatchFormat(format, [&](auto traits) { name = decltype(traits)::kName; });
+        return name;
+    }
+
+    // Run one case: runOnce() performs a repetition and returns its timed duration in ns (< 0 on failure)
+    template <typename Fn>
+    bool runCase(std::vector<BenchmarkResult>& results,
+                 const std::string& id,
+                 const size_t bufferBytes,
+                 const size_t bytesPerFrame,
+                 const uint64_t bytesPerRep,
+                 Fn&& runOnce) {
+        // One untimed warm-up repetition to fault in pages and caches
+        if (runOnce() < 0) {
+            sLogger.error("Benchmark case %s failed\n", id.c_str());
+            return false;
+        }
+
+        std::vector<int64_t> samples;
+        samples.reserve(mConfig.benchRepetitions);
+        for (int32_t rep = 0; rep < mConfig.benchRepetitions && !sExitRequested; ++rep) {
+            const int64_t elapsedNs = runOnce();
+            if (elapsedNs < 0) {
+                sLogger.error("Benchmark case %s failed\n", id.c_str());
+                return false;
+            }
+            samples.push_back(std::max<int64_t>(elapsedNs, 1));
+        }
+        if (samples.empty()) {
+            return false;
+        }
+
+        // Median is robust against scheduler noise, which keeps regression thresholds meaningful
+        std::sort(samples.begin(), samples.end());
+        BenchmarkResult result{};
+        result.id = id;
+        result.bufferBytes = bufferBytes;
+        result.bytesPerFrame = bytesPerFrame;
+        result.bytesPerRep = bytesPerRep;
+        result.medianNs = samples[samples.size() / 2];
+        result.minNs = samples.front();
+        result.bytesPerSec = static_cast<double>(bytesPerRep) * 1e9 / static_cast<double>(result.medianNs);
+        result.framesPerSec = result.bytesPerSec / static_cast<double>(bytesPerFrame);
+        result.bestBytesPerSec = static_cast<double>(bytesPerRep) * 1e9 / static_cast<double>(result.minNs);
+        results.push_back(result);
+        return true;
+    }
+
+    // Measure WAVFile::writeData and WAVFile::readData throughput across buffer sizes
+    bool runWavFileBenchmarks(std::vector<BenchmarkResult>& results) {
+        static const size_t kBufferSizes[] = {256, 1024, 4096, 16384, 65536, 262144};
+        constexpr uint32_t kSampleRate = 48000;
+        constexpr uint32_t kChannels = 2;
+        constexpr uint32_t kBitsPerSample = 16;
+        constexpr size_t kBytesPerFrame = kChannels * kBitsPerSample / 8;
+
+        const std::string scratchPath = getScratchFilePath();
+        BufferManager bufferManager(kBufferSizes[sizeof(kBufferSizes) / sizeof(kBufferSizes[0]) - 1]);
+        if (!bufferManager.isValid()) {
+            printf("Error: Failed to create valid buffer manager\n");
+            return false;
+        }
+        char* const buffer = bufferManager.get();
+        fillTestSignal(buffer, bufferManager.getSize() / sizeof(int16_t), AUDIO_FORMAT_PCM_16_BIT, kBenchSeed);
+
+        for (const size_t bufferBytes : kBufferSizes) {
+            const size_t writesPerRep = kWavBytesPerRep / bufferBytes;
+            const uint64_t bytesPerRep = static_cast<uint64_t>(writesPerRep) * bufferBytes;
+            char id[64];
+
+            snprintf(id, sizeof(id), "wav_write/%zu", bufferBytes);
+            const bool writeOk = runCase(results, id, bufferBytes, kBytesPerFrame, bytesPerRep, [&]() -> int64_t {
+                WAVFile wavFile;
+                if (!wavFile.createForWriting(scratchPath, kSampleRate, kChannels, kBitsPerSample)) {
+                    sLogger.error("Can't create scratch file: %s\n", scratchPath.c_str());
+                    return -1;
+                }
+                const int64_t startNs = AudioUtils::getMonotonicNs();
+                for (size_t i = 0; i < writesPerRep; ++i) {
+                    if (wavFile.writeData(buffer, bufferBytes) != bufferBytes) {
+                        return -1;
+                    }
+                }
+                wavFile.finalize();
+                return AudioUtils::getMonotonicNs() - startNs;
+            });
+            if (!writeOk) {
+                unlink(scratchPath.c_str());
+                return false;
+            }
+
+            // Read back the file produced by the last write repetition
+            snprintf(id, sizeof(id), "wav_read/%zu", bufferBytes);
+            const bool readOk = runCase(results, id, bufferBytes, kBytesPerFrame, bytesPerRep, [&]() -> int64_t {
+                WAVFile wavFile;
+                if (!wavFile.openForReading(scratchPath)) {
+                    sLogger.error("Can't open scratch file: %s\n", scratchPath.c_str());
+                    return -1;
+                }
+                uint64_t totalRead = 0;
+                const int64_t startNs = AudioUtils::getMonotonicNs();
+                size_t bytesRead = 0;
+                while ((bytesRead = wavFile.readData(buffer, bufferBytes)) > 0) {
+                    totalRead += bytesRead;
+                }
+                const int64_t elapsedNs = AudioUtils::getMonotonicNs() - startNs;
+                return totalRead == bytesPerRep ? elapsedNs : -1;
+            });
+            if (!readOk) {
+                unlink(scratchPath.c_str());
+                return false;
+            }
+        }
 
-        printf("AudioTrack initialized successfully\n");
+        unlink(scratchPath.c_str());
         return true;
     }
 
-    // Start audio component (AudioRecord or AudioTrack) with parameter setup
-    template <typename T> bool startAudioComponent(const sp<T>& component) {
-        // set params before AudioTrack.start()
-        if constexpr (std::is_same_v<T, AudioTrack>) {
-            mAudioParamManager.setOpenSourceWithUsage(mConfig.usage);
+    // Measure level meter kernel for every supported PCM format and 1-16 channels
+    void runLevelMeterBenchmarks(std::vector<BenchmarkResult>& results) {
+        static const audio_format_t kFormats[] = {AUDIO_FORMAT_PCM_8_BIT,          AUDIO_FORMAT_PCM_16_BIT,
+                                                  AUDIO_FORMAT_PCM_24_BIT_PACKED,  AUDIO_FORMAT_PCM_8_24_BIT,
+                                                  AUDIO_FORMAT_PCM_32_BIT,         AUDIO_FORMAT_PCM_FLOAT};
+        constexpr int32_t kMaxChannels = 16;
+
+        for (const audio_format_t format : kFormats) {
+            const size_t bytesPerSample = audio_bytes_per_sample(format);
+            for (int32_t channels = 1; channels <= kMaxChannels && !sExitRequested; ++channels) {
+                const size_t bytesPerFrame = bytesPerSample * channels;
+                const size_t bufferBytes = kLevelMeterBufferFrames * bytesPerFrame;
+                const size_t callsPerRep = kLevelMeterFramesPerRep / kLevelMeterBufferFrames;
+                std::vector<char> buffer(bufferBytes);
+                fillTestSignal(buffer.data(), kLevelMeterBufferFrames * channels, format, kBenchSeed + channels);
+
+                char id[64];
+                snprintf(id, sizeof(id), "level_meter/%s/%dch", formatName(format), channels);
+                runCase(results, id, bufferBytes, bytesPerFrame, static_cast<uint64_t>(callsPerRep) * bufferBytes,
+                        [&]() -> int64_t {
+                            float peak = 0.0f;
+                            const int64_t startNs = AudioUtils::getMonotonicNs();
+                            for (size_t i = 0; i < callsPerRep; ++i) {
+                                clobberMemory();
+                                peak = std::max(peak, AudioUtils::computePeakAmplitude(buffer.data(), bufferBytes,
+                                                                                       format));
+                            }
+                            const int64_t elapsedNs = AudioUtils::getMonotonicNs() - startNs;
+                            mSink += peak;
+                            return elapsedNs;
+                        });
+            }
         }
+    }
 
-        printf("Starting audio component\n");
-        ALOGI("Starting audio component");
-        status_t startResult = component->start();
-        if (startResult != NO_ERROR) {
-            const char* componentName = std::is_same_v<T, AudioRecord> ? "AudioRecord" : "AudioTrack";
-            printf("Error: %s start failed with status %d\n", componentName, startResult);
-            ALOGE("%s start failed with status %d", componentName, startResult);
-            return false;
+    // Measure both conversion directions per PCM format: float to PCM (stand-in backends, DSP output) and PCM
+    // to float (DSP input, -m205 conversion)
+    void runConversionBenchmarks(std::vector<BenchmarkResult>& results) {
+        static const audio_format_t kFormats[] = {AUDIO_FORMAT_PCM_8_BIT,          AUDIO_FORMAT_PCM_16_BIT,
+                                                  AUDIO_FORMAT_PCM_24_BIT_PACKED,  AUDIO_FORMAT_PCM_8_24_BIT,
+                                                  AUDIO_FORMAT_PCM_32_BIT,         AUDIO_FORMAT_PCM_FLOAT};
+        constexpr int32_t kChannels = 2;
+        const size_t numSamples = kLevelMeterBufferFrames * kChannels;
+        const size_t callsPerRep = kLevelMeterFramesPerRep / kLevelMeterBufferFrames;
+
+        std::vector<float> source(numSamples);
+        fillTestSignal(reinterpret_cast<char*>(source.data()), numSamples, AUDIO_FORMAT_PCM_FLOAT, kBenchSeed);
+        for (const audio_format_t format : kFormats) {
+            if (sExitRequested) {
+                break;
+            }
+            // Throughput is counted in output bytes, so frames/s is comparable across formats
+            const size_t bytesPerFrame = audio_bytes_per_sample(format) * kChannels;
+            std::vector<char> output(kLevelMeterBufferFrames * bytesPerFrame);
+
+            char id[64];
+            snprintf(id, sizeof(id), "float_to_pcm/%s/%dch", formatName(format), kChannels);
+            runCase(results, id, output.size(), bytesPerFrame, static_cast<uint64_t>(callsPerRep) * output.size(),
+                    [&]() -> int64_t {
+                        const int64_t startNs = AudioUtils::getMonotonicNs();
+                        for (size_t i = 0; i < callsPerRep; ++i) {
+                            clobberMemory();
+                            AudioUtils::floatToPcm(source.data(), output.data(), numSamples, format);
+                        }
+                        const int64_t elapsedNs = AudioUtils::getMonotonicNs() - startNs;
+                        mSink += static_cast<float>(output[0]);
+                        return elapsedNs;
+                    });
+        }
+        std::vector<float> converted(numSamples);
+        for (const audio_format_t format : kFormats) {
+            if (sExitRequested) {
+                break;
+            }
+            // Counted in input bytes, the PCM side as above
+            const size_t bytesPerFrame = audio_bytes_per_sample(format) * kChannels;
+            std::vector<char> input(kLevelMeterBufferFrames * bytesPerFrame);
+            fillTestSignal(input.data(), numSamples, format, kBenchSeed);
+
+            char id[64];
+            snprintf(id, sizeof(id), "pcm_to_float/%s/%dch", formatName(format), kChannels);
+            runCase(results, id, input.size(), bytesPerFrame, static_cast<uint64_t>(callsPerRep) * input.size(),
+                    [&]() -> int64_t {
+                        const int64_t startNs = AudioUtils::getMonotonicNs();
+                        for (size_t i = 0; i < callsPerRep; ++i) {
+                            clobberMemory();
+                            AudioUtils::pcmToFloat(input.data(), converted.data(), numSamples, format);
+                        }
+                        const int64_t elapsedNs = AudioUtils::getMonotonicNs() - startNs;
+                        mSink += converted[0];
+                        return elapsedNs;
+                    });
         }
-        return true;
     }
 
-    // Stop audio component and clean up parameters
-    template <typename T> void stopAudioComponent(const sp<T>& audioComponent) {
-        if (audioComponent != nullptr) {
-            printf("Stopping audio component\n");
-            ALOGI("Stopping audio component");
-            audioComponent->stop();
-            if constexpr (std::is_same_v<T, AudioTrack>) {
-                mAudioParamManager.setCloseSourceWithUsage(mConfig.usage);
+    // Measure the routing test's Goertzel bank, one tone per channel as in -m10, fed read-sized buffers
+    void runGoertzelBenchmarks(std::vector<BenchmarkResult>& results) {
+        static const int32_t kChannelCounts[] = {2, 8, 16};
+        constexpr int32_t kSampleRate = 48000;
+
+        for (const int32_t channels : kChannelCounts) {
+            if (sExitRequested) {
+                break;
             }
+            const std::vector<double> frequencies = RoutingOperation::toneFrequencies(channels);
+            GoertzelBank bank;
+            bank.configure(channels, frequencies, kSampleRate, kSampleRate / 10);
+            const size_t numSamples = kLevelMeterBufferFrames * channels;
+            const size_t callsPerRep = kGoertzelFramesPerRep / kLevelMeterBufferFrames;
+            const size_t bytesPerFrame = sizeof(float) * channels;
+            std::vector<float> source(numSamples);
+            fillTestSignal(reinterpret_cast<char*>(source.data()), numSamples, AUDIO_FORMAT_PCM_FLOAT,
+                           kBenchSeed + channels);
+
+            char id[64];
+            snprintf(id, sizeof(id), "goertzel/%dch/%dtones", channels, channels);
+            runCase(results, id, numSamples * sizeof(float), bytesPerFrame,
+                    static_cast<uint64_t>(callsPerRep) * numSamples * sizeof(float), [&]() -> int64_t {
+                        const int64_t startNs = AudioUtils::getMonotonicNs();
+                        for (size_t i = 0; i < callsPerRep; ++i) {
+                            clobberMemory();
+                            for (size_t done = 0; done < kLevelMeterBufferFrames;) {
+                                done += bank.process(source.data() + done * channels, kLevelMeterBufferFrames - done);
+                                if (bank.isBlockComplete()) {
+                                    mSink += bank.finishBlock()[0];
+                                }
+                            }
+                        }
+                        return AudioUtils::getMonotonicNs() - startNs;
+                    });
         }
     }
 
-    // Setup WAV file for audio recording with configuration
-    bool setupWavFileForRecording(WAVFile& wavFile) {
-        size_t bytesPerSample = audio_bytes_per_sample(mConfig.format);
+    // Print human-readable result table
+    void printResults(const std::vector<BenchmarkResult>& results) const {
+        printf("%-28s %10s %14s %16s %12s\n", "case", "buffer", "median(us)", "frames/s", "MB/s");
+        for (const BenchmarkResult& r : results) {
+            printf("%-28s %10zu %14.1f %16.0f %12.2f\n", r.id.c_str(), r.bufferBytes, r.medianNs / 1000.0,
+                   r.framesPerSec, r.bytesPerSec / (1024.0 * 1024.0));
+        }
+        printf("Benchmark finished: %zu cases (checksum %.3f)\n", results.size(), mSink);
+    }
 
-        mConfig.recordFilePath = AudioUtils::makeRecordFilePath(mConfig.sampleRate, mConfig.channelCount,
-                                                                bytesPerSample * 8, mConfig.recordFilePath);
+    // Format one result as a single-line JSON object (JSON Lines report)
+    static std::string toJsonLine(const BenchmarkResult& r) {
+        char line[512];
+        snprintf(line, sizeof(line),
+                 "{\"version\":\"%s\",\"id\":\"%s\",\"buffer_bytes\":%zu,\"bytes_per_frame\":%zu,"
+                 "\"bytes_per_rep\":%" PRIu64 ",\"median_ns\":%" PRId64 ",\"min_ns\":%" PRId64
+                 ",\"frames_per_sec\":%.1f,\"bytes_per_sec\":%.1f,\"best_bytes_per_sec\":%.1f}",
+                 AUDIO_TEST_CLIENT_VERSION, r.id.c_str(), r.bufferBytes, r.bytesPerFrame, r.bytesPerRep, r.medianNs,
+                 r.minNs, r.framesPerSec, r.bytesPerSec, r.bestBytesPerSec);
+        return std::string(line);
+    }
 
-        printf("Recording audio to file: %s\n", mConfig.recordFilePath.c_str());
-        if (!wavFile.createForWriting(mConfig.recordFilePath, mConfig.sampleRate, mConfig.channelCount,
-                                      bytesPerSample * 8)) {
-            printf("Error: Can't create record file: %s\n", mConfig.recordFilePath.c_str());
+    // Write JSON Lines report, one object per case
+    bool writeReport(const std::vector<BenchmarkResult>& results) const {
+        std::ofstream report;
+        if (!openReportFile(report)) {
+            printf("Error: Can't create report file: %s\n", mConfig.reportPath.c_str());
             return false;
         }
+        for (const BenchmarkResult& r : results) {
+            report << toJsonLine(r) << '\n';
+        }
+        printf("Benchmark report saved: %s\n", mConfig.reportPath.c_str());
+        return report.good();
+    }
 
+    // Extract a string or number field from a flat JSON line written by toJsonLine()
+    static bool findJsonField(const std::string& line, const char* key, std::string& value) {
+        const std::string pattern = std::string("\"") + key + "\":";
+        size_t pos = line.find(pattern);
+        if (pos == std::string::npos) {
+            return false;
+        }
+        pos += pattern.size();
+        if (pos < line.size() && line[pos] == '"') {
+            const size_t end = line.find('"', pos + 1);
+            if (end == std::string::npos) {
+                return false;
+            }
+            value = line.substr(pos + 1, end - pos - 1);
+        } else {
+            const size_t end = line.find_first_of(",}", pos);
+            value = line.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+        }
         return true;
     }
 
-    // Setup WAV file for audio playback and extract audio parameters
-    bool setupWavFileForPlayback(WAVFile& wavFile) {
-        if (mConfig.playFilePath.empty() || access(mConfig.playFilePath.c_str(), F_OK) == -1) {
-            printf("Error: File does not exist: %s\n", mConfig.playFilePath.c_str());
-            return false;
+    // Compare best-case throughput against a previous report, returns 1 if any case regressed beyond the threshold.
+    // The fastest repetition is the least affected by preemption, so it gives the most stable comparison.
+    int32_t compareWithBaseline(const std::vector<BenchmarkResult>& results) const {
+        std::ifstream baseline(mConfig.benchBaselinePath);
+        if (!baseline.is_open()) {
+            printf("Error: Can't open baseline file: %s\n", mConfig.benchBaselinePath.c_str());
+            return -1;
         }
 
-        // Open WAV file for reading
-        if (!wavFile.openForReading(mConfig.playFilePath)) {
-            printf("Error: Failed to open WAV file: %s\n", mConfig.playFilePath.c_str());
-            return false;
+        std::unordered_map<std::string, double> baselineBytesPerSec;
+        std::string line;
+        while (std::getline(baseline, line)) {
+            std::string id;
+            std::string value;
+            if (findJsonField(line, "id", id) && findJsonField(line, "best_bytes_per_sec", value)) {
+                baselineBytesPerSec[id] = atof(value.c_str());
+            }
         }
 
-        mConfig.sampleRate = wavFile.getSampleRate();
-        mConfig.channelCount = wavFile.getNumChannels();
-        mConfig.format = wavFile.getAudioFormat();
-        printf("audio file info: %s, sampleRate: %d, channelCount: %d, format: %d\n", mConfig.playFilePath.c_str(),
-               mConfig.sampleRate, mConfig.channelCount, mConfig.format);
+        size_t compared = 0;
+        size_t regressions = 0;
+        const double allowedRatio = 1.0 - mConfig.benchThresholdPercent / 100.0;
+        for (const BenchmarkResult& r : results) {
+            const auto it = baselineBytesPerSec.find(r.id);
+            if (it == baselineBytesPerSec.end() || it->second <= 0.0) {
+                continue;
+            }
+            ++compared;
+            const double ratio = r.bestBytesPerSec / it->second;
+            if (ratio < allowedRatio) {
+                ++regressions;
+                printf("Regression: %s %.1f%% of baseline (%.2f -> %.2f MB/s)\n", r.id.c_str(), ratio * 100.0,
+                       it->second / (1024.0 * 1024.0), r.bestBytesPerSec / (1024.0 * 1024.0));
+            }
+        }
 
-        return true;
+        printf("Baseline comparison: %zu cases compared, %zu regressions (threshold %.1f%%)\n", compared, regressions,
+               mConfig.benchThresholdPercent);
+        return regressions > 0 ? 1 : 0;
     }
+};
 
-    // Report progress during audio recording or playback
-    template <typename T>
-    bool reportProgress(const sp<T>& component,
-                        const uint64_t totalBytesProcessed,
-                        const uint64_t bytesPerSecond,
-                        WAVFile* wavFile = nullptr) {
-        if (component == nullptr) {
-            return false;
-        }
+/************************** Metrics Reader Operation ******************************/
+// Watches the live metrics pages of running instances (--metrics) and prints each new snapshot, optionally
+// dumping them as JSON Lines to --report. Reading only maps the pages, so publishers are never slowed down.
+class MetricsReaderOperation : public AudioOperation {
+public:
+    // Constructor for metrics reader operation
+    explicit MetricsReaderOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~MetricsReaderOperation() override { unmapPages(); }
 
-        if (totalBytesProcessed >= mNextProgressReport) {
-            const char* operationTypeName = std::is_same_v<T, AudioRecord> ? "Recording" : "Playing";
-            printf("%s ... , processed %.2f seconds, %.2f MB\n", operationTypeName,
-                   static_cast<float>(totalBytesProcessed) / bytesPerSecond,
-                   static_cast<float>(totalBytesProcessed) / (1024u * 1024u));
-            mNextProgressReport += bytesPerSecond * kProgressReportInterval;
+    // Disable copy operations (inherited from AudioOperation)
+    MetricsReaderOperation(const MetricsReaderOperation&) = delete;
+    MetricsReaderOperation& operator=(const MetricsReaderOperation&) = delete;
 
-            if constexpr (std::is_same_v<T, AudioRecord>) {
-                if (wavFile) {
-                    wavFile->updateHeader();
-                }
+    // Poll every page until all runs finished, the duration elapsed or Ctrl+C
+    int32_t execute() override {
+        if (mConfig.metricsReadPaths.empty()) {
+            printf("Error: No metrics file given\n");
+            return -1;
+        }
+        std::ofstream report;
+        if (!mConfig.reportPath.empty()) {
+            if (!openReportFile(report)) {
+                printf("Error: Can't create report file: %s\n", mConfig.reportPath.c_str());
+                return -1;
             }
-            return true;
         }
-        return false;
-    }
+        for (const std::string& path : mConfig.metricsReadPaths) {
+            mPages.push_back({path});
+        }
 
-    // Handle SIGINT signal (Ctrl+C) for graceful shutdown
-    static void signalHandler(int signal) {
-        if (signal == SIGINT) {
-            sExitRequested.store(true);
+        const int32_t intervalMs = mConfig.metricsIntervalMs > 0 ? mConfig.metricsIntervalMs : kReaderIntervalMs;
+        const int64_t endNs = mConfig.durationSeconds > 0
+                                  ? AudioUtils::getMonotonicNs() + mConfig.durationSeconds * 1000000000LL
+                                  : INT64_MAX;
+        printf("Watching %zu metrics file(s) every %d ms. Press Ctrl+C to stop\n", mPages.size(), intervalMs);
+        while (!sExitRequested && AudioUtils::getMonotonicNs() < endNs) {
+            bool allFinished = true;
+            for (WatchedPage& page : mPages) {
+                pollPage(page, report);
+                allFinished = allFinished && page.finished;
+            }
+            if (allFinished) {
+                sLogger.print("All runs finished\n");
+                break;
+            }
+            usleep(static_cast<useconds_t>(intervalMs) * 1000);
         }
+        sLogger.flush();
+        unmapPages();
+        return 0;
     }
 
-    // Setup SIGINT signal handler for graceful termination
-    void setupSignalHandler() { signal(SIGINT, signalHandler); }
-
-    // Update audio level meter with low CPU usage
-    void updateLevelMeter(const char* buffer, size_t size) {
-        // Only update level meter every kLevelMeterInterval frames
-        if (++mLevelMeterCounter % kLevelMeterInterval != 0) {
-            return;
-        }
+private:
+    static constexpr int32_t kReaderIntervalMs = 1000;
+
+    struct WatchedPage {
+        std::string path;
+        const LiveMetricsPage* page = nullptr;
+        uint64_t lastPublishCount = 0;
+        bool finished = false;
+        bool waitingReported = false;
+    };
 
-        constexpr float NORM_16BIT = 32768.0f;
-        constexpr float NORM_32BIT = 2147483648.0f;
-        constexpr float DB_FLOOR = -60.0f;
+    std::vector<WatchedPage> mPages;
 
-        const size_t bytesPerSample = audio_bytes_per_sample(mConfig.format);
-        if (size == 0 || bytesPerSample == 0) {
-            printf("Error: Invalid input size or bytesPerSample\n");
-            return;
+    // Map a page once its writer created and initialized it
+    static bool mapPage(WatchedPage& page) {
+        if (page.page != nullptr) {
+            return true;
+        }
+        const int fd = open(page.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
         }
+        struct stat st;
+        void* addr = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(LiveMetricsPage::kSize)) {
+            addr = mmap(nullptr, LiveMetricsPage::kSize, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+        const LiveMetricsPage* mapped = static_cast<const LiveMetricsPage*>(addr);
+        if (mapped->magic != LiveMetricsPage::kMagic || mapped->version != LiveMetricsPage::kVersion) {
+            munmap(addr, LiveMetricsPage::kSize);
+            return false;
+        }
+        page.page = mapped;
+        return true;
+    }
 
-        const size_t numSamples = size / bytesPerSample;
-        float peakAmplitude = 0.0f;
-        // Process 16-bit and 32-bit integer audio
-        if (bytesPerSample == 2) {
-            const int16_t* int16Data = reinterpret_cast<const int16_t*>(buffer);
-            for (size_t i = 0; i < numSamples; ++i) {
-                peakAmplitude = std::max(peakAmplitude, static_cast<float>(std::abs(int16Data[i])) / NORM_16BIT);
+    void unmapPages() {
+        for (WatchedPage& page : mPages) {
+            if (page.page != nullptr) {
+                munmap(const_cast<LiveMetricsPage*>(page.page), LiveMetricsPage::kSize);
+                page.page = nullptr;
             }
-        } else if (bytesPerSample == 4) {
-            const int32_t* int32Data = reinterpret_cast<const int32_t*>(buffer);
-            for (size_t i = 0; i < numSamples; ++i) {
-                peakAmplitude = std::max(peakAmplitude, static_cast<float>(std::abs(int32Data[i])) / NORM_32BIT);
+        }
+    }
+
+    // Print the snapshot of one page if the writer published a new one since the last poll
+    void pollPage(WatchedPage& page, std::ofstream& report) {
+        if (!mapPage(page)) {
+            if (!page.waitingReported) {
+                sLogger.print("Waiting for metrics file: %s\n", page.path.c_str());
+                page.waitingReported = true;
             }
-        } else {
-            printf("Error: Unsupported audio format for level meter\n");
+            page.finished = false;
+            return;
+        }
+        LiveMetricsSnapshot snapshot;
+        if (!page.page->load(snapshot)) {
+            sLogger.print("Warning: %s is being updated too often to read\n", page.path.c_str());
+            return;
+        }
+        page.finished = snapshot.finished != 0;
+        if (snapshot.publishCount == page.lastPublishCount) {
             return;
         }
+        page.lastPublishCount = snapshot.publishCount;
 
-        // Convert to dB scale (with floor at -60dB)
-        const float dbLevel = peakAmplitude > 0.0f ? std::max(20.0f * std::log10(peakAmplitude), DB_FLOOR) : DB_FLOOR;
-        const std::string timestamp = AudioUtils::getTimestamp();
-        printf("[%s] Audio Level: %.1f dB, bytes: %zu\n", timestamp.c_str(), dbLevel, size);
+        const double ageMs = (AudioUtils::getMonotonicNs() - snapshot.updateTimeNs) / 1e6;
+        const int32_t channels = std::clamp(snapshot.channelCount, 0, LiveMetricsSnapshot::kMaxChannels);
+        std::string peaks;
+        for (int32_t ch = 0; ch < channels; ++ch) {
+            peaks += String8::format("%s%.1f", ch > 0 ? "," : "", snapshot.peakDb[ch]).c_str();
+        }
+        sLogger.printTimed("%s pid=%d mode=%d %s age=%.0fms in=%.2fMB out=%.2fMB overrun=%u underrun=%u "
+                           "read=%.2f/%.2fms write=%.2f/%.2fms peak=%sdB\n",
+                           page.path.c_str(), snapshot.pid, snapshot.mode, snapshot.finished ? "finished" : "running",
+                           ageMs, snapshot.bytesCaptured / (1024.0 * 1024.0),
+                           snapshot.bytesRendered / (1024.0 * 1024.0), snapshot.overrunFrames,
+                           snapshot.underrunCount, snapshot.read.meanNs / 1e6, snapshot.read.maxNs / 1e6,
+                           snapshot.write.meanNs / 1e6, snapshot.write.maxNs / 1e6, peaks.c_str());
+
+        if (report.is_open()) {
+            report << String8::format("{\"path\":\"%s\",\"pid\":%d,\"mode\":%d,\"finished\":%d,\"age_ms\":%.1f,"
+                                      "\"publish_count\":%" PRIu64 ",\"bytes_captured\":%" PRIu64
+                                      ",\"bytes_rendered\":%" PRIu64 ",\"overrun_frames\":%u,\"underrun_count\":%u,",
+                                      page.path.c_str(), snapshot.pid, snapshot.mode, snapshot.finished, ageMs,
+                                      snapshot.publishCount, snapshot.bytesCaptured, snapshot.bytesRendered,
+                                      snapshot.overrunFrames, snapshot.underrunCount)
+                          .c_str()
+                   << transferJson("read", snapshot.read) << transferJson("write", snapshot.write) << "\"peak_db\":["
+                   << peaks << "]}\n";
+            report.flush();
+        }
+    }
+
+    static std::string transferJson(const char* name, const LiveTransferStats& stats) {
+        return String8::format("\"%s_count\":%u,\"%s_mean_ms\":%.3f,\"%s_max_ms\":%.3f,\"%s_peak_ms\":%.3f,", name,
+                               stats.count, name, stats.meanNs / 1e6, name, stats.maxNs / 1e6, name,
+                               stats.peakNs / 1e6)
+            .c_str();
     }
 };
 
-/************************** Audio Record Operation ******************************/
-class AudioRecordOperation : public AudioOperation {
+/************************** Bit-Exact Check Operation ******************************/
+// Offline side of -m4: verifies recorded WAV files against the bit-exact pattern, or exports the pattern as a
+// WAV (--pattern-out) for playback and capture with other tools. Needs no audio device.
+class BitExactCheckOperation : public AudioOperation {
 public:
-    // Constructor for audio recording operation
-    explicit AudioRecordOperation(const AudioConfig& config) : AudioOperation(config) {}
-    ~AudioRecordOperation() override = default;
+    // Constructor for offline bit-exact verification
+    explicit BitExactCheckOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~BitExactCheckOperation() override = default;
 
     // Disable copy operations (inherited from AudioOperation)
-    AudioRecordOperation(const AudioRecordOperation&) = delete;
-    AudioRecordOperation& operator=(const AudioRecordOperation&) = delete;
+    BitExactCheckOperation(const BitExactCheckOperation&) = delete;
+    BitExactCheckOperation& operator=(const BitExactCheckOperation&) = delete;
 
-    // Execute audio recording operation
+    // Export the pattern, or verify every file and return 1 if any of them is not bit-exact
     int32_t execute() override {
-        WAVFile wavFile;
-        sp<AudioRecord> audioRecord;
-
-        if (!setupWavFileForRecording(wavFile) || !validateAudioParameters()) {
-            printf("Error: Failed to setup WAV file or validate audio parameters\n");
+        if (!mConfig.patternOutPath.empty()) {
+            return exportPattern() ? 0 : -1;
+        }
+        if (mConfig.verifyPaths.empty()) {
+            printf("Error: No capture file given\n");
             return -1;
         }
+        std::ofstream report;
+        if (!mConfig.reportPath.empty()) {
+            if (!openReportFile(report)) {
+                printf("Error: Can't create report file: %s\n", mConfig.reportPath.c_str());
+                return -1;
+            }
+        }
+        int32_t result = 0;
+        for (const std::string& path : mConfig.verifyPaths) {
+            const int32_t fileResult = verifyFile(path, report);
+            result = fileResult < 0 ? -1 : std::max(result, fileResult);
+        }
+        return result;
+    }
 
-        if (!initializeAudioRecord(audioRecord)) {
-            wavFile.close();
+private:
+    static constexpr size_t kReadChunkBytes = 64 * 1024;
+    static constexpr int32_t kDefaultPatternSeconds = 10;
+
+    int32_t verifyFile(const std::string& path, std::ofstream& report) {
+        WAVFile wavFile;
+        if (!wavFile.openForReading(path)) {
+            printf("Error: Can't open WAV file: %s\n", path.c_str());
             return -1;
         }
-
-        if (!startAudioComponent(audioRecord)) {
-            wavFile.close();
+        const audio_format_t format = wavFile.getAudioFormat();
+        if (!BitExactPattern::isSupportedFormat(format)) {
+            printf("Error: %s: format %d is not supported for bit-exact verification\n", path.c_str(), format);
             return -1;
         }
 
-        // Main recording loop
-        int32_t operationResult = recordLoop(audioRecord, wavFile);
+        BitExactVerifier verifier(format, wavFile.getNumChannels());
+        std::vector<char> buffer(kReadChunkBytes);
+        size_t bytesRead = 0;
+        while ((bytesRead = wavFile.readData(buffer.data(), buffer.size())) > 0 && !sExitRequested) {
+            verifier.feed(buffer.data(), bytesRead);
+        }
+        verifier.print(path.c_str(), wavFile.getSampleRate());
+        if (report.is_open()) {
+            report << verifier.toJsonLine(path.c_str()) << '\n';
+        }
+        return verifier.isBitExact() ? 0 : 1;
+    }
 
-        // Cleanup
-        stopAudioComponent(audioRecord);
+    // WAV files written here are tagged integer PCM, so only formats that read back the same are exported
+    bool exportPattern() {
+        if (mConfig.format != AUDIO_FORMAT_PCM_16_BIT && mConfig.format != AUDIO_FORMAT_PCM_24_BIT_PACKED &&
+            mConfig.format != AUDIO_FORMAT_PCM_32_BIT) {
+            printf("Error: Pattern export supports 16, 24 and 32 bit PCM only\n");
+            return false;
+        }
+        const size_t bytesPerSample = audio_bytes_per_sample(mConfig.format);
+        WAVFile wavFile;
+        if (!wavFile.createForWriting(mConfig.patternOutPath, mConfig.sampleRate, mConfig.channelCount,
+                                      bytesPerSample * 8)) {
+            printf("Error: Can't create pattern file: %s\n", mConfig.patternOutPath.c_str());
+            return false;
+        }
+        const int32_t seconds = mConfig.durationSeconds > 0 ? mConfig.durationSeconds : kDefaultPatternSeconds;
+        const uint64_t totalFrames = static_cast<uint64_t>(seconds) * mConfig.sampleRate;
+        const size_t chunkFrames = kReadChunkBytes / (bytesPerSample * mConfig.channelCount);
+        std::vector<char> buffer(chunkFrames * bytesPerSample * mConfig.channelCount);
+        for (uint64_t frame = 0; frame < totalFrames;) {
+            const size_t frames = static_cast<size_t>(std::min<uint64_t>(chunkFrames, totalFrames - frame));
+            const size_t bytes = frames * bytesPerSample * mConfig.channelCount;
+            BitExactPattern::fill(frame, frames, buffer.data(), mConfig.format, mConfig.channelCount);
+            if (wavFile.writeData(buffer.data(), bytes) != bytes) {
+                printf("Error: Failed to write pattern file: %s\n", mConfig.patternOutPath.c_str());
+                return false;
+            }
+            frame += frames;
+        }
         wavFile.finalize();
-
-        return operationResult;
+        printf("Pattern saved: %s (%d s, sampleRate=%d, channelCount=%d, format=%d)\n", mConfig.patternOutPath.c_str(),
+               seconds, mConfig.sampleRate, mConfig.channelCount, mConfig.format);
+        return true;
     }
+};
 
-private:
-    // Main recording loop that handles audio data collection
-    int32_t recordLoop(const sp<AudioRecord>& audioRecord, WAVFile& wavFile) {
-        // Setup buffer
-        BufferManager bufferManager(calculateBufferSize());
-        if (!bufferManager.isValid()) {
-            printf("Error: Failed to create valid buffer manager\n");
+/************************** Timestamp Dump Operation ******************************/
+// Reads --timestamps sidecars and reconstructs the timing of a recording after the fact: every read, gaps
+// between reads, read jitter, capture latency from the stream timestamps and the device sample rate measured
+// against CLOCK_MONOTONIC. Wall clock times come from the realtime anchor in the header, so reads can be
+// matched with logcat, kernel or other device logs.
+class TimestampDumpOperation : public AudioOperation {
+public:
+    // Constructor for timestamp sidecar dump operation (no audio device is opened)
+    explicit TimestampDumpOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~TimestampDumpOperation() override = default;
+
+    // Disable copy operations (inherited from AudioOperation)
+    TimestampDumpOperation(const TimestampDumpOperation&) = delete;
+    TimestampDumpOperation& operator=(const TimestampDumpOperation&) = delete;
+
+    // Dump and analyse every file
+    int32_t execute() override {
+        if (mConfig.timestampReadPaths.empty()) {
+            printf("Error: No timestamp file given\n");
             return -1;
         }
-        char* const audioBuffer = bufferManager.get();
+        std::ofstream report;
+        if (!mConfig.reportPath.empty()) {
+            if (!openReportFile(report)) {
+                printf("Error: Can't create report file: %s\n", mConfig.reportPath.c_str());
+                return -1;
+            }
+        }
+        int32_t result = 0;
+        for (const std::string& path : mConfig.timestampReadPaths) {
+            if (!dumpFile(path, report)) {
+                result = -1;
+            }
+        }
+        if (report.is_open()) {
+            printf("Timestamp report saved: %s\n", mConfig.reportPath.c_str());
+        }
+        return result;
+    }
 
-        if (mConfig.durationSeconds > 0) {
-            printf("Recording for %d seconds...\n", mConfig.durationSeconds);
+private:
+    static constexpr double kGapFactor = 1.5; // an interval longer than 1.5 read durations is a gap
+    static constexpr size_t kMaxListedGaps = 16;
+
+    struct Gap {
+        size_t index;
+        uint64_t framePosition;
+        double atMs;
+        double intervalMs;
+        double expectedMs;
+    };
+
+    bool readFile(const std::string& path,
+                  TimestampSidecarHeader& header,
+                  std::vector<TimestampSidecarRecord>& records) const {
+        std::ifstream file(path, std::ios::binary | std::ios::in);
+        if (!file.is_open()) {
+            printf("Error: Can't open timestamp file: %s\n", path.c_str());
+            return false;
+        }
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            header.magic != TimestampSidecarHeader::kMagic || header.version != TimestampSidecarHeader::kVersion ||
+            header.recordSize != sizeof(TimestampSidecarRecord) || header.sampleRate <= 0 || header.frameSize == 0) {
+            printf("Error: %s is not a timestamp file\n", path.c_str());
+            return false;
         }
+        TimestampSidecarRecord record;
+        while (file.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+            records.push_back(record);
+        }
+        return true;
+    }
 
-        printf("Recording in progress. Press Ctrl+C to stop\n");
-        ALOGI("Recording in progress.");
-        const uint64_t bytesPerSecond = calculateBytesPerSecond();
-        const uint64_t maxBytesToRecord =
-            (mConfig.durationSeconds > 0) ? std::min(static_cast<uint64_t>(mConfig.durationSeconds) * bytesPerSecond,
-                                                     static_cast<uint64_t>(kMaxAudioDataSize))
-                                          : static_cast<uint64_t>(kMaxAudioDataSize);
-        mNextProgressReport = bytesPerSecond * kProgressReportInterval;
+    bool dumpFile(const std::string& path, std::ofstream& report) const {
+        TimestampSidecarHeader header;
+        std::vector<TimestampSidecarRecord> records;
+        if (!readFile(path, header, records)) {
+            return false;
+        }
+        printf("\n%s: sampleRate=%d, channelCount=%u, reads=%zu, started %s\n", path.c_str(), header.sampleRate,
+               header.channelCount, records.size(), AudioUtils::formatWallTime(header.startRealtimeNs).c_str());
+        if (records.empty()) {
+            return true;
+        }
+        if (!report.is_open()) {
+            printf("%8s %12s %8s %12s %12s %14s %12s\n", "read", "frame", "bytes", "time(ms)", "interval(ms)",
+                   "stream_pos", "latency(ms)");
+        }
 
-        uint64_t totalBytesRead = 0;
-        while (totalBytesRead < maxBytesToRecord && !sExitRequested) {
-            const ssize_t bytesRead = audioRecord->read(audioBuffer, calculateBufferSize());
-            if (bytesRead < 0) {
-                printf("Error: AudioRecord read failed: %zd\n", bytesRead);
-                ALOGE("AudioRecord read failed: %zd", bytesRead);
-                break;
+        const double rate = header.sampleRate;
+        std::vector<Gap> gaps;
+        size_t gapCount = 0;
+        double intervalSum = 0.0;
+        double deviationSquareSum = 0.0;
+        double intervalMin = 0.0;
+        double intervalMax = 0.0;
+        double latencySum = 0.0;
+        double latencyMax = 0.0;
+        size_t latencyCount = 0;
+        const TimestampSidecarRecord* firstValid = nullptr;
+        const TimestampSidecarRecord* lastValid = nullptr;
+        for (size_t i = 0; i < records.size(); ++i) {
+            const TimestampSidecarRecord& r = records[i];
+            const uint64_t frames = r.bytes / header.frameSize;
+            const double atMs = (r.returnNs - header.startMonotonicNs) / 1e6;
+            const double intervalMs = i > 0 ? (r.returnNs - records[i - 1].returnNs) / 1e6 : 0.0;
+            const double expectedMs = frames * 1000.0 / rate;
+            if (i > 0) {
+                intervalSum += intervalMs;
+                deviationSquareSum += (intervalMs - expectedMs) * (intervalMs - expectedMs);
+                intervalMin = i == 1 ? intervalMs : std::min(intervalMin, intervalMs);
+                intervalMax = std::max(intervalMax, intervalMs);
+                if (intervalMs > kGapFactor * expectedMs) {
+                    if (gaps.size() < kMaxListedGaps) {
+                        gaps.push_back({i, r.framePosition, atMs, intervalMs, expectedMs});
+                    }
+                    ++gapCount;
+                }
             }
-            if (bytesRead == 0) {
-                continue;
+
+            // Age of the newest frame of the read when read() returned, from the stream's position/time pair
+            const bool valid = (r.flags & TimestampSidecarRecord::kFlagTimestampValid) != 0;
+            double latencyMs = 0.0;
+            if (valid) {
+                const double lastFrameNs =
+                    r.streamTimeNs +
+                    (static_cast<double>(r.framePosition + frames) - static_cast<double>(r.streamPosition)) * 1e9 /
+                        rate;
+                latencyMs = (r.returnNs - lastFrameNs) / 1e6;
+                latencySum += latencyMs;
+                latencyMax = latencyCount == 0 ? latencyMs : std::max(latencyMax, latencyMs);
+                ++latencyCount;
+                firstValid = firstValid != nullptr ? firstValid : &r;
+                lastValid = &r;
             }
-            totalBytesRead += static_cast<uint64_t>(bytesRead);
 
-            // Update level meter
-            updateLevelMeter(audioBuffer, static_cast<size_t>(bytesRead));
+            if (report.is_open()) {
+                report << String8::format("{\"type\":\"read\",\"file\":\"%s\",\"index\":%zu,\"frame\":%" PRIu64
+                                          ",\"bytes\":%u,\"monotonic_ns\":%" PRId64 ",\"realtime_ns\":%" PRId64
+                                          ",\"interval_ms\":%.3f",
+                                          path.c_str(), i, r.framePosition, r.bytes, r.returnNs,
+                                          header.startRealtimeNs + (r.returnNs - header.startMonotonicNs), intervalMs)
+                              .c_str();
+                if (valid) {
+                    report << String8::format(",\"stream_position\":%" PRId64 ",\"stream_time_ns\":%" PRId64
+                                              ",\"latency_ms\":%.3f",
+                                              r.streamPosition, r.streamTimeNs, latencyMs)
+                                  .c_str();
+                }
+                report << "}\n";
+            } else {
+                printf("%8zu %12" PRIu64 " %8u %12.3f %12.3f %14s %12s\n", i, r.framePosition, r.bytes, atMs,
+                       intervalMs, valid ? String8::format("%" PRId64, r.streamPosition).c_str() : "-",
+                       valid ? String8::format("%.3f", latencyMs).c_str() : "-");
+            }
+        }
 
-            // Write data to WAV file
-            if (wavFile.writeData(audioBuffer, static_cast<size_t>(bytesRead)) != static_cast<size_t>(bytesRead)) {
-                printf("Error: Failed to save audio data to file\n");
-                ALOGE("Failed to save audio data to file");
-                break;
+        const size_t intervals = records.size() - 1;
+        const double intervalMean = intervals > 0 ? intervalSum / intervals : 0.0;
+        const double jitterMs = intervals > 0 ? std::sqrt(deviationSquareSum / intervals) : 0.0;
+        const TimestampSidecarRecord& last = records.back();
+        const uint64_t totalFrames = last.framePosition + last.bytes / header.frameSize;
+        printf("Summary: %" PRIu64 " frames (%.2f s of audio) over %.2f s\n", totalFrames, totalFrames / rate,
+               (last.returnNs - records.front().returnNs) / 1e9);
+        printf("  Read interval: mean %.3f ms, min %.3f ms, max %.3f ms, jitter %.3f ms (rms vs read duration)\n",
+               intervalMean, intervalMin, intervalMax, jitterMs);
+        printf("  Gaps (> %.1fx read duration): %zu\n", kGapFactor, gapCount);
+        for (const Gap& gap : gaps) {
+            printf("    read %zu at frame %" PRIu64 " (+%.3f ms, %s): %.3f ms, expected %.3f ms\n", gap.index,
+                   gap.framePosition, gap.atMs,
+                   AudioUtils::formatWallTime(header.startRealtimeNs + static_cast<int64_t>(gap.atMs * 1e6)).c_str(),
+                   gap.intervalMs, gap.expectedMs);
+        }
+        if (gapCount > gaps.size()) {
+            printf("    ... %zu more\n", gapCount - gaps.size());
+        }
+        double deviceRate = 0.0;
+        if (latencyCount > 0) {
+            printf("  Capture latency: mean %.3f ms, max %.3f ms\n", latencySum / latencyCount, latencyMax);
+            if (lastValid->streamTimeNs > firstValid->streamTimeNs) {
+                deviceRate = (lastValid->streamPosition - firstValid->streamPosition) * 1e9 /
+                             (lastValid->streamTimeNs - firstValid->streamTimeNs);
+                printf("  Device rate: %.3f Hz (%+.1f ppm vs %d Hz)\n", deviceRate, (deviceRate / rate - 1.0) * 1e6,
+                       header.sampleRate);
             }
+        } else {
+            printf("  Capture latency: no stream timestamps\n");
+        }
 
-            // Report progress
-            reportProgress(audioRecord, totalBytesRead, calculateBytesPerSecond(), &wavFile);
+        if (report.is_open()) {
+            report << String8::format("{\"type\":\"read_summary\",\"file\":\"%s\",\"reads\":%zu,\"frames\":%" PRIu64
+                                      ",\"interval_mean_ms\":%.3f,\"interval_max_ms\":%.3f,\"jitter_ms\":%.3f,"
+                                      "\"gaps\":%zu,\"latency_mean_ms\":%.3f,\"latency_max_ms\":%.3f,"
+                                      "\"device_rate_hz\":%.3f}\n",
+                                      path.c_str(), records.size(), totalFrames, intervalMean, intervalMax, jitterMs,
+                                      gapCount, latencyCount > 0 ? latencySum / latencyCount : 0.0, latencyMax,
+                                      deviceRate)
+                          .c_str();
+        }
+        return true;
+    }
+};
+
+/************************** Work-Stealing Pool ******************************/
+// Fixed set of workers, each with its own task deque. A worker takes tasks from the back of its own deque and,
+// once that is empty, steals from the front of the others, so a few long tasks do not leave the rest idle.
+// Tasks are dealt round-robin before run(); the calling thread works as worker 0.
+template <typename Task> class WorkStealingPool {
+public:
+    explicit WorkStealingPool(const size_t workerCount) : mQueues(std::max<size_t>(workerCount, 1)) {}
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    size_t getWorkerCount() const { return mQueues.size(); }
+    uint64_t getSteals() const { return mSteals; }
+
+    void add(Task task) { mQueues[mNextQueue++ % mQueues.size()].tasks.push_back(std::move(task)); }
+
+    // Run fn(task, worker) for every task, returns when all tasks ran or exit was requested
+    template <typename Fn> void run(Fn&& fn) {
+        auto work = [this, &fn](const size_t worker) {
+            Task task;
+            while (!sExitRequested && take(worker, task)) {
+                fn(task, worker);
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t worker = 1; worker < mQueues.size(); ++worker) {
+            threads.emplace_back(work, worker);
         }
+        work(0);
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
 
-        printf("Recording finished: Recorded %" PRIu64 " bytes, File saved: %s\n", totalBytesRead,
-               wavFile.getFilePath().c_str());
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
 
-        return 0;
+    // No task is added while running, so one pass over empty queues means the work is done
+    bool take(const size_t worker, Task& task) {
+        {
+            Queue& own = mQueues[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < mQueues.size(); ++i) {
+            Queue& victim = mQueues[(worker + i) % mQueues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                ++mSteals;
+                return true;
+            }
+        }
+        return false;
     }
+
+    std::vector<Queue> mQueues;
+    size_t mNextQueue = 0;
+    std::atomic<uint64_t> mSteals{0};
 };
 
-/************************** Audio Play Operation ******************************/
-class AudioPlayOperation : public AudioOperation {
+/************************** File Batch Operation ******************************/
+// Applies one offline operation to many WAV files on all cores. Files are split into fixed-size chunks that
+// run as independent tasks on a work-stealing pool, so a few huge captures spread over every worker instead
+// of serializing the run. Data is read with pread(), converted output written with pwrite() at its final
+// offset, so chunks of one file need no ordering. A file is opened when its first chunk runs and closed after
+// its last one, so large batches stay below the descriptor limit. Headers of recordings truncated before
+// finalize() are detected by comparing the data size with the file size; such files are processed up to the
+// metadata chunks (LIST, id3, ...) that follow the data, or to their end.
+//   stats    peak and RMS level, clipped samples
+//   convert  write every file in the -f format to --batch-out
+//   hash     FNV-1a 64 of each chunk, combined in chunk order (value depends on kChunkBytes)
+//   repair   rewrite the RIFF and data sizes of stale headers from the file size and the trailing chunks
+class FileBatchOperation : public AudioOperation {
 public:
-    // Constructor for audio playback operation
-    explicit AudioPlayOperation(const AudioConfig& config) : AudioOperation(config) {}
-    ~AudioPlayOperation() override = default;
+    // Constructor for offline batch processing (no audio device is opened)
+    explicit FileBatchOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~FileBatchOperation() override { closeFiles(); }
 
     // Disable copy operations (inherited from AudioOperation)
-    AudioPlayOperation(const AudioPlayOperation&) = delete;
-    AudioPlayOperation& operator=(const AudioPlayOperation&) = delete;
+    FileBatchOperation(const FileBatchOperation&) = delete;
+    FileBatchOperation& operator=(const FileBatchOperation&) = delete;
 
-    // Execute audio playback operation
+    // Process every file and print the aggregate throughput
     int32_t execute() override {
-        WAVFile wavFile;
-        sp<AudioTrack> audioTrack;
-
-        if (!setupWavFileForPlayback(wavFile) || !validateAudioParameters()) {
-            printf("Error: Failed to setup WAV file or validate audio parameters\n");
+        mOp = parseOp(mConfig.fileBatchOp);
+        if (mOp == OP_INVALID) {
+            printf("Error: Unknown batch operation %s (stats, convert, hash, repair)\n", mConfig.fileBatchOp.c_str());
+            return -1;
+        }
+        if (mConfig.fileBatchPaths.empty()) {
+            printf("Error: -m205 needs a directory, glob pattern, list file or WAV files\n");
+            return -1;
+        }
+        if (mOp == OP_CONVERT && !prepareOutputDirectory()) {
+            return -1;
+        }
+        std::vector<std::string> paths;
+        if (!AudioUtils::collectWavFiles(mConfig.fileBatchPaths, paths)) {
+            return -1;
+        }
+        if (paths.empty()) {
+            printf("Error: No WAV files found\n");
             return -1;
         }
 
-        if (!initializeAudioTrack(audioTrack)) {
-            wavFile.close();
+        mFiles.resize(paths.size());
+        for (size_t i = 0; i < paths.size(); ++i) {
+            inspectFile(paths[i], mFiles[i]);
+        }
+        const size_t workers = mConfig.batchJobs > 0 ? static_cast<size_t>(mConfig.batchJobs)
+                                                     : std::max(std::thread::hardware_concurrency(), 1u);
+        WorkStealingPool<Task> pool(workers);
+        size_t taskCount = 0;
+        for (size_t i = 0; i < mFiles.size(); ++i) {
+            taskCount += addTasks(i, pool);
+        }
+        printf("Batch %s: %zu file(s), %zu task(s) on %zu worker(s)\n", opName(mOp), mFiles.size(), taskCount,
+               pool.getWorkerCount());
+
+        // One input and one output chunk buffer per worker
+        std::vector<std::vector<char>> inBuffers(pool.getWorkerCount(), std::vector<char>(kChunkBytes));
+        std::vector<std::vector<char>> outBuffers(pool.getWorkerCount());
+        const int64_t startNs = AudioUtils::getMonotonicNs();
+        pool.run([&](const Task& task, const size_t worker) {
+            runTask(task, inBuffers[worker], outBuffers[worker]);
+        });
+        const double seconds = std::max((AudioUtils::getMonotonicNs() - startNs) / 1e9, 1e-9);
+        closeFiles();
+        if (sExitRequested) {
+            printf("Batch interrupted\n");
             return -1;
         }
 
-        // Start playback
-        if (!startAudioComponent(audioTrack)) {
-            wavFile.close();
+        printReport(seconds, pool.getWorkerCount(), taskCount, pool.getSteals());
+        if (!mConfig.reportPath.empty() && !writeReport(seconds, pool.getWorkerCount())) {
             return -1;
         }
+        for (const FileJob& file : mFiles) {
+            if (!file.error.empty()) {
+                return -1;
+            }
+        }
+        return 0;
+    }
 
-        // Main playback loop
-        int32_t operationResult = playLoop(audioTrack, wavFile);
+private:
+    static constexpr size_t kChunkBytes = 4u << 20; // task size, rounded down to whole frames per file
+    static constexpr size_t kHeaderBytes = 44;       // canonical header written by WAVFile
+    static constexpr size_t kMaxListedFiles = 50;    // longer runs print only the summary and problem files
+    static constexpr size_t kTrailerScanBytes = 1u << 20; // tail searched for metadata chunks after the data
+
+    enum Op { OP_INVALID, OP_STATS, OP_CONVERT, OP_HASH, OP_REPAIR };
+
+    struct Task {
+        size_t file = 0;
+        size_t chunk = 0;
+        uint64_t offset = 0; // in the data chunk
+        size_t bytes = 0;
+    };
 
-        // Cleanup
-        stopAudioComponent(audioTrack);
-        wavFile.close();
+    struct ChunkResult {
+        double peak = 0.0;       // normalized to full scale
+        double squareSum = 0.0;  // normalized to full scale
+        uint64_t samples = 0;
+        uint64_t clipped = 0;
+        uint64_t hash = 0;
+        bool ok = false;
+    };
 
-        return operationResult;
+    struct FileJob {
+        std::string path;
+        std::string outPath;
+        std::string error;
+        int fd = -1;
+        int outFd = -1;
+        audio_format_t format = AUDIO_FORMAT_INVALID;
+        int32_t sampleRate = 0;
+        int32_t channelCount = 0;
+        size_t frameSize = 0;
+        uint64_t dataBytes = 0;    // processed bytes of the data chunk
+        uint64_t trailerBytes = 0; // chunks after the data chunk, including its pad byte
+        bool staleHeader = false;  // header sizes do not match the file size
+        bool repaired = false;
+        std::vector<ChunkResult> chunks;
+        std::unique_ptr<std::mutex> lock = std::make_unique<std::mutex>(); // guards the descriptors and error
+        size_t pendingTasks = 0; // the last task to finish closes the descriptors
+    };
+
+    static Op parseOp(const std::string& name) {
+        for (const Op op : {OP_STATS, OP_CONVERT, OP_HASH, OP_REPAIR}) {
+            if (name == opName(op)) {
+                return op;
+            }
+        }
+        return OP_INVALID;
     }
 
-private:
-    // Main playback loop that handles audio data playback
-    int32_t playLoop(const sp<AudioTrack>& audioTrack, WAVFile& wavFile) {
-        // Setup buffer
-        BufferManager bufferManager(calculateBufferSize());
-        if (!bufferManager.isValid()) {
-            printf("Error: Failed to create valid buffer manager\n");
-            return -1;
+    static const char* opName(const Op op) {
+        switch (op) {
+        case OP_STATS:
+            return "stats";
+        case OP_CONVERT:
+            return "convert";
+        case OP_HASH:
+            return "hash";
+        case OP_REPAIR:
+            return "repair";
+        default:
+            return "invalid";
         }
-        char* const audioBuffer = bufferManager.get();
+    }
 
-        printf("Playing in progress. Press Ctrl+C to stop\n");
-        ALOGI("Playing in progress.");
-        const uint64_t bytesPerSecond = calculateBytesPerSecond();
-        mNextProgressReport = bytesPerSecond * kProgressReportInterval;
-        uint64_t totalBytesPlayed = 0;
-        while (!sExitRequested) {
-            const size_t bytesRead = wavFile.readData(audioBuffer, calculateBufferSize());
-            if (bytesRead == 0) {
-                printf("End of file reached\n");
-                break;
+    // 8.24 has no WAV representation of its own, it is converted to 32-bit like the recorder saves it
+    bool prepareOutputDirectory() {
+        mOutFormat = mConfig.format == AUDIO_FORMAT_PCM_8_24_BIT ? AUDIO_FORMAT_PCM_32_BIT : mConfig.format;
+        if (!dispatchFormat(mOutFormat, [](auto) {})) {
+            printf("Error: Unsupported convert format: %d\n", static_cast<int>(mConfig.format));
+            return false;
+        }
+        if (mConfig.fileBatchOutDir.empty()) {
+            printf("Error: convert needs --batch-out {dir}\n");
+            return false;
+        }
+        if (mkdir(mConfig.fileBatchOutDir.c_str(), 0755) != 0 && errno != EEXIST) {
+            printf("Error: Can't create directory %s: %s\n", mConfig.fileBatchOutDir.c_str(), strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    // Validate the header and size the data; errors are kept per file so one bad file does not stop the run.
+    // The descriptors are opened later, by acquireFile().
+    void inspectFile(const std::string& path, FileJob& file) {
+        file.path = path;
+        WAVFile wavFile;
+        if (!wavFile.openForReading(path)) {
+            file.error = "not a supported WAV file";
+            return;
+        }
+        const WAVFile::Header header = wavFile.getHeader();
+        wavFile.close();
+        file.format = wavFile.getAudioFormat();
+        file.sampleRate = wavFile.getSampleRate();
+        file.channelCount = wavFile.getNumChannels();
+        file.frameSize = header.blockAlign;
+        if (file.format == AUDIO_FORMAT_INVALID || file.frameSize == 0) {
+            file.error = "unsupported sample format";
+            return;
+        }
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st {};
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            file.error = strerror(errno);
+            if (fd >= 0) {
+                ::close(fd);
             }
+            return;
+        }
+        const uint64_t fileSize = static_cast<uint64_t>(st.st_size);
+        const uint64_t dataEnd = findTrailingChunks(fd, fileSize, header.dataSize, file.frameSize);
+        ::close(fd);
+        const uint64_t available = dataEnd - kHeaderBytes;
+        const uint64_t availableFrames = available / file.frameSize * file.frameSize;
+        file.trailerBytes = fileSize - dataEnd; // 0 without trailing chunks, a partial last frame is no chunk
+        file.staleHeader = header.dataSize != availableFrames ||
+                           header.riffSize != 36 + header.dataSize + file.trailerBytes;
+        // A zero or oversized data size is a recording that was never finalized: take the data to the trailing
+        // chunks or the file end
+        file.dataBytes = header.dataSize > 0 && header.dataSize <= available
+                             ? header.dataSize / file.frameSize * file.frameSize
+                             : availableFrames;
+    }
 
-            size_t bytesWritten = 0;
-            const size_t bytesToWrite = bytesRead;
-            while (bytesWritten < bytesToWrite && !sExitRequested) {
-                const ssize_t written = audioTrack->write(audioBuffer + bytesWritten, bytesToWrite - bytesWritten);
-                if (written < 0) {
-                    printf("Error: AudioTrack write failed: %zd\n", written);
-                    ALOGE("AudioTrack write failed: %zd", written);
-                    return -1;
+    // End of the data chunk when chunks follow it up to the end of the file, fileSize if there are none.
+    // The data end of the header is tried first; an unfinalized header has none, then every frame boundary in
+    // the last kTrailerScanBytes is tried. Only a chain of chunk headers that ends exactly at the file end
+    // counts, which sample data practically never forms.
+    static uint64_t findTrailingChunks(const int fd, const uint64_t fileSize, const uint32_t headerDataSize,
+                                       const size_t frameSize) {
+        if (fileSize <= kHeaderBytes + 8) {
+            return fileSize;
+        }
+        const uint64_t windowStart =
+            fileSize > kHeaderBytes + kTrailerScanBytes ? fileSize - kTrailerScanBytes : kHeaderBytes;
+        std::vector<char> window(static_cast<size_t>(fileSize - windowStart));
+        if (pread(fd, window.data(), window.size(), static_cast<off_t>(windowStart)) !=
+            static_cast<ssize_t>(window.size())) {
+            return fileSize;
+        }
+        const auto chainEndsAtFileEnd = [&](const uint64_t start) {
+            if (start < windowStart || start >= fileSize) {
+                return false;
+            }
+            size_t at = static_cast<size_t>(start - windowStart);
+            while (at + 8 <= window.size()) {
+                for (size_t i = 0; i < 4; ++i) {
+                    const unsigned char c = static_cast<unsigned char>(window[at + i]);
+                    if (c < 0x20 || c > 0x7e) {
+                        return false;
+                    }
                 }
-                bytesWritten += static_cast<size_t>(written);
+                uint32_t size = 0;
+                memcpy(&size, window.data() + at + 4, sizeof(size));
+                const uint64_t next = static_cast<uint64_t>(at) + 8 + size;
+                // The pad byte of an odd last chunk is often left out
+                if (next == window.size() || next + (size & 1) == window.size()) {
+                    return true;
+                }
+                at = static_cast<size_t>(next + (size & 1));
             }
-            // Update total bytes played
-            totalBytesPlayed += static_cast<uint64_t>(bytesWritten);
+            return false;
+        };
+        // An odd data chunk is followed by a pad byte
+        const auto followedByChunks = [&](const uint64_t dataEnd) {
+            return chainEndsAtFileEnd(dataEnd + ((dataEnd - kHeaderBytes) & 1));
+        };
+        const uint64_t headerEnd = kHeaderBytes + static_cast<uint64_t>(headerDataSize);
+        if (headerDataSize > 0 && followedByChunks(headerEnd)) {
+            return headerEnd;
+        }
+        const uint64_t firstFrame = windowStart + (frameSize - (windowStart - kHeaderBytes) % frameSize) % frameSize;
+        for (uint64_t dataEnd = firstFrame; dataEnd + 8 <= fileSize; dataEnd += frameSize) {
+            if (followedByChunks(dataEnd)) {
+                return dataEnd;
+            }
+        }
+        return fileSize;
+    }
 
-            // Update level meter
-            updateLevelMeter(audioBuffer, bytesRead);
+    // Open the input, and for convert create the output, when the first chunk of a file runs
+    bool acquireFile(FileJob& file) {
+        std::lock_guard<std::mutex> lock(*file.lock);
+        if (file.fd < 0 && file.error.empty()) {
+            file.fd = ::open(file.path.c_str(), mOp == OP_REPAIR ? O_RDWR : O_RDONLY);
+            if (file.fd < 0) {
+                file.error = strerror(errno);
+            } else if (mOp == OP_CONVERT) {
+                openOutputFile(file);
+            }
+        }
+        return file.error.empty();
+    }
 
-            // Report progress
-            reportProgress(audioTrack, totalBytesPlayed, calculateBytesPerSecond());
+    // Close the descriptors after the last chunk of a file
+    void releaseFile(FileJob& file) {
+        std::lock_guard<std::mutex> lock(*file.lock);
+        if (--file.pendingTasks == 0) {
+            closeFile(file);
         }
-        printf("Playback finished: Total bytes played: %" PRIu64 "\n", totalBytesPlayed);
+    }
 
-        return 0;
+    // Create the converted file at its final size, so every chunk can pwrite() its own range
+    void openOutputFile(FileJob& file) {
+        const size_t slash = file.path.rfind('/');
+        file.outPath = mConfig.fileBatchOutDir + "/" +
+                       (slash == std::string::npos ? file.path : file.path.substr(slash + 1));
+        struct stat in {};
+        struct stat out {};
+        if (stat(file.outPath.c_str(), &out) == 0 && fstat(file.fd, &in) == 0 && in.st_ino == out.st_ino &&
+            in.st_dev == out.st_dev) {
+            file.error = "output would overwrite the input";
+            return;
+        }
+        const size_t outSampleBytes = audio_bytes_per_sample(mOutFormat);
+        const uint64_t frames = file.dataBytes / file.frameSize;
+        const uint64_t outBytes = frames * outSampleBytes * file.channelCount;
+        if (outBytes > UINT32_MAX - 36) {
+            file.error = "converted data exceeds the WAV size limit";
+            return;
+        }
+        WAVFile::Header header{};
+        memcpy(header.riffID, "RIFF", 4);
+        memcpy(header.waveID, "WAVE", 4);
+        memcpy(header.fmtID, "fmt ", 4);
+        memcpy(header.dataID, "data", 4);
+        header.fmtSize = 16;
+        header.audioFormat = mOutFormat == AUDIO_FORMAT_PCM_FLOAT ? 3 : 1;
+        header.numChannels = static_cast<uint16_t>(file.channelCount);
+        header.sampleRate = static_cast<uint32_t>(file.sampleRate);
+        header.bitsPerSample = static_cast<uint16_t>(outSampleBytes * 8);
+        header.blockAlign = static_cast<uint16_t>(outSampleBytes * file.channelCount);
+        header.byteRate = header.sampleRate * header.blockAlign;
+        header.dataSize = static_cast<uint32_t>(outBytes);
+        header.riffSize = 36 + header.dataSize;
+        std::ostringstream headerBytes;
+        header.write(headerBytes);
+
+        file.outFd = ::open(file.outPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (file.outFd < 0 || pwrite(file.outFd, headerBytes.str().data(), kHeaderBytes, 0) !=
+                                  static_cast<ssize_t>(kHeaderBytes) ||
+            ftruncate(file.outFd, static_cast<off_t>(kHeaderBytes + outBytes)) != 0) {
+            file.error = String8::format("can't create %s: %s", file.outPath.c_str(), strerror(errno)).c_str();
+        }
     }
-};
 
-/************************** Audio Loopback Operation ******************************/
-class AudioLoopbackOperation : public AudioOperation {
-public:
-    // Constructor for audio loopback operation (record + playback)
-    explicit AudioLoopbackOperation(const AudioConfig& config) : AudioOperation(config) {}
-    ~AudioLoopbackOperation() override = default;
+    // Split a file into chunk tasks; repair is one task per file and touches only the header
+    size_t addTasks(const size_t index, WorkStealingPool<Task>& pool) {
+        FileJob& file = mFiles[index];
+        if (!file.error.empty()) {
+            return 0;
+        }
+        if (mOp == OP_REPAIR) {
+            file.chunks.resize(1);
+            file.pendingTasks = 1;
+            pool.add(Task{index, 0, 0, 0});
+            return 1;
+        }
+        const size_t chunkBytes = kChunkBytes / file.frameSize * file.frameSize;
+        const size_t count = static_cast<size_t>((file.dataBytes + chunkBytes - 1) / chunkBytes);
+        file.chunks.resize(count);
+        file.pendingTasks = count;
+        for (size_t chunk = 0; chunk < count; ++chunk) {
+            const uint64_t offset = static_cast<uint64_t>(chunk) * chunkBytes;
+            pool.add(Task{index, chunk, offset, static_cast<size_t>(std::min<uint64_t>(chunkBytes,
+                                                                                      file.dataBytes - offset))});
+        }
+        return count;
+    }
 
-    // Disable copy operations (inherited from AudioOperation)
-    AudioLoopbackOperation(const AudioLoopbackOperation&) = delete;
-    AudioLoopbackOperation& operator=(const AudioLoopbackOperation&) = delete;
+    void runTask(const Task& task, std::vector<char>& in, std::vector<char>& out) {
+        FileJob& file = mFiles[task.file];
+        if (acquireFile(file)) {
+            processChunk(task, file, in, out);
+        }
+        releaseFile(file);
+    }
 
-    // Execute audio loopback operation (simultaneous recording and playback)
-    int32_t execute() override {
-        WAVFile wavFile;
-        sp<AudioRecord> audioRecord;
-        sp<AudioTrack> audioTrack;
+    void processChunk(const Task& task, FileJob& file, std::vector<char>& in, std::vector<char>& out) {
+        ChunkResult& result = file.chunks[task.chunk];
+        if (mOp == OP_REPAIR) {
+            result.ok = repairHeader(file);
+            return;
+        }
+        if (pread(file.fd, in.data(), task.bytes, static_cast<off_t>(kHeaderBytes + task.offset)) !=
+            static_cast<ssize_t>(task.bytes)) {
+            sLogger.error("%s: read failed at %" PRIu64 "\n", file.path.c_str(), task.offset);
+            return;
+        }
+        switch (mOp) {
+        case OP_STATS:
+            dispatchFormat(file.format,
+                           [&](auto traits) { measureChunk<decltype(traits)>(in.data(), task.bytes, result); });
+            break;
+        case OP_HASH:
+            result.hash = fnv1a64(in.data(), task.bytes, kFnvOffset);
+            break;
+        case OP_CONVERT: {
+            const size_t samples = task.bytes / audio_bytes_per_sample(file.format);
+            const size_t outSampleBytes = audio_bytes_per_sample(mOutFormat);
+            out.resize(samples * outSampleBytes);
+            dispatchFormat(file.format, [&](auto inTraits) {
+                dispatchFormat(mOutFormat, [&](auto outTraits) {
+                    convertChunk<decltype(inTraits), decltype(outTraits)>(in.data(), out.data(), samples);
+                });
+            });
+            const uint64_t outOffset = task.offset / audio_bytes_per_sample(file.format) * outSampleBytes;
+            if (pwrite(file.outFd, out.data(), out.size(), static_cast<off_t>(kHeaderBytes + outOffset)) !=
+                static_cast<ssize_t>(out.size())) {
+                sLogger.error("%s: write failed at %" PRIu64 "\n", file.outPath.c_str(), outOffset);
+                return;
+            }
+            break;
+        }
+        default:
+            return;
+        }
+        result.ok = true;
+    }
 
-        if (!setupWavFileForRecording(wavFile) || !validateAudioParameters()) {
-            printf("Error: Failed to setup WAV file or validate audio parameters\n");
-            return -1;
+    template <typename T> static void measureChunk(const char* data, const size_t bytes, ChunkResult& result) {
+        using Magnitude = typename T::Magnitude;
+        // Integer samples clip at the largest positive code, float samples at 1.0
+        const Magnitude clipLevel = T::kIsFloat ? Magnitude(1) : static_cast<Magnitude>(T::kFullScale - 1);
+        const size_t samples = bytes / T::kBytes;
+        Magnitude peak = 0;
+        typename T::SquareSum squareSum = 0;
+        uint64_t clipped = 0;
+        for (size_t i = 0; i < samples; ++i) {
+            const typename T::Value v = T::load(data, i);
+            const Magnitude m = T::magnitude(v);
+            peak = std::max(peak, m);
+            squareSum += T::square(v);
+            clipped += m >= clipLevel ? 1 : 0;
         }
+        result.peak = static_cast<double>(peak) / T::kFullScale;
+        result.squareSum = static_cast<double>(squareSum) / (static_cast<double>(T::kFullScale) * T::kFullScale);
+        result.samples = samples;
+        result.clipped = clipped;
+    }
 
-        if (!initializeAudioRecord(audioRecord)) {
-            wavFile.close();
-            return -1;
+    template <typename In, typename Out> static void convertChunk(const char* in, char* out, const size_t samples) {
+        for (size_t i = 0; i < samples; ++i) {
+            Out::storeFloat(out, i, In::toFloat(In::load(in, i)));
         }
+    }
 
-        if (!initializeAudioTrack(audioTrack)) {
-            wavFile.close();
-            return -1;
+    static constexpr uint64_t kFnvOffset = 0xcbf29ce484222325ULL;
+    static constexpr uint64_t kFnvPrime = 0x100000001b3ULL;
+
+    static uint64_t fnv1a64(const void* data, const size_t bytes, uint64_t hash) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < bytes; ++i) {
+            hash = (hash ^ p[i]) * kFnvPrime;
         }
+        return hash;
+    }
 
-        // Start recording and playback
-        if (!startAudioComponent(audioRecord)) {
-            wavFile.close();
-            return -1;
+    // Rewrite the RIFF and data sizes from the file size, leaving headers that already match untouched
+    bool repairHeader(FileJob& file) {
+        if (!file.staleHeader) {
+            return true;
         }
-        if (!startAudioComponent(audioTrack)) {
-            stopAudioComponent(audioRecord);
-            wavFile.close();
-            return -1;
+        const uint32_t dataSize = static_cast<uint32_t>(std::min<uint64_t>(file.dataBytes, UINT32_MAX - 36));
+        const uint32_t riffSize = static_cast<uint32_t>(std::min<uint64_t>(36 + dataSize + file.trailerBytes,
+                                                                           UINT32_MAX));
+        if (pwrite(file.fd, &riffSize, 4, 4) != 4 || pwrite(file.fd, &dataSize, 4, 40) != 4 || fsync(file.fd) != 0) {
+            sLogger.error("%s: header write failed: %s\n", file.path.c_str(), strerror(errno));
+            return false;
         }
+        file.repaired = true;
+        return true;
+    }
 
-        // Main loopback loop
-        int32_t operationResult = loopbackLoop(audioRecord, audioTrack, wavFile);
-
-        // Cleanup
-        stopAudioComponent(audioRecord);
-        stopAudioComponent(audioTrack);
-        wavFile.finalize();
-
-        return operationResult;
+    static void closeFile(FileJob& file) {
+        if (file.fd >= 0) {
+            ::close(file.fd);
+            file.fd = -1;
+        }
+        if (file.outFd >= 0) {
+            ::close(file.outFd);
+            file.outFd = -1;
+        }
     }
 
-private:
-    // Main loopback loop for simultaneous recording and playback
-    int32_t loopbackLoop(const sp<AudioRecord>& audioRecord, const sp<AudioTrack>& audioTrack, WAVFile& wavFile) {
-        // Setup buffer
-        BufferManager bufferManager(calculateBufferSize());
-        if (!bufferManager.isValid()) {
-            printf("Error: Failed to create valid buffer manager\n");
-            return -1;
+    // Files of tasks that never ran (interrupted run) are still open
+    void closeFiles() {
+        for (FileJob& file : mFiles) {
+            closeFile(file);
         }
-        char* const audioBuffer = bufferManager.get();
+    }
 
-        if (mConfig.durationSeconds > 0) {
-            printf("Duplex audio started: Recording for %d seconds...\n", mConfig.durationSeconds);
+    // Merge the chunk results of a file; false if a chunk failed
+    static bool mergeChunks(const FileJob& file, ChunkResult& total) {
+        total = ChunkResult();
+        total.hash = kFnvOffset;
+        for (const ChunkResult& chunk : file.chunks) {
+            if (!chunk.ok) {
+                return false;
+            }
+            total.peak = std::max(total.peak, chunk.peak);
+            total.squareSum += chunk.squareSum;
+            total.samples += chunk.samples;
+            total.clipped += chunk.clipped;
+            total.hash = fnv1a64(&chunk.hash, sizeof(chunk.hash), total.hash);
         }
+        total.ok = true;
+        return true;
+    }
 
-        printf("Duplex audio in progress. Press Ctrl+C to stop\n");
-        ALOGI("Duplex audio in progress.");
-        const uint64_t bytesPerSecond = calculateBytesPerSecond();
-        const uint64_t maxBytesToRecord =
-            (mConfig.durationSeconds > 0) ? std::min(static_cast<uint64_t>(mConfig.durationSeconds) * bytesPerSecond,
-                                                     static_cast<uint64_t>(kMaxAudioDataSize))
-                                          : static_cast<uint64_t>(kMaxAudioDataSize);
-        mNextProgressReport = bytesPerSecond * kProgressReportInterval;
+    static double toDbfs(const double linear) { return linear > 0.0 ? 20.0 * std::log10(linear) : -200.0; }
 
-        uint64_t totalBytesRead = 0;
-        uint64_t totalBytesPlayed = 0;
-        bool duplexError = false; // Track if any error occurred during duplex operation
-        while (totalBytesRead < maxBytesToRecord && !sExitRequested && !duplexError) {
-            const ssize_t bytesRead = audioRecord->read(audioBuffer, calculateBufferSize());
-            if (bytesRead < 0) {
-                printf("Error: AudioRecord read failed: %zd\n", bytesRead);
-                ALOGE("AudioRecord read failed: %zd", bytesRead);
-                break;
+    static double rmsDbfs(const ChunkResult& total) {
+        return total.samples > 0 ? toDbfs(std::sqrt(total.squareSum / total.samples)) : -200.0;
+    }
+
+    // Result column of one file for the console and the report
+    std::string describe(FileJob& file, const ChunkResult& total) const {
+        switch (mOp) {
+        case OP_STATS:
+            return String8::format("peak %.2f dBFS, rms %.2f dBFS, clipped %" PRIu64, toDbfs(total.peak),
+                                   rmsDbfs(total), total.clipped)
+                .c_str();
+        case OP_HASH:
+            return String8::format("fnv1a64 %016" PRIx64, total.hash).c_str();
+        case OP_CONVERT:
+            return "-> " + file.outPath;
+        case OP_REPAIR:
+            return file.repaired ? "header repaired" : "header ok";
+        default:
+            return "";
+        }
+    }
+
+    void printReport(const double seconds, const size_t workers, const size_t tasks, const uint64_t steals) {
+        uint64_t bytes = 0;
+        size_t failed = 0;
+        size_t stale = 0;
+        const bool listAll = mFiles.size() <= kMaxListedFiles;
+        printf("\n");
+        for (FileJob& file : mFiles) {
+            ChunkResult total;
+            if (file.error.empty() && !mergeChunks(file, total)) {
+                file.error = "processing failed";
             }
-            if (bytesRead == 0) {
-                continue;
+            // repair reads no sample data, its throughput would be meaningless
+            bytes += file.error.empty() && mOp != OP_REPAIR ? file.dataBytes : 0;
+            failed += file.error.empty() ? 0 : 1;
+            stale += file.staleHeader ? 1 : 0;
+            if (!file.error.empty()) {
+                printf("  %s: Error: %s\n", file.path.c_str(), file.error.c_str());
+            } else if (listAll || (mOp == OP_STATS && total.clipped > 0) || file.repaired) {
+                printf("  %s: %s%s\n", file.path.c_str(), describe(file, total).c_str(),
+                       file.staleHeader && mOp != OP_REPAIR ? " (stale header)" : "");
             }
-            totalBytesRead += static_cast<uint64_t>(bytesRead);
-
-            // Update level meter for recording
-            updateLevelMeter(audioBuffer, static_cast<size_t>(bytesRead));
+        }
+        printf("Batch %s finished: %zu file(s), %zu failed, %zu stale header(s)\n", opName(mOp), mFiles.size(), failed,
+               stale);
+        printf("  %.3f GB in %.3f s: %.3f GB/s on %zu worker(s), %zu task(s), %" PRIu64 " stolen\n", bytes / 1e9,
+               seconds, bytes / 1e9 / seconds, workers, tasks, steals);
+        mProcessedBytes = bytes;
+    }
 
-            // Write to WAV file
-            if (wavFile.writeData(audioBuffer, static_cast<size_t>(bytesRead)) != static_cast<size_t>(bytesRead)) {
-                printf("Error: Failed to save audio data to file\n");
-                // break; // Continue playing if save failed
+    bool writeReport(const double seconds, const size_t workers) {
+        std::ofstream report;
+        if (!openReportFile(report)) {
+            printf("Error: Can't create report file: %s\n", mConfig.reportPath.c_str());
+            return false;
+        }
+        for (FileJob& file : mFiles) {
+            ChunkResult total;
+            const bool ok = file.error.empty() && mergeChunks(file, total);
+            report << String8::format("{\"type\":\"batch_file\",\"op\":\"%s\",\"file\":\"%s\",\"ok\":%s,"
+                                      "\"data_bytes\":%" PRIu64 ",\"stale_header\":%s",
+                                      opName(mOp), file.path.c_str(), ok ? "true" : "false", file.dataBytes,
+                                      file.staleHeader ? "true" : "false")
+                          .c_str();
+            if (!ok) {
+                report << String8::format(",\"error\":\"%s\"}\n", file.error.c_str()).c_str();
+            } else if (mOp == OP_STATS) {
+                report << String8::format(",\"peak_dbfs\":%.3f,\"rms_dbfs\":%.3f,\"clipped\":%" PRIu64 "}\n",
+                                          toDbfs(total.peak), rmsDbfs(total), total.clipped)
+                              .c_str();
+            } else if (mOp == OP_HASH) {
+                report << String8::format(",\"fnv1a64\":\"%016" PRIx64 "\"}\n", total.hash).c_str();
+            } else if (mOp == OP_CONVERT) {
+                report << String8::format(",\"output\":\"%s\"}\n", file.outPath.c_str()).c_str();
+            } else {
+                report << String8::format(",\"repaired\":%s}\n", file.repaired ? "true" : "false").c_str();
             }
+        }
+        report << String8::format("{\"type\":\"batch_summary\",\"op\":\"%s\",\"files\":%zu,\"bytes\":%" PRIu64
+                                  ",\"seconds\":%.3f,\"gb_per_sec\":%.3f,\"workers\":%zu}\n",
+                                  opName(mOp), mFiles.size(), mProcessedBytes, seconds,
+                                  mProcessedBytes / 1e9 / seconds, workers)
+                      .c_str();
+        printf("Batch report saved: %s\n", mConfig.reportPath.c_str());
+        return true;
+    }
 
-            // Report progress for recording
-            reportProgress(audioRecord, totalBytesRead, calculateBytesPerSecond(), &wavFile);
+    Op mOp = OP_INVALID;
+    audio_format_t mOutFormat = AUDIO_FORMAT_INVALID; // convert target
+    std::vector<FileJob> mFiles;
+    uint64_t mProcessedBytes = 0;
+};
 
-            // Check recording finish
-            if (totalBytesRead >= maxBytesToRecord) {
-                break;
-            }
+/************************** Self Test Operation ******************************/
+// Checks of the streaming building blocks on synthetic input, without an audio device or audio server: the
+// multi-source aligner, the callback ring of the aaudio backends, the --trace/--replay round trip, the fan-out
+// ring with a late client and the drift estimators against --sim-ppm. Every expectation prints its measured
+// values; the exit status is the number of failed checks. Built for the host as audio_test_client_selftest.
+class SelfTestOperation : public AudioOperation {
+public:
+    // Constructor for the self test, the checks use their own configurations
+    explicit SelfTestOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~SelfTestOperation() override { removeScratchDirectory(); }
 
-            size_t bytesWritten = 0;
-            const size_t bytesToWrite = static_cast<size_t>(bytesRead);
-            while (bytesWritten < bytesToWrite && !sExitRequested) {
-                const ssize_t written = audioTrack->write(audioBuffer + bytesWritten, bytesToWrite - bytesWritten);
-                if (written < 0) {
-                    printf("Error: AudioTrack write failed: %zd\n", written);
-                    ALOGE("AudioTrack write failed: %zd", written);
-                    duplexError = true;
-                    break;
-                }
-                bytesWritten += static_cast<size_t>(written);
-            }
-            totalBytesPlayed += static_cast<uint64_t>(bytesWritten);
+    // Disable copy operations (inherited from AudioOperation)
+    SelfTestOperation(const SelfTestOperation&) = delete;
+    SelfTestOperation& operator=(const SelfTestOperation&) = delete;
+
+    // Run every check, returns the number that failed
+    int32_t execute() override {
+        if (!createScratchDirectory()) {
+            return -1;
+        }
+        struct Check {
+            const char* name;
+            bool (SelfTestOperation::*run)();
+        };
+        static const Check kChecks[] = {
+            {"multi-source alignment", &SelfTestOperation::checkAligner},
+            {"callback ring", &SelfTestOperation::checkCallbackRing},
+            {"callback input overruns", &SelfTestOperation::checkCallbackInput},
+            {"callback output underruns", &SelfTestOperation::checkCallbackOutput},
+            {"trace and replay", &SelfTestOperation::checkTraceReplay},
+            {"fan-out late client", &SelfTestOperation::checkFanoutLateClient},
+            {"segmented drift fit", &SelfTestOperation::checkSegmentedFit},
+            {"clock drift against --sim-ppm", &SelfTestOperation::checkClockDrift},
+        };
+        int32_t failed = 0;
+        for (const Check& check : kChecks) {
+            printf("== %s\n", check.name);
+            const bool passed = (this->*check.run)();
+            sLogger.flush();
+            sExitRequested = false; // a replay that ran out of trace stops its loop like Ctrl+C
+            printf("%s %s\n", passed ? "PASS" : "FAIL", check.name);
+            failed += passed ? 0 : 1;
+        }
+        printf("Self test: %zu check(s), %d failed\n", sizeof(kChecks) / sizeof(kChecks[0]), failed);
+        return failed;
+    }
+
+private:
+    static constexpr int32_t kSampleRate = 48000;
+
+    // Callback driver whose bursts are delivered by the test, with a settable device xrun count
+    class ManualCallbackDriver : public CallbackStreamDriver {
+    public:
+        explicit ManualCallbackDriver(const int32_t framesPerBurst) : mFramesPerBurst(framesPerBurst) {}
+
+        const char* getName() const override { return "ManualCallback"; }
+        status_t start(Client* client) override {
+            mClient = client;
+            return NO_ERROR;
         }
+        void stop() override {}
+        int32_t getFramesPerBurst() const override { return mFramesPerBurst; }
+        int32_t getXRunCount() override { return xRuns; }
+        bool isDisconnected() const override { return false; }
+        bool getTimestamp(int64_t& /* position */, int64_t& /* timeNs */) override { return false; }
 
-        printf("Loopback audio completed: Total bytes read: %" PRIu64 ", Total bytes played: %" PRIu64
-               ", File saved: %s\n",
-               totalBytesRead, totalBytesPlayed, wavFile.getFilePath().c_str());
+        void burst(void* data) { mClient->onData(data, mFramesPerBurst); }
 
-        return 0;
+        int32_t xRuns = 0;
+
+    private:
+        int32_t mFramesPerBurst;
+        Client* mClient = nullptr;
+    };
+
+    // Print one expectation, true when it holds
+    static bool expect(const bool condition, const std::string& what) {
+        printf("  %s %s\n", condition ? "ok  " : "FAIL", what.c_str());
+        return condition;
     }
-};
 
-/************************** Set Parameters Operation ******************************/
-class SetParamsOperation : public AudioOperation {
-public:
-    // Constructor for parameter setting operation
-    explicit SetParamsOperation(const AudioConfig& config, const std::vector<int32_t>& params)
-        : AudioOperation(config), mTargetParameters(params) {}
-    ~SetParamsOperation() override = default;
+    // Mono 16-bit frames whose samples are consecutive values from first
+    static std::vector<int16_t> counterFrames(const int32_t first, const size_t frames) {
+        std::vector<int16_t> samples(frames);
+        for (size_t f = 0; f < frames; ++f) {
+            samples[f] = static_cast<int16_t>(first + static_cast<int32_t>(f));
+        }
+        return samples;
+    }
 
-    // Disable copy operations (inherited from AudioOperation)
-    SetParamsOperation(const SetParamsOperation&) = delete;
-    SetParamsOperation& operator=(const SetParamsOperation&) = delete;
+    static AudioConfig monoConfig() {
+        AudioConfig config;
+        config.sampleRate = kSampleRate;
+        config.channelCount = 1;
+        config.format = AUDIO_FORMAT_PCM_16_BIT;
+        return config;
+    }
 
-    // Execute parameter setting operation
-    int32_t execute() override {
-        if (mTargetParameters.empty()) {
-            printf("Error: No parameters provided\n");
-            return -1;
+    // Stream 1 starts 10ms after stream 0; every sample holds the frame index of its capture instant, so an
+    // aligned output frame carries the same value in both channels
+    bool checkAligner() {
+        constexpr size_t kFrames = 4800;
+        constexpr int32_t kOffsetFrames = 480;
+        constexpr int64_t kStartNs = 1000000000LL;
+        MultiSourceAligner aligner(2, sizeof(int16_t), kSampleRate, kFrames);
+        const std::vector<int16_t> first = counterFrames(0, kFrames);
+        const std::vector<int16_t> second = counterFrames(kOffsetFrames, kFrames);
+        aligner.push(0, reinterpret_cast<const char*>(first.data()), kFrames);
+        aligner.push(1, reinterpret_cast<const char*>(second.data()), kFrames);
+        aligner.anchor(0, 0, kStartNs, true);
+        aligner.anchor(1, 0, kStartNs + kOffsetFrames * 1000000000LL / kSampleRate, true);
+
+        std::vector<int16_t> merged(2 * kFrames);
+        const size_t frames = aligner.merge(reinterpret_cast<char*>(merged.data()), kFrames);
+        size_t mismatched = 0;
+        for (size_t f = 0; f < frames; ++f) {
+            mismatched += merged[2 * f] != merged[2 * f + 1] ? 1 : 0;
         }
+        const MultiSourceAligner::StreamResult result0 = aligner.getResult(0);
+        const MultiSourceAligner::StreamResult result1 = aligner.getResult(1);
+        bool passed =
+            expect(frames == kFrames - kOffsetFrames,
+                   String8::format("%zu frames merged, expected %zu", frames, kFrames - kOffsetFrames).c_str());
+        passed &= expect(frames > 0 && merged[0] == kOffsetFrames && mismatched == 0,
+                         String8::format("first frame %d/%d, %zu misaligned frame(s)", frames > 0 ? merged[0] : -1,
+                                         frames > 0 ? merged[1] : -1, mismatched)
+                             .c_str());
+        passed &= expect(result0.skippedFrames == kOffsetFrames && result1.skippedFrames == 0,
+                         String8::format("skipped %" PRIu64 "/%" PRIu64 " frames", result0.skippedFrames,
+                                         result1.skippedFrames)
+                             .c_str());
+        passed &= expect(std::fabs(result1.startOffsetMs - 10.0) < 1e-6 && std::fabs(result1.residualStart) < 0.5,
+                         String8::format("start offset %.3f ms, residual %.3f frames", result1.startOffsetMs,
+                                         result1.residualStart)
+                             .c_str());
+        return passed;
+    }
 
-        printf("SetParams operation started with %zu parameters\n", mTargetParameters.size());
-        for (size_t i = 0; i < mTargetParameters.size(); ++i) {
-            printf("  Parameter %zu: %d\n", i + 1, mTargetParameters[i]);
+    // Bytes written and read in uneven pieces wrap around the ring in order; a full ring takes no more
+    bool checkCallbackRing() {
+        CallbackRing ring(10);
+        std::vector<char> in(32);
+        for (size_t i = 0; i < in.size(); ++i) {
+            in[i] = static_cast<char>(i);
+        }
+        std::vector<char> out;
+        char buffer[16];
+        size_t written = ring.write(in.data(), 7);
+        out.insert(out.end(), buffer, buffer + ring.read(buffer, 5));
+        written += ring.write(in.data() + written, 7);
+        const size_t full = ring.write(in.data() + written, 4);
+        const size_t available = ring.available();
+        out.insert(out.end(), buffer, buffer + ring.read(buffer, sizeof(buffer)));
+        bool passed = expect(written == 14 && full == 1 && available == 10,
+                             String8::format("wrote %zu then %zu into a full ring, %zu available", written, full,
+                                             available)
+                                 .c_str());
+        passed &= expect(out.size() == 15 && std::equal(out.begin(), out.end(), in.begin()),
+                         String8::format("read %zu bytes back in order across the wrap", out.size()).c_str());
+        return passed;
+    }
+
+    // An 8-frame ring fed with 3-frame bursts: the ninth frame does not fit and is counted, later bursts wrap
+    // around the ring end, and every device xrun adds one burst
+    bool checkCallbackInput() {
+        auto driver = std::make_unique<ManualCallbackDriver>(3);
+        ManualCallbackDriver* device = driver.get();
+        CallbackInputStream stream(std::move(driver), monoConfig(), 8);
+        stream.start();
+        int32_t next = 0;
+        for (int32_t b = 0; b < 3; ++b, next += 3) {
+            std::vector<int16_t> burst = counterFrames(next, 3);
+            device->burst(burst.data());
         }
+        const uint32_t lost = stream.getOverrunFrames();
+        int16_t frames[8] = {};
+        const ssize_t first = stream.read(frames, 5 * sizeof(int16_t), false);
+        std::vector<int16_t> burst = counterFrames(next, 3);
+        device->burst(burst.data());
+        const ssize_t second = stream.read(frames + 5, 3 * sizeof(int16_t), false);
+        int16_t rest[8] = {};
+        const ssize_t third = stream.read(rest, sizeof(rest), false);
+        device->xRuns = 2;
+
+        const int16_t expected[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+        bool passed = expect(lost == 1, String8::format("%u frame(s) lost to the full ring, expected 1", lost).c_str());
+        passed &= expect(first == 10 && second == 6 && memcmp(frames, expected, sizeof(expected)) == 0,
+                         String8::format("read %zd + %zd bytes, frames 0-7 in order", first, second).c_str());
+        passed &= expect(third == 6 && rest[0] == 9 && rest[1] == 10 && rest[2] == 11,
+                         String8::format("after the wrap read %zd bytes: %d %d %d", third, rest[0], rest[1], rest[2])
+                             .c_str());
+        passed &= expect(stream.getOverrunFrames() == 7,
+                         String8::format("%u overrun frames with 2 device xruns, expected 1 + 2 * 3",
+                                         stream.getOverrunFrames())
+                             .c_str());
+        return passed;
+    }
 
-        int32_t sourceType = mTargetParameters[0];
-        switch (sourceType) {
-        case 1: // open_source
-            if (mTargetParameters.size() >= 2) {
-                int32_t usageValue = mTargetParameters[1];
-                audio_usage_t usage = static_cast<audio_usage_t>(usageValue);
-                printf("Setting open_source with usage: %d\n", usage);
-                mAudioParamManager.setOpenSourceWithUsage(usage);
-            } else {
-                printf("Error: Audio usage parameter is required for open_source\n");
-            }
-            break;
-        case 2: // close_source
-            if (mTargetParameters.size() >= 2) {
-                int32_t usageValue = mTargetParameters[1];
-                audio_usage_t usage = static_cast<audio_usage_t>(usageValue);
-                printf("Setting close_source with usage: %d\n", usage);
-                mAudioParamManager.setCloseSourceWithUsage(usage);
-            } else {
-                printf("Error: Audio usage parameter is required for close_source\n");
+    // Silence before the first write is start-up, a dry ring is one underrun however long it stays dry
+    bool checkCallbackOutput() {
+        auto driver = std::make_unique<ManualCallbackDriver>(3);
+        ManualCallbackDriver* device = driver.get();
+        CallbackOutputStream stream(std::move(driver), monoConfig(), 8);
+        stream.start();
+        int16_t burst[3] = {};
+        device->burst(burst);
+        const uint32_t startUnderruns = stream.getUnderrunCount();
+        const std::vector<int16_t> data = counterFrames(1, 4);
+        stream.write(data.data(), 4 * sizeof(int16_t), false);
+        device->burst(burst);
+        const bool played = burst[0] == 1 && burst[1] == 2 && burst[2] == 3;
+        device->burst(burst);
+        const bool padded = burst[0] == 4 && burst[1] == 0 && burst[2] == 0;
+        device->burst(burst);
+        const uint32_t dryUnderruns = stream.getUnderrunCount();
+        stream.write(data.data(), 3 * sizeof(int16_t), false);
+        device->burst(burst);
+        device->burst(burst);
+        device->xRuns = 1;
+
+        bool passed = expect(startUnderruns == 0, String8::format("%u underrun(s) before the first write",
+                                                                  startUnderruns).c_str());
+        passed &= expect(played && padded, "bursts play the written frames, a short ring is padded with silence");
+        passed &= expect(dryUnderruns == 1,
+                         String8::format("%u underrun(s) for one dry spell of two bursts", dryUnderruns).c_str());
+        passed &= expect(stream.getUnderrunCount() == 3,
+                         String8::format("%u underrun(s) after a second dry spell and 1 device xrun, expected 3",
+                                         stream.getUnderrunCount())
+                             .c_str());
+        return passed;
+    }
+
+    // Trace a sim-fast recording, replay it through the same loop without divergence, then replay it with a
+    // different transfer size: every replayed read diverges
+    bool checkTraceReplay() {
+        AudioConfig config;
+        config.backend = BACKEND_SIM_FAST;
+        config.sampleRate = kSampleRate;
+        config.durationSeconds = 1;
+        config.tracePath = mScratchDir + "/run.trace";
+        config.recordFilePath = mScratchDir + "/traced.wav";
+        AudioRecordOperation traced(config);
+        const int32_t tracedResult = traced.execute();
+        const bool traceError = traced.hasTraceError();
+        const AudioRunStats tracedStats = traced.getRunStats();
+
+        config.backend = BACKEND_REPLAY;
+        config.replayPath = config.tracePath;
+        config.tracePath = "";
+        config.recordFilePath = mScratchDir + "/replay.wav";
+        AudioRecordOperation replayed(config);
+        const int32_t replayResult = replayed.execute();
+        const AudioRunStats replayStats = replayed.getRunStats();
+        const uint64_t divergences = replayed.getReplayDivergences();
+
+        // Smaller transfers: every read asks for another size than the trace recorded
+        config.frameCount = 480;
+        config.recordFilePath = mScratchDir + "/divergent.wav";
+        AudioRecordOperation divergent(config);
+        divergent.execute();
+        const uint64_t divergentCount = divergent.getReplayDivergences();
+
+        bool passed = expect(tracedResult == 0 && !traceError && tracedStats.readCalls > 0,
+                             String8::format("traced run: %" PRIu64 " reads, %" PRIu64 " bytes", tracedStats.readCalls,
+                                             tracedStats.bytesCaptured)
+                                 .c_str());
+        passed &= expect(replayResult == 0 && divergences == 0 && replayStats.readCalls == tracedStats.readCalls &&
+                             replayStats.bytesCaptured == tracedStats.bytesCaptured,
+                         String8::format("replay: %" PRIu64 " reads, %" PRIu64 " bytes, %" PRIu64 " divergence(s)",
+                                         replayStats.readCalls, replayStats.bytesCaptured, divergences)
+                             .c_str());
+        passed &= expect(divergentCount == tracedStats.readCalls,
+                         String8::format("changed transfer size: %" PRIu64 " divergence(s), expected %" PRIu64,
+                                         divergentCount, tracedStats.readCalls)
+                             .c_str());
+        return passed;
+    }
+
+    // A client attaching after the ring wrapped several times starts at the live position, follows the server to
+    // its end without overrun and reads only what was captured after it attached
+    bool checkFanoutLateClient() {
+        constexpr int32_t kServerSeconds = 3;
+        constexpr useconds_t kAttachDelayUs = 1500000;
+        AudioConfig config;
+        config.backend = BACKEND_SIM;
+        config.sampleRate = kSampleRate;
+        config.durationSeconds = kServerSeconds;
+        config.fanoutRingMs = 500;
+        config.fanoutSocketPath = String8::format("@audio_test_selftest_%d", getpid()).c_str();
+        FanoutServerOperation server(config);
+        int32_t serverResult = -1;
+        std::thread serverThread([&]() { serverResult = server.execute(); });
+        usleep(kAttachDelayUs);
+
+        AudioConfig clientConfig;
+        clientConfig.fanoutSocketPath = config.fanoutSocketPath;
+        FanoutClientOperation client(clientConfig);
+        const int32_t clientResult = client.execute();
+        serverThread.join();
+
+        const uint64_t bytesPerSecond =
+            static_cast<uint64_t>(kSampleRate) * config.channelCount * audio_bytes_per_sample(config.format);
+        const uint64_t captured = server.getRunStats().bytesCaptured;
+        const uint64_t read = client.getRunStats().bytesCaptured;
+        bool passed = expect(serverResult == 0 && clientResult == 0,
+                             String8::format("server status %d, client status %d (1 = overrun)", serverResult,
+                                             clientResult)
+                                 .c_str());
+        passed &= expect(read >= bytesPerSecond / 2 && read + bytesPerSecond <= captured,
+                         String8::format("client read %.2f s of the %.2f s captured", read / double(bytesPerSecond),
+                                         captured / double(bytesPerSecond))
+                             .c_str());
+        return passed;
+    }
+
+    // Two segments on the same slope with a step between them and a short third one: the step does not bias
+    // the slope and the short segment is discarded
+    bool checkSegmentedFit() {
+        constexpr double kSlope = 2.4; // 50 ppm of 48 kHz
+        SegmentedFit fit;
+        LinearFit unsegmented;
+        const auto addRange = [&](const double from, const double to, const double step) {
+            for (double x = from; x < to; x += 0.01) {
+                fit.add(x, kSlope * x + step);
+                unsegmented.add(x, kSlope * x + step);
             }
-            break;
-        default:
-            printf("Error: Unknown primary parameter %d (1=open_source, 2=close_source)\n", sourceType);
-            return -1;
+            fit.breakSegment();
+        };
+        addRange(0.0, 2.0, 0.0);
+        addRange(2.0, 5.0, -480.0);
+        addRange(5.0, 5.5, -960.0);
+        bool passed = expect(fit.isValid() && std::fabs(fit.getSlope() - kSlope) < 1e-9,
+                             String8::format("slope %.9f, expected %.9f (unsegmented %.3f)", fit.getSlope(), kSlope,
+                                             unsegmented.getSlope())
+                                 .c_str());
+        passed &= expect(fit.getSegments() == 2 && fit.getDiscarded() == 1,
+                         String8::format("%u segment(s), %u discarded", fit.getSegments(), fit.getDiscarded()).c_str());
+        return passed;
+    }
+
+    // The paced sim backend with distinct capture and render clocks: both estimators see (1+out)/(1+in)-1
+    bool checkClockDrift() {
+        AudioConfig config;
+        config.backend = BACKEND_SIM;
+        config.sampleRate = kSampleRate;
+        config.durationSeconds = 3;
+        config.driftIntervalSeconds = 10;
+        config.simInputPpm = -20.0;
+        config.simOutputPpm = 50.0;
+        ClockDriftOperation drift(config);
+        const int32_t result = drift.execute();
+        const double expected = ((1.0 + config.simOutputPpm * 1e-6) / (1.0 + config.simInputPpm * 1e-6) - 1.0) * 1e6;
+        const double pilot = drift.getPilotPpm();
+        const double timestamps = drift.getTimestampPpm();
+        bool passed = expect(result == 0 && std::fabs(pilot - expected) < 0.05,
+                             String8::format("pilot %+.3f ppm, expected %+.3f", pilot, expected).c_str());
+        passed &= expect(std::fabs(timestamps - expected) < 0.5,
+                         String8::format("timestamps %+.3f ppm, expected %+.3f", timestamps, expected).c_str());
+        return passed;
+    }
+
+    // Trace and WAV files of the checks go to a private directory under $TMPDIR, /data/local/tmp or /tmp
+    bool createScratchDirectory() {
+        const char* base = getenv("TMPDIR");
+        if (base == nullptr || base[0] == '\0') {
+            base = access("/data/local/tmp", W_OK) == 0 ? "/data/local/tmp" : "/tmp";
+        }
+        std::string path = std::string(base) + "/audio_test_selftest.XXXXXX";
+        if (mkdtemp(&path[0]) == nullptr) {
+            printf("Error: Can't create a scratch directory in %s: %s\n", base, strerror(errno));
+            return false;
         }
+        mScratchDir = path;
+        return true;
+    }
 
-        printf("SetParams operation completed\n");
-        return 0;
+    void removeScratchDirectory() {
+        if (mScratchDir.empty()) {
+            return;
+        }
+        for (const char* name : {"run.trace", "traced.wav", "replay.wav", "divergent.wav"}) {
+            unlink((mScratchDir + "/" + name).c_str());
+        }
+        rmdir(mScratchDir.c_str());
+        mScratchDir.clear();
     }
 
-private:
-    std::vector<int32_t> mTargetParameters;
+    std::string mScratchDir;
 };
 
 /************************** Audio Operation Factory ******************************/
@@ -1363,21 +12573,8 @@ private:
 
 public:
     // Factory method to create appropriate audio operation based on mode
-    static std::unique_ptr<AudioOperation> createOperation(AudioMode mode, const AudioConfig& config) {
-        switch (mode) {
-        case MODE_RECORD:
-            return std::make_unique<AudioRecordOperation>(config);
-        case MODE_PLAY:
-            return std::make_unique<AudioPlayOperation>(config);
-        case MODE_LOOPBACK:
-            return std::make_unique<AudioLoopbackOperation>(config);
-        case MODE_SET_PARAMS:
-            return std::make_unique<SetParamsOperation>(config, config.setParams);
-        default:
-            printf("Error: Invalid mode specified: %d\n", static_cast<int>(mode));
-            return nullptr;
-        }
-    }
+    // Defined after BatchOperation, which itself creates operations through this factory
+    static std::unique_ptr<AudioOperation> createOperation(AudioMode mode, const AudioConfig& config);
 };
 
 /************************** Command Line Parser ******************************/
@@ -1386,11 +12583,171 @@ private:
     // Private constructor to prevent instantiation - this is a utility class
     CommandLineParser() = delete;
 
+    // Long-only options, values start above the single-character option range
+    enum LongOption {
+        OPT_REPORT = 256,
+        OPT_BENCH_REPS,
+        OPT_BENCH_BASELINE,
+        OPT_BENCH_THRESHOLD,
+        OPT_BACKEND,
+        OPT_JOBS,
+        OPT_STARTUP,
+        OPT_STARTUP_CYCLES,
+        OPT_FRAMES,
+        OPT_TUNE_TARGET,
+        OPT_TUNE_FLAGS,
+        OPT_TUNE_INTERVAL,
+        OPT_TUNE_TRIALS,
+        OPT_TUNE_FILE,
+        OPT_TUNED,
+        OPT_METRICS,
+        OPT_METRICS_INTERVAL,
+        OPT_PATTERN_OUT,
+        OPT_TIMESTAMPS,
+        OPT_SOURCES,
+        OPT_STAGGER,
+        OPT_PRE_TRIGGER,
+        OPT_POST_TRIGGER,
+        OPT_TRIGGER_LEVEL,
+        OPT_TRIGGER_STEP,
+        OPT_TRIGGER_CLIP,
+        OPT_TRIGGER_OVERRUN,
+        OPT_TRIGGER_FIFO,
+        OPT_GATE,
+        OPT_GATE_RELEASE,
+        OPT_GATE_ATTACK,
+        OPT_GATE_HOLD,
+        OPT_GATE_SPLIT,
+        OPT_CPU,
+        OPT_CPU_SERVER,
+        OPT_EVENT_LOOP,
+        OPT_EVENT_PERIOD,
+        OPT_BATCH_OP,
+        OPT_BATCH_OUT,
+        OPT_SPECTRUM,
+        OPT_SPECTRUM_CHANNELS,
+        OPT_SPECTRUM_FFT,
+        OPT_SPECTRUM_RATE,
+        OPT_SPECTRUM_OUT,
+        OPT_RAW,
+        OPT_FANOUT_SOCKET,
+        OPT_FANOUT_RING,
+        OPT_TRACE,
+        OPT_REPLAY,
+        OPT_REPLAY_REALTIME,
+        OPT_DRIFT_INTERVAL,
+        OPT_SIM_PPM,
+        OPT_ROUTE_STEPPED,
+        OPT_ROUTE_STEP,
+        OPT_ISOLATION,
+        OPT_DSP,
+        OPT_DSP_BLOCK,
+        OPT_PARAMS,
+        OPT_PARAMS_FILE,
+        OPT_PARAMS_CYCLES,
+        OPT_PARAMS_BATCH,
+    };
+
 public:
     // Parse command line arguments and configure audio mode and parameters
     static void parseArguments(int32_t argc, char** argv, AudioMode& mode, AudioConfig& config) {
+        bool helpRequested = false;
+        if (!parseOptions(argc, argv, mode, config, helpRequested)) {
+            showHelp();
+            exit(-1);
+        }
+        if (helpRequested) {
+            showHelp();
+            exit(0);
+        }
+        if (WAVFile::isStdio(config.recordFilePath) && !claimStdoutForRecording(mode, config)) {
+            exit(-1);
+        }
+    }
+
+    // A recording streamed to stdout takes stdout over before any console output is flushed to it.
+    // Modes that derive more file names from the record path (segment list, split segments) can't stream.
+    static bool claimStdoutForRecording(const AudioMode mode, const AudioConfig& config) {
+        const bool streamable = mode == MODE_RECORD || mode == MODE_LOOPBACK || mode == MODE_VERIFY ||
+                                mode == MODE_MULTI_CAPTURE || mode == MODE_FANOUT_CLIENT;
+        if (!streamable || (mode == MODE_RECORD && config.gateAttackDb < 0.0f)) {
+            printf("Error: This mode can't stream its recording to stdout\n");
+            return false;
+        }
+        return StdoutStreamWriter::claimStdout() >= 0;
+    }
+
+    // Parse options into mode and config without exiting, shared by the command line and batch scenario lines.
+    // Returns false on unknown options or malformed values; -h only sets helpRequested.
+    static bool parseOptions(int32_t argc, char** argv, AudioMode& mode, AudioConfig& config, bool& helpRequested) {
+        static const struct option kLongOptions[] = {
+            {"report", required_argument, nullptr, OPT_REPORT},
+            {"bench-reps", required_argument, nullptr, OPT_BENCH_REPS},
+            {"bench-baseline", required_argument, nullptr, OPT_BENCH_BASELINE},
+            {"bench-threshold", required_argument, nullptr, OPT_BENCH_THRESHOLD},
+            {"backend", required_argument, nullptr, OPT_BACKEND},
+            {"jobs", required_argument, nullptr, OPT_JOBS},
+            {"startup", no_argument, nullptr, OPT_STARTUP},
+            {"startup-cycles", required_argument, nullptr, OPT_STARTUP_CYCLES},
+            {"frames", required_argument, nullptr, OPT_FRAMES},
+            {"tune-target", required_argument, nullptr, OPT_TUNE_TARGET},
+            {"tune-flags", required_argument, nullptr, OPT_TUNE_FLAGS},
+            {"tune-interval", required_argument, nullptr, OPT_TUNE_INTERVAL},
+            {"tune-trials", required_argument, nullptr, OPT_TUNE_TRIALS},
+            {"tune-file", required_argument, nullptr, OPT_TUNE_FILE},
+            {"tuned", no_argument, nullptr, OPT_TUNED},
+            {"metrics", required_argument, nullptr, OPT_METRICS},
+            {"metrics-interval", required_argument, nullptr, OPT_METRICS_INTERVAL},
+            {"pattern-out", required_argument, nullptr, OPT_PATTERN_OUT},
+            {"timestamps", no_argument, nullptr, OPT_TIMESTAMPS},
+            {"sources", required_argument, nullptr, OPT_SOURCES},
+            {"stagger", required_argument, nullptr, OPT_STAGGER},
+            {"pre-trigger", required_argument, nullptr, OPT_PRE_TRIGGER},
+            {"post-trigger", required_argument, nullptr, OPT_POST_TRIGGER},
+            {"trigger-level", required_argument, nullptr, OPT_TRIGGER_LEVEL},
+            {"trigger-step", required_argument, nullptr, OPT_TRIGGER_STEP},
+            {"trigger-clip", no_argument, nullptr, OPT_TRIGGER_CLIP},
+            {"trigger-overrun", no_argument, nullptr, OPT_TRIGGER_OVERRUN},
+            {"trigger-fifo", required_argument, nullptr, OPT_TRIGGER_FIFO},
+            {"gate", required_argument, nullptr, OPT_GATE},
+            {"gate-release", required_argument, nullptr, OPT_GATE_RELEASE},
+            {"gate-attack", required_argument, nullptr, OPT_GATE_ATTACK},
+            {"gate-hold", required_argument, nullptr, OPT_GATE_HOLD},
+            {"gate-split", no_argument, nullptr, OPT_GATE_SPLIT},
+            {"cpu", no_argument, nullptr, OPT_CPU},
+            {"cpu-server", required_argument, nullptr, OPT_CPU_SERVER},
+            {"event-loop", no_argument, nullptr, OPT_EVENT_LOOP},
+            {"event-period", required_argument, nullptr, OPT_EVENT_PERIOD},
+            {"batch-op", required_argument, nullptr, OPT_BATCH_OP},
+            {"batch-out", required_argument, nullptr, OPT_BATCH_OUT},
+            {"spectrum", no_argument, nullptr, OPT_SPECTRUM},
+            {"spectrum-channels", required_argument, nullptr, OPT_SPECTRUM_CHANNELS},
+            {"spectrum-fft", required_argument, nullptr, OPT_SPECTRUM_FFT},
+            {"spectrum-rate", required_argument, nullptr, OPT_SPECTRUM_RATE},
+            {"spectrum-out", required_argument, nullptr, OPT_SPECTRUM_OUT},
+            {"raw", no_argument, nullptr, OPT_RAW},
+            {"fanout-socket", required_argument, nullptr, OPT_FANOUT_SOCKET},
+            {"fanout-ring", required_argument, nullptr, OPT_FANOUT_RING},
+            {"trace", required_argument, nullptr, OPT_TRACE},
+            {"replay", required_argument, nullptr, OPT_REPLAY},
+            {"replay-realtime", no_argument, nullptr, OPT_REPLAY_REALTIME},
+            {"drift-interval", required_argument, nullptr, OPT_DRIFT_INTERVAL},
+            {"sim-ppm", required_argument, nullptr, OPT_SIM_PPM},
+            {"route-stepped", no_argument, nullptr, OPT_ROUTE_STEPPED},
+            {"route-step", required_argument, nullptr, OPT_ROUTE_STEP},
+            {"isolation", required_argument, nullptr, OPT_ISOLATION},
+            {"dsp", required_argument, nullptr, OPT_DSP},
+            {"dsp-block", required_argument, nullptr, OPT_DSP_BLOCK},
+            {"params", required_argument, nullptr, OPT_PARAMS},
+            {"params-file", required_argument, nullptr, OPT_PARAMS_FILE},
+            {"params-cycles", required_argument, nullptr, OPT_PARAMS_CYCLES},
+            {"params-batch", required_argument, nullptr, OPT_PARAMS_BATCH},
+            {nullptr, 0, nullptr, 0},
+        };
+
+        optind = 0; // full rescan, so the parser can run once per batch scenario line
         int32_t opt = 0;
-        while ((opt = getopt(argc, argv, "m:s:r:c:f:I:u:O:F:d:P:h:")) != -1) {
+        while ((opt = getopt_long(argc, argv, "m:s:r:c:f:I:u:O:F:d:P:h:", kLongOptions, nullptr)) != -1) {
             switch (opt) {
             case 'm': // mode
                 mode = static_cast<AudioMode>(atoi(optarg));
@@ -1425,16 +12782,276 @@ public:
             case 'P': // audio file path (input for play, output for record/loopback)
                 if (mode == MODE_PLAY) {
                     config.playFilePath = optarg;
-                } else if ((mode == MODE_RECORD) || (mode == MODE_LOOPBACK)) {
+                } else if (mode == MODE_PLAYLIST) {
+                    config.playlistPaths.push_back(optarg);
+                } else if ((mode == MODE_RECORD) || (mode == MODE_LOOPBACK) || (mode == MODE_VERIFY) ||
+                           (mode == MODE_MULTI_CAPTURE) || (mode == MODE_PRE_TRIGGER) || (mode == MODE_BENCHMARK) ||
+                           (mode == MODE_FANOUT_CLIENT)) {
                     config.recordFilePath = optarg;
                 }
                 break;
+            case OPT_REPORT: // machine-readable report output path
+                config.reportPath = optarg;
+                break;
+            case OPT_BENCH_REPS: // benchmark repetitions per case
+                config.benchRepetitions = atoi(optarg);
+                break;
+            case OPT_BENCH_BASELINE: // benchmark baseline report
+                config.benchBaselinePath = optarg;
+                break;
+            case OPT_BENCH_THRESHOLD: // benchmark regression threshold in percent
+                config.benchThresholdPercent = static_cast<float>(atof(optarg));
+                break;
+            case OPT_BACKEND: // stream backend
+                config.backend = AudioUtils::parseBackendOption(optarg);
+                break;
+            case OPT_JOBS: // concurrent batch runs or file batch workers
+                config.batchJobs = std::max(atoi(optarg), 0);
+                break;
+            case OPT_STARTUP: // startup phase breakdown
+                config.startupReport = true;
+                break;
+            case OPT_STARTUP_CYCLES: // repeated open/start/stop cycles
+                config.startupCycles = atoi(optarg);
+                if (config.startupCycles < 0) {
+                    printf("Error: Invalid startup cycles: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case OPT_FRAMES: // explicit stream buffer frames
+                config.frameCount = static_cast<size_t>(std::max(atoi(optarg), 0));
+                break;
+            case OPT_TUNE_TARGET: // mode whose buffer is tuned
+                if (strcmp(optarg, "record") == 0) {
+                    config.tuneTarget = MODE_RECORD;
+                } else if (strcmp(optarg, "play") == 0) {
+                    config.tuneTarget = MODE_PLAY;
+                } else if (strcmp(optarg, "loopback") == 0) {
+                    config.tuneTarget = MODE_LOOPBACK;
+                } else {
+                    printf("Error: Unknown tune target: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case OPT_TUNE_FLAGS: // comma separated flags to sweep
+                config.tuneFlags.clear();
+                for (const char* p = optarg; *p != '\0';) {
+                    char* end = nullptr;
+                    config.tuneFlags.push_back(static_cast<int32_t>(strtol(p, &end, 0)));
+                    if (end == p) {
+                        printf("Error: Invalid tune flags: %s\n", optarg);
+                        return false;
+                    }
+                    p = (*end == ',') ? end + 1 : end;
+                }
+                break;
+            case OPT_TUNE_INTERVAL: // measured time per trial
+                config.tuneIntervalMs = atoi(optarg);
+                break;
+            case OPT_TUNE_TRIALS: // clean trials needed per size
+                config.tuneTrials = atoi(optarg);
+                break;
+            case OPT_TUNE_FILE: // tuning results file
+                config.tuneFilePath = optarg;
+                break;
+            case OPT_TUNED: // apply saved tuning
+                config.useTuning = true;
+                break;
+            case OPT_METRICS: // live metrics page
+                config.metricsPath = optarg;
+                break;
+            case OPT_METRICS_INTERVAL: // live metrics publish/poll period
+                config.metricsIntervalMs = atoi(optarg);
+                break;
+            case OPT_PATTERN_OUT: // bit-exact pattern export
+                config.patternOutPath = optarg;
+                break;
+            case OPT_TIMESTAMPS: // per-read timestamp sidecar
+                config.timestampSidecar = true;
+                break;
+            case OPT_SOURCES: // comma separated sources captured together
+                config.captureSources.clear();
+                for (const char* p = optarg; *p != '\0';) {
+                    char* end = nullptr;
+                    config.captureSources.push_back(static_cast<int32_t>(strtol(p, &end, 0)));
+                    if (end == p) {
+                        printf("Error: Invalid sources: %s\n", optarg);
+                        return false;
+                    }
+                    p = (*end == ',') ? end + 1 : end;
+                }
+                break;
+            case OPT_STAGGER: // delay between source starts
+                config.sourceStaggerMs = atoi(optarg);
+                break;
+            case OPT_PRE_TRIGGER: // seconds kept before a trigger
+                config.preTriggerSeconds = atoi(optarg);
+                break;
+            case OPT_POST_TRIGGER: // seconds saved after a trigger
+                config.postTriggerSeconds = atoi(optarg);
+                break;
+            case OPT_TRIGGER_LEVEL: // peak threshold in dBFS
+                config.triggerLevelDb = static_cast<float>(atof(optarg));
+                break;
+            case OPT_TRIGGER_STEP: // sample step threshold in dBFS
+                config.triggerStepDb = static_cast<float>(atof(optarg));
+                break;
+            case OPT_TRIGGER_CLIP: // full-scale runs
+                config.triggerClip = true;
+                break;
+            case OPT_TRIGGER_OVERRUN: // lost frames
+                config.triggerOverrun = true;
+                break;
+            case OPT_TRIGGER_FIFO: // trigger command FIFO
+                config.triggerFifoPath = optarg;
+                break;
+            case OPT_GATE: // level gate attack threshold in dBFS
+                config.gateAttackDb = static_cast<float>(atof(optarg));
+                break;
+            case OPT_GATE_RELEASE: // level gate release threshold in dBFS
+                config.gateReleaseDb = static_cast<float>(atof(optarg));
+                break;
+            case OPT_GATE_ATTACK: // level gate attack time
+                config.gateAttackMs = std::max(atoi(optarg), 0);
+                break;
+            case OPT_GATE_HOLD: // level gate hold time
+                config.gateHoldMs = std::max(atoi(optarg), 0);
+                break;
+            case OPT_GATE_SPLIT: // one file per gated segment
+                config.gateSplit = true;
+                break;
+            case OPT_CPU: // CPU, context switch and page fault accounting
+                config.cpuUsage = true;
+                break;
+            case OPT_CPU_SERVER: // also account a server process, implies --cpu
+                config.cpuUsage = true;
+                config.cpuServer = optarg;
+                break;
+            case OPT_EVENT_LOOP: // single-thread non-blocking duplex loop
+                config.eventLoop = true;
+                break;
+            case OPT_EVENT_PERIOD: // event loop timer period, implies --event-loop
+                config.eventLoop = true;
+                config.eventPeriodMs = std::max(atoi(optarg), 0);
+                break;
+            case OPT_BATCH_OP: // file batch operation
+                config.fileBatchOp = optarg;
+                break;
+            case OPT_BATCH_OUT: // file batch output directory
+                config.fileBatchOutDir = optarg;
+                break;
+            case OPT_SPECTRUM: // spectrum monitor on the console
+                config.spectrum = true;
+                break;
+            case OPT_SPECTRUM_CHANNELS: // comma separated analyzed channels, implies --spectrum
+                config.spectrum = true;
+                config.spectrumChannels.clear();
+                for (const char* p = optarg; *p != '\0';) {
+                    char* end = nullptr;
+                    config.spectrumChannels.push_back(static_cast<int32_t>(strtol(p, &end, 0)));
+                    if (end == p) {
+                        printf("Error: Invalid spectrum channels: %s\n", optarg);
+                        return false;
+                    }
+                    p = (*end == ',') ? end + 1 : end;
+                }
+                break;
+            case OPT_SPECTRUM_FFT: // FFT size, implies --spectrum
+                config.spectrum = true;
+                config.spectrumFftSize = atoi(optarg);
+                break;
+            case OPT_SPECTRUM_RATE: // analyses per second, implies --spectrum
+                config.spectrum = true;
+                config.spectrumRate = static_cast<float>(atof(optarg));
+                if (config.spectrumRate <= 0.0f) {
+                    printf("Error: Invalid spectrum rate: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case OPT_SPECTRUM_OUT: // binary spectrum file, implies --spectrum
+                config.spectrum = true;
+                config.spectrumPath = optarg;
+                break;
+            case OPT_RAW: // headerless PCM record/play files
+                config.rawPcm = true;
+                break;
+            case OPT_FANOUT_SOCKET: // fan-out server socket
+                config.fanoutSocketPath = optarg;
+                break;
+            case OPT_FANOUT_RING: // fan-out ring length in ms
+                config.fanoutRingMs = atoi(optarg);
+                if (config.fanoutRingMs < 100) {
+                    printf("Error: Invalid fan-out ring length: %s (minimum 100 ms)\n", optarg);
+                    return false;
+                }
+                break;
+            case OPT_TRACE: // stream call trace output
+                config.tracePath = optarg;
+                break;
+            case OPT_REPLAY: // trace to replay, implies the replay backend
+                config.replayPath = optarg;
+                config.backend = BACKEND_REPLAY;
+                break;
+            case OPT_REPLAY_REALTIME: // replay with the recorded timing
+                config.replayRealtime = true;
+                break;
+            case OPT_DRIFT_INTERVAL: // drift time series period
+                config.driftIntervalSeconds = atoi(optarg);
+                if (config.driftIntervalSeconds <= 0) {
+                    printf("Error: Invalid drift interval: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case OPT_SIM_PPM: // simulated capture[,render] clock offsets
+                if (sscanf(optarg, "%lf,%lf", &config.simInputPpm, &config.simOutputPpm) < 1) {
+                    printf("Error: Invalid simulated clock offsets: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case OPT_ROUTE_STEPPED: // one routing tone at a time
+                config.routeStepped = true;
+                break;
+            case OPT_ROUTE_STEP: // routing step length in ms
+                config.routeStepMs = atoi(optarg);
+                break;
+            case OPT_ISOLATION: // minimum routing isolation in dB
+                config.routeIsolationDb = atof(optarg);
+                break;
+            case OPT_DSP: // DSP stage graph spec
+                config.dspSpec = optarg;
+                break;
+            case OPT_DSP_BLOCK: // DSP block size in frames
+                config.dspBlockFrames = atoi(optarg);
+                if (config.dspBlockFrames <= 0) {
+                    printf("Error: Invalid DSP block size: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case OPT_PARAMS: // batched key=value operations
+                config.paramList = optarg;
+                break;
+            case OPT_PARAMS_FILE: // batched operations file
+                config.paramFilePath = optarg;
+                break;
+            case OPT_PARAMS_CYCLES: // repetitions of the batch
+                config.paramCycles = atoi(optarg);
+                if (config.paramCycles <= 0) {
+                    printf("Error: Invalid parameter cycles: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case OPT_PARAMS_BATCH: // keys per setParameters call
+                config.paramBatchSize = atoi(optarg);
+                if (config.paramBatchSize < 0) {
+                    printf("Error: Invalid parameter batch size: %s\n", optarg);
+                    return false;
+                }
+                break;
             case 'h': // help for use
-                showHelp();
-                exit(0);
+                helpRequested = true;
+                break;
             default:
-                showHelp();
-                exit(-1);
+                return false;
             }
         }
 
@@ -1461,11 +13078,25 @@ public:
             if (optind < argc) {
                 if (mode == MODE_PLAY) {
                     config.playFilePath = argv[optind];
-                } else if ((mode == MODE_RECORD) || (mode == MODE_LOOPBACK)) {
+                } else if (mode == MODE_PLAYLIST) {
+                    config.playlistPaths.insert(config.playlistPaths.end(), argv + optind, argv + argc);
+                } else if ((mode == MODE_RECORD) || (mode == MODE_LOOPBACK) || (mode == MODE_VERIFY) ||
+                           (mode == MODE_MULTI_CAPTURE) || (mode == MODE_PRE_TRIGGER) || (mode == MODE_FANOUT_CLIENT)) {
                     config.recordFilePath = argv[optind];
+                } else if (mode == MODE_BATCH) {
+                    config.batchScenarioPath = argv[optind];
+                } else if (mode == MODE_METRICS_READER) {
+                    config.metricsReadPaths.assign(argv + optind, argv + argc);
+                } else if (mode == MODE_VERIFY_FILE) {
+                    config.verifyPaths.assign(argv + optind, argv + argc);
+                } else if (mode == MODE_TIMESTAMP_DUMP) {
+                    config.timestampReadPaths.assign(argv + optind, argv + argc);
+                } else if (mode == MODE_FILE_BATCH) {
+                    config.fileBatchPaths.assign(argv + optind, argv + argc);
                 }
             }
         }
+        return true;
     }
 
     // Display comprehensive help information for command line usage
@@ -1478,7 +13109,23 @@ Modes:
   -m0   Record mode
   -m1   Play mode
   -m2   Loopback mode (record and play simultaneously, echo test)
+  -m3   Tuner mode (find the smallest glitch-free buffer size)
+  -m4   Bit-exact verify mode (play a test pattern, verify the capture block by block)
+  -m5   Multi-source capture mode (several sources aligned into one multichannel file)
+  -m6   Pre-trigger capture mode (keep the last seconds in memory, save them when a trigger fires)
+  -m7   Playlist mode (play many WAV files back to back without gaps)
+  -m8   Fan-out server mode (one capture shared with -m206 clients through a shared-memory ring)
+  -m9   Clock drift mode (ppm offset between the render and capture clocks, from a pilot tone and timestamps)
+  -m10  Routing mode (channel-to-channel routing and crosstalk matrix from one tone per output channel)
   -m100 Set params mode (set audio parameters without playback/recording)
+  -m200 Benchmark mode (WAV I/O and level meter microbenchmarks, no audio device)
+  -m201 Batch mode (run every configuration of a scenario file in one process)
+  -m202 Metrics reader mode (watch the --metrics pages of running instances)
+  -m203 Bit-exact check mode (verify captured WAV files offline, no audio device)
+  -m204 Timestamp dump mode (print a --timestamps sidecar with gap and jitter analysis)
+  -m205 File batch mode (stats/convert/hash/repair many WAV files on all cores, no audio device)
+  -m206 Fan-out client mode (read the capture of a running -m8 server, optionally into a file)
+  -m207 Self test mode (checks of the streaming building blocks on synthetic input, no audio device)
 
 Record Options:
   -s{inputSource}     Set audio source
@@ -1573,6 +13220,192 @@ Common Options:
   -F{minFrameCount}   Set play/record min frame count (default: system selected)
   -P{filePath}        Audio file path (input for play, output for record/loopback)
   -h                  Show this help message
+  --report {file}     Write machine-readable report (JSON Lines) to file, replaced once per run
+  --backend {name}    Stream backend for record/play/loopback
+                       legacy: AudioRecord/AudioTrack (default)
+                       sim: stand-in streams paced to real time, no audio server needed
+                       sim-fast: stand-in streams running as fast as possible
+                       aaudio: AAudio exclusive low-latency (MMAP) streams with data callbacks
+                       aaudio-fake: host stand-in for aaudio, callbacks from a thread paced to real time
+                       replay: replay the calls of a --trace file (see --replay)
+  --frames {n}        Stream buffer frames, transferred in halves (default: 2 x max(minFrameCount, 10ms))
+  --tuned             Use the buffer size and flags saved by -m3 for this setup (see --tune-file)
+  --metrics {file}    Publish live metrics (bytes, per-channel peaks, xruns, read/write call times)
+                      to a shared memory-mapped file, read with -m202
+  --metrics-interval {ms} Publish period (default: 100), or poll period for -m202 (default: 1000)
+
+Benchmark Options:
+  --bench-reps {n}        Timed repetitions per case, median is reported (default: 5)
+  --bench-baseline {file} Compare with a previous --report file, exit 1 on regression
+  --bench-threshold {pct} Allowed throughput drop in percent (default: 10)
+  -P{filePath}            Scratch WAV file (default: /data/local/tmp/audio_test_bench.wav)
+
+Batch Options:
+  Usage: audio_test_client -m201 [--jobs {n}] [--report {file}] [defaults...] scenario_file
+  Each scenario line is "<name> <options>" using the options above, e.g. "rec48k -m0 -r48000 -c2 -d2".
+  Options given before the scenario file are defaults for every line. Lines starting with # are ignored.
+  Recordings without -P are saved to /data/batch_<name>.wav.
+  --jobs {n}              Scenarios run concurrently (default: 1)
+
+File Batch Options:
+  Usage: audio_test_client -m205 [--batch-op {op}] [--jobs {n}] [--report {file}] {dir|pattern|list|file}...
+  Files are split into 4 MiB chunks processed by a work-stealing pool; GB/s and steals are printed at the end.
+  Headers of truncated recordings are detected from the file size and the data is read to the file end.
+  --batch-op {op}         stats: peak/RMS level and clipped samples (default)
+                          convert: rewrite every file in the -f format into --batch-out
+                          hash: FNV-1a 64 content hash, comparable between runs
+                          repair: fix the RIFF/data sizes of truncated headers in place
+  --batch-out {dir}       Output directory of convert, created if missing
+  --jobs {n}              Worker threads (default: all cores)
+
+Tuner Options:
+  Usage: audio_test_client -m3 [--tune-target {mode}] [--tune-flags {f1,f2...}] [-r -c -f -s -u -I -O]
+  Doubles the buffer from 2ms until a size stays clean, then bisects down to 1ms granularity.
+  A size is clean when no underrun/overrun is counted and no transfer gap exceeds the buffer.
+  --tune-target {mode}    Tuned mode: record, play (default) or loopback
+  --tune-flags {list}     Comma separated flags to sweep, output flags unless the target is record
+                          (default: the -O/-I flag)
+  --tune-interval {ms}    Measured time per trial after a 200ms warm-up (default: 1000)
+  --tune-trials {n}       Consecutive clean trials required per size (default: 2)
+  --tune-file {file}      Tuning results (default: /data/local/tmp/audio_test_tuning.txt)
+
+Metrics Reader Options:
+  Usage: audio_test_client -m202 [--metrics-interval {ms}] [-d{seconds}] [--report {file}] file...
+  Prints every new snapshot of each file until all runs finished, -d seconds passed or Ctrl+C.
+  --report {file}         Also dump the snapshots as JSON Lines
+  Batch runs publish to "<file>.<scenario name>" when --metrics is given before the scenario file.
+
+Bit-Exact Options:
+  -m4 plays a self-synchronizing pattern (block counter + PRBS) and captures it with the record options;
+  the capture is saved like in loopback mode. Formats: -f1, -f3, -f4, -f6.
+  Usage: audio_test_client -m203 [--report {file}] capture.wav...
+  --pattern-out {file}    -m203: write the pattern as WAV instead (-r, -c, -f1/-f3/-f6, -d seconds, default 10)
+  Exit status is 0 when bit-exact, 1 when not.
+
+Timestamp Options:
+  --timestamps            Record/loopback: write "<wav file>.ts" with frame offset, size, return time and
+                          stream timestamp of every read
+  Usage: audio_test_client -m204 [--report {file}] file.ts...
+  Prints every read, then gaps, read jitter, capture latency and the device rate; with --report the reads
+  are saved as JSON Lines instead of printed.
+
+Multi-Source Options:
+  Usage: audio_test_client -m5 --sources {s1,s2...} [-r -c -f -I -d] [file]
+  Every source is opened with the record options; source i is saved as channels [i*c, (i+1)*c).
+  The streams are aligned on their timestamps, the residual offset per source is reported in frames.
+  --sources {list}        Comma separated sources, e.g. 1,1997 for MIC + ECHO_REFERENCE
+  --stagger {ms}          Delay between starting consecutive sources (default: 0)
+
+Pre-Trigger Options:
+  Usage: audio_test_client -m6 [--pre-trigger {s}] [--post-trigger {s}] [triggers] [-r -c -f -s -I -d] [file]
+  Saves --pre-trigger seconds before and --post-trigger seconds after every trigger to "<file>_<n>.wav".
+  SIGUSR1 is always a trigger. -d limits the run time (default: until Ctrl+C).
+  --pre-trigger {s}       Seconds kept in memory before a trigger (default: 10)
+  --post-trigger {s}      Seconds saved after a trigger (default: 5)
+  --trigger-level {dBFS}  Trigger when a sample peak reaches the level, e.g. -3
+  --trigger-step {dBFS}   Trigger when consecutive samples of a channel differ by more, e.g. -12 (pops, dropouts)
+  --trigger-clip          Trigger on 3 consecutive samples at full scale
+  --trigger-overrun       Trigger when the stream reports lost frames
+  --trigger-fifo {file}   Create a FIFO, every line written to it is a trigger (echo label > file)
+
+Playlist Options:
+  Usage: audio_test_client -m7 [-u -O -F --frames] [--report {file}] {dir|pattern|list|file.wav}...
+  A directory plays its .wav files sorted by name; a quoted pattern is expanded like the shell;
+  any other file that is not a .wav is a list with one path per line (relative to the list, # comment).
+  The next file is opened and its first 250ms read ahead while the current one plays. Files with the same
+  format share one output stream, a format change reopens it. Start frame, load/wait time and underruns
+  are reported per file.
+
+Level Gate Options (record):
+  Writes only the regions where the RMS level is active, plus 100ms before each; a "<file>.segments" list maps
+  them to capture frame and time. The written/captured ratio is printed at the end.
+  --gate {dBFS}           Attack threshold opening the gate, e.g. -45 (default: off, record everything)
+  --gate-release {dBFS}   Release threshold keeping the gate open (default: 6dB below --gate)
+  --gate-attack {ms}      Time at or above the attack threshold before the gate opens (default: 0)
+  --gate-hold {ms}        Time below the release threshold before the gate closes (default: 500)
+  --gate-split            Save every segment as "<file>_<n>.wav" instead of one file
+
+CPU Usage Options (record/play/loopback/multi-source/playlist):
+  --cpu                   Print user/system CPU time, wakeups, preemptions and page faults of each loop thread
+                          and of the process at exit, per second of audio; --report saves them as JSON
+  --cpu-server {name}     Also account the process with this name, e.g. audioserver (implies --cpu)
+
+Event Loop Options (loopback):
+  --event-loop            Service capture, render and the file from one timer driven thread with non-blocking
+                          reads and writes, through a 4-buffer render FIFO; wakeups and FIFO depth are printed
+  --event-period {ms}     Timer period (default: half the transfer buffer; implies --event-loop)
+
+Streaming Options:
+  -                       As file path: -m0/-m2/-m4/-m5/-m206 stream the recording to stdout, -m1 plays from stdin.
+                          The WAV header carries 0xFFFFFFFF sizes (length unknown), nothing is seeked back.
+                          Console output moves to stderr, or is dropped when stderr is stdout (adb exec-out).
+                          Not with --gate, which also writes a segment list next to the recording.
+  --raw                   Headerless PCM instead of WAV for the record/play file or stream; when playing,
+                          the layout comes from -r, -c and -f
+
+Fan-Out Options:
+  Usage: audio_test_client -m8 [record options] [-d] [--fanout-ring {ms}] [--fanout-socket {path}]
+         audio_test_client -m206 [-d] [--fanout-socket {path}] [file.wav|-]
+  The server captures into a sealed shared ring and never waits for clients; each client maps the ring read-only,
+  copies every chunk out of it once (not zero-copy) from the live position at its own pace and reports overruns
+  (data lost because it fell a ring behind).
+  Clients take rate/channels/format from the server and report their statistics to it when they leave.
+  --fanout-socket {path}  UNIX socket of the server, '@name' for an abstract socket
+                          (default: /data/local/tmp/audio_test_fanout.sock)
+  --fanout-ring {ms}      Ring length, how far a client may fall behind (default: 2000)
+
+Clock Drift Options:
+  Usage: audio_test_client -m9 [record and play options] [-d] [--drift-interval {s}] [--report {file}]
+  Plays a 1kHz pilot at -12dBFS on every channel; the capture (channel 0) must hear it through a loopback path.
+  The phase walk of the captured pilot and the frame position/CLOCK_MONOTONIC slopes of both streams' timestamps
+  each give the render clock offset relative to the capture clock, printed as a time series with 95% confidence
+  intervals. Positive ppm: the render clock is faster. The pilot estimate covers +-5000 ppm.
+  --drift-interval {s}    Time series period (default: 10); --report saves it as JSON lines
+  --sim-ppm {in}[,{out}]  Clock offsets of the sim backends in ppm; the simulated capture hears its tone as
+                          played on the simulated render clock, so -m9 --backend sim measures out - in
+
+Routing Options:
+  Usage: audio_test_client -m10 [record and play options] [--route-stepped] [--route-step {ms}] [--isolation {dB}]
+  Output channel c plays 1050 + 40*m[c] Hz at -12dBFS (m: 0,1,4,11,26,32,56,68,76,115,117,134,150,163,168,177,
+  a Golomb ruler, so no 2nd/3rd order intermodulation lands on a tone; 16 channels reach 8130 Hz). A Goertzel
+  bank measures every tone on every input channel during the second half of each step. Prints the output x input
+  level matrix (dBFS), the input each output reaches loudest and its isolation from the next loudest input;
+  --report saves one JSON line per output.
+  --route-stepped         One output channel per step instead of all at once (channels x step in total)
+  --route-step {ms}       Step length (min 400); the first half absorbs the round-trip latency (default: 1000)
+  --isolation {dB}        Fail (exit status 1) when a route's isolation is below this (default: only detection)
+
+DSP Options (record/play/loopback):
+  Float stages between source and sink: capture -> file (record), file -> stream (play), capture -> render
+  (loopback, the file keeps the capture). Prints the CPU time of every stage at the end.
+  --dsp {stages}          Comma-separated stages, parameters separated by ':':
+                          gain:<dB>, fade:<in ms>[:<out ms>] (fade-out needs -d or a file length),
+                          lp|hp:<Hz>[:<Q>], peak|lowshelf|highshelf:<Hz>:<dB>[:<Q>] (consecutive filters form
+                          one biquad cascade), mix:<channels> (record/play only; downmix averages input i
+                          into output i % channels, upmix copies input o % inputs to output o)
+  --dsp-block {frames}    Processing block size (default: 256)
+
+Trace/Replay Options (record/play/loopback):
+  --trace {file}          Log every stream read/write (requested size, result or status, blocking, start time,
+                          duration) and overrun/underrun query into a compact binary trace (24 bytes per call)
+  --replay {file}         Replay a trace through the same loops on any host (implies --backend replay): reads
+                          and writes return the recorded results, read data is a 1kHz sine following the frame
+                          position. Use the recorded -r/-c/-f and loop options; calls that differ from the trace
+                          are reported as divergences and make the exit status non-zero
+  --replay-realtime       Hold every call until its recorded return time (default: as fast as possible)
+
+Spectrum Options (record/loopback):
+  --spectrum              Analyze the capture on a side thread: Hann window + FFT per channel, printing the
+                          3 strongest peaks (Hz/dBFS) and octave band levels (dBFS); capture never waits for it
+  --spectrum-channels {list} Comma separated channels to analyze (default: all; implies --spectrum)
+  --spectrum-fft {n}      FFT size, power of two 256..65536 (default: 4096; implies --spectrum)
+  --spectrum-rate {hz}    Analyses per second, newer windows are skipped in between (default: 4; implies --spectrum)
+  --spectrum-out {file}   Write binary spectrum records to this file instead of the console (implies --spectrum)
+
+Startup Options (record/play/loopback):
+  --startup               Print time spent in each startup phase, from process entry to the first frame
+  --startup-cycles {n}    Repeat open/start/first frame/stop/close n times instead of streaming,
+                          cycle 0 is cold, the others are warm; --report saves every cycle and a summary
 
 Set Params Options:
   Parameters format: audio_test_client -m100 param1[,param2[,param3...]]
@@ -1584,6 +13417,15 @@ Set Params Options:
                        2: AUDIO_USAGE_VOICE_COMMUNICATION
                        ... (see usage)
     param3+           Additional parameters (reserved for future use)
+  Batch format: audio_test_client -m100 [--params {k=v;...}] [--params-file {file}] [--params-cycles {n}]
+  Sends many key=value operations in one process and times every AudioSystem::setParameters round trip.
+  Consecutive operations share one call until a key repeats, an empty ';;' segment or blank file line, or the
+  --params-batch limit. open_source/close_source accept a usage number. Prints each call of the first cycle and
+  per-key cold/warm latency; --report saves one JSON line per key. Exit status 1 when a call failed.
+  --params {k=v;...}      Operations, ';' separated (after the --params-file operations)
+  --params-file {file}    One or more ';' separated pairs per line, '#' comments
+  --params-cycles {n}     Send the whole batch n times, e.g. open/close cycles (default: 1)
+  --params-batch {n}      At most n keys per call, 1 = no coalescing (default: 0 = unlimited)
 
 For more details, please refer to system/media/audio/include/system/audio-hal-enums.h
 
@@ -1592,20 +13434,368 @@ Examples:
   Play:   audio_test_client -m1 -u1 -O0 -F960 -P/data/audio_test.wav
   Loopback: audio_test_client -m2 -s1 -r48000 -c2 -f1 -I0 -u1 -O0 -F960 -d20
   SetParams: audio_test_client -m100 1,1
+  SetParams batch: audio_test_client -m100 --params "open_source=1;;close_source=1" --params-cycles 50
+  Benchmark: audio_test_client -m200 --report /data/local/tmp/bench.jsonl
+  Batch:  audio_test_client -m201 --jobs 2 --report /data/batch.jsonl /data/scenarios.txt
+  FileBatch: audio_test_client -m205 --batch-op convert -f3 --batch-out /data/pcm32 /data/captures
+  Tune:   audio_test_client -m3 --tune-target play -r48000 -c2 -f1 --tune-flags 0,4
+  Tuned:  audio_test_client -m1 --tuned -P/data/audio_test.wav
+  Metrics: audio_test_client -m0 -d60 --metrics /data/local/tmp/rec.metrics &
+          audio_test_client -m202 /data/local/tmp/rec.metrics
+  Startup: audio_test_client -m0 -r48000 -c2 --startup-cycles 10 --report /data/startup.jsonl
+  Verify: audio_test_client -m4 -s8 -O1048576 -r48000 -c2 -f1 -d10 /data/verify.wav
+          audio_test_client -m203 --report /data/verify.jsonl /data/verify.wav
+  MultiSource: audio_test_client -m5 --sources 1,1997 -r48000 -c1 -f1 -d30 /data/aec.wav
+  PreTrigger: audio_test_client -m6 -r48000 -c2 --pre-trigger 20 --trigger-step -12 --trigger-clip /data/pop.wav
+  Playlist: audio_test_client -m7 --report /data/suite.jsonl /data/stimuli
+  Gate:   audio_test_client -m0 -r16000 -c1 -d3600 --gate -45 --gate-hold 1000 /data/long.wav
+  CPU:    audio_test_client -m1 --cpu-server audioserver /data/test.wav
+  EventLoop: audio_test_client -m2 -r48000 -c2 -d30 --event-loop --cpu /data/loopback.wav
+  Stream: adb exec-out audio_test_client -m0 -r48000 -c2 -d10 - > cap.wav
+          adb exec-in audio_test_client -m1 - < tone.wav
+  Spectrum: audio_test_client -m0 -r48000 -c2 -d60 --spectrum-channels 0 --spectrum-rate 2 /data/hum.wav
+  FanOut: audio_test_client -m8 -s1 -r48000 -c2 -f1 --fanout-ring 4000 &
+          audio_test_client -m206 -d30 /data/a.wav & audio_test_client -m206 -d10
+  Drift:  audio_test_client -m9 -s1 -u1 -r48000 -c2 -d3600 --drift-interval 60 --report /data/drift.jsonl
+          audio_test_client -m9 --backend sim --sim-ppm -20,30 -d120
+  Routing: audio_test_client -m10 -s1 -u1 -r48000 -c16 --isolation 40 --report /data/routes.jsonl
+  DSP: audio_test_client -m1 --dsp hp:80,peak:1000:-3:1.4,fade:500:500,mix:1 /data/test.wav
+  Replay: audio_test_client -m1 --trace /data/glitch.trace /data/test.wav
+          audio_test_client -m1 --replay glitch.trace test.wav
+  Timestamps: audio_test_client -m0 -d60 --timestamps /data/rec.wav
+          audio_test_client -m204 /data/rec.wav.ts
+  SelfTest: audio_test_client -m207
 )";
         puts(helpText);
     }
 };
 
+/************************** Batch Operation ******************************/
+class BatchOperation : public AudioOperation {
+public:
+    // Constructor for batch operation, runs every scenario of config.batchScenarioPath in this process
+    explicit BatchOperation(const AudioConfig& config) : AudioOperation(config) {}
+    ~BatchOperation() override = default;
+
+    // Disable copy operations (inherited from AudioOperation)
+    BatchOperation(const BatchOperation&) = delete;
+    BatchOperation& operator=(const BatchOperation&) = delete;
+
+    // Execute all scenarios on a bounded worker pool and emit one result table
+    int32_t execute() override {
+        std::vector<Scenario> scenarios;
+        if (!loadScenarios(scenarios)) {
+            return -1;
+        }
+        if (scenarios.empty()) {
+            printf("Error: No scenarios found in %s\n", mConfig.batchScenarioPath.c_str());
+            return -1;
+        }
+
+        const int32_t maxJobs = std::min(kMaxJobs, static_cast<int32_t>(scenarios.size()));
+        const int32_t jobs = std::clamp(mConfig.batchJobs, 1, maxJobs);
+        printf("Batch started: %zu scenarios, %d jobs\n", scenarios.size(), jobs);
+        ALOGI("Batch started: %zu scenarios, %d jobs", scenarios.size(), jobs);
+
+        // Workers pull the next scenario index; results are stored by index so the table keeps file order
+        std::vector<ScenarioResult> results(scenarios.size());
+        std::atomic<size_t> nextScenario{0};
+        auto worker = [&]() {
+            size_t index = 0;
+            while ((index = nextScenario.fetch_add(1)) < scenarios.size() && !sExitRequested) {
+                runScenario(scenarios[index], results[index]);
+            }
+        };
+        std::vector<std::thread> workers;
+        for (int32_t i = 1; i < jobs; ++i) {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (std::thread& t : workers) {
+            t.join();
+        }
+        sLogger.flush();
+
+        printResults(scenarios, results);
+        if (!mConfig.reportPath.empty() && !writeReport(scenarios, results)) {
+            return -1;
+        }
+
+        const size_t failures = static_cast<size_t>(std::count_if(
+            results.begin(), results.end(), [](const ScenarioResult& r) { return !r.executed || r.status != 0; }));
+        return failures > 0 ? 1 : 0;
+    }
+
+private:
+    static constexpr int32_t kMaxJobs = 16;
+
+    struct Scenario {
+        std::string name;
+        int32_t lineNumber;
+        AudioMode mode;
+        AudioConfig config;
+    };
+
+    struct ScenarioResult {
+        bool executed = false;
+        int32_t status = -1;
+        int64_t wallTimeNs = 0;
+        AudioRunStats stats;
+    };
+
+    // Shared across runs: buffers are recycled and streams with identical configuration stay open
+    BufferPool mSharedBufferPool;
+    AudioStreamCache mSharedStreamCache;
+
+    // Split a scenario line into whitespace separated tokens, double quotes group a token
+    static std::vector<std::string> tokenize(const std::string& line) {
+        std::vector<std::string> tokens;
+        std::string current;
+        bool inQuotes = false;
+        bool hasToken = false;
+        for (const char ch : line) {
+            if (ch == '"') {
+                inQuotes = !inQuotes;
+                hasToken = true;
+            } else if (!inQuotes && isspace(static_cast<unsigned char>(ch))) {
+                if (hasToken) {
+                    tokens.push_back(current);
+                    current.clear();
+                    hasToken = false;
+                }
+            } else {
+                current += ch;
+                hasToken = true;
+            }
+        }
+        if (hasToken) {
+            tokens.push_back(current);
+        }
+        return tokens;
+    }
+
+    // Parse scenario file: "<name> <options>" per line, options are applied on top of the batch defaults
+    bool loadScenarios(std::vector<Scenario>& scenarios) {
+        if (mConfig.batchScenarioPath.empty()) {
+            printf("Error: Scenario file is required for batch mode\n");
+            return false;
+        }
+        std::ifstream file(mConfig.batchScenarioPath);
+        if (!file.is_open()) {
+            printf("Error: Can't open scenario file: %s\n", mConfig.batchScenarioPath.c_str());
+            return false;
+        }
+
+        // Batch-only settings must not leak into the individual runs
+        AudioConfig defaults = mConfig;
+        defaults.reportPath.clear();
+        defaults.batchScenarioPath.clear();
+        defaults.batchJobs = 1;
+
+        std::unordered_map<std::string, int32_t> names;
+        std::string line;
+        int32_t lineNumber = 0;
+        while (std::getline(file, line)) {
+            ++lineNumber;
+            const size_t comment = line.find('#');
+            if (comment != std::string::npos) {
+                line.erase(comment);
+            }
+            std::vector<std::string> tokens = tokenize(line);
+            if (tokens.empty()) {
+                continue;
+            }
+            if (tokens[0][0] == '-') {
+                printf("Error: %s:%d: scenario name is missing\n", mConfig.batchScenarioPath.c_str(), lineNumber);
+                return false;
+            }
+            if (!names.emplace(tokens[0], lineNumber).second) {
+                printf("Error: %s:%d: duplicate scenario name %s\n", mConfig.batchScenarioPath.c_str(), lineNumber,
+                       tokens[0].c_str());
+                return false;
+            }
+
+            // Build an argv for the regular option parser; argv[0] is the scenario name for getopt messages
+            std::vector<char*> argv;
+            for (std::string& token : tokens) {
+                argv.push_back(&token[0]);
+            }
+            argv.push_back(nullptr);
+
+            Scenario scenario{tokens[0], lineNumber, MODE_INVALID, defaults};
+            bool helpRequested = false;
+            bool parsed = false;
+            try {
+                parsed = CommandLineParser::parseOptions(static_cast<int32_t>(tokens.size()), argv.data(),
+                                                         scenario.mode, scenario.config, helpRequested);
+            } catch (const std::exception& e) {
+                printf("Error: %s:%d: %s\n", mConfig.batchScenarioPath.c_str(), lineNumber, e.what());
+            }
+            if (!parsed || helpRequested) {
+                printf("Error: %s:%d: invalid options\n", mConfig.batchScenarioPath.c_str(), lineNumber);
+                return false;
+            }
+            if (scenario.mode != MODE_RECORD && scenario.mode != MODE_PLAY && scenario.mode != MODE_LOOPBACK &&
+                scenario.mode != MODE_SET_PARAMS) {
+                printf("Error: %s:%d: mode %d is not supported in batch (use -m0, -m1, -m2 or -m100)\n",
+                       mConfig.batchScenarioPath.c_str(), lineNumber, static_cast<int>(scenario.mode));
+                return false;
+            }
+            // Timestamped default names collide when runs start within the same second
+            if ((scenario.mode == MODE_RECORD || scenario.mode == MODE_LOOPBACK) &&
+                scenario.config.recordFilePath.empty()) {
+                scenario.config.recordFilePath = "/data/batch_" + scenario.name + ".wav";
+            }
+            // Concurrent scenarios need a metrics page each; a path set on the line itself is kept
+            if (!scenario.config.metricsPath.empty() && scenario.config.metricsPath == mConfig.metricsPath) {
+                scenario.config.metricsPath += "." + scenario.name;
+            }
+            scenarios.push_back(std::move(scenario));
+        }
+        return true;
+    }
+
+    // Run a single scenario with the shared buffer pool and stream cache
+    void runScenario(const Scenario& scenario, ScenarioResult& result) {
+        sLogger.info("[batch] %s: started\n", scenario.name.c_str());
+        sLogger.flush();
+        const int64_t startNs = AudioUtils::getMonotonicNs();
+        std::unique_ptr<AudioOperation> operation =
+            AudioOperationFactory::createOperation(scenario.mode, scenario.config);
+        if (!operation) {
+            return;
+        }
+        operation->setSharedResources(&mSharedBufferPool, &mSharedStreamCache);
+        result.status = operation->execute();
+        if (result.status == 0 && operation->hasTraceError()) {
+            result.status = -1;
+        }
+        result.wallTimeNs = AudioUtils::getMonotonicNs() - startNs;
+        result.stats = operation->getRunStats();
+        result.executed = true;
+        sLogger.info("[batch] %s: finished with status %d\n", scenario.name.c_str(), result.status);
+    }
+
+    // Print consolidated result table, one row per scenario in file order
+    void printResults(const std::vector<Scenario>& scenarios, const std::vector<ScenarioResult>& results) const {
+        printf("\n%-20s %4s %6s %3s %3s %6s %9s %9s %12s %12s %8s %9s\n", "scenario", "mode", "rate", "ch", "fmt",
+               "status", "wall_ms", "loop_ms", "captured", "rendered", "overrun", "underrun");
+        for (size_t i = 0; i < scenarios.size(); ++i) {
+            const Scenario& sc = scenarios[i];
+            const ScenarioResult& r = results[i];
+            if (!r.executed) {
+                printf("%-20s %4d %6s\n", sc.name.c_str(), static_cast<int>(sc.mode), "skipped");
+                continue;
+            }
+            printf("%-20s %4d %6d %3d %3d %6d %9.1f %9.1f %12" PRIu64 " %12" PRIu64 " %8u %9u\n", sc.name.c_str(),
+                   static_cast<int>(sc.mode), sc.config.sampleRate, sc.config.channelCount, sc.config.format, r.status,
+                   r.wallTimeNs / 1e6, r.stats.loopTimeNs / 1e6, r.stats.bytesCaptured, r.stats.bytesRendered,
+                   r.stats.overrunFrames, r.stats.underrunCount);
+        }
+        printf("Batch finished: %zu scenarios, %u stream reuses\n", scenarios.size(), mSharedStreamCache.getHits());
+    }
+
+    // Write result table as JSON Lines, one object per scenario
+    bool writeReport(const std::vector<Scenario>& scenarios, const std::vector<ScenarioResult>& results) const {
+        std::ofstream report;
+        if (!openReportFile(report)) {
+            printf("Error: Can't create report file: %s\n", mConfig.reportPath.c_str());
+            return false;
+        }
+        for (size_t i = 0; i < scenarios.size(); ++i) {
+            const Scenario& sc = scenarios[i];
+            const ScenarioResult& r = results[i];
+            char line[512];
+            snprintf(line, sizeof(line),
+                     "{\"scenario\":\"%s\",\"line\":%d,\"mode\":%d,\"backend\":%d,\"sample_rate\":%d,\"channels\":%d,"
+                     "\"format\":%d,\"executed\":%s,\"status\":%d,\"wall_ms\":%.3f,\"loop_ms\":%.3f,"
+                     "\"bytes_captured\":%" PRIu64 ",\"bytes_rendered\":%" PRIu64
+                     ",\"overrun_frames\":%u,\"underruns\":%u}",
+                     sc.name.c_str(), sc.lineNumber, static_cast<int>(sc.mode), sc.config.backend,
+                     sc.config.sampleRate, sc.config.channelCount, sc.config.format, r.executed ? "true" : "false",
+                     r.status, r.wallTimeNs / 1e6, r.stats.loopTimeNs / 1e6, r.stats.bytesCaptured,
+                     r.stats.bytesRendered, r.stats.overrunFrames, r.stats.underrunCount);
+            report << line << '\n';
+        }
+        printf("Batch report saved: %s\n", mConfig.reportPath.c_str());
+        return report.good();
+    }
+};
+
+// Factory method to create appropriate audio operation based on mode
+std::unique_ptr<AudioOperation> AudioOperationFactory::createOperation(AudioMode mode, const AudioConfig& config) {
+    switch (mode) {
+    case MODE_RECORD:
+        return std::make_unique<AudioRecordOperation>(config);
+    case MODE_PLAY:
+        return std::make_unique<AudioPlayOperation>(config);
+    case MODE_LOOPBACK:
+        return std::make_unique<AudioLoopbackOperation>(config);
+    case MODE_TUNE:
+        return std::make_unique<AudioTunerOperation>(config);
+    case MODE_VERIFY:
+        return std::make_unique<BitExactVerifyOperation>(config);
+    case MODE_METRICS_READER:
+        return std::make_unique<MetricsReaderOperation>(config);
+    case MODE_VERIFY_FILE:
+        return std::make_unique<BitExactCheckOperation>(config);
+    case MODE_MULTI_CAPTURE:
+        return std::make_unique<MultiCaptureOperation>(config);
+    case MODE_PRE_TRIGGER:
+        return std::make_unique<PreTriggerOperation>(config);
+    case MODE_PLAYLIST:
+        return std::make_unique<PlaylistOperation>(config);
+    case MODE_FANOUT_SERVER:
+        return std::make_unique<FanoutServerOperation>(config);
+    case MODE_CLOCK_DRIFT:
+        return std::make_unique<ClockDriftOperation>(config);
+    case MODE_ROUTING:
+        return std::make_unique<RoutingOperation>(config);
+    case MODE_FANOUT_CLIENT:
+        return std::make_unique<FanoutClientOperation>(config);
+    case MODE_TIMESTAMP_DUMP:
+        return std::make_unique<TimestampDumpOperation>(config);
+    case MODE_FILE_BATCH:
+        return std::make_unique<FileBatchOperation>(config);
+#ifndef AUDIO_TEST_CLIENT_HOST
+    case MODE_SET_PARAMS:
+        return std::make_unique<SetParamsOperation>(config, config.setParams);
+#endif
+    case MODE_BENCHMARK:
+        return std::make_unique<BenchmarkOperation>(config);
+    case MODE_BATCH:
+        return std::make_unique<BatchOperation>(config);
+    case MODE_SELF_TEST:
+        return std::make_unique<SelfTestOperation>(config);
+    default:
+        printf("Error: Invalid mode specified: %d\n", static_cast<int>(mode));
+        return nullptr;
+    }
+}
+
 /************************** Main function ******************************/
 // Main entry point for audio test client application
 int32_t main(int32_t argc, char** argv) {
     AudioMode mode = MODE_INVALID;
     AudioConfig config;
 
+    StartupTimeline processTimeline;
+    processTimeline.markAt("process_entry", sProcessEntryNs);
+    processTimeline.mark("main_entry");
+
     printf("Audio Test Client %s Start...\n", AUDIO_TEST_CLIENT_VERSION);
     // Parse command line arguments
+#ifdef AUDIO_TEST_CLIENT_SELF_TEST
+    // The test runner starts audio_test_client_selftest without arguments
+    if (argc == 1) {
+        mode = MODE_SELF_TEST;
+    } else {
+        CommandLineParser::parseArguments(argc, argv, mode, config);
+    }
+#else
     CommandLineParser::parseArguments(argc, argv, mode, config);
+#endif
+    processTimeline.mark("args_parsed");
 
     // Create the appropriate audio operation using factory
     std::unique_ptr<AudioOperation> operation = AudioOperationFactory::createOperation(mode, config);
@@ -1613,7 +13803,15 @@ int32_t main(int32_t argc, char** argv) {
         CommandLineParser::showHelp();
         return -1;
     }
-
-    // Execute the audio operation
-    return operation->execute();
+    processTimeline.mark("operation_created");
+    operation->getStartupTimeline().append(processTimeline);
+
+    // Execute the audio operation, streaming loops log through the writer thread
+    sLogger.start();
+    const int32_t result = operation->execute();
+    sLogger.stop();
+    if (result == 0 && operation->hasTraceError()) {
+        return -1;
+    }
+    return result == 0 && operation->hasReplayDivergence() ? 1 : result;
 }